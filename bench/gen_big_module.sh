@@ -0,0 +1,30 @@
+#!/bin/sh
+# Generate a module of about N top-level statements (default 16000) under
+# DIR, and a main.lingua that imports { f3, K5 } from it, so evaluating
+# the import walks the dependency graph of one large module.  Every
+# group of four statements is a var, a function, a const and an
+# assignment to the var.  Functions in the second half of each block of
+# 16 call the block's first one, and every fourth writes its var.
+#
+#   bench/gen_big_module.sh DIR [N]
+set -e
+dir=${1:?usage: gen_big_module.sh DIR [N]}
+n=${2:-16000}
+mkdir -p "$dir"
+awk -v dir="$dir" -v n="$n" 'BEGIN {
+    f = dir "/big.lingua"
+    for (k = 0; k < n / 4; k++) {
+        printf "var v%d = %d;\n", k, k > f
+        w = k % 4 == 1 ? sprintf("v%d = x; ", k) : ""
+        if (k % 16 < 8)
+            printf "pub fn f%d(x: int) -> int { %sreturn x; }\n", k, w > f
+        else
+            printf "pub fn f%d(x: int) -> int { %sreturn f%d(x) + %d; }\n", k, w, k - k % 16, k > f
+        printf "pub const K%d = %d;\n", k, k * 3 > f
+        printf "v%d = v%d + K%d;\n", k, k, k > f
+    }
+    close(f)
+    f = dir "/main.lingua"
+    printf "import { f3, K5 } from \"./big\";\nprint(f3(1) + K5);\n" > f
+    close(f)
+}'
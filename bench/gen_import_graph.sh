@@ -0,0 +1,31 @@
+#!/bin/sh
+# Generate an import graph of N modules (default 5000) under DIR.  Module k
+# imports up to three earlier modules and exports one function; main.lingua
+# imports the last four, so resolving main walks the whole graph.
+#
+#   bench/gen_import_graph.sh DIR [N]
+set -e
+dir=${1:?usage: gen_import_graph.sh DIR [N]}
+n=${2:-5000}
+mkdir -p "$dir"
+awk -v dir="$dir" -v n="$n" 'BEGIN {
+    for (k = 0; k < n; k++) {
+        f = dir "/m" k ".lingua"
+        for (j = 1; j <= 3; j++) {
+            d = k - j * 7 - (k % 5)
+            if (d >= 0)
+                printf "import { f%d } from \"./m%d\";\n", d, d > f
+        }
+        printf "pub fn f%d(x: int) -> int return x * %d + %d;\n", k, k % 13 + 1, k > f
+        close(f)
+    }
+    f = dir "/main.lingua"
+    lo = n > 4 ? n - 4 : 0
+    for (k = lo; k < n; k++)
+        printf "import { f%d } from \"./m%d\";\n", k, k > f
+    printf "var s = 0;\n" > f
+    for (k = lo; k < n; k++)
+        printf "s = s + f%d(1);\n", k > f
+    printf "print(s);\n" > f
+    close(f)
+}'
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Time the benchmark programs and the synthetic import graph.
+#
+#   bench/run.sh [-O<n>] [name...]
+#
+# LINGUA selects the compiler (default ./lingua relative to the repo root);
+# set LINGUA_BASE to a second compiler to print its timings alongside, and
+# LINGUA_FLAGS to pass extra build flags (e.g. --unroll=4) to both.
+# Each program runs with stdout sent to /dev/null; printed times are
+# wall-clock seconds for the run (or the compile, for import_graph and
+# big_module).
+set -e
+root=$(cd "$(dirname "$0")/.." && pwd)
+LINGUA=${LINGUA:-$root/lingua}
+opt=-O2
+case "$1" in -O*) opt=$1; shift ;; esac
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+now() { date +%s.%N; }
+elapsed() { echo "$1 $2" | awk '{ printf "%.3f", $2 - $1 }'; }
+
+# time_run COMPILER SOURCE -> seconds to run the built program
+time_run() {
+    "$1" build "$2" -o "$tmp/prog" "$opt" $LINGUA_FLAGS >/dev/null 2>&1 || { printf 'FAIL'; return; }
+    t0=$(now); "$tmp/prog" >/dev/null; t1=$(now)
+    elapsed "$t0" "$t1"
+}
+
+# time_build COMPILER SOURCE -> seconds to compile with a cold module cache
+time_build() {
+    rm -rf "$tmp/cache"
+    t0=$(now)
+    XDG_CACHE_HOME=$tmp/cache "$1" build "$2" -o "$tmp/prog" "$opt" $LINGUA_FLAGS >/dev/null 2>&1 ||
+        { printf 'FAIL'; return; }
+    t1=$(now)
+    elapsed "$t0" "$t1"
+}
+
+report() {
+    name=$1; shift
+    new=$("$@" "$LINGUA" "$src")
+    if [ -n "$LINGUA_BASE" ]; then
+        base=$("$@" "$LINGUA_BASE" "$src")
+        printf '%-20s %8s  base %8s\n' "$name" "$new" "$base"
+    else
+        printf '%-20s %8s\n' "$name" "$new"
+    fi
+}
+
+names=${*:-$(cd "$root/bench/programs" && ls *.lingua | sed 's/\.lingua$//') import_graph big_module}
+for name in $names; do
+    case "$name" in
+    import_graph)
+        [ -f "$tmp/graph/main.lingua" ] || "$root/bench/gen_import_graph.sh" "$tmp/graph" 5000
+        src=$tmp/graph/main.lingua
+        report "$name" time_build ;;
+    big_module)
+        [ -f "$tmp/big/main.lingua" ] || "$root/bench/gen_big_module.sh" "$tmp/big" 16000
+        src=$tmp/big/main.lingua
+        report "$name" time_build ;;
+    *)
+        src=$root/bench/programs/$name.lingua
+        report "$name" time_run ;;
+    esac
+done
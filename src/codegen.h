@@ -3,6 +3,14 @@
 
 #include "parser.h"
 
-int codegen(ASTNode *ast, const char *output_path, const char *source_file);
+typedef struct {
+    int dump_ir;        /* print the runtime IR and its SSA form to stdout */
+    int opt_level;      /* -O level for the runtime IR (0 = unoptimized) */
+    int unroll;         /* loop unroll factor at -O2 (0 = default, 1 = off) */
+    int line_buffered;  /* runtime output is flushed at every newline */
+} CodegenOptions;
+
+int codegen(ASTNode *ast, const char *output_path, const char *source_file,
+            const CodegenOptions *opts);
 
 #endif
@@ -1,8 +1,11 @@
 #define _POSIX_C_SOURCE 200809L
 #include "codegen.h"
 #include "codegen/codegen_internal.h"
+#include "codegen/ir_cfg.h"
+#include "codegen/ir_opt.h"
 #include "diagnostic.h"
 #include "import.h"
+#include "pathtable.h"
 #include <libgen.h>
 #include <string.h>
 
@@ -31,9 +34,9 @@ int emit_net_binary(NetConfig *config, const char *output_path)
     diag_error_no_loc("no codegen backend for this platform");
     return 1;
 }
-int emit_binary_ir(IRProgram *prog, const char *output_path)
+int emit_binary_ir(IRProgram *prog, const char *output_path, int line_buffered)
 {
-    (void)prog; (void)output_path;
+    (void)prog; (void)output_path; (void)line_buffered;
     diag_error_no_loc("no codegen backend for this platform");
     return 1;
 }
@@ -133,6 +136,7 @@ typedef struct {
     int field_count;
     /* field_values is an array of EvalResult (forward declared below) */
     struct EvalResultS *field_values;
+    int guessed; /* 1 if field_values is only a guess at a runtime object's */
 } ObjData;
 
 /* ================================================================
@@ -141,6 +145,7 @@ typedef struct {
 
 typedef struct ArrayDataS ArrayData;
 typedef struct ChannelDataS ChannelData;
+typedef struct MapDataS MapData;
 
 /* ================================================================
  * EvalResult — compile-time evaluated value
@@ -156,6 +161,7 @@ typedef struct EvalResultS {
     ObjData *obj_val;
     ArrayData *arr_val;
     ChannelData *chan_val;
+    MapData *map_val;
 } EvalResult;
 
 struct ArrayDataS {
@@ -172,6 +178,195 @@ struct ChannelDataS {
     ValueType elem_type;
 };
 
+struct MapDataS {
+    EvalResult *keys;       /* entries in insertion order */
+    EvalResult *values;
+    int count;
+    int cap;
+    uint8_t *ctrl;          /* MAP_GROUP control bytes per group */
+    int *slots;             /* entry index behind each control byte */
+    int group_mask;         /* group count - 1, a power of two less one */
+    int growth_left;        /* EMPTY bytes that may still be filled */
+    ValueType key_type;
+    ValueType value_type;
+    int guessed;            /* 1 if the entries are only a guess at a runtime map's */
+};
+
+/* ================================================================
+ * MapData — compile-time Map<K, V> operations
+ *
+ * The same Swiss table the runtime maps use (see ir.h), with groups of
+ * eight control bytes matched a word at a time instead of sixteen in an
+ * SSE register.  A control byte is EMPTY, DELETED, or the low 7 bits
+ * (h2) of the hash of the key in the entry it points at; the rest of
+ * the hash picks the first group of the probe sequence.  Entries stay
+ * in insertion order, and remove moves the last one into the hole.
+ * ================================================================ */
+
+#define MAP_GROUP 8
+#define MAP_EMPTY 0x80
+#define MAP_DELETED 0xFE
+#define MAP_LSB 0x0101010101010101ULL
+#define MAP_MSB 0x8080808080808080ULL
+
+static uint64_t map_hash(EvalResult *key) {
+    uint64_t h;
+    if (key->type == VAL_STRING) {
+        h = 0xCBF29CE484222325ULL;
+        for (int i = 0; i < key->str_len; i++)
+            h = (h ^ (unsigned char)key->str_val[i]) * 0x100000001B3ULL;
+    } else {
+        h = key->type == VAL_BOOL ? (uint64_t)key->bool_val : (uint64_t)key->int_val;
+    }
+    h *= 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 32);
+}
+
+static int map_key_equal(EvalResult *a, EvalResult *b) {
+    if (a->type == VAL_STRING)
+        return a->str_len == b->str_len && memcmp(a->str_val, b->str_val, a->str_len) == 0;
+    if (a->type == VAL_BOOL)
+        return a->bool_val == b->bool_val;
+    return a->int_val == b->int_val;
+}
+
+static uint64_t map_group_load(MapData *m, int group) {
+    uint64_t w;
+    memcpy(&w, m->ctrl + group * MAP_GROUP, sizeof(w));
+    return w;
+}
+
+/* The top bit of each byte of w equal to h2.  A borrow may also flag
+ * the byte after a real match; comparing keys weeds those out. */
+static uint64_t map_group_match(uint64_t w, int h2) {
+    uint64_t x = w ^ (MAP_LSB * (uint64_t)h2);
+    return (x - MAP_LSB) & ~x & MAP_MSB;
+}
+
+/* EMPTY is the only control byte with bit 7 set and bit 1 clear */
+static uint64_t map_group_empty(uint64_t w) {
+    return w & ~(w << 6) & MAP_MSB;
+}
+
+/* EMPTY and DELETED are the control bytes with bit 7 set */
+static uint64_t map_group_free(uint64_t w) {
+    return w & MAP_MSB;
+}
+
+static int map_match_pos(int group, uint64_t bits) {
+    return group * MAP_GROUP + (__builtin_ctzll(bits) >> 3);
+}
+
+static MapData *map_data_new(ValueType key_type, ValueType value_type) {
+    MapData *m = calloc(1, sizeof(MapData));
+    m->cap = 8;
+    m->keys = malloc(m->cap * sizeof(EvalResult));
+    m->values = malloc(m->cap * sizeof(EvalResult));
+    m->ctrl = malloc(MAP_GROUP);
+    memset(m->ctrl, MAP_EMPTY, MAP_GROUP);
+    m->slots = malloc(MAP_GROUP * sizeof(int));
+    m->growth_left = MAP_GROUP - 1;
+    m->key_type = key_type;
+    m->value_type = value_type;
+    return m;
+}
+
+/* Index of the entry holding key, or -1.  *pos receives its control
+ * byte's position when pos is not NULL. */
+static int map_data_find(MapData *m, EvalResult *key, int *pos) {
+    uint64_t h = map_hash(key);
+    int h2 = (int)(h & 0x7F);
+    int group = (int)((h >> 7) & (uint64_t)m->group_mask);
+    for (int step = 1; ; step++) {
+        uint64_t w = map_group_load(m, group);
+        for (uint64_t bits = map_group_match(w, h2); bits; bits &= bits - 1) {
+            int p = map_match_pos(group, bits);
+            if (m->ctrl[p] == h2 && map_key_equal(&m->keys[m->slots[p]], key)) {
+                if (pos) *pos = p;
+                return m->slots[p];
+            }
+        }
+        if (map_group_empty(w)) return -1;
+        group = (group + step) & m->group_mask;
+    }
+}
+
+/* First EMPTY or DELETED control byte on the probe sequence of h */
+static int map_data_free_pos(MapData *m, uint64_t h) {
+    int group = (int)((h >> 7) & (uint64_t)m->group_mask);
+    for (int step = 1; ; step++) {
+        uint64_t bits = map_group_free(map_group_load(m, group));
+        if (bits) return map_match_pos(group, bits);
+        group = (group + step) & m->group_mask;
+    }
+}
+
+/* Rebuild the control bytes with groups groups, dropping DELETED ones */
+static void map_data_rehash(MapData *m, int groups) {
+    free(m->ctrl);
+    free(m->slots);
+    m->ctrl = malloc(groups * MAP_GROUP);
+    memset(m->ctrl, MAP_EMPTY, groups * MAP_GROUP);
+    m->slots = malloc(groups * MAP_GROUP * sizeof(int));
+    m->group_mask = groups - 1;
+    m->growth_left = groups * (MAP_GROUP - 1) - m->count;
+    for (int e = 0; e < m->count; e++) {
+        uint64_t h = map_hash(&m->keys[e]);
+        int p = map_data_free_pos(m, h);
+        m->ctrl[p] = (uint8_t)(h & 0x7F);
+        m->slots[p] = e;
+    }
+}
+
+static void map_data_set(MapData *m, EvalResult key, EvalResult value) {
+    int e = map_data_find(m, &key, NULL);
+    if (e >= 0) {
+        m->values[e] = value;
+        return;
+    }
+    /* Out of room: double the groups when over half the bytes are
+     * taken, else rebuild at the same size to clear DELETED ones */
+    if (m->growth_left == 0) {
+        int groups = m->group_mask + 1;
+        map_data_rehash(m, m->count > groups * MAP_GROUP / 2 ? groups * 2 : groups);
+    }
+    if (m->count == m->cap) {
+        m->cap *= 2;
+        m->keys = realloc(m->keys, m->cap * sizeof(EvalResult));
+        m->values = realloc(m->values, m->cap * sizeof(EvalResult));
+    }
+    uint64_t h = map_hash(&key);
+    int p = map_data_free_pos(m, h);
+    if (m->ctrl[p] == MAP_EMPTY) m->growth_left--;
+    m->ctrl[p] = (uint8_t)(h & 0x7F);
+    m->slots[p] = m->count;
+    m->keys[m->count] = key;
+    m->values[m->count] = value;
+    m->count++;
+}
+
+static void map_data_remove(MapData *m, EvalResult key) {
+    int p;
+    int e = map_data_find(m, &key, &p);
+    if (e < 0) return;
+    /* The byte goes back to EMPTY when its group still has one: no
+     * probe sequence has gone on past a group never full */
+    if (map_group_empty(map_group_load(m, p / MAP_GROUP))) {
+        m->ctrl[p] = MAP_EMPTY;
+        m->growth_left++;
+    } else {
+        m->ctrl[p] = MAP_DELETED;
+    }
+    int last = --m->count;
+    if (e == last) return;
+    /* The last entry moves into the hole; repoint its control byte */
+    m->keys[e] = m->keys[last];
+    m->values[e] = m->values[last];
+    int q;
+    map_data_find(m, &m->keys[last], &q);
+    m->slots[q] = e;
+}
+
 /* ================================================================
  * ClassDef — compile-time class definition
  * ================================================================ */
@@ -261,6 +456,7 @@ typedef struct {
     SourceLoc loc;
     int has_slot;       /* 1 if this variable has a runtime stack slot */
     int slot;           /* IR slot number (valid when has_slot == 1) */
+    int guessed;        /* 1 if val is only a guess at the slot's value */
 } Symbol;
 
 typedef struct SymTable {
@@ -309,6 +505,7 @@ static void sym_add(SymTable *st, const char *name, EvalResult val, int is_const
     st->syms[st->count].loc = loc;
     st->syms[st->count].has_slot = 0;
     st->syms[st->count].slot = -1;
+    st->syms[st->count].guessed = 0;
     st->count++;
 }
 
@@ -334,15 +531,20 @@ static const char *g_stdlib_string_fns[] = {
 static char g_stdlib_imported_flags[STDLIB_STRING_FN_COUNT];
 
 static const char *g_stdlib_array_fns[] = {
-    "push", "pop", "shift", "concat", "reverse", "sort", "join", "remove"
+    "push", "pop", "shift", "concat", "reverse", "sort", "join", "remove",
+    "sum", "min", "max"
 };
-#define STDLIB_ARRAY_FN_COUNT 8
+#define STDLIB_ARRAY_FN_COUNT 11
 static char g_stdlib_array_imported_flags[STDLIB_ARRAY_FN_COUNT];
 
 static const char *g_stdlib_concurrency_fns[] = { "send", "receive" };
 #define STDLIB_CONCURRENCY_FN_COUNT 2
 static char g_stdlib_concurrency_imported_flags[STDLIB_CONCURRENCY_FN_COUNT];
 
+static const char *g_stdlib_map_fns[] = { "get", "set", "has", "remove", "len", "keys" };
+#define STDLIB_MAP_FN_COUNT 6
+static char g_stdlib_map_imported_flags[STDLIB_MAP_FN_COUNT];
+
 /* HTTP stdlib */
 static const char *g_stdlib_http_fns[] = { "get", "post", "listen" };
 #define STDLIB_HTTP_FN_COUNT 3
@@ -371,6 +573,7 @@ static void stdlib_reset(void) {
     memset(g_stdlib_imported_flags, 0, sizeof(g_stdlib_imported_flags));
     memset(g_stdlib_array_imported_flags, 0, sizeof(g_stdlib_array_imported_flags));
     memset(g_stdlib_concurrency_imported_flags, 0, sizeof(g_stdlib_concurrency_imported_flags));
+    memset(g_stdlib_map_imported_flags, 0, sizeof(g_stdlib_map_imported_flags));
     memset(g_stdlib_http_imported_flags, 0, sizeof(g_stdlib_http_imported_flags));
     g_http_routes = NULL;
     g_http_route_count = 0;
@@ -431,6 +634,22 @@ static void stdlib_concurrency_fn_import(const char *name) {
     if (idx >= 0) g_stdlib_concurrency_imported_flags[idx] = 1;
 }
 
+static int stdlib_map_fn_index(const char *name) {
+    for (int i = 0; i < STDLIB_MAP_FN_COUNT; i++)
+        if (strcmp(g_stdlib_map_fns[i], name) == 0) return i;
+    return -1;
+}
+
+static int stdlib_map_fn_is_imported(const char *name) {
+    int idx = stdlib_map_fn_index(name);
+    return idx >= 0 && g_stdlib_map_imported_flags[idx];
+}
+
+static void stdlib_map_fn_import(const char *name) {
+    int idx = stdlib_map_fn_index(name);
+    if (idx >= 0) g_stdlib_map_imported_flags[idx] = 1;
+}
+
 static int stdlib_http_fn_index(const char *name) {
     for (int i = 0; i < STDLIB_HTTP_FN_COUNT; i++)
         if (strcmp(g_stdlib_http_fns[i], name) == 0) return i;
@@ -463,12 +682,75 @@ static void stdlib_net_fn_import(const char *name) {
     if (idx >= 0) g_stdlib_net_imported_flags[idx] = 1;
 }
 
+/* Check if a call to name, whose first argument has type arg_type,
+ * goes to std/map: get, remove and len are also in other modules, and
+ * those are called unless the argument is a map */
+static int stdlib_map_call(const char *name, ValueType arg_type) {
+    if (!stdlib_map_fn_is_imported(name)) return 0;
+    return arg_type == VAL_MAP ||
+           (!stdlib_fn_is_imported(name) && !stdlib_array_fn_is_imported(name) &&
+            !stdlib_http_fn_is_imported(name));
+}
+
 /* ================================================================
  * IR compilation support — globals and helpers
  * ================================================================ */
 
 static IRProgram *g_ir = NULL;       /* NULL when IR not active */
 static int g_ir_mode = 0;           /* 1 once any IR print has been emitted */
+static ASTNode *g_ir_fn_decl = NULL; /* out-of-line fn being compiled, if any */
+static SymTable *g_ir_fn_scope = NULL; /* its parameter scope (frame boundary) */
+static ASTNode *g_ir_frame_fn = NULL; /* fn whose frame is being compiled */
+static SymTable *g_ir_loop_scope = NULL; /* scope of the innermost runtime loop */
+
+static SymTable *g_ir_self_scope = NULL; /* scope of the fields of the receiver
+                                          * of the method being compiled */
+static ClassDef *g_ir_self_cls = NULL; /* the receiver's class */
+static int g_ir_self_slot = -1;        /* the slot holding the receiver */
+
+/* Slot variables live in the frame of the function that declared them.
+ * While compiling an out-of-line function only names found between st
+ * and the function's parameter scope are addressable. */
+static int sym_in_ir_frame(SymTable *st, const char *name) {
+    if (!g_ir_fn_scope) return 1;
+    for (SymTable *t = st; t; t = t->parent) {
+        if (sym_lookup(t, name) >= 0) return 1;
+        if (t == g_ir_fn_scope) return 0;
+    }
+    return 0;
+}
+
+/* Check if obj_name.method() is called on a runtime object, one held
+ * by a variable with a slot */
+static int ir_is_runtime_receiver(const char *obj_name, SymTable *st) {
+    Symbol *sym = obj_name ? sym_find(st, obj_name) : NULL;
+    return sym && sym->has_slot && sym->val.type == VAL_OBJECT;
+}
+
+/* Find method name of cls, walking up the inheritance chain */
+static ASTNode *ir_find_method(ClassDef *cls, const char *name) {
+    while (cls) {
+        for (ASTNode *m = cls->methods; m; m = m->next) {
+            if (strcmp(m->fn_name, name) == 0)
+                return m;
+        }
+        cls = cls->parent_name ? class_table_find(g_ct, cls->parent_name) : NULL;
+    }
+    return NULL;
+}
+
+/* The declaration of the user function, or method of a runtime object,
+ * that call expression expr calls; NULL if it calls neither */
+static ASTNode *ir_user_call_decl(Expr *expr, SymTable *st) {
+    if (expr->kind != EXPR_FN_CALL) return NULL;
+    if (!expr->as.fn_call.obj_name) {
+        FnEntry *fn = fn_table_find(g_ft, expr->as.fn_call.fn_name);
+        return fn ? fn->decl : NULL;
+    }
+    if (!ir_is_runtime_receiver(expr->as.fn_call.obj_name, st)) return NULL;
+    ObjData *obj = sym_find(st, expr->as.fn_call.obj_name)->val.obj_val;
+    return ir_find_method(class_table_find(g_ct, obj->class_name), expr->as.fn_call.fn_name);
+}
 
 /* Check if an expression involves runtime variables (has_slot symbols) */
 static int expr_is_runtime(Expr *expr, SymTable *st) {
@@ -479,141 +761,1907 @@ static int expr_is_runtime(Expr *expr, SymTable *st) {
         return sym && sym->has_slot;
     }
     case EXPR_BINARY:
-        return expr_is_runtime(expr->as.binary.left, st) ||
-               expr_is_runtime(expr->as.binary.right, st);
+        return expr_is_runtime(expr->as.binary.left, st) ||
+               expr_is_runtime(expr->as.binary.right, st);
+    case EXPR_UNARY:
+        return expr_is_runtime(expr->as.unary.operand, st);
+    case EXPR_INT_LIT:
+    case EXPR_FLOAT_LIT:
+    case EXPR_STRING_LIT:
+    case EXPR_BOOL_LIT:
+        return 0;
+    case EXPR_INDEX:
+        return expr_is_runtime(expr->as.index_access.object, st) ||
+               expr_is_runtime(expr->as.index_access.index, st);
+    case EXPR_MEMBER_ACCESS:
+        return expr_is_runtime(expr->as.member_access.object, st);
+    case EXPR_ARRAY_LIT:
+        for (int i = 0; i < expr->as.array_lit.count; i++) {
+            if (expr_is_runtime(expr->as.array_lit.elements[i], st))
+                return 1;
+        }
+        return 0;
+    case EXPR_FN_CALL: {
+        if (ir_is_runtime_receiver(expr->as.fn_call.obj_name, st))
+            return 1;
+        for (int i = 0; i < expr->as.fn_call.arg_count; i++) {
+            if (expr_is_runtime(expr->as.fn_call.args[i], st))
+                return 1;
+        }
+        return 0;
+    }
+    default:
+        return 0;
+    }
+}
+
+/* Check if an expression calls a user function with runtime arguments.
+ * Such calls are compiled to IR_CALL and must not also be run by the
+ * compile-time evaluator. */
+static int expr_has_runtime_call(Expr *expr, SymTable *st) {
+    if (!expr) return 0;
+    switch (expr->kind) {
+    case EXPR_BINARY:
+        return expr_has_runtime_call(expr->as.binary.left, st) ||
+               expr_has_runtime_call(expr->as.binary.right, st);
+    case EXPR_UNARY:
+        return expr_has_runtime_call(expr->as.unary.operand, st);
+    case EXPR_MEMBER_ACCESS:
+        return expr_has_runtime_call(expr->as.member_access.object, st);
+    case EXPR_ARRAY_LIT:
+        for (int i = 0; i < expr->as.array_lit.count; i++) {
+            if (expr_has_runtime_call(expr->as.array_lit.elements[i], st))
+                return 1;
+        }
+        return 0;
+    case EXPR_FN_CALL:
+        if (ir_user_call_decl(expr, st) && expr_is_runtime(expr, st))
+            return 1;
+        for (int i = 0; i < expr->as.fn_call.arg_count; i++) {
+            if (expr_has_runtime_call(expr->as.fn_call.args[i], st))
+                return 1;
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static int expr_is_runtime_array(Expr *expr, SymTable *st);
+static int ir_is_array_builtin(Expr *expr, const char *name, SymTable *st);
+static int ir_is_map_builtin(Expr *expr, const char *name, SymTable *st);
+
+/* Check if the compile-time value of a runtime expression is only a
+ * guess: it reads a variable whose slot was assigned a guess, or a map
+ * whose entries are one, or an object whose fields are, or calls a
+ * function at runtime.  Inside a runtime loop or function every value
+ * is a guess, as the statements after it may already have run. */
+static int expr_is_guessed(Expr *expr, SymTable *st) {
+    if (!expr_is_runtime(expr, st)) return 0;
+    if (g_ir_loop_scope || g_ir_fn_decl || expr_has_runtime_call(expr, st)) return 1;
+    switch (expr->kind) {
+    case EXPR_VAR_REF: {
+        Symbol *sym = sym_find(st, expr->as.var_ref.name);
+        return sym->guessed || (sym->val.type == VAL_MAP && sym->val.map_val && sym->val.map_val->guessed) ||
+               (sym->val.type == VAL_OBJECT && sym->val.obj_val && sym->val.obj_val->guessed);
+    }
+    case EXPR_MEMBER_ACCESS:
+        return expr_is_guessed(expr->as.member_access.object, st);
+    case EXPR_BINARY:
+        return expr_is_guessed(expr->as.binary.left, st) ||
+               expr_is_guessed(expr->as.binary.right, st);
+    case EXPR_UNARY:
+        return expr_is_guessed(expr->as.unary.operand, st);
+    case EXPR_INDEX:
+        return expr_is_guessed(expr->as.index_access.object, st) ||
+               expr_is_guessed(expr->as.index_access.index, st);
+    case EXPR_ARRAY_LIT:
+        for (int i = 0; i < expr->as.array_lit.count; i++) {
+            if (expr_is_guessed(expr->as.array_lit.elements[i], st))
+                return 1;
+        }
+        return 0;
+    case EXPR_FN_CALL:
+        for (int i = 0; i < expr->as.fn_call.arg_count; i++) {
+            if (expr_is_guessed(expr->as.fn_call.args[i], st))
+                return 1;
+        }
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+/* Check if name is a built-in the array routines implement on runtime
+ * arrays; push() is compiled too, other built-ins are rejected */
+static int ir_is_array_routine(const char *name) {
+    return strcmp(name, "len") == 0 || strcmp(name, "sum") == 0 ||
+           strcmp(name, "min") == 0 || strcmp(name, "max") == 0 ||
+           strcmp(name, "contains") == 0 || strcmp(name, "index_of") == 0;
+}
+
+/* Check if an expression indexes an array with a guessed runtime
+ * index, or reads an element of a guessed runtime array, or gets a
+ * guessed key or the key of a guessed runtime map.  The evaluator's
+ * guess for the index, or for the array's length, may be out of range,
+ * and its guess for the map may lack the key, so such expressions have
+ * no compile-time value to guess at. */
+static int expr_has_runtime_index(Expr *expr, SymTable *st) {
+    if (!expr) return 0;
+    switch (expr->kind) {
+    case EXPR_BINARY:
+        return expr_has_runtime_index(expr->as.binary.left, st) ||
+               expr_has_runtime_index(expr->as.binary.right, st);
+    case EXPR_UNARY:
+        return expr_has_runtime_index(expr->as.unary.operand, st);
+    case EXPR_INDEX:
+        return expr_is_guessed(expr->as.index_access.index, st) ||
+               (expr_is_runtime_array(expr->as.index_access.object, st) &&
+                expr_is_guessed(expr->as.index_access.object, st)) ||
+               expr_has_runtime_index(expr->as.index_access.object, st);
+    case EXPR_FN_CALL:
+        if ((ir_is_array_builtin(expr, "min", st) || ir_is_array_builtin(expr, "max", st)) &&
+            expr_is_guessed(expr->as.fn_call.args[0], st))
+            return 1;
+        if (ir_is_map_builtin(expr, "get", st) && expr->as.fn_call.arg_count == 2 &&
+            (expr_is_guessed(expr->as.fn_call.args[0], st) ||
+             expr_is_guessed(expr->as.fn_call.args[1], st)))
+            return 1;
+        for (int i = 0; i < expr->as.fn_call.arg_count; i++) {
+            if (expr_has_runtime_index(expr->as.fn_call.args[i], st))
+                return 1;
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/* Forward declare eval_expr (needed by ir_compile_expr for const-folding) */
+static EvalResult eval_expr(Expr *expr, SymTable *st);
+
+/* Forward declare runtime call lowering (defined with ir_compile_stmts) */
+static int ir_compile_call(const char *fn_name, SourceLoc loc, Expr **args,
+                           char **arg_names, int arg_count, SymTable *st,
+                           IRProgram *prog, int require_value);
+static int ir_compile_user_call(Expr *expr, SymTable *st, IRProgram *prog, int require_value);
+
+/* The 64 bits an int, bool or float value has in a vreg: a float's are
+ * its IEEE encoding (see ir.h) */
+static int64_t ir_value_bits(const EvalResult *v) {
+    if (v->type == VAL_BOOL) return v->bool_val;
+    if (v->type == VAL_FLOAT) {
+        int64_t bits;
+        memcpy(&bits, &v->float_val, sizeof(bits));
+        return bits;
+    }
+    return v->int_val;
+}
+
+/* Fold a compile-time expression into an IR constant */
+static int ir_compile_folded(Expr *expr, SymTable *st, IRProgram *prog) {
+    EvalResult r = eval_expr(expr, st);
+    if (r.type == VAL_INT || r.type == VAL_BOOL || r.type == VAL_FLOAT)
+        return ir_emit_const_int(prog, ir_value_bits(&r));
+    else if (r.type == VAL_STRING)
+        return ir_emit_const_str(prog, r.str_val, r.str_len);
+    return ir_emit_const_int(prog, 0);
+}
+
+/* IR opcode of a binary operator other than and/or */
+static IROpcode ir_binop_opcode(BinOpKind op) {
+    switch (op) {
+    case BINOP_ADD: return IR_ADD;
+    case BINOP_SUB: return IR_SUB;
+    case BINOP_MUL: return IR_MUL;
+    case BINOP_DIV: return IR_DIV;
+    case BINOP_MOD: return IR_MOD;
+    case BINOP_EQ:  return IR_CMP_EQ;
+    case BINOP_NE:  return IR_CMP_NE;
+    case BINOP_LT:  return IR_CMP_LT;
+    case BINOP_LE:  return IR_CMP_LE;
+    case BINOP_GT:  return IR_CMP_GT;
+    case BINOP_GE:  return IR_CMP_GE;
+    case BINOP_BIT_AND: return IR_BIT_AND;
+    case BINOP_BIT_OR:  return IR_BIT_OR;
+    case BINOP_BIT_XOR: return IR_BIT_XOR;
+    case BINOP_SHL: return IR_SHL;
+    case BINOP_SHR: return IR_SHR;
+    default:        return IR_ADD;
+    }
+}
+
+static void ir_compile_branch(Expr *expr, SymTable *st, IRProgram *prog,
+                              int label, int when_true);
+static int ir_compile_expr(Expr *expr, SymTable *st, IRProgram *prog);
+static ValueType expr_runtime_type(Expr *expr, SymTable *st);
+static int ir_compile_string(Expr *expr, SymTable *st, IRProgram *prog,
+                             const char *steal, int *fresh);
+static int ir_is_str_compare(Expr *expr, SymTable *st);
+static IROpcode ir_compile_str_compare(Expr *expr, SymTable *st, IRProgram *prog,
+                                       int *lhs, int *rhs);
+static ValueType ir_array_elem_type(Expr *expr, SymTable *st);
+static int ir_array_table(IRProgram *prog, ArrayData *a);
+static int ir_compile_array(Expr *expr, SymTable *st, IRProgram *prog,
+                            const char *steal, int *fresh);
+static int ir_compile_array_builtin(Expr *expr, SymTable *st, IRProgram *prog);
+static void ir_reject_array_call(Expr *expr, SymTable *st);
+static void ir_reject_string_call(Expr *expr, SymTable *st);
+static void ir_map_types(Expr *expr, SymTable *st, ValueType *key_type, ValueType *value_type);
+static int ir_compile_map_builtin(Expr *expr, SymTable *st, IRProgram *prog);
+static void ir_reject_map_call(Expr *expr, SymTable *st);
+static ClassDef *ir_object_class(Expr *expr, SymTable *st);
+static ObjData *ir_object_shadow(ClassDef *cls);
+static int ir_class_field(ClassDef *cls, const char *name);
+static int ir_compile_field_load(Expr *expr, SymTable *st, IRProgram *prog);
+
+/* Compile a runtime index into a compile-time Array<int>, Array<bool> or
+ * Array<float>.
+ * The array's elements become a constant table in the binary, read by
+ * IR_LOAD_ELEM, which checks the index at run time the way the
+ * evaluator does at compile time.  Only const arrays qualify: a var
+ * could still change after the table is built. */
+static int ir_compile_index(Expr *expr, SymTable *st, IRProgram *prog) {
+    Expr *obj = expr->as.index_access.object;
+    Expr *index = expr->as.index_access.index;
+    if (obj->kind == EXPR_VAR_REF) {
+        Symbol *sym = sym_find(st, obj->as.var_ref.name);
+        if (sym && !sym->is_const)
+            diag_emit(expr->loc, DIAG_ERROR,
+                      "indexing '%s' with a runtime value requires it to be const",
+                      obj->as.var_ref.name);
+    }
+    if (expr_is_runtime(obj, st))
+        diag_emit(expr->loc, DIAG_ERROR, "indexing requires a string or array, got '%s'",
+                  value_type_name(expr_runtime_type(obj, st)));
+    EvalResult arr = eval_expr(obj, st);
+    if (arr.type != VAL_ARRAY || !arr.arr_val)
+        diag_emit(expr->loc, DIAG_ERROR, "indexing with a runtime value requires an array, got '%s'",
+                  value_type_name(arr.type));
+    ArrayData *a = arr.arr_val;
+    if (a->count > 0 && a->elem_type != VAL_INT && a->elem_type != VAL_BOOL &&
+        a->elem_type != VAL_FLOAT)
+        diag_emit(expr->loc, DIAG_ERROR,
+                  "indexing with a runtime value requires an Array<int>, Array<bool> or Array<float>, got Array<%s>",
+                  value_type_name(a->elem_type));
+    if (expr_runtime_type(index, st) != VAL_INT)
+        diag_emit(expr->loc, DIAG_ERROR, "array index must be an int, got '%s'",
+                  value_type_name(expr_runtime_type(index, st)));
+
+    return ir_emit_load_elem(prog, ir_array_table(prog, a), ir_compile_expr(index, st, prog));
+}
+
+/* Compile an operand of float arithmetic or of a float comparison, an
+ * int one converted as the evaluator promotes it */
+static int ir_compile_float_operand(Expr *expr, SymTable *st, IRProgram *prog) {
+    int v = ir_compile_expr(expr, st, prog);
+    if (expr_runtime_type(expr, st) == VAL_INT)
+        v = ir_emit_unop(prog, IR_INT_TO_FLOAT, v);
+    return v;
+}
+
+/* Compile a binary operator with a float operand, checked the way
+ * eval_binary checks it.  A comparison gives a 0/1 IR_FCMP. */
+static int ir_compile_float_binary(Expr *expr, SymTable *st, IRProgram *prog) {
+    BinOpKind bop = expr->as.binary.op;
+    ValueType lt = expr_runtime_type(expr->as.binary.left, st);
+    ValueType rt = expr_runtime_type(expr->as.binary.right, st);
+    if (bop >= BINOP_BIT_AND)
+        diag_emit(expr->loc, DIAG_ERROR, "bitwise operator requires int operands, got '%s'",
+                  value_type_name(lt != VAL_INT ? lt : rt));
+    if (bop >= BINOP_EQ && bop <= BINOP_LE) {
+        if ((lt != VAL_INT && lt != VAL_FLOAT) || (rt != VAL_INT && rt != VAL_FLOAT))
+            diag_emit(expr->loc, DIAG_ERROR, "cannot compare '%s' with '%s'",
+                      value_type_name(lt), value_type_name(rt));
+    } else {
+        if (lt != VAL_INT && lt != VAL_FLOAT)
+            diag_emit(expr->loc, DIAG_ERROR, "arithmetic not supported for '%s'", value_type_name(lt));
+        if (rt != VAL_INT && rt != VAL_FLOAT)
+            diag_emit(expr->loc, DIAG_ERROR, "arithmetic not supported for '%s'", value_type_name(rt));
+        if (bop == BINOP_MOD)
+            diag_emit(expr->loc, DIAG_ERROR, "'%%' operator requires int operands");
+    }
+    int lhs = ir_compile_float_operand(expr->as.binary.left, st, prog);
+    int rhs = ir_compile_float_operand(expr->as.binary.right, st, prog);
+    switch (bop) {
+    case BINOP_ADD: return ir_emit_binop(prog, IR_FADD, lhs, rhs);
+    case BINOP_SUB: return ir_emit_binop(prog, IR_FSUB, lhs, rhs);
+    case BINOP_MUL: return ir_emit_binop(prog, IR_FMUL, lhs, rhs);
+    case BINOP_DIV: return ir_emit_binop(prog, IR_FDIV, lhs, rhs);
+    default:        return ir_emit_fcmp(prog, ir_binop_opcode(bop), lhs, rhs);
+    }
+}
+
+/* Compile an int expression to IR instructions, returns vreg holding result */
+static int ir_compile_expr(Expr *expr, SymTable *st, IRProgram *prog) {
+    switch (expr->kind) {
+    case EXPR_INT_LIT:
+        return ir_emit_const_int(prog, expr->as.int_lit.value);
+
+    case EXPR_BOOL_LIT:
+        return ir_emit_const_int(prog, expr->as.bool_lit.value);
+
+    case EXPR_VAR_REF: {
+        Symbol *sym = sym_find(st, expr->as.var_ref.name);
+        if (sym && sym->has_slot) {
+            if (!sym_in_ir_frame(st, expr->as.var_ref.name))
+                diag_emit(expr->loc, DIAG_ERROR,
+                          "function '%s' cannot read runtime variable '%s' from an enclosing scope; pass it as a parameter",
+                          g_ir_frame_fn->fn_name, expr->as.var_ref.name);
+            return ir_emit_load(prog, sym->slot);
+        }
+        /* Compile-time constant — fold its value */
+        return ir_emit_const_int(prog, ir_value_bits(&sym->val));
+    }
+
+    case EXPR_BINARY: {
+        BinOpKind bop = expr->as.binary.op;
+        if (bop == BINOP_AND || bop == BINOP_OR) {
+            /* Short-circuit: the left operand alone decides `false and _`
+             * and `true or _`; otherwise the result is the right one */
+            int decided = bop == BINOP_OR;
+            int slot = ir_alloc_slot(prog);
+            int done = ir_alloc_label(prog);
+            ir_emit_store(prog, slot, ir_emit_const_int(prog, decided));
+            ir_compile_branch(expr->as.binary.left, st, prog, done, decided);
+            ir_emit_store(prog, slot, ir_compile_expr(expr->as.binary.right, st, prog));
+            ir_emit_label(prog, done);
+            return ir_emit_load(prog, slot);
+        }
+        if (ir_is_str_compare(expr, st)) {
+            int lhs, rhs;
+            IROpcode cmp = ir_compile_str_compare(expr, st, prog, &lhs, &rhs);
+            return ir_emit_binop(prog, cmp, lhs, rhs);
+        }
+        /* Arrays only compare at compile time */
+        if (expr_runtime_type(expr->as.binary.left, st) == VAL_ARRAY ||
+            expr_runtime_type(expr->as.binary.right, st) == VAL_ARRAY)
+            return ir_compile_folded(expr, st, prog);
+        if (expr_runtime_type(expr->as.binary.left, st) == VAL_FLOAT ||
+            expr_runtime_type(expr->as.binary.right, st) == VAL_FLOAT)
+            return ir_compile_float_binary(expr, st, prog);
+        int lhs = ir_compile_expr(expr->as.binary.left, st, prog);
+        int rhs = ir_compile_expr(expr->as.binary.right, st, prog);
+        return ir_emit_binop(prog, ir_binop_opcode(bop), lhs, rhs);
+    }
+
+    case EXPR_UNARY: {
+        int operand = ir_compile_expr(expr->as.unary.operand, st, prog);
+        if (expr_runtime_type(expr->as.unary.operand, st) == VAL_FLOAT) {
+            /* Negation flips the sign bit */
+            if (expr->as.unary.op == UNOP_BIT_NOT)
+                diag_emit(expr->loc, DIAG_ERROR, "'~' requires int operand, got 'float'");
+            return ir_emit_binop(prog, IR_BIT_XOR, operand, ir_emit_const_int(prog, INT64_MIN));
+        }
+        if (expr->as.unary.op == UNOP_NEG) {
+            IRInstr instr;
+            memset(&instr, 0, sizeof(instr));
+            instr.op = IR_NEG;
+            instr.dst = ir_alloc_vreg(prog);
+            instr.src = operand;
+            ir_emit(prog, instr);
+            return instr.dst;
+        } else {
+            /* UNOP_BIT_NOT */
+            IRInstr instr;
+            memset(&instr, 0, sizeof(instr));
+            instr.op = IR_BIT_NOT;
+            instr.dst = ir_alloc_vreg(prog);
+            instr.src = operand;
+            ir_emit(prog, instr);
+            return instr.dst;
+        }
+    }
+
+    case EXPR_MEMBER_ACCESS:
+        if (expr_is_runtime(expr, st))
+            return ir_compile_field_load(expr, st, prog);
+        return ir_compile_folded(expr, st, prog);
+
+    case EXPR_FN_CALL:
+        /* User functions with runtime arguments, and methods of runtime
+         * objects, are called out of line */
+        if (ir_user_call_decl(expr, st) && expr_is_runtime(expr, st))
+            return ir_compile_user_call(expr, st, prog, 1);
+        /* Built-ins the array routines implement */
+        if (ir_is_array_routine(expr->as.fn_call.fn_name) &&
+            ir_is_array_builtin(expr, expr->as.fn_call.fn_name, st))
+            return ir_compile_array_builtin(expr, st, prog);
+        /* Built-ins the map routines implement */
+        if (ir_is_map_builtin(expr, expr->as.fn_call.fn_name, st))
+            return ir_compile_map_builtin(expr, st, prog);
+        ir_reject_map_call(expr, st);
+        ir_reject_array_call(expr, st);
+        /* len() of a runtime string reads its header */
+        if (!expr->as.fn_call.obj_name && strcmp(expr->as.fn_call.fn_name, "len") == 0 &&
+            !fn_table_find(g_ft, "len") && stdlib_fn_is_imported("len") &&
+            expr->as.fn_call.arg_count == 1 && expr_is_runtime(expr->as.fn_call.args[0], st) &&
+            expr_runtime_type(expr->as.fn_call.args[0], st) == VAL_STRING) {
+            int fresh;
+            int str = ir_compile_string(expr->as.fn_call.args[0], st, prog, NULL, &fresh);
+            int len = ir_emit_unop(prog, IR_STR_LEN, str);
+            if (fresh) ir_emit_str_release(prog, str);
+            return len;
+        }
+        ir_reject_string_call(expr, st);
+        return ir_compile_folded(expr, st, prog);
+
+    case EXPR_INDEX:
+        if (expr_is_runtime_array(expr->as.index_access.object, st)) {
+            if (expr_runtime_type(expr->as.index_access.index, st) != VAL_INT)
+                diag_emit(expr->loc, DIAG_ERROR, "array index must be an int, got '%s'",
+                          value_type_name(expr_runtime_type(expr->as.index_access.index, st)));
+            int fresh;
+            int arr = ir_compile_array(expr->as.index_access.object, st, prog, NULL, &fresh);
+            int elem = ir_emit_binop(prog, IR_ARR_LOAD, arr,
+                                     ir_compile_expr(expr->as.index_access.index, st, prog));
+            if (fresh) ir_emit_arr_release(prog, arr);
+            return elem;
+        }
+        if (expr_is_runtime(expr, st))
+            return ir_compile_index(expr, st, prog);
+        return ir_compile_folded(expr, st, prog);
+
+    default:
+        /* Fallback: evaluate at compile time and emit as constant */
+        return ir_compile_folded(expr, st, prog);
+    }
+}
+
+/* Compile a bool expression as control flow: jump to label if it is
+ * when_true (1 or 0), fall through otherwise.  and/or only evaluate
+ * their right operand when the left one does not decide, and a
+ * comparison becomes a single IR_BR_CMP instead of a 0/1 value that is
+ * then tested. */
+static void ir_compile_branch(Expr *expr, SymTable *st, IRProgram *prog,
+                              int label, int when_true) {
+    if (expr->kind == EXPR_BINARY) {
+        BinOpKind bop = expr->as.binary.op;
+        if (bop == BINOP_AND || bop == BINOP_OR) {
+            int decided = bop == BINOP_OR;
+            if (when_true == decided) {
+                /* Either operand being `decided` is enough */
+                ir_compile_branch(expr->as.binary.left, st, prog, label, when_true);
+                ir_compile_branch(expr->as.binary.right, st, prog, label, when_true);
+            } else {
+                /* Both must agree: a decisive left operand skips the test */
+                int skip = ir_alloc_label(prog);
+                ir_compile_branch(expr->as.binary.left, st, prog, skip, decided);
+                ir_compile_branch(expr->as.binary.right, st, prog, label, when_true);
+                ir_emit_label(prog, skip);
+            }
+            return;
+        }
+        if (bop >= BINOP_EQ && bop <= BINOP_LE &&
+            expr_runtime_type(expr->as.binary.left, st) != VAL_ARRAY &&
+            expr_runtime_type(expr->as.binary.right, st) != VAL_ARRAY) {
+            int lhs, rhs;
+            IROpcode cmp;
+            if (ir_is_str_compare(expr, st)) {
+                cmp = ir_compile_str_compare(expr, st, prog, &lhs, &rhs);
+            } else if (expr_runtime_type(expr->as.binary.left, st) == VAL_FLOAT ||
+                       expr_runtime_type(expr->as.binary.right, st) == VAL_FLOAT) {
+                /* Not negated: no float comparison but != holds for a nan */
+                int v = ir_compile_float_binary(expr, st, prog);
+                if (when_true) ir_emit_jnz(prog, v, label);
+                else ir_emit_jz(prog, v, label);
+                return;
+            } else {
+                lhs = ir_compile_expr(expr->as.binary.left, st, prog);
+                rhs = ir_compile_expr(expr->as.binary.right, st, prog);
+                cmp = ir_binop_opcode(bop);
+            }
+            ir_emit_br_cmp(prog, when_true ? cmp : ir_cmp_negate(cmp), lhs, rhs, label);
+            return;
+        }
+    }
+    int v = ir_compile_expr(expr, st, prog);
+    if (when_true) ir_emit_jnz(prog, v, label);
+    else ir_emit_jz(prog, v, label);
+}
+
+/* Determine the runtime type of an expression (for IR print dispatch):
+ * VAL_BOOL, VAL_STRING or VAL_FLOAT for those, VAL_INT otherwise.  Parts
+ * without runtime values are typed by what they evaluate to. */
+static ValueType expr_runtime_type(Expr *expr, SymTable *st) {
+    if (!expr) return VAL_INT;
+    switch (expr->kind) {
+    case EXPR_BOOL_LIT:
+        return VAL_BOOL;
+    case EXPR_STRING_LIT:
+        return VAL_STRING;
+    case EXPR_VAR_REF: {
+        Symbol *sym = sym_find(st, expr->as.var_ref.name);
+        if (sym) return sym->val.type;
+        return VAL_INT;
+    }
+    case EXPR_BINARY:
+        if (expr->as.binary.op >= BINOP_EQ && expr->as.binary.op <= BINOP_LE)
+            return VAL_BOOL;
+        if (expr->as.binary.op == BINOP_AND || expr->as.binary.op == BINOP_OR)
+            return VAL_BOOL;
+        if (expr->as.binary.op == BINOP_ADD &&
+            expr_runtime_type(expr->as.binary.right, st) == VAL_STRING)
+            return VAL_STRING;
+        /* int op float is promoted to float */
+        if (expr_runtime_type(expr->as.binary.right, st) == VAL_FLOAT &&
+            expr_runtime_type(expr->as.binary.left, st) == VAL_INT)
+            return VAL_FLOAT;
+        return expr_runtime_type(expr->as.binary.left, st);
+    case EXPR_UNARY:
+        return expr_runtime_type(expr->as.unary.operand, st);
+    case EXPR_MEMBER_ACCESS: {
+        if (!expr_is_runtime(expr, st)) return eval_expr(expr, st).type;
+        ClassDef *cls = ir_object_class(expr->as.member_access.object, st);
+        int f = cls ? ir_class_field(cls, expr->as.member_access.field_name) : -1;
+        return f >= 0 ? cls->field_types[f] : VAL_INT;
+    }
+    case EXPR_FN_CALL: {
+        ASTNode *decl = ir_user_call_decl(expr, st);
+        if (decl && decl->has_return_type) return decl->return_type;
+        if (decl) return VAL_INT;
+        /* Those on runtime arrays are typed without a guess at the
+         * array, which may be wrong about its length */
+        const char *name = expr->as.fn_call.fn_name;
+        if (ir_is_array_routine(name) && ir_is_array_builtin(expr, name, st)) {
+            if (name[0] == 'c') return VAL_BOOL;
+            if (name[0] == 's' || name[0] == 'm')
+                return ir_array_elem_type(expr->as.fn_call.args[0], st);
+            return VAL_INT;
+        }
+        if (ir_is_map_builtin(expr, name, st)) {
+            ValueType kt, vt;
+            ir_map_types(expr->as.fn_call.args[0], st, &kt, &vt);
+            if (strcmp(name, "get") == 0) return vt;
+            if (strcmp(name, "has") == 0) return VAL_BOOL;
+            if (strcmp(name, "len") == 0) return VAL_INT;
+            if (strcmp(name, "keys") == 0) return VAL_ARRAY;
+            return VAL_VOID;
+        }
+        /* Built-ins are pure: their guessed result has the right type */
+        return eval_expr(expr, st).type;
+    }
+    case EXPR_INDEX: {
+        /* Element type of the array being indexed; a character of a
+         * string is a string */
+        Expr *obj = expr->as.index_access.object;
+        if (expr_runtime_type(obj, st) == VAL_STRING) return VAL_STRING;
+        if (expr_is_runtime_array(obj, st)) return ir_array_elem_type(obj, st);
+        if (expr_is_runtime(obj, st)) return VAL_INT;
+        EvalResult arr = eval_expr(obj, st);
+        if (arr.type == VAL_ARRAY && arr.arr_val &&
+            (arr.arr_val->elem_type == VAL_BOOL || arr.arr_val->elem_type == VAL_FLOAT))
+            return arr.arr_val->elem_type;
+        return VAL_INT;
+    }
+    case EXPR_ARRAY_LIT:
+        return VAL_ARRAY;
+    default:
+        if (!expr_is_runtime(expr, st)) return eval_expr(expr, st).type;
+        return VAL_INT;
+    }
+}
+
+/* Compile-time value recorded for a symbol assigned a runtime expression.
+ * Normally the evaluator's best guess; when the expression contains a
+ * runtime call, or parameters have no compile-time value at all (inside
+ * an out-of-line function), only the type is known. */
+static EvalResult ir_shadow_value(Expr *expr, SymTable *st) {
+    if (!g_ir_fn_decl && !expr_has_runtime_call(expr, st) && !expr_has_runtime_index(expr, st))
+        return eval_expr(expr, st);
+    EvalResult r;
+    memset(&r, 0, sizeof(r));
+    r.type = expr_runtime_type(expr, st);
+    if (r.type == VAL_ARRAY) {
+        r.arr_val = calloc(1, sizeof(ArrayData));
+        r.arr_val->elem_type = ir_array_elem_type(expr, st);
+    } else if (r.type == VAL_MAP) {
+        ValueType kt, vt;
+        ir_map_types(expr, st, &kt, &vt);
+        r.map_val = map_data_new(kt, vt);
+        r.map_val->guessed = 1;
+    } else if (r.type == VAL_OBJECT) {
+        r.obj_val = ir_object_shadow(ir_object_class(expr, st));
+    }
+    return r;
+}
+
+static char *eval_to_string(EvalResult *r, int *out_len);
+
+/* ================================================================
+ * Runtime strings
+ *
+ * A string variable with a slot holds a string value (see ir.h): a
+ * constant in the data section, or a heap string only it refers to,
+ * released when it is overwritten or goes out of scope.  Each string
+ * expression is compiled noting whether its value is fresh, a heap
+ * string the consumer must store or release, or borrowed from a
+ * variable or the constants.
+ * ================================================================ */
+
+/* Check if an expression reads variable name */
+static int expr_reads_var(Expr *expr, const char *name) {
+    if (!expr) return 0;
+    switch (expr->kind) {
+    case EXPR_VAR_REF:
+        return strcmp(expr->as.var_ref.name, name) == 0;
+    case EXPR_BINARY:
+        return expr_reads_var(expr->as.binary.left, name) ||
+               expr_reads_var(expr->as.binary.right, name);
+    case EXPR_UNARY:
+        return expr_reads_var(expr->as.unary.operand, name);
+    case EXPR_MEMBER_ACCESS:
+        return expr_reads_var(expr->as.member_access.object, name);
+    case EXPR_INDEX:
+        return expr_reads_var(expr->as.index_access.object, name) ||
+               expr_reads_var(expr->as.index_access.index, name);
+    case EXPR_FN_CALL:
+        for (int i = 0; i < expr->as.fn_call.arg_count; i++) {
+            if (expr_reads_var(expr->as.fn_call.args[i], name))
+                return 1;
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/* Compile an expression to a string value, converting an int, float or
+ * bool the way printing does.  *fresh is set when the result is a new heap
+ * string.  steal names a variable about to be overwritten with the
+ * result: when it is the leftmost operand of a chain of +, its string
+ * is taken over and appended to, in place while its capacity lasts. */
+static int ir_compile_string(Expr *expr, SymTable *st, IRProgram *prog,
+                             const char *steal, int *fresh) {
+    *fresh = 0;
+    if (!expr_is_runtime(expr, st)) {
+        EvalResult r = eval_expr(expr, st);
+        int len;
+        char *str = eval_to_string(&r, &len);
+        return ir_emit_const_str(prog, str, len);
+    }
+
+    ValueType t = expr_runtime_type(expr, st);
+    if (t == VAL_INT || t == VAL_FLOAT) {
+        *fresh = 1;
+        return ir_emit_unop(prog, t == VAL_INT ? IR_STR_FROM_INT : IR_STR_FROM_FLOAT,
+                            ir_compile_expr(expr, st, prog));
+    }
+    if (t == VAL_BOOL) {
+        IRInstr instr;
+        memset(&instr, 0, sizeof(instr));
+        instr.op = IR_SELECT;
+        instr.src = ir_compile_expr(expr, st, prog);
+        instr.lhs = ir_emit_const_str(prog, "true", 4);
+        instr.rhs = ir_emit_const_str(prog, "false", 5);
+        instr.dst = ir_alloc_vreg(prog);
+        ir_emit(prog, instr);
+        return instr.dst;
+    }
+    if (t != VAL_STRING)
+        diag_emit(expr->loc, DIAG_ERROR, "cannot convert '%s' to a string at runtime",
+                  value_type_name(t));
+
+    switch (expr->kind) {
+    case EXPR_VAR_REF:
+        if (steal && strcmp(expr->as.var_ref.name, steal) == 0) *fresh = 1;
+        return ir_compile_expr(expr, st, prog);
+
+    case EXPR_BINARY: {
+        int lhs_fresh, rhs_fresh;
+        int lhs = ir_compile_string(expr->as.binary.left, st, prog, steal, &lhs_fresh);
+        int rhs = ir_compile_string(expr->as.binary.right, st, prog, NULL, &rhs_fresh);
+        int dst = ir_emit_binop(prog, lhs_fresh ? IR_STR_APPEND : IR_STR_CONCAT, lhs, rhs);
+        if (rhs_fresh) ir_emit_str_release(prog, rhs);
+        *fresh = 1;
+        return dst;
+    }
+
+    case EXPR_FN_CALL:
+        if (ir_user_call_decl(expr, st)) {
+            *fresh = 1;
+            return ir_compile_user_call(expr, st, prog, 1);
+        }
+        ir_reject_map_call(expr, st);
+        ir_reject_array_call(expr, st);
+        ir_reject_string_call(expr, st);
+        break;
+
+    case EXPR_INDEX:
+        if (expr_is_runtime(expr->as.index_access.index, st))
+            diag_emit(expr->loc, DIAG_ERROR, "indexing a string with a runtime value is not supported");
+        else if (expr_is_guessed(expr->as.index_access.object, st))
+            diag_emit(expr->loc, DIAG_ERROR, "indexing a runtime string is not supported");
+        break;
+
+    default:
+        break;
+    }
+    /* What is left is known exactly at compile time */
+    return ir_compile_folded(expr, st, prog);
+}
+
+/* Compile a string value that is to be stored in a variable: one
+ * borrowed from another variable is copied */
+static int ir_compile_owned_string(Expr *expr, SymTable *st, IRProgram *prog,
+                                   const char *steal) {
+    int fresh;
+    int v = ir_compile_string(expr, st, prog, steal, &fresh);
+    if (!fresh && expr->kind == EXPR_VAR_REF && expr_is_runtime(expr, st))
+        v = ir_emit_binop(prog, IR_STR_CONCAT, v, ir_emit_const_str(prog, "", 0));
+    return v;
+}
+
+/* Compile the new value of string variable name, which takes its old
+ * string over when the assignment only appends to it.  *replaced is
+ * cleared in that case: otherwise the old string is the caller's to
+ * release once the new one is stored. */
+static int ir_compile_string_update(Expr *expr, SymTable *st, IRProgram *prog,
+                                    const char *name, int *replaced) {
+    Expr *left = expr;
+    while (left->kind == EXPR_BINARY && left->as.binary.op == BINOP_ADD &&
+           !expr_reads_var(left->as.binary.right, name))
+        left = left->as.binary.left;
+    *replaced = !(left != expr && left->kind == EXPR_VAR_REF &&
+                  strcmp(left->as.var_ref.name, name) == 0);
+    return ir_compile_owned_string(expr, st, prog, *replaced ? NULL : name);
+}
+
+/* Release the strings, arrays, maps and objects of the variables
+ * declared in scopes from st up to, but not including, outer.
+ * Parameters, which are const, borrow theirs from the caller. */
+static void ir_release_vars(SymTable *st, SymTable *outer, IRProgram *prog) {
+    for (SymTable *t = st; t && t != outer; t = t->parent) {
+        int first = t == g_ir_fn_scope && g_ir_fn_decl ? g_ir_fn_decl->param_count : 0;
+        for (int i = first; i < t->count; i++) {
+            if (!t->syms[i].has_slot) continue;
+            if (t->syms[i].val.type == VAL_STRING)
+                ir_emit_str_release(prog, ir_emit_load(prog, t->syms[i].slot));
+            else if (t->syms[i].val.type == VAL_ARRAY)
+                ir_emit_arr_release(prog, ir_emit_load(prog, t->syms[i].slot));
+            else if (t->syms[i].val.type == VAL_MAP)
+                ir_emit_map_release(prog, ir_emit_load(prog, t->syms[i].slot));
+            else if (t->syms[i].val.type == VAL_OBJECT)
+                ir_emit_obj_release(prog, ir_emit_load(prog, t->syms[i].slot));
+        }
+    }
+}
+
+/* ----------------------------------------------------------------
+ * Compile-time objects around runtime code: a loop body or out-of-line
+ * function is compiled once, so a change it makes to an object only
+ * known at compile time would happen once instead of on every run.
+ * The fields of such objects visible from st are copied before the
+ * code is compiled and compared after it.
+ * ---------------------------------------------------------------- */
+
+typedef struct {
+    const char *name;
+    ObjData *obj;
+    EvalResult *fields;
+} IRFrozenObj;
+
+typedef struct {
+    IRFrozenObj *objs;
+    int count;
+} IRFrozen;
+
+static void ir_freeze_objects(SymTable *st, IRFrozen *fz) {
+    int cap = 0;
+    fz->objs = NULL;
+    fz->count = 0;
+    for (SymTable *t = st; t; t = t->parent) {
+        for (int i = 0; i < t->count; i++) {
+            Symbol *s = &t->syms[i];
+            if (s->has_slot || s->val.type != VAL_OBJECT || !s->val.obj_val) continue;
+            if (fz->count == cap) {
+                cap = cap ? cap * 2 : 8;
+                fz->objs = realloc(fz->objs, cap * sizeof(IRFrozenObj));
+            }
+            ObjData *obj = s->val.obj_val;
+            IRFrozenObj *f = &fz->objs[fz->count++];
+            f->name = s->name;
+            f->obj = obj;
+            f->fields = malloc((obj->field_count > 0 ? obj->field_count : 1) * sizeof(EvalResult));
+            memcpy(f->fields, obj->field_values, obj->field_count * sizeof(EvalResult));
+        }
+    }
+}
+
+static int ir_field_unchanged(EvalResult *a, EvalResult *b) {
+    if (a->type != b->type) return 0;
+    switch (a->type) {
+    case VAL_INT:    return a->int_val == b->int_val;
+    case VAL_BOOL:   return a->bool_val == b->bool_val;
+    case VAL_FLOAT:  return memcmp(&a->float_val, &b->float_val, sizeof(double)) == 0;
+    case VAL_STRING: return a->str_len == b->str_len && memcmp(a->str_val, b->str_val, a->str_len) == 0;
+    default:
+        return a->obj_val == b->obj_val && a->arr_val == b->arr_val &&
+               a->chan_val == b->chan_val && a->map_val == b->map_val;
+    }
+}
+
+/* Report an object of fz that the runtime code at loc changed; where
+ * names that code */
+static void ir_check_frozen(IRFrozen *fz, SourceLoc loc, const char *where) {
+    for (int i = 0; i < fz->count; i++) {
+        IRFrozenObj *f = &fz->objs[i];
+        for (int k = 0; k < f->obj->field_count; k++) {
+            if (!ir_field_unchanged(&f->fields[k], &f->obj->field_values[k]))
+                diag_emit(loc, DIAG_ERROR,
+                          "object '%s' is only known at compile time and cannot change %s (declare it with var and new)",
+                          f->name, where);
+        }
+        free(f->fields);
+    }
+    free(fz->objs);
+}
+
+/* Check if a comparison is between strings */
+static int ir_is_str_compare(Expr *expr, SymTable *st) {
+    BinOpKind bop = expr->as.binary.op;
+    return bop >= BINOP_EQ && bop <= BINOP_LE &&
+           (expr_runtime_type(expr->as.binary.left, st) == VAL_STRING ||
+            expr_runtime_type(expr->as.binary.right, st) == VAL_STRING);
+}
+
+/* Compile a comparison of two strings into one of an int against 0:
+ * the result is cmp(*lhs, *rhs) for the opcode returned */
+static IROpcode ir_compile_str_compare(Expr *expr, SymTable *st, IRProgram *prog,
+                                       int *lhs, int *rhs) {
+    BinOpKind bop = expr->as.binary.op;
+    ValueType lt = expr_runtime_type(expr->as.binary.left, st);
+    ValueType rt = expr_runtime_type(expr->as.binary.right, st);
+    if (lt != rt)
+        diag_emit(expr->loc, DIAG_ERROR, "cannot compare '%s' with '%s'",
+                  value_type_name(lt), value_type_name(rt));
+    int lhs_fresh, rhs_fresh;
+    int a = ir_compile_string(expr->as.binary.left, st, prog, NULL, &lhs_fresh);
+    int b = ir_compile_string(expr->as.binary.right, st, prog, NULL, &rhs_fresh);
+    int equality = bop == BINOP_EQ || bop == BINOP_NE;
+    *lhs = ir_emit_binop(prog, equality ? IR_STR_EQ : IR_STR_CMP, a, b);
+    if (lhs_fresh) ir_emit_str_release(prog, a);
+    if (rhs_fresh) ir_emit_str_release(prog, b);
+    *rhs = ir_emit_const_int(prog, 0);
+    if (bop == BINOP_EQ) return IR_CMP_NE;
+    if (bop == BINOP_NE) return IR_CMP_EQ;
+    return ir_binop_opcode(bop);
+}
+
+/* ================================================================
+ * Runtime arrays
+ *
+ * An Array<int>, Array<bool> or Array<float> variable with a slot holds
+ * an array
+ * value (see ir.h) only it refers to, a heap array it may assign the
+ * elements of, released when it is overwritten or goes out of scope.
+ * As with strings, each array expression is compiled noting whether
+ * its value is fresh or borrowed from a variable or the constants.
+ * ================================================================ */
+
+/* Check if an expression is an array only known at runtime */
+static int expr_is_runtime_array(Expr *expr, SymTable *st) {
+    return expr && expr_is_runtime(expr, st) && expr_runtime_type(expr, st) == VAL_ARRAY;
+}
+
+/* Check if expr calls std/array built-in name on a runtime array */
+static int ir_is_array_builtin(Expr *expr, const char *name, SymTable *st) {
+    if (expr->kind != EXPR_FN_CALL || expr->as.fn_call.obj_name ||
+        strcmp(expr->as.fn_call.fn_name, name) != 0 || fn_table_find(g_ft, name))
+        return 0;
+    if (!stdlib_array_fn_is_imported(name) && !stdlib_fn_is_imported(name))
+        return 0;
+    return expr->as.fn_call.arg_count > 0 && expr_is_runtime_array(expr->as.fn_call.args[0], st);
+}
+
+/* Element type of an array expression, VAL_VOID for an empty one whose
+ * type nothing declares */
+static ValueType ir_array_elem_type(Expr *expr, SymTable *st) {
+    if (expr_is_runtime(expr, st)) {
+        if (expr->kind == EXPR_VAR_REF) {
+            Symbol *sym = sym_find(st, expr->as.var_ref.name);
+            return sym->val.arr_val ? sym->val.arr_val->elem_type : VAL_VOID;
+        }
+        if (ir_user_call_decl(expr, st))
+            return ir_user_call_decl(expr, st)->return_array_elem_type;
+        if (expr->kind == EXPR_FN_CALL && !expr->as.fn_call.obj_name) {
+            if (strcmp(expr->as.fn_call.fn_name, "push") == 0 && expr->as.fn_call.arg_count == 2) {
+                ValueType et = ir_array_elem_type(expr->as.fn_call.args[0], st);
+                return et != VAL_VOID ? et : expr_runtime_type(expr->as.fn_call.args[1], st);
+            }
+            if (ir_is_map_builtin(expr, "keys", st)) {
+                ValueType kt, vt;
+                ir_map_types(expr->as.fn_call.args[0], st, &kt, &vt);
+                return kt;
+            }
+        }
+        if (expr->kind == EXPR_ARRAY_LIT)
+            return expr_runtime_type(expr->as.array_lit.elements[0], st);
+    }
+    EvalResult r = eval_expr(expr, st);
+    return r.type == VAL_ARRAY && r.arr_val ? r.arr_val->elem_type : VAL_VOID;
+}
+
+/* Add the elements of a compile-time Array<int>, Array<bool> or
+ * Array<float> to the constant tables, floats as their bits */
+static int ir_array_table(IRProgram *prog, ArrayData *a) {
+    int count = a ? a->count : 0;
+    int64_t *values = malloc((count > 0 ? count : 1) * sizeof(int64_t));
+    for (int k = 0; k < count; k++) {
+        if (a->elements[k].type == VAL_FLOAT)
+            memcpy(&values[k], &a->elements[k].float_val, sizeof(int64_t));
+        else
+            values[k] = a->elements[k].type == VAL_BOOL ? a->elements[k].bool_val
+                                                        : a->elements[k].int_val;
+    }
+    int table = ir_add_table(prog, values, count);
+    free(values);
+    return table;
+}
+
+/* Compile an expression to an array value.  *fresh is set when the
+ * result is a new heap array.  steal names a variable about to be
+ * overwritten with the result: when it is the array a chain of push()
+ * calls starts from, its array is taken over and pushed to, in place
+ * while its capacity lasts. */
+static int ir_compile_array(Expr *expr, SymTable *st, IRProgram *prog,
+                            const char *steal, int *fresh) {
+    *fresh = 0;
+    ValueType et = ir_array_elem_type(expr, st);
+    if (et != VAL_INT && et != VAL_BOOL && et != VAL_FLOAT && et != VAL_VOID)
+        diag_emit(expr->loc, DIAG_ERROR,
+                  "runtime arrays must be Array<int>, Array<bool> or Array<float>, got Array<%s>",
+                  value_type_name(et));
+    if (!expr_is_runtime(expr, st)) {
+        EvalResult r = eval_expr(expr, st);
+        if (r.type != VAL_ARRAY)
+            diag_emit(expr->loc, DIAG_ERROR, "expected an array, got '%s'", value_type_name(r.type));
+        return ir_emit_const_arr(prog, ir_array_table(prog, r.arr_val));
+    }
+
+    switch (expr->kind) {
+    case EXPR_VAR_REF:
+        if (steal && strcmp(expr->as.var_ref.name, steal) == 0) *fresh = 1;
+        return ir_compile_expr(expr, st, prog);
+
+    case EXPR_FN_CALL: {
+        const char *name = expr->as.fn_call.fn_name;
+        Expr **args = expr->as.fn_call.args;
+        if (ir_user_call_decl(expr, st)) {
+            *fresh = 1;
+            return ir_compile_user_call(expr, st, prog, 1);
+        }
+        if (expr->as.fn_call.obj_name) break;
+        if (strcmp(name, "push") == 0 && stdlib_array_fn_is_imported("push") &&
+            expr->as.fn_call.arg_count == 2) {
+            ValueType base = ir_array_elem_type(args[0], st);
+            ValueType xt = expr_runtime_type(args[1], st);
+            if (base != VAL_VOID && xt != base)
+                diag_emit(expr->loc, DIAG_ERROR,
+                          "push() element type '%s' does not match array element type '%s'",
+                          value_type_name(xt), value_type_name(base));
+            int arr_fresh;
+            int arr = ir_compile_array(args[0], st, prog, steal, &arr_fresh);
+            if (!arr_fresh) arr = ir_emit_unop(prog, IR_ARR_COPY, arr);
+            *fresh = 1;
+            return ir_emit_binop(prog, IR_ARR_PUSH, arr, ir_compile_expr(args[1], st, prog));
+        }
+        if (ir_is_map_builtin(expr, "keys", st)) {
+            *fresh = 1;
+            return ir_compile_map_builtin(expr, st, prog);
+        }
+        break;
+    }
+
+    case EXPR_ARRAY_LIT: {
+        /* Elements known only at runtime are pushed one by one onto an
+         * empty array */
+        int arr = ir_emit_unop(prog, IR_ARR_COPY, ir_emit_const_arr(prog, ir_array_table(prog, NULL)));
+        for (int i = 0; i < expr->as.array_lit.count; i++) {
+            Expr *e = expr->as.array_lit.elements[i];
+            if (expr_runtime_type(e, st) != et)
+                diag_emit(e->loc, DIAG_ERROR,
+                          "array element type '%s' does not match array element type '%s'",
+                          value_type_name(expr_runtime_type(e, st)), value_type_name(et));
+            arr = ir_emit_binop(prog, IR_ARR_PUSH, arr, ir_compile_expr(e, st, prog));
+        }
+        *fresh = 1;
+        return arr;
+    }
+
+    default:
+        break;
+    }
+    ir_reject_array_call(expr, st);
+    ir_reject_string_call(expr, st);
+    EvalResult r = eval_expr(expr, st);
+    return ir_emit_const_arr(prog, ir_array_table(prog, r.arr_val));
+}
+
+/* Reject a built-in call on a runtime array that nothing above
+ * compiles, when the evaluator could only guess at its result */
+static void ir_reject_array_call(Expr *expr, SymTable *st) {
+    if (expr->kind != EXPR_FN_CALL || expr->as.fn_call.obj_name ||
+        fn_table_find(g_ft, expr->as.fn_call.fn_name))
+        return;
+    for (int i = 0; i < expr->as.fn_call.arg_count; i++) {
+        if (expr_is_runtime_array(expr->as.fn_call.args[i], st) &&
+            expr_is_guessed(expr->as.fn_call.args[i], st))
+            diag_emit(expr->loc, DIAG_ERROR,
+                      "%s() is not supported on runtime arrays (only len, sum, min, max, contains, index_of and push are)",
+                      expr->as.fn_call.fn_name);
+    }
+}
+
+/* Reject a built-in call on a runtime string other than len(), when
+ * the evaluator could only guess at its result */
+static void ir_reject_string_call(Expr *expr, SymTable *st) {
+    if (expr->kind != EXPR_FN_CALL || expr->as.fn_call.obj_name ||
+        fn_table_find(g_ft, expr->as.fn_call.fn_name))
+        return;
+    for (int i = 0; i < expr->as.fn_call.arg_count; i++) {
+        Expr *arg = expr->as.fn_call.args[i];
+        if (expr_is_runtime(arg, st) && expr_runtime_type(arg, st) == VAL_STRING &&
+            expr_is_guessed(arg, st))
+            diag_emit(expr->loc, DIAG_ERROR,
+                      "%s() is not supported on runtime strings (only len is)",
+                      expr->as.fn_call.fn_name);
+    }
+}
+
+/* Compile an array value that is to be stored in a variable: one not
+ * fresh is copied, since the variable may assign its elements */
+static int ir_compile_owned_array(Expr *expr, SymTable *st, IRProgram *prog,
+                                  const char *steal) {
+    int fresh;
+    int v = ir_compile_array(expr, st, prog, steal, &fresh);
+    return fresh ? v : ir_emit_unop(prog, IR_ARR_COPY, v);
+}
+
+/* Compile the new value of array variable name, which takes its old
+ * array over when the assignment only pushes to it.  *replaced is
+ * cleared in that case: otherwise the old array is the caller's to
+ * release once the new one is stored. */
+static int ir_compile_array_update(Expr *expr, SymTable *st, IRProgram *prog,
+                                   const char *name, int *replaced) {
+    Expr *base = expr;
+    while (base->kind == EXPR_FN_CALL && !base->as.fn_call.obj_name &&
+           strcmp(base->as.fn_call.fn_name, "push") == 0 && !fn_table_find(g_ft, "push") &&
+           base->as.fn_call.arg_count == 2 && !expr_reads_var(base->as.fn_call.args[1], name))
+        base = base->as.fn_call.args[0];
+    *replaced = !(base != expr && base->kind == EXPR_VAR_REF &&
+                  strcmp(base->as.var_ref.name, name) == 0);
+    return ir_compile_owned_array(expr, st, prog, *replaced ? NULL : name);
+}
+
+/* Compile len, sum, min, max, contains or index_of of a runtime array
+ * to the array routines, the float ones for an Array<float> */
+static int ir_compile_array_builtin(Expr *expr, SymTable *st, IRProgram *prog) {
+    const char *name = expr->as.fn_call.fn_name;
+    Expr **args = expr->as.fn_call.args;
+    int search = strcmp(name, "contains") == 0 || strcmp(name, "index_of") == 0;
+    if (expr->as.fn_call.arg_count != 1 + search)
+        diag_emit(expr->loc, DIAG_ERROR, "%s() expects %d argument(s), got %d",
+                  name, 1 + search, expr->as.fn_call.arg_count);
+    ValueType et = ir_array_elem_type(args[0], st);
+    int fresh;
+    int arr = ir_compile_array(args[0], st, prog, NULL, &fresh);
+    int result;
+    if (strcmp(name, "len") == 0) {
+        result = ir_emit_unop(prog, IR_ARR_LEN, arr);
+    } else if (!search) {
+        if (et != VAL_INT && et != VAL_FLOAT && et != VAL_VOID)
+            diag_emit(expr->loc, DIAG_ERROR, "%s() expects an Array<int> or Array<float>, got Array<%s>",
+                      name, value_type_name(et));
+        IROpcode op;
+        if (et == VAL_FLOAT)
+            op = name[0] == 's' ? IR_ARR_FSUM : name[1] == 'i' ? IR_ARR_FMIN : IR_ARR_FMAX;
+        else
+            op = name[0] == 's' ? IR_ARR_SUM : name[1] == 'i' ? IR_ARR_MIN : IR_ARR_MAX;
+        result = ir_emit_unop(prog, op, arr);
+    } else if (et == VAL_FLOAT) {
+        /* An int is found as the float it equals, as the evaluator
+         * compares them */
+        ValueType xt = expr_runtime_type(args[1], st);
+        if (xt != VAL_FLOAT && xt != VAL_INT)
+            diag_emit(expr->loc, DIAG_ERROR, "%s() element type '%s' does not match array element type 'float'",
+                      name, value_type_name(xt));
+        result = ir_emit_binop(prog, IR_ARR_FINDEX_OF, arr, ir_compile_float_operand(args[1], st, prog));
+        if (name[0] == 'c')
+            result = ir_emit_binop(prog, IR_CMP_GE, result, ir_emit_const_int(prog, 0));
+    } else {
+        ValueType xt = expr_runtime_type(args[1], st);
+        if (et != VAL_VOID && xt != et)
+            diag_emit(expr->loc, DIAG_ERROR, "%s() element type '%s' does not match array element type '%s'",
+                      name, value_type_name(xt), value_type_name(et));
+        result = ir_emit_binop(prog, IR_ARR_INDEX_OF, arr, ir_compile_expr(args[1], st, prog));
+        if (name[0] == 'c')
+            result = ir_emit_binop(prog, IR_CMP_GE, result, ir_emit_const_int(prog, 0));
+    }
+    if (fresh) ir_emit_arr_release(prog, arr);
+    return result;
+}
+
+/* Print a runtime array the way eval_to_string formats one */
+static void ir_compile_print_array(Expr *expr, SymTable *st, IRProgram *prog) {
+    ValueType et = ir_array_elem_type(expr, st);
+    int fresh;
+    int arr = ir_compile_array(expr, st, prog, NULL, &fresh);
+    int len = ir_emit_unop(prog, IR_ARR_LEN, arr);
+    int slot = ir_alloc_slot(prog);
+    int loop = ir_alloc_label(prog);
+    int first = ir_alloc_label(prog);
+    int done = ir_alloc_label(prog);
+    ir_emit_print_str(prog, "[", 1);
+    ir_emit_store(prog, slot, ir_emit_const_int(prog, 0));
+    ir_emit_label(prog, loop);
+    int i = ir_emit_load(prog, slot);
+    ir_emit_br_cmp(prog, IR_CMP_GE, i, len, done);
+    ir_emit_br_cmp(prog, IR_CMP_EQ, i, ir_emit_const_int(prog, 0), first);
+    ir_emit_print_str(prog, ", ", 2);
+    ir_emit_label(prog, first);
+    int elem = ir_emit_binop(prog, IR_ARR_LOAD, arr, i);
+    if (et == VAL_BOOL) ir_emit_print_bool(prog, elem);
+    else if (et == VAL_FLOAT) ir_emit_print_float(prog, elem);
+    else ir_emit_print_int(prog, elem);
+    ir_emit_store(prog, slot, ir_emit_binop(prog, IR_ADD, i, ir_emit_const_int(prog, 1)));
+    ir_emit_jmp(prog, loop);
+    ir_emit_label(prog, done);
+    ir_emit_print_str(prog, "]", 1);
+    if (fresh) ir_emit_arr_release(prog, arr);
+}
+
+/* ================================================================
+ * Runtime maps
+ *
+ * A Map<K, V> variable with a slot, K and V each int or bool, holds a
+ * map value (see ir.h).  Maps are shared rather than copied: a variable
+ * assigned one, or a function passed one, sees the same entries, and
+ * the map counts the references to it.  Each map expression is compiled
+ * noting whether its value is fresh, a reference the consumer must
+ * store or release, or borrowed from a variable.
+ * ================================================================ */
+
+/* Check if a map with these key and value types can exist at runtime */
+static int ir_map_type_ok(ValueType key_type, ValueType value_type) {
+    return (key_type == VAL_INT || key_type == VAL_BOOL) &&
+           (value_type == VAL_INT || value_type == VAL_BOOL);
+}
+
+/* Check if an expression is a map only known at runtime */
+static int expr_is_runtime_map(Expr *expr, SymTable *st) {
+    return expr && expr_is_runtime(expr, st) && expr_runtime_type(expr, st) == VAL_MAP;
+}
+
+/* Check if expr calls std/map built-in name on a runtime map */
+static int ir_is_map_builtin(Expr *expr, const char *name, SymTable *st) {
+    if (expr->kind != EXPR_FN_CALL || expr->as.fn_call.obj_name ||
+        strcmp(expr->as.fn_call.fn_name, name) != 0 || fn_table_find(g_ft, name) ||
+        !stdlib_map_fn_is_imported(name))
+        return 0;
+    return expr->as.fn_call.arg_count > 0 && expr_is_runtime_map(expr->as.fn_call.args[0], st);
+}
+
+/* Key and value types of a map expression, VAL_VOID if it is none */
+static void ir_map_types(Expr *expr, SymTable *st, ValueType *key_type, ValueType *value_type) {
+    MapData *m = NULL;
+    if (expr->kind == EXPR_VAR_REF) {
+        Symbol *sym = sym_find(st, expr->as.var_ref.name);
+        if (sym && sym->val.type == VAL_MAP) m = sym->val.map_val;
+    } else if (ir_user_call_decl(expr, st)) {
+        ASTNode *decl = ir_user_call_decl(expr, st);
+        *key_type = decl->return_map_key_type;
+        *value_type = decl->return_array_elem_type;
+        return;
+    } else {
+        EvalResult r = eval_expr(expr, st);
+        if (r.type == VAL_MAP) m = r.map_val;
+    }
+    *key_type = m ? m->key_type : VAL_VOID;
+    *value_type = m ? m->value_type : VAL_VOID;
+}
+
+/* Report std/map built-in name called with runtime arguments on map,
+ * which the evaluator holds: it could only guess at the result */
+static void ir_map_not_runtime(const char *name, Expr *map, SourceLoc loc, SymTable *st) {
+    ValueType kt, vt;
+    ir_map_types(map, st, &kt, &vt);
+    if (!ir_map_type_ok(kt, vt))
+        diag_emit(loc, DIAG_ERROR,
+                  "%s() with a runtime argument requires a Map of int or bool keys and values, got 'Map<%s, %s>'",
+                  name, value_type_name(kt), value_type_name(vt));
+    diag_emit(loc, DIAG_ERROR, "%s() with a runtime argument requires a map variable", name);
+}
+
+/* Reject a std/map call expression with runtime arguments on a map
+ * that is not a runtime one */
+static void ir_reject_map_call(Expr *expr, SymTable *st) {
+    if (expr->as.fn_call.obj_name || expr->as.fn_call.arg_count == 0 ||
+        fn_table_find(g_ft, expr->as.fn_call.fn_name) || !expr_is_runtime(expr, st) ||
+        expr_is_runtime(expr->as.fn_call.args[0], st))
+        return;
+    ValueType at = expr_runtime_type(expr->as.fn_call.args[0], st);
+    if (at == VAL_MAP && stdlib_map_call(expr->as.fn_call.fn_name, at))
+        ir_map_not_runtime(expr->as.fn_call.fn_name, expr->as.fn_call.args[0], expr->loc, st);
+}
+
+/* Build a runtime map holding the entries of a compile-time one, set
+ * in a loop over constant tables of its keys and values */
+static int ir_compile_map_const(IRProgram *prog, MapData *m) {
+    int map = ir_emit_map_new(prog);
+    if (!m || m->count == 0) return map;
+    ArrayData keys = { m->keys, m->count, m->key_type };
+    ArrayData values = { m->values, m->count, m->value_type };
+    int key_table = ir_array_table(prog, &keys);
+    int value_table = ir_array_table(prog, &values);
+    int slot = ir_alloc_slot(prog);
+    int loop = ir_alloc_label(prog);
+    int done = ir_alloc_label(prog);
+    ir_emit_store(prog, slot, ir_emit_const_int(prog, 0));
+    ir_emit_label(prog, loop);
+    int i = ir_emit_load(prog, slot);
+    ir_emit_br_cmp(prog, IR_CMP_GE, i, ir_emit_const_int(prog, m->count), done);
+    ir_emit_map_set(prog, map, ir_emit_load_elem(prog, key_table, i),
+                    ir_emit_load_elem(prog, value_table, i));
+    ir_emit_store(prog, slot, ir_emit_binop(prog, IR_ADD, i, ir_emit_const_int(prog, 1)));
+    ir_emit_jmp(prog, loop);
+    ir_emit_label(prog, done);
+    return map;
+}
+
+/* Compile an expression to a map value.  *fresh is set when the result
+ * is a reference the caller owns: a map built from a compile-time one,
+ * or returned by a runtime call. */
+static int ir_compile_map(Expr *expr, SymTable *st, IRProgram *prog, int *fresh) {
+    ValueType kt, vt;
+    ir_map_types(expr, st, &kt, &vt);
+    if (!ir_map_type_ok(kt, vt))
+        diag_emit(expr->loc, DIAG_ERROR,
+                  "runtime maps must have int or bool keys and values, got 'Map<%s, %s>'",
+                  value_type_name(kt), value_type_name(vt));
+    *fresh = 1;
+    if (expr_is_runtime(expr, st)) {
+        if (expr->kind == EXPR_VAR_REF) {
+            *fresh = 0;
+            return ir_compile_expr(expr, st, prog);
+        }
+        if (ir_user_call_decl(expr, st))
+            return ir_compile_user_call(expr, st, prog, 1);
+    }
+    EvalResult r = eval_expr(expr, st);
+    if (r.type != VAL_MAP)
+        diag_emit(expr->loc, DIAG_ERROR, "expected a map, got '%s'", value_type_name(r.type));
+    return ir_compile_map_const(prog, r.map_val);
+}
+
+/* Compile a map value that is to be stored in a variable or returned:
+ * one borrowed from a variable gains a reference */
+static int ir_compile_owned_map(Expr *expr, SymTable *st, IRProgram *prog) {
+    int fresh;
+    int v = ir_compile_map(expr, st, prog, &fresh);
+    if (!fresh) ir_emit_map_retain(prog, v);
+    return v;
+}
+
+/* Check that key, an argument of std/map built-in name, has the map's
+ * key type */
+static void ir_check_map_key(const char *name, Expr *key, ValueType key_type,
+                             SourceLoc loc, SymTable *st) {
+    ValueType t = expr_runtime_type(key, st);
+    if (t != key_type)
+        diag_emit(loc, DIAG_ERROR, "%s() key type '%s' does not match map key type '%s'",
+                  name, value_type_name(t), value_type_name(key_type));
+}
+
+/* Compile get, has, len or keys of a runtime map to the map routines */
+static int ir_compile_map_builtin(Expr *expr, SymTable *st, IRProgram *prog) {
+    const char *name = expr->as.fn_call.fn_name;
+    Expr **args = expr->as.fn_call.args;
+    if (strcmp(name, "set") == 0 || strcmp(name, "remove") == 0)
+        diag_emit(expr->loc, DIAG_ERROR, "cannot use void function result");
+    int keyed = strcmp(name, "get") == 0 || strcmp(name, "has") == 0;
+    if (expr->as.fn_call.arg_count != 1 + keyed)
+        diag_emit(expr->loc, DIAG_ERROR, "%s() expects %d argument(s), got %d",
+                  name, 1 + keyed, expr->as.fn_call.arg_count);
+    ValueType kt, vt;
+    ir_map_types(args[0], st, &kt, &vt);
+    if (keyed) ir_check_map_key(name, args[1], kt, expr->loc, st);
+    int fresh;
+    int map = ir_compile_map(args[0], st, prog, &fresh);
+    int result;
+    if (strcmp(name, "len") == 0)
+        result = ir_emit_unop(prog, IR_MAP_LEN, map);
+    else if (strcmp(name, "keys") == 0)
+        result = ir_emit_unop(prog, IR_MAP_KEYS, map);
+    else
+        result = ir_emit_binop(prog, name[0] == 'g' ? IR_MAP_GET : IR_MAP_HAS, map,
+                               ir_compile_expr(args[1], st, prog));
+    if (fresh) ir_emit_map_release(prog, map);
+    return result;
+}
+
+/* Print a runtime map the way eval_to_string formats one */
+static void ir_compile_print_map(Expr *expr, SymTable *st, IRProgram *prog) {
+    ValueType kt, vt;
+    ir_map_types(expr, st, &kt, &vt);
+    int fresh;
+    int map = ir_compile_map(expr, st, prog, &fresh);
+    int keys = ir_emit_unop(prog, IR_MAP_KEYS, map);
+    int len = ir_emit_unop(prog, IR_ARR_LEN, keys);
+    int slot = ir_alloc_slot(prog);
+    int loop = ir_alloc_label(prog);
+    int first = ir_alloc_label(prog);
+    int done = ir_alloc_label(prog);
+    ir_emit_print_str(prog, "{", 1);
+    ir_emit_store(prog, slot, ir_emit_const_int(prog, 0));
+    ir_emit_label(prog, loop);
+    int i = ir_emit_load(prog, slot);
+    ir_emit_br_cmp(prog, IR_CMP_GE, i, len, done);
+    ir_emit_br_cmp(prog, IR_CMP_EQ, i, ir_emit_const_int(prog, 0), first);
+    ir_emit_print_str(prog, ", ", 2);
+    ir_emit_label(prog, first);
+    int key = ir_emit_binop(prog, IR_ARR_LOAD, keys, i);
+    if (kt == VAL_BOOL) ir_emit_print_bool(prog, key);
+    else ir_emit_print_int(prog, key);
+    ir_emit_print_str(prog, ": ", 2);
+    int value = ir_emit_binop(prog, IR_MAP_GET, map, key);
+    if (vt == VAL_BOOL) ir_emit_print_bool(prog, value);
+    else ir_emit_print_int(prog, value);
+    ir_emit_store(prog, slot, ir_emit_binop(prog, IR_ADD, i, ir_emit_const_int(prog, 1)));
+    ir_emit_jmp(prog, loop);
+    ir_emit_label(prog, done);
+    ir_emit_print_str(prog, "}", 1);
+    ir_emit_arr_release(prog, keys);
+    if (fresh) ir_emit_map_release(prog, map);
+}
+
+/* Check if call statement n is a std/map set() or remove() to run at
+ * runtime: on a runtime map, or with a runtime key or value */
+static int ir_stmt_is_map_update(ASTNode *n, SymTable *st) {
+    if (n->obj_name || fn_table_find(g_ft, n->fn_name) || n->call_arg_count == 0 ||
+        (strcmp(n->fn_name, "set") != 0 && strcmp(n->fn_name, "remove") != 0))
+        return 0;
+    if (!stdlib_map_call(n->fn_name, expr_runtime_type(n->call_arg_exprs[0], st)))
+        return 0;
+    for (int i = 0; i < n->call_arg_count; i++) {
+        if (expr_is_runtime(n->call_arg_exprs[i], st))
+            return 1;
+    }
+    return 0;
+}
+
+/* Compile call statement n, a set() or remove() on a runtime map.  The
+ * map's compile-time entries follow along when the statement runs in
+ * straight-line code (exact) on known values; otherwise they become a
+ * guess. */
+static void ir_compile_map_update(ASTNode *n, SymTable *st, IRProgram *prog, int exact) {
+    Expr **args = n->call_arg_exprs;
+    int is_set = n->fn_name[0] == 's';
+    if (n->call_arg_count != 2 + is_set)
+        diag_emit(n->loc, DIAG_ERROR, "%s() expects %d arguments, got %d",
+                  n->fn_name, 2 + is_set, n->call_arg_count);
+    if (!expr_is_runtime(args[0], st))
+        ir_map_not_runtime(n->fn_name, args[0], n->loc, st);
+    ValueType kt, vt;
+    ir_map_types(args[0], st, &kt, &vt);
+    ir_check_map_key(n->fn_name, args[1], kt, n->loc, st);
+    if (is_set && expr_runtime_type(args[2], st) != vt)
+        diag_emit(n->loc, DIAG_ERROR, "set() value type '%s' does not match map value type '%s'",
+                  value_type_name(expr_runtime_type(args[2], st)), value_type_name(vt));
+
+    int fresh;
+    int map = ir_compile_map(args[0], st, prog, &fresh);
+    int key = ir_compile_expr(args[1], st, prog);
+    if (is_set) ir_emit_map_set(prog, map, key, ir_compile_expr(args[2], st, prog));
+    else ir_emit_map_remove(prog, map, key);
+    if (fresh) ir_emit_map_release(prog, map);
+
+    if (args[0]->kind != EXPR_VAR_REF) return;
+    MapData *m = sym_find(st, args[0]->as.var_ref.name)->val.map_val;
+    int known = exact;
+    for (int i = 0; i < n->call_arg_count; i++) {
+        if (expr_is_guessed(args[i], st)) known = 0;
+    }
+    if (!known) {
+        m->guessed = 1;
+        return;
+    }
+    EvalResult key_val = eval_expr(args[1], st);
+    if (is_set) map_data_set(m, key_val, eval_expr(args[2], st));
+    else map_data_remove(m, key_val);
+}
+
+/* ================================================================
+ * Runtime objects
+ *
+ * An object of a class whose fields are int, bool or float can live at
+ * runtime (see ir.h for its layout).  A variable with a slot holds its
+ * address, and the symbol's ObjData the fields as far as they are known
+ * at compile time.  Objects are shared like maps: a variable assigned
+ * one, or a function passed one, sees the same fields, and the object
+ * counts the references to it.  One created by `new` that never
+ * escapes the function declaring the variable lives in that
+ * function's frame, where scalar replacement can usually turn its
+ * fields into plain slots.
+ * ================================================================ */
+
+/* Reference count of an object in a stack frame: releases never bring
+ * it to zero */
+#define IR_STACK_OBJECT_REFS ((int64_t)1 << 40)
+
+/* Check if objects of cls can exist at runtime */
+static int ir_class_ok(ClassDef *cls) {
+    for (int i = 0; i < cls->field_count; i++) {
+        if (cls->field_types[i] != VAL_INT && cls->field_types[i] != VAL_BOOL &&
+            cls->field_types[i] != VAL_FLOAT)
+            return 0;
+    }
+    return 1;
+}
+
+/* Report a class whose objects cannot exist at runtime */
+static void ir_check_class(ClassDef *cls, SourceLoc loc) {
+    for (int i = 0; i < cls->field_count; i++) {
+        if (cls->field_types[i] != VAL_INT && cls->field_types[i] != VAL_BOOL &&
+            cls->field_types[i] != VAL_FLOAT)
+            diag_emit(loc, DIAG_ERROR,
+                      "runtime objects must have int, bool or float fields, but field '%s' of class '%s' is a '%s'",
+                      cls->field_names[i], cls->name, value_type_name(cls->field_types[i]));
+    }
+}
+
+/* Size in bytes of a runtime object of cls: its reference count and a
+ * word per field */
+static int ir_class_size(ClassDef *cls) {
+    return 8 * (cls->field_count + 1);
+}
+
+/* Offset of field index field in a runtime object */
+static int ir_field_offset(int field) {
+    return 8 * (field + 1);
+}
+
+/* Index of field name in cls, -1 if it has none */
+static int ir_class_field(ClassDef *cls, const char *name) {
+    for (int i = 0; i < cls->field_count; i++) {
+        if (strcmp(cls->field_names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* Class of an object expression: that of the object a variable holds,
+ * or the declared one of a call's result; NULL if expr is neither */
+static ClassDef *ir_object_class(Expr *expr, SymTable *st) {
+    const char *name = NULL;
+    ASTNode *decl = ir_user_call_decl(expr, st);
+    if (decl) {
+        if (decl->has_return_type && decl->return_type == VAL_OBJECT)
+            name = decl->return_class_name;
+    } else if (expr->kind == EXPR_VAR_REF) {
+        Symbol *sym = sym_find(st, expr->as.var_ref.name);
+        if (sym && sym->val.type == VAL_OBJECT && sym->val.obj_val)
+            name = sym->val.obj_val->class_name;
+    }
+    return name ? class_table_find(g_ct, name) : NULL;
+}
+
+/* A compile-time object of cls whose fields are not known */
+static ObjData *ir_object_shadow(ClassDef *cls) {
+    if (!cls) return NULL;
+    ObjData *obj = malloc(sizeof(ObjData));
+    obj->class_name = cls->name;
+    obj->field_names = cls->field_names;
+    obj->field_count = cls->field_count;
+    obj->field_values = calloc(cls->field_count > 0 ? cls->field_count : 1, sizeof(EvalResult));
+    for (int i = 0; i < cls->field_count; i++)
+        obj->field_values[i].type = cls->field_types[i];
+    obj->guessed = 1;
+    return obj;
+}
+
+/* Allocate a runtime object of cls, in the frame when on_stack, and
+ * set its reference count */
+static int ir_compile_object_alloc(IRProgram *prog, ClassDef *cls, int on_stack) {
+    int size = ir_class_size(cls);
+    int obj = on_stack ? ir_emit_stack_alloc(prog, size)
+                       : ir_emit_alloc(prog, ir_emit_const_int(prog, size));
+    ir_emit_obj_store(prog, obj, 0, ir_emit_const_int(prog, on_stack ? IR_STACK_OBJECT_REFS : 1));
+    return obj;
+}
+
+/* Build a runtime object holding the fields of a compile-time one */
+static int ir_compile_object_const(IRProgram *prog, ClassDef *cls, ObjData *o) {
+    int obj = ir_compile_object_alloc(prog, cls, 0);
+    for (int i = 0; i < cls->field_count; i++) {
+        EvalResult *v = &o->field_values[i];
+        ir_emit_obj_store(prog, obj, ir_field_offset(i),
+                          ir_emit_const_int(prog, ir_value_bits(v)));
+    }
+    return obj;
+}
+
+/* Compile an expression to an object.  *fresh is set when the result
+ * is a reference the caller owns: an object built from a compile-time
+ * one, or returned by a runtime call. */
+static int ir_compile_object(Expr *expr, SymTable *st, IRProgram *prog, int *fresh) {
+    *fresh = 1;
+    if (!expr_is_runtime(expr, st)) {
+        EvalResult r = eval_expr(expr, st);
+        if (r.type != VAL_OBJECT || !r.obj_val)
+            diag_emit(expr->loc, DIAG_ERROR, "expected an object, got '%s'", value_type_name(r.type));
+        ClassDef *cls = class_table_find(g_ct, r.obj_val->class_name);
+        ir_check_class(cls, expr->loc);
+        return ir_compile_object_const(prog, cls, r.obj_val);
+    }
+    if (expr_runtime_type(expr, st) != VAL_OBJECT)
+        diag_emit(expr->loc, DIAG_ERROR, "expected an object, got '%s'",
+                  value_type_name(expr_runtime_type(expr, st)));
+    if (expr->kind == EXPR_VAR_REF) {
+        *fresh = 0;
+        return ir_compile_expr(expr, st, prog);
+    }
+    return ir_compile_user_call(expr, st, prog, 1);
+}
+
+/* Compile an object that is to be stored in a variable or returned:
+ * one borrowed from a variable gains a reference */
+static int ir_compile_owned_object(Expr *expr, SymTable *st, IRProgram *prog) {
+    int fresh;
+    int v = ir_compile_object(expr, st, prog, &fresh);
+    if (!fresh) ir_emit_obj_retain(prog, v);
+    return v;
+}
+
+/* Compile obj.field on a runtime object */
+static int ir_compile_field_load(Expr *expr, SymTable *st, IRProgram *prog) {
+    Expr *object = expr->as.member_access.object;
+    ClassDef *cls = ir_object_class(object, st);
+    if (!cls)
+        diag_emit(expr->loc, DIAG_ERROR, "member access on non-object value");
+    int f = ir_class_field(cls, expr->as.member_access.field_name);
+    if (f < 0)
+        diag_emit(expr->loc, DIAG_ERROR, "no field '%s' on object of class '%s'",
+                  expr->as.member_access.field_name, cls->name);
+    int fresh;
+    int obj = ir_compile_object(object, st, prog, &fresh);
+    int v = ir_emit_obj_load(prog, obj, ir_field_offset(f));
+    if (fresh) ir_emit_obj_release(prog, obj);
+    return v;
+}
+
+/* Compile new ClassName(args) (node n) to a runtime object, in the
+ * frame when on_stack.  Arguments bind to fields as in eval_new_expr:
+ * positional first, then named.  *shadow is set to the object as
+ * known at compile time. */
+static int ir_compile_new(ASTNode *n, SymTable *st, IRProgram *prog, int on_stack,
+                          EvalResult *shadow) {
+    ClassDef *cls = class_table_find(g_ct, n->fn_name);
+    if (!cls)
+        diag_emit(n->loc, DIAG_ERROR, "undefined class '%s'", n->fn_name);
+    ir_check_class(cls, n->loc);
+
+    int has_named = 0;
+    for (int i = 0; i < n->call_arg_count; i++) {
+        if (n->call_arg_names && n->call_arg_names[i]) has_named = 1;
+    }
+    if (!has_named && n->call_arg_count != cls->field_count)
+        diag_emit(n->loc, DIAG_ERROR, "class '%s' has %d field(s), got %d argument(s)",
+                  cls->name, cls->field_count, n->call_arg_count);
+    int n_fields = cls->field_count > 0 ? cls->field_count : 1;
+    Expr **bound = calloc(n_fields, sizeof(Expr *));
+    int *values = malloc(n_fields * sizeof(int));
+    int pos_idx = 0;
+    for (int i = 0; i < n->call_arg_count; i++) {
+        if (n->call_arg_names && n->call_arg_names[i]) continue;
+        if (pos_idx >= cls->field_count)
+            diag_emit(n->loc, DIAG_ERROR, "too many positional arguments for class '%s'", cls->name);
+        bound[pos_idx++] = n->call_arg_exprs[i];
+    }
+    for (int i = 0; i < n->call_arg_count; i++) {
+        if (!n->call_arg_names || !n->call_arg_names[i]) continue;
+        int f = ir_class_field(cls, n->call_arg_names[i]);
+        if (f < 0)
+            diag_emit(n->loc, DIAG_ERROR, "unknown field '%s' in class '%s'",
+                      n->call_arg_names[i], cls->name);
+        if (bound[f])
+            diag_emit(n->loc, DIAG_ERROR, "duplicate argument for field '%s' in class '%s'",
+                      n->call_arg_names[i], cls->name);
+        bound[f] = n->call_arg_exprs[i];
+    }
+
+    ObjData *obj = ir_object_shadow(cls);
+    obj->guessed = 0;
+    for (int f = 0; f < cls->field_count; f++) {
+        if (!bound[f])
+            diag_emit(n->loc, DIAG_ERROR, "missing value for field '%s' in class '%s'",
+                      cls->field_names[f], cls->name);
+        ValueType t = expr_runtime_type(bound[f], st);
+        if (t != cls->field_types[f])
+            diag_emit(n->loc, DIAG_ERROR, "field '%s' expects '%s', got '%s'",
+                      cls->field_names[f], value_type_name(cls->field_types[f]), value_type_name(t));
+        if (expr_is_runtime(bound[f], st)) {
+            obj->field_values[f] = ir_shadow_value(bound[f], st);
+            if (expr_is_guessed(bound[f], st)) obj->guessed = 1;
+        } else {
+            obj->field_values[f] = eval_expr(bound[f], st);
+        }
+    }
+    /* Runtime arguments run in the order they are written */
+    for (int i = 0; i < n->call_arg_count; i++) {
+        for (int f = 0; f < cls->field_count; f++) {
+            if (bound[f] != n->call_arg_exprs[i]) continue;
+            EvalResult *fv = &obj->field_values[f];
+            values[f] = expr_is_runtime(bound[f], st)
+                      ? ir_compile_expr(bound[f], st, prog)
+                      : ir_emit_const_int(prog, ir_value_bits(fv));
+        }
+    }
+    int v = ir_compile_object_alloc(prog, cls, on_stack);
+    for (int f = 0; f < cls->field_count; f++)
+        ir_emit_obj_store(prog, v, ir_field_offset(f), values[f]);
+    free(values);
+    free(bound);
+
+    memset(shadow, 0, sizeof(*shadow));
+    shadow->type = VAL_OBJECT;
+    shadow->obj_val = obj;
+    return v;
+}
+
+/* Check if a new ClassName(args) declaration (node n) makes a runtime
+ * object: a var, or a const with runtime arguments, of a class whose
+ * objects can exist at runtime */
+static int ir_new_is_runtime(ASTNode *n, SymTable *st) {
+    ClassDef *cls = class_table_find(g_ct, n->fn_name);
+    if (!cls || !ir_class_ok(cls)) return 0;
+    if (!n->is_const) return 1;
+    for (int i = 0; i < n->call_arg_count; i++) {
+        if (expr_is_runtime(n->call_arg_exprs[i], st))
+            return 1;
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------
+ * Escape analysis: an object escapes its function when a variable
+ * holding it (or declared from one that does) is returned, assigned to
+ * another variable, passed to a method or to a function that returns
+ * an object, or spawned with.  Shadowing is ignored, which only errs
+ * on the side of escaping.
+ * ---------------------------------------------------------------- */
+
+typedef struct {
+    const char **names;
+    int count;
+    int cap;
+} IRAliases;
+
+/* Check if expr is a variable holding the object */
+static int ir_is_alias(Expr *expr, IRAliases *a) {
+    if (!expr || expr->kind != EXPR_VAR_REF) return 0;
+    for (int i = 0; i < a->count; i++) {
+        if (strcmp(a->names[i], expr->as.var_ref.name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Check if a call passes the object to a callee that could hand it back */
+static int ir_call_leaks(const char *obj_name, const char *fn_name, Expr **args, int arg_count,
+                         IRAliases *a) {
+    int passed = 0;
+    for (int i = 0; i < arg_count; i++) {
+        if (ir_is_alias(args[i], a)) passed = 1;
+    }
+    if (!passed) return 0;
+    if (obj_name) return 1;
+    FnEntry *fn = fn_table_find(g_ft, fn_name);
+    return fn && fn->decl->has_return_type && fn->decl->return_type == VAL_OBJECT;
+}
+
+static int ir_expr_leaks(Expr *expr, IRAliases *a) {
+    if (!expr) return 0;
+    switch (expr->kind) {
+    case EXPR_BINARY:
+        return ir_expr_leaks(expr->as.binary.left, a) || ir_expr_leaks(expr->as.binary.right, a);
     case EXPR_UNARY:
-        return expr_is_runtime(expr->as.unary.operand, st);
-    case EXPR_INT_LIT:
-    case EXPR_FLOAT_LIT:
-    case EXPR_STRING_LIT:
-    case EXPR_BOOL_LIT:
-        return 0;
+        return ir_expr_leaks(expr->as.unary.operand, a);
     case EXPR_INDEX:
-        return expr_is_runtime(expr->as.index_access.object, st) ||
-               expr_is_runtime(expr->as.index_access.index, st);
-    case EXPR_FN_CALL: {
+        return ir_expr_leaks(expr->as.index_access.object, a) ||
+               ir_expr_leaks(expr->as.index_access.index, a);
+    case EXPR_MEMBER_ACCESS:
+        return ir_expr_leaks(expr->as.member_access.object, a);
+    case EXPR_ARRAY_LIT:
+        for (int i = 0; i < expr->as.array_lit.count; i++) {
+            if (ir_is_alias(expr->as.array_lit.elements[i], a) ||
+                ir_expr_leaks(expr->as.array_lit.elements[i], a))
+                return 1;
+        }
+        return 0;
+    case EXPR_FN_CALL:
+        if (ir_call_leaks(expr->as.fn_call.obj_name, expr->as.fn_call.fn_name,
+                          expr->as.fn_call.args, expr->as.fn_call.arg_count, a))
+            return 1;
         for (int i = 0; i < expr->as.fn_call.arg_count; i++) {
-            if (expr_is_runtime(expr->as.fn_call.args[i], st))
+            if (ir_expr_leaks(expr->as.fn_call.args[i], a))
                 return 1;
         }
         return 0;
-    }
     default:
         return 0;
     }
 }
 
-/* Forward declare eval_expr (needed by ir_compile_expr for const-folding) */
-static EvalResult eval_expr(Expr *expr, SymTable *st);
-
-/* Compile an int expression to IR instructions, returns vreg holding result */
-static int ir_compile_expr(Expr *expr, SymTable *st, IRProgram *prog) {
-    switch (expr->kind) {
-    case EXPR_INT_LIT:
-        return ir_emit_const_int(prog, expr->as.int_lit.value);
-
-    case EXPR_BOOL_LIT:
-        return ir_emit_const_int(prog, expr->as.bool_lit.value);
-
-    case EXPR_VAR_REF: {
-        Symbol *sym = sym_find(st, expr->as.var_ref.name);
-        if (sym && sym->has_slot) {
-            return ir_emit_load(prog, sym->slot);
+/* Scan stmts for a leak of the object, adding the variables declared
+ * from one holding it */
+static int ir_stmts_leak(ASTNode *stmts, IRAliases *a) {
+    int leaks = 0;
+    for (ASTNode *n = stmts; n; n = n->next) {
+        if (n->type == NODE_FN_DECL || n->type == NODE_CLASS_DECL) continue;
+        if (n->type == NODE_VAR_DECL && ir_is_alias(n->expr, a)) {
+            int seen = 0;
+            for (int i = 0; i < a->count; i++) {
+                if (strcmp(a->names[i], n->var_name) == 0) seen = 1;
+            }
+            if (!seen) {
+                if (a->count == a->cap) {
+                    a->cap *= 2;
+                    a->names = realloc(a->names, a->cap * sizeof(char *));
+                }
+                a->names[a->count++] = n->var_name;
+            }
+        }
+        if ((n->type == NODE_ASSIGN || n->type == NODE_RETURN) && ir_is_alias(n->expr, a))
+            leaks = 1;
+        if (n->type == NODE_SPAWN && n->spawn_expr) {
+            for (int i = 0; i < n->spawn_expr->as.fn_call.arg_count; i++) {
+                if (ir_is_alias(n->spawn_expr->as.fn_call.args[i], a)) leaks = 1;
+            }
+        }
+        if (n->is_fn_call && !n->is_new_expr && n->call_arg_exprs &&
+            ir_call_leaks(n->obj_name, n->fn_name, n->call_arg_exprs, n->call_arg_count, a))
+            leaks = 1;
+        for (int i = 0; n->call_arg_exprs && i < n->call_arg_count; i++) {
+            if (ir_expr_leaks(n->call_arg_exprs[i], a)) leaks = 1;
+        }
+        if (ir_expr_leaks(n->expr, a) || ir_expr_leaks(n->for_cond, a) ||
+            ir_expr_leaks(n->if_cond, a) || ir_expr_leaks(n->match_expr, a) ||
+            ir_expr_leaks(n->index_expr, a) || ir_expr_leaks(n->spawn_expr, a))
+            leaks = 1;
+        if (ir_stmts_leak(n->for_init, a) | ir_stmts_leak(n->for_update, a) |
+            ir_stmts_leak(n->body, a) | ir_stmts_leak(n->if_body, a) |
+            ir_stmts_leak(n->else_body, a))
+            leaks = 1;
+        for (int i = 0; i < n->match_arm_count; i++) {
+            if (ir_stmts_leak(n->match_arms[i].body, a)) leaks = 1;
         }
-        /* Compile-time constant — fold its value */
-        int64_t cv = (sym->val.type == VAL_BOOL) ? (int64_t)sym->val.bool_val : sym->val.int_val;
-        return ir_emit_const_int(prog, cv);
     }
+    return leaks;
+}
 
-    case EXPR_BINARY: {
-        int lhs = ir_compile_expr(expr->as.binary.left, st, prog);
-        int rhs = ir_compile_expr(expr->as.binary.right, st, prog);
-        IROpcode op;
-        switch (expr->as.binary.op) {
-        case BINOP_ADD: op = IR_ADD; break;
-        case BINOP_SUB: op = IR_SUB; break;
-        case BINOP_MUL: op = IR_MUL; break;
-        case BINOP_DIV: op = IR_DIV; break;
-        case BINOP_MOD: op = IR_MOD; break;
-        case BINOP_EQ:  op = IR_CMP_EQ; break;
-        case BINOP_NE:  op = IR_CMP_NE; break;
-        case BINOP_LT:  op = IR_CMP_LT; break;
-        case BINOP_LE:  op = IR_CMP_LE; break;
-        case BINOP_GT:  op = IR_CMP_GT; break;
-        case BINOP_GE:  op = IR_CMP_GE; break;
-        case BINOP_BIT_AND: op = IR_BIT_AND; break;
-        case BINOP_BIT_OR:  op = IR_BIT_OR; break;
-        case BINOP_BIT_XOR: op = IR_BIT_XOR; break;
-        case BINOP_SHL: op = IR_SHL; break;
-        case BINOP_SHR: op = IR_SHR; break;
-        case BINOP_AND: op = IR_BIT_AND; break; /* logical and on ints (0/1) */
-        case BINOP_OR:  op = IR_BIT_OR; break;  /* logical or on ints (0/1) */
-        default: op = IR_ADD; break;
-        }
-        return ir_emit_binop(prog, op, lhs, rhs);
-    }
+/* Check if the object variable name, declared just before stmts,
+ * escapes through them */
+static int ir_object_escapes(ASTNode *stmts, const char *name) {
+    IRAliases a;
+    a.cap = 8;
+    a.count = 1;
+    a.names = malloc(a.cap * sizeof(char *));
+    a.names[0] = name;
+    int leaks, count;
+    do {
+        count = a.count;
+        leaks = ir_stmts_leak(stmts, &a);
+    } while (!leaks && a.count != count);
+    free(a.names);
+    return leaks;
+}
 
-    case EXPR_UNARY: {
-        int operand = ir_compile_expr(expr->as.unary.operand, st, prog);
-        if (expr->as.unary.op == UNOP_NEG) {
-            IRInstr instr;
-            memset(&instr, 0, sizeof(instr));
-            instr.op = IR_NEG;
-            instr.dst = ir_alloc_vreg(prog);
-            instr.src = operand;
-            ir_emit(prog, instr);
-            return instr.dst;
-        } else {
-            /* UNOP_BIT_NOT */
-            IRInstr instr;
-            memset(&instr, 0, sizeof(instr));
-            instr.op = IR_BIT_NOT;
-            instr.dst = ir_alloc_vreg(prog);
-            instr.src = operand;
-            ir_emit(prog, instr);
-            return instr.dst;
-        }
-    }
+/* Declare the variable of node n, initialized by new ClassName(args),
+ * in st as a runtime object */
+static void ir_declare_new_object(ASTNode *n, SymTable *st, IRProgram *prog) {
+    EvalResult val;
+    int obj = ir_compile_new(n, st, prog, !ir_object_escapes(n->next, n->var_name), &val);
+    sym_add(st, n->var_name, val, n->is_const, n->loc);
+    Symbol *sym = &st->syms[st->count - 1];
+    sym->has_slot = 1;
+    sym->slot = ir_alloc_slot(prog);
+    ir_emit_store(prog, sym->slot, obj);
+}
 
-    default:
-        /* Fallback: evaluate at compile time and emit as constant */
-        {
-            EvalResult r = eval_expr(expr, st);
-            if (r.type == VAL_INT)
-                return ir_emit_const_int(prog, r.int_val);
-            else if (r.type == VAL_BOOL)
-                return ir_emit_const_int(prog, r.bool_val);
-            return ir_emit_const_int(prog, 0);
-        }
+/* Print a runtime object the way eval_to_string formats one */
+static void ir_compile_print_object(Expr *expr, SymTable *st, IRProgram *prog) {
+    ClassDef *cls = ir_object_class(expr, st);
+    int fresh;
+    int obj = ir_compile_object(expr, st, prog, &fresh);
+    ir_emit_print_str(prog, cls->name, (int)strlen(cls->name));
+    ir_emit_print_str(prog, "{", 1);
+    for (int f = 0; f < cls->field_count; f++) {
+        if (f > 0) ir_emit_print_str(prog, ", ", 2);
+        ir_emit_print_str(prog, cls->field_names[f], (int)strlen(cls->field_names[f]));
+        ir_emit_print_str(prog, ": ", 2);
+        int v = ir_emit_obj_load(prog, obj, ir_field_offset(f));
+        if (cls->field_types[f] == VAL_BOOL) ir_emit_print_bool(prog, v);
+        else if (cls->field_types[f] == VAL_FLOAT) ir_emit_print_float(prog, v);
+        else ir_emit_print_int(prog, v);
     }
+    ir_emit_print_str(prog, "}", 1);
+    if (fresh) ir_emit_obj_release(prog, obj);
 }
 
-/* Determine the runtime type of an expression (for IR print dispatch).
- * Returns VAL_BOOL if the expression produces a bool, VAL_INT otherwise. */
-static ValueType expr_runtime_type(Expr *expr, SymTable *st) {
-    if (!expr) return VAL_INT;
-    switch (expr->kind) {
-    case EXPR_BOOL_LIT:
-        return VAL_BOOL;
-    case EXPR_VAR_REF: {
-        Symbol *sym = sym_find(st, expr->as.var_ref.name);
-        if (sym) return sym->val.type;
-        return VAL_INT;
+/* Compile field assignment n to the runtime object of variable sym.
+ * The compile-time copy of the field follows along, but unless the
+ * statement runs in straight-line code (exact) on known values the
+ * object's fields become a guess. */
+static void ir_compile_field_assign(ASTNode *n, Symbol *sym, SymTable *st, IRProgram *prog,
+                                    int exact) {
+    ObjData *obj = sym->val.obj_val;
+    ClassDef *cls = class_table_find(g_ct, obj->class_name);
+    int f = ir_class_field(cls, n->field_name);
+    if (f < 0)
+        diag_emit(n->loc, DIAG_ERROR, "no field '%s' on object of class '%s'",
+                  n->field_name, obj->class_name);
+    ValueType t = n->expr ? expr_runtime_type(n->expr, st) : VAL_OBJECT;
+    if (t != cls->field_types[f])
+        diag_emit(n->loc, DIAG_ERROR, "type mismatch: field '%s' has type '%s', cannot assign '%s'",
+                  n->field_name, value_type_name(cls->field_types[f]), value_type_name(t));
+    if (!sym_in_ir_frame(st, n->var_name))
+        diag_emit(n->loc, DIAG_ERROR,
+                  "function '%s' cannot assign runtime variable '%s' from an enclosing scope",
+                  g_ir_frame_fn->fn_name, n->var_name);
+
+    int v = ir_compile_expr(n->expr, st, prog);
+    ir_emit_obj_store(prog, ir_emit_load(prog, sym->slot), ir_field_offset(f), v);
+    obj->field_values[f] = expr_is_runtime(n->expr, st) ? ir_shadow_value(n->expr, st)
+                                                        : eval_expr(n->expr, st);
+    if (!exact || sym->guessed || expr_is_guessed(n->expr, st))
+        obj->guessed = 1;
+    sym->mutated = 1;
+}
+
+/* Compile assignment n to object variable sym, which has a slot: the
+ * variable's old object is released once the new one is stored.  Out
+ * of straight-line code (!exact) the variable may hold either object
+ * afterwards, so both become guesses. */
+static void ir_compile_object_assign(ASTNode *n, Symbol *sym, SymTable *st, IRProgram *prog,
+                                     int exact) {
+    ObjData *old_obj = sym->val.obj_val;
+    EvalResult val;
+    int src;
+    if (!sym_in_ir_frame(st, n->var_name))
+        diag_emit(n->loc, DIAG_ERROR,
+                  "function '%s' cannot assign runtime variable '%s' from an enclosing scope",
+                  g_ir_frame_fn->fn_name, n->var_name);
+    if (n->is_new_expr) {
+        if (strcmp(n->fn_name, old_obj->class_name) != 0)
+            diag_emit(n->loc, DIAG_ERROR, "type mismatch: variable '%s' has class '%s', cannot assign '%s'",
+                      n->var_name, old_obj->class_name, n->fn_name);
+        src = ir_compile_new(n, st, prog, 0, &val);
+    } else {
+        ValueType t = expr_runtime_type(n->expr, st);
+        if (t != VAL_OBJECT)
+            diag_emit(n->loc, DIAG_ERROR, "type mismatch: variable '%s' has type '%s', cannot assign '%s'",
+                      n->var_name, value_type_name(VAL_OBJECT), value_type_name(t));
+        val = expr_is_runtime(n->expr, st) ? ir_shadow_value(n->expr, st) : eval_expr(n->expr, st);
+        if (!val.obj_val || strcmp(val.obj_val->class_name, old_obj->class_name) != 0)
+            diag_emit(n->loc, DIAG_ERROR, "type mismatch: variable '%s' has class '%s', cannot assign '%s'",
+                      n->var_name, old_obj->class_name,
+                      val.obj_val ? val.obj_val->class_name : value_type_name(t));
+        src = ir_compile_owned_object(n->expr, st, prog);
     }
-    case EXPR_BINARY:
-        if (expr->as.binary.op >= BINOP_EQ && expr->as.binary.op <= BINOP_LE)
-            return VAL_BOOL;
-        if (expr->as.binary.op == BINOP_AND || expr->as.binary.op == BINOP_OR)
-            return VAL_BOOL;
-        return expr_runtime_type(expr->as.binary.left, st);
-    case EXPR_UNARY:
-        return expr_runtime_type(expr->as.unary.operand, st);
-    default:
-        return VAL_INT;
+    int old = ir_emit_load(prog, sym->slot);
+    ir_emit_store(prog, sym->slot, src);
+    ir_emit_obj_release(prog, old);
+
+    sym->guessed = !exact || (n->expr && expr_is_guessed(n->expr, st));
+    if (!exact) {
+        old_obj->guessed = 1;
+        val.obj_val->guessed = 1;
     }
+    sym->val = val;
+    sym->mutated = 1;
 }
 
-static char *eval_to_string(EvalResult *r, int *out_len);
 static EvalResult evaluate_fn_call(FnTable *ft, ClassTable *ct, SymTable *outer_st,
                                    const char *fn_name, SourceLoc call_loc,
                                    int arg_count,
@@ -675,6 +2723,16 @@ static EvalResult eval_binary(BinOpKind op, EvalResult lhs, EvalResult rhs, Sour
             return r;
         }
 
+        /* Map comparison (== and != only, identity like channels) */
+        if (lhs.type == VAL_MAP && rhs.type == VAL_MAP) {
+            if (op != BINOP_EQ && op != BINOP_NE)
+                diag_emit(loc, DIAG_ERROR, "only == and != are supported for maps");
+            int equal = (lhs.map_val == rhs.map_val);
+            r.type = VAL_BOOL;
+            r.bool_val = (op == BINOP_EQ) ? equal : !equal;
+            return r;
+        }
+
         /* Type promotion for comparisons: int op float → float */
         if ((lhs.type == VAL_INT && rhs.type == VAL_FLOAT) ||
             (lhs.type == VAL_FLOAT && rhs.type == VAL_INT)) {
@@ -1032,6 +3090,10 @@ static EvalResult eval_expr(Expr *expr, SymTable *st) {
             r.chan_val = ch;
             return r;
         }
+        case EXPR_MAP_LIT:
+            r.type = VAL_MAP;
+            r.map_val = map_data_new(expr->as.map_lit.key_type, expr->as.map_lit.value_type);
+            return r;
         case EXPR_FN_CALL: {
             int argc = expr->as.fn_call.arg_count;
 
@@ -1091,7 +3153,8 @@ static char *eval_to_string(EvalResult *r, int *out_len) {
                 return s;
             }
         case VAL_FLOAT:
-            *out_len = snprintf(buf, sizeof(buf), "%g", r->float_val);
+            *out_len = ir_format_float(r->float_val, buf);
+            buf[*out_len] = '\0';
             {
                 char *s = malloc(*out_len + 1);
                 memcpy(s, buf, *out_len + 1);
@@ -1182,6 +3245,35 @@ static char *eval_to_string(EvalResult *r, int *out_len) {
                 memcpy(s, str, *out_len + 1);
                 return s;
             }
+        case VAL_MAP: {
+            /* {key: value, ...} in insertion order */
+            int cap = 256;
+            char *s = malloc(cap);
+            int pos = 0;
+            s[pos++] = '{';
+            for (int i = 0; r->map_val && i < r->map_val->count; i++) {
+                int klen, vlen;
+                char *kstr = eval_to_string(&r->map_val->keys[i], &klen);
+                char *vstr = eval_to_string(&r->map_val->values[i], &vlen);
+                while (pos + klen + vlen + 6 >= cap) { cap *= 2; s = realloc(s, cap); }
+                if (i > 0) {
+                    s[pos++] = ',';
+                    s[pos++] = ' ';
+                }
+                memcpy(s + pos, kstr, klen);
+                pos += klen;
+                s[pos++] = ':';
+                s[pos++] = ' ';
+                memcpy(s + pos, vstr, vlen);
+                pos += vlen;
+                free(kstr);
+                free(vstr);
+            }
+            s[pos++] = '}';
+            s[pos] = '\0';
+            *out_len = pos;
+            return s;
+        }
         default:
             *out_len = 0;
             return malloc(1);
@@ -1293,6 +3385,7 @@ static EvalResult eval_new_expr(ASTNode *n, SymTable *st, ClassTable *ct) {
     /* Match args to class fields (same logic as fn call: positional then named) */
     ObjData *obj = malloc(sizeof(ObjData));
     obj->class_name = cls->name;
+    obj->guessed = 0;
     obj->field_count = cls->field_count;
     obj->field_names = cls->field_names;
     obj->field_values = malloc(cls->field_count * sizeof(EvalResult));
@@ -1491,21 +3584,807 @@ static EvalResult evaluate_method_call(ASTNode *n, SymTable *st, FnTable *ft,
     return result;
 }
 
-/* ================================================================
- * eval_stmts — unified statement evaluator with block scoping
- * ================================================================ */
+/* ================================================================
+ * eval_stmts — unified statement evaluator with block scoping
+ * ================================================================ */
+
+/* ================================================================
+ * Flush pending compile-time prints to IR
+ * ================================================================ */
+
+static void flush_prints_to_ir(PrintList *prints) {
+    if (!g_ir_mode && g_ir) {
+        for (int pi = 0; pi < prints->count; pi++) {
+            ir_emit_print_str(g_ir, prints->strings[pi], prints->lengths[pi]);
+        }
+        g_ir_mode = 1;
+    }
+}
+
+/* An empty array literal has no element type of its own; a variable
+ * declared as Array<T> gives it one */
+static EvalResult array_declared_as(EvalResult val, ValueType elem_type) {
+    if (val.type != VAL_ARRAY || elem_type == VAL_VOID) return val;
+    if (val.arr_val && val.arr_val->elem_type != VAL_VOID) return val;
+    ArrayData *a = calloc(1, sizeof(ArrayData));
+    if (val.arr_val) *a = *val.arr_val;
+    a->elem_type = elem_type;
+    val.arr_val = a;
+    return val;
+}
+
+/* Check if a variable holding val can have a slot: an int, float, bool
+ * or string, an array of ints, bools or floats, a Map of int or bool keys
+ * and values, or an object of int, bool and float fields */
+static int ir_slot_value(EvalResult val) {
+    if (val.type == VAL_INT || val.type == VAL_FLOAT || val.type == VAL_BOOL ||
+        val.type == VAL_STRING)
+        return 1;
+    if (val.type == VAL_OBJECT)
+        return val.obj_val && ir_class_ok(class_table_find(g_ct, val.obj_val->class_name));
+    if (val.type == VAL_MAP)
+        return val.map_val && ir_map_type_ok(val.map_val->key_type, val.map_val->value_type);
+    return val.type == VAL_ARRAY && val.arr_val &&
+           (val.arr_val->elem_type == VAL_INT || val.arr_val->elem_type == VAL_BOOL ||
+            val.arr_val->elem_type == VAL_FLOAT);
+}
+
+/* Assign n->expr to element n->index_expr of array variable n->var_name.
+ * The variable's compile-time array is replaced by a copy with the
+ * element changed.  One with a slot has the element stored at runtime
+ * as well, its copy only changed when the index is known and in range
+ * of it. */
+static void assign_element(ASTNode *n, SymTable *st, IRProgram *prog) {
+    Symbol *sym = sym_find(st, n->var_name);
+    if (!sym) diag_emit(n->loc, DIAG_ERROR, "undefined variable '%s'", n->var_name);
+    if (sym->is_const)
+        diag_emit(n->loc, DIAG_ERROR, "cannot assign elements of const variable '%s'", n->var_name);
+    if (sym->val.type != VAL_ARRAY)
+        diag_emit(n->loc, DIAG_ERROR, "cannot assign an element of '%s': it is a '%s', not an array",
+                  n->var_name, value_type_name(sym->val.type));
+    if (expr_runtime_type(n->index_expr, st) != VAL_INT)
+        diag_emit(n->loc, DIAG_ERROR, "array index must be an int, got '%s'",
+                  value_type_name(expr_runtime_type(n->index_expr, st)));
+    int rt_index = expr_is_runtime(n->index_expr, st);
+    int rt_value = expr_is_runtime(n->expr, st);
+    if (!sym->has_slot && (rt_index || rt_value))
+        diag_emit(n->loc, DIAG_ERROR,
+                  "assigning a runtime value or index into '%s' requires an Array<int>, Array<bool> or Array<float> variable",
+                  n->var_name);
+
+    ArrayData *old = sym->val.arr_val;
+    int count = old ? old->count : 0;
+    EvalResult val = rt_value ? ir_shadow_value(n->expr, st) : eval_expr(n->expr, st);
+    if (old && old->elem_type != VAL_VOID && val.type != old->elem_type)
+        diag_emit(n->loc, DIAG_ERROR, "type mismatch: elements of '%s' have type '%s', cannot assign '%s'",
+                  n->var_name, value_type_name(old->elem_type), value_type_name(val.type));
+    sym->mutated = 1;
+
+    if (sym->has_slot) {
+        if (!sym_in_ir_frame(st, n->var_name))
+            diag_emit(n->loc, DIAG_ERROR,
+                      "function '%s' cannot assign runtime variable '%s' from an enclosing scope",
+                      g_ir_frame_fn->fn_name, n->var_name);
+        int arr = ir_emit_load(prog, sym->slot);
+        int index = ir_compile_expr(n->index_expr, st, prog);
+        ir_emit_arr_store(prog, arr, index, ir_compile_expr(n->expr, st, prog));
+        if (expr_is_guessed(n->expr, st)) sym->guessed = 1;
+        if (expr_is_guessed(n->index_expr, st)) {
+            sym->guessed = 1;
+            return;
+        }
+    }
+
+    long idx = eval_expr(n->index_expr, st).int_val;
+    long i = idx < 0 ? idx + count : idx;
+    if (i < 0 || i >= count) {
+        if (sym->has_slot) return;
+        diag_emit(n->loc, DIAG_ERROR, "array index %ld out of range (length %d)", idx, count);
+    }
+    ArrayData *arr = malloc(sizeof(ArrayData));
+    arr->count = count;
+    arr->elem_type = old->elem_type;
+    arr->elements = malloc(count * sizeof(EvalResult));
+    memcpy(arr->elements, old->elements, count * sizeof(EvalResult));
+    arr->elements[i] = val;
+    sym->val.arr_val = arr;
+}
+
+/* The value a slot variable holds once assigned val: an array keeps
+ * its element type, which val must agree with unless it is empty, and
+ * a map its key and value types */
+static EvalResult ir_slot_assigned(ASTNode *n, Symbol *sym, EvalResult val) {
+    if (val.type == VAL_MAP) {
+        MapData *m = sym->val.map_val;
+        if (val.map_val->key_type != m->key_type || val.map_val->value_type != m->value_type)
+            diag_emit(n->loc, DIAG_ERROR, "type mismatch: variable '%s' has type 'Map<%s, %s>', cannot assign 'Map<%s, %s>'",
+                      n->var_name, value_type_name(m->key_type), value_type_name(m->value_type),
+                      value_type_name(val.map_val->key_type), value_type_name(val.map_val->value_type));
+        return val;
+    }
+    if (val.type != VAL_ARRAY) return val;
+    ValueType et = sym->val.arr_val->elem_type;
+    if (val.arr_val && val.arr_val->elem_type != VAL_VOID && val.arr_val->elem_type != et)
+        diag_emit(n->loc, DIAG_ERROR, "type mismatch: variable '%s' has type 'Array<%s>', cannot assign 'Array<%s>'",
+                  n->var_name, value_type_name(et), value_type_name(val.arr_val->elem_type));
+    return array_declared_as(val, et);
+}
+
+/* Store the value of assignment n, whose target has a slot.  A string,
+ * array or map variable's old value is released once the new one is
+ * stored, unless the new one took it over. */
+static void ir_compile_assign(ASTNode *n, Symbol *sym, SymTable *st, IRProgram *prog) {
+    EvalResult val = sym->val;
+    int runtime = n->expr && expr_is_runtime(n->expr, st);
+    if (val.type == VAL_STRING) {
+        int replaced = 1;
+        int old = ir_emit_load(prog, sym->slot);
+        int src = runtime ? ir_compile_string_update(n->expr, st, prog, n->var_name, &replaced)
+                          : ir_emit_const_str(prog, val.str_val, val.str_len);
+        ir_emit_store(prog, sym->slot, src);
+        if (replaced) ir_emit_str_release(prog, old);
+        return;
+    }
+    if (val.type == VAL_ARRAY) {
+        int replaced = 1;
+        int old = ir_emit_load(prog, sym->slot);
+        int src = runtime ? ir_compile_array_update(n->expr, st, prog, n->var_name, &replaced)
+                          : ir_emit_unop(prog, IR_ARR_COPY,
+                                         ir_emit_const_arr(prog, ir_array_table(prog, val.arr_val)));
+        ir_emit_store(prog, sym->slot, src);
+        if (replaced) ir_emit_arr_release(prog, old);
+        return;
+    }
+    if (val.type == VAL_MAP) {
+        int old = ir_emit_load(prog, sym->slot);
+        int src = runtime ? ir_compile_owned_map(n->expr, st, prog)
+                          : ir_compile_map_const(prog, val.map_val);
+        ir_emit_store(prog, sym->slot, src);
+        ir_emit_map_release(prog, old);
+        return;
+    }
+    int src;
+    if (runtime) {
+        src = ir_compile_expr(n->expr, st, prog);
+    } else {
+        src = ir_emit_const_int(prog, ir_value_bits(&val));
+    }
+    ir_emit_store(prog, sym->slot, src);
+}
+
+/* Print the value of a runtime expression */
+static void ir_compile_print(Expr *expr, SymTable *st, IRProgram *prog) {
+    ValueType rt = expr_runtime_type(expr, st);
+    if (rt == VAL_STRING) {
+        int fresh;
+        int str = ir_compile_string(expr, st, prog, NULL, &fresh);
+        ir_emit_print_str_val(prog, str);
+        if (fresh) ir_emit_str_release(prog, str);
+    } else if (rt == VAL_ARRAY) {
+        ir_compile_print_array(expr, st, prog);
+    } else if (rt == VAL_MAP) {
+        ir_compile_print_map(expr, st, prog);
+    } else if (rt == VAL_OBJECT) {
+        ir_compile_print_object(expr, st, prog);
+    } else if (rt == VAL_BOOL) {
+        ir_emit_print_bool(prog, ir_compile_expr(expr, st, prog));
+    } else if (rt == VAL_FLOAT) {
+        ir_emit_print_float(prog, ir_compile_expr(expr, st, prog));
+    } else {
+        ir_emit_print_int(prog, ir_compile_expr(expr, st, prog));
+    }
+}
+
+/* ================================================================
+ * Runtime functions — user fns called with runtime arguments
+ *
+ * evaluate_fn_call can only run a function on compile-time values.
+ * When an argument depends on a slot variable the callee is instead
+ * compiled once into an out-of-line IR function (IR_FUNC, IR_PARAM
+ * stores, body, IR_RET) and each call site becomes IR_ARGs plus an
+ * IR_CALL.  Bodies are compiled into side buffers, resolved against
+ * the global scope, and appended after main's IR_EXIT by
+ * ir_functions_finish.
+ *
+ * A method of a runtime object is compiled the same way, once per
+ * class it is called on, taking the object as a hidden first
+ * parameter.  Its fields are variables of the method, read from the
+ * object on entry and written back before each return.
+ * ================================================================ */
+
+typedef struct {
+    ASTNode *decl;
+    ClassDef *self_cls; /* class of the receiver of a method, else NULL */
+    int entry_label;
+    IRInstr *instrs;    /* compiled body (NULL while still compiling) */
+    int instr_count;
+} IRFunction;
+
+static IRFunction *g_ir_fns = NULL;
+static int g_ir_fn_count = 0;
+static int g_ir_fn_cap = 0;
+
+static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
+                              int break_label, int continue_label);
+
+/* Check that every path through stmts ends in a return */
+static int ir_stmts_always_return(ASTNode *stmts) {
+    for (ASTNode *n = stmts; n; n = n->next) {
+        if (n->type == NODE_RETURN)
+            return 1;
+        if (n->type == NODE_BLOCK && ir_stmts_always_return(n->body))
+            return 1;
+        if (n->type == NODE_IF_STMT) {
+            ASTNode *branch = n;
+            int all = 1;
+            while (branch && branch->type == NODE_IF_STMT && branch->if_cond) {
+                if (!ir_stmts_always_return(branch->if_body)) all = 0;
+                branch = branch->else_body;
+            }
+            if (all && branch && ir_stmts_always_return(branch))
+                return 1;
+        }
+        if (n->type == NODE_MATCH_STMT) {
+            int all = 1, has_wildcard = 0;
+            for (int a = 0; a < n->match_arm_count; a++) {
+                if (n->match_arms[a].is_wildcard) has_wildcard = 1;
+                if (!ir_stmts_always_return(n->match_arms[a].body)) all = 0;
+            }
+            if (all && has_wildcard)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Check if a parameter or return type can be passed at runtime */
+static int ir_fn_type_ok(ValueType t, ValueType elem_type, ValueType key_type,
+                         const char *class_name) {
+    if (t == VAL_OBJECT) {
+        ClassDef *cls = class_name ? class_table_find(g_ct, class_name) : NULL;
+        return cls && ir_class_ok(cls);
+    }
+    return t == VAL_INT || t == VAL_FLOAT || t == VAL_BOOL || t == VAL_STRING ||
+           (t == VAL_ARRAY && (elem_type == VAL_INT || elem_type == VAL_BOOL ||
+                               elem_type == VAL_FLOAT)) ||
+           (t == VAL_MAP && ir_map_type_ok(key_type, elem_type));
+}
+
+/* Write the fields of the receiver of the method being compiled back
+ * to it, before the method returns */
+static void ir_store_self(IRProgram *prog) {
+    if (!g_ir_self_cls) return;
+    int self = ir_emit_load(prog, g_ir_self_slot);
+    for (int f = 0; f < g_ir_self_cls->field_count; f++) {
+        Symbol *field = &g_ir_self_scope->syms[sym_lookup(g_ir_self_scope, g_ir_self_cls->field_names[f])];
+        ir_emit_obj_store(prog, self, ir_field_offset(f), ir_emit_load(prog, field->slot));
+    }
+}
+
+/* Return the entry label of decl's out-of-line function, compiling it
+ * on first use; self_cls is the receiver's class when decl is a method.
+ * The entry is registered before the body is compiled so recursive
+ * calls resolve to the same label. */
+static int ir_function_label(ASTNode *decl, ClassDef *self_cls, SymTable *caller_st,
+                             SourceLoc call_loc, IRProgram *prog) {
+    for (int i = 0; i < g_ir_fn_count; i++) {
+        if (g_ir_fns[i].decl == decl && g_ir_fns[i].self_cls == self_cls)
+            return g_ir_fns[i].entry_label;
+    }
+
+    for (int p = 0; p < decl->param_count; p++) {
+        FnParam *param = &decl->params[p];
+        if (!ir_fn_type_ok(param->type, param->array_elem_type, param->map_key_type,
+                           param->class_type_name))
+            diag_emit(call_loc, DIAG_ERROR,
+                      "cannot call '%s' with runtime arguments: parameter '%s' has type '%s' (only int, float, bool, string, Array<int>, Array<bool>, Array<float>, Maps of int and bool and objects of int, bool and float fields are supported)",
+                      decl->fn_name, param->name,
+                      param->type == VAL_OBJECT && param->class_type_name ? param->class_type_name
+                                                                           : value_type_name(param->type));
+        if (self_cls && ir_class_field(self_cls, param->name) >= 0)
+            diag_emit(call_loc, DIAG_ERROR,
+                      "cannot call method '%s' at runtime: parameter '%s' has the name of a field of class '%s'",
+                      decl->fn_name, param->name, self_cls->name);
+    }
+    if (decl->has_return_type) {
+        ValueType rt = decl->return_type;
+        if (!ir_fn_type_ok(rt, decl->return_array_elem_type, decl->return_map_key_type,
+                           decl->return_class_name))
+            diag_emit(call_loc, DIAG_ERROR,
+                      "cannot call '%s' with runtime arguments: return type '%s' is not int, bool, string, Array<int>, Array<bool>, a Map of int and bool or an object of int and bool fields",
+                      decl->fn_name,
+                      rt == VAL_OBJECT && decl->return_class_name ? decl->return_class_name
+                                                                  : value_type_name(rt));
+        if (!ir_stmts_always_return(decl->body))
+            diag_emit(decl->loc, DIAG_ERROR, "function '%s' must return a value of type '%s' on every path",
+                      decl->fn_name, value_type_name(decl->return_type));
+    }
+
+    if (g_ir_fn_count == g_ir_fn_cap) {
+        g_ir_fn_cap = g_ir_fn_cap ? g_ir_fn_cap * 2 : 8;
+        g_ir_fns = realloc(g_ir_fns, g_ir_fn_cap * sizeof(IRFunction));
+    }
+    int idx = g_ir_fn_count++;
+    int label = ir_alloc_label(prog);
+    g_ir_fns[idx].decl = decl;
+    g_ir_fns[idx].self_cls = self_cls;
+    g_ir_fns[idx].entry_label = label;
+    g_ir_fns[idx].instrs = NULL;
+    g_ir_fns[idx].instr_count = 0;
+
+    /* Switch prog to a fresh instruction buffer for the body */
+    IRInstr *saved_instrs = prog->instrs;
+    int saved_count = prog->instr_count;
+    int saved_cap = prog->instr_cap;
+    ASTNode *saved_decl = g_ir_fn_decl;
+    ASTNode *saved_frame = g_ir_frame_fn;
+    SymTable *saved_scope = g_ir_fn_scope;
+    SymTable *saved_loop_scope = g_ir_loop_scope;
+    SymTable *saved_self_scope = g_ir_self_scope;
+    ClassDef *saved_self_cls = g_ir_self_cls;
+    int saved_self_slot = g_ir_self_slot;
+    prog->instr_cap = 64;
+    prog->instr_count = 0;
+    prog->instrs = malloc(prog->instr_cap * sizeof(IRInstr));
+
+    SymTable *global_st = caller_st;
+    while (global_st->parent) global_st = global_st->parent;
+    SymTable fn_st;
+    sym_table_init(&fn_st);
+    fn_st.parent = global_st;
+    g_ir_fn_decl = decl;
+    g_ir_frame_fn = decl;
+    g_ir_fn_scope = &fn_st;
+    g_ir_loop_scope = NULL;
+    g_ir_self_scope = self_cls ? &fn_st : NULL;
+    g_ir_self_cls = self_cls;
+
+    int first_param = self_cls ? 1 : 0;
+    ir_emit_func(prog, label, first_param + decl->param_count);
+    if (self_cls) {
+        g_ir_self_slot = ir_alloc_slot(prog);
+        ir_emit_store(prog, g_ir_self_slot, ir_emit_param(prog, 0));
+    }
+    for (int p = 0; p < decl->param_count; p++) {
+        EvalResult pv;
+        memset(&pv, 0, sizeof(pv));
+        pv.type = decl->params[p].type;
+        if (pv.type == VAL_ARRAY) {
+            pv.arr_val = calloc(1, sizeof(ArrayData));
+            pv.arr_val->elem_type = decl->params[p].array_elem_type;
+        } else if (pv.type == VAL_MAP) {
+            pv.map_val = map_data_new(decl->params[p].map_key_type, decl->params[p].array_elem_type);
+            pv.map_val->guessed = 1;
+        } else if (pv.type == VAL_OBJECT) {
+            pv.obj_val = ir_object_shadow(class_table_find(g_ct, decl->params[p].class_type_name));
+        }
+        sym_add(&fn_st, decl->params[p].name, pv, 1, decl->loc);
+        int slot = ir_alloc_slot(prog);
+        fn_st.syms[fn_st.count - 1].has_slot = 1;
+        fn_st.syms[fn_st.count - 1].slot = slot;
+        fn_st.syms[fn_st.count - 1].guessed = 1;
+        ir_emit_store(prog, slot, ir_emit_param(prog, first_param + p));
+    }
+    /* The receiver's fields follow the parameters */
+    for (int f = 0; self_cls && f < self_cls->field_count; f++) {
+        EvalResult fv;
+        memset(&fv, 0, sizeof(fv));
+        fv.type = self_cls->field_types[f];
+        sym_add(&fn_st, self_cls->field_names[f], fv, 0, decl->loc);
+        int slot = ir_alloc_slot(prog);
+        fn_st.syms[fn_st.count - 1].has_slot = 1;
+        fn_st.syms[fn_st.count - 1].slot = slot;
+        fn_st.syms[fn_st.count - 1].guessed = 1;
+        ir_emit_store(prog, slot, ir_emit_obj_load(prog, ir_emit_load(prog, g_ir_self_slot),
+                                                   ir_field_offset(f)));
+    }
+
+    IRFrozen frozen;
+    ir_freeze_objects(global_st, &frozen);
+    ir_compile_stmts(decl->body, &fn_st, prog, -1, -1);
+    ir_check_frozen(&frozen, decl->loc, "in a function called at runtime");
+    if (!decl->has_return_type) {
+        ir_store_self(prog);
+        ir_release_vars(&fn_st, global_st, prog);
+        ir_emit_ret(prog, -1);
+    }
+
+    sym_table_free(&fn_st);
+    g_ir_fns[idx].instrs = prog->instrs;
+    g_ir_fns[idx].instr_count = prog->instr_count;
+
+    prog->instrs = saved_instrs;
+    prog->instr_count = saved_count;
+    prog->instr_cap = saved_cap;
+    g_ir_fn_decl = saved_decl;
+    g_ir_frame_fn = saved_frame;
+    g_ir_fn_scope = saved_scope;
+    g_ir_loop_scope = saved_loop_scope;
+    g_ir_self_scope = saved_self_scope;
+    g_ir_self_cls = saved_self_cls;
+    g_ir_self_slot = saved_self_slot;
+    return label;
+}
+
+/* Compile a call to decl with runtime arguments: bind args to
+ * parameters (positional, then named, then defaults), emit IR_ARG for
+ * each and an IR_CALL.  A method (self_cls set) gets the object self
+ * as its first argument.  Returns the result vreg, or -1 for a void
+ * call when !require_value. */
+static int ir_compile_call_decl(ASTNode *decl, ClassDef *self_cls, int self, SourceLoc loc,
+                                Expr **args, char **arg_names, int arg_count, SymTable *st,
+                                IRProgram *prog, int require_value) {
+    const char *fn_name = decl->fn_name;
+    const char *what = self_cls ? "method" : "function";
+
+    if (require_value && !decl->has_return_type)
+        diag_emit(loc, DIAG_ERROR, "cannot use void function result");
+    if (arg_count > decl->param_count)
+        diag_emit(loc, DIAG_ERROR, "%s '%s' expects at most %d argument(s), got %d",
+                  what, fn_name, decl->param_count, arg_count);
+
+    /* Anything printed so far at compile time precedes the call's output */
+    flush_prints_to_ir(g_prints);
+
+    int label = ir_function_label(decl, self_cls, st, loc, prog);
+
+    int n_params = decl->param_count > 0 ? decl->param_count : 1;
+    Expr **bound = calloc(n_params, sizeof(Expr *));
+    int *arg_vregs = malloc(n_params * sizeof(int));
+    char *arg_fresh = calloc(n_params, 1);
+    int pos_idx = 0;
+    for (int i = 0; i < arg_count; i++) {
+        int p = -1;
+        if (arg_names && arg_names[i]) {
+            for (int q = 0; q < decl->param_count; q++) {
+                if (strcmp(arg_names[i], decl->params[q].name) == 0) { p = q; break; }
+            }
+            if (p < 0)
+                diag_emit(loc, DIAG_ERROR, "unknown parameter '%s' in %s '%s'", arg_names[i], what, fn_name);
+            if (bound[p])
+                diag_emit(loc, DIAG_ERROR, "duplicate argument for parameter '%s' in %s '%s'",
+                          arg_names[i], what, fn_name);
+        } else {
+            p = pos_idx++;
+        }
+        bound[p] = args[i];
+    }
+
+    for (int p = 0; p < decl->param_count; p++) {
+        FnParam *param = &decl->params[p];
+        ValueType at;
+        if (!bound[p]) {
+            if (!param->has_default)
+                diag_emit(loc, DIAG_ERROR, "missing argument for required parameter '%s' in %s '%s'",
+                          param->name, what, fn_name);
+            at = param->type;
+            if (param->type == VAL_ARRAY || param->type == VAL_MAP)
+                diag_emit(loc, DIAG_ERROR, "cannot call '%s' with runtime arguments: parameter '%s' has %s default",
+                          fn_name, param->name, param->type == VAL_MAP ? "a map" : "an array");
+            if (param->type == VAL_STRING) {
+                arg_vregs[p] = ir_emit_const_str(prog, param->default_value, param->default_value_len);
+            } else {
+                EvalResult dv;
+                memset(&dv, 0, sizeof(dv));
+                dv.type = param->type;
+                if (param->type == VAL_BOOL) dv.bool_val = strcmp(param->default_value, "true") == 0;
+                else if (param->type == VAL_FLOAT) dv.float_val = atof(param->default_value);
+                else dv.int_val = atol(param->default_value);
+                arg_vregs[p] = ir_emit_const_int(prog, ir_value_bits(&dv));
+            }
+        } else if (expr_is_runtime(bound[p], st) || param->type == VAL_ARRAY ||
+                   param->type == VAL_MAP || param->type == VAL_OBJECT) {
+            at = expr_is_runtime(bound[p], st) || param->type != VAL_OBJECT
+               ? expr_runtime_type(bound[p], st) : eval_expr(bound[p], st).type;
+            int fresh = 0;
+            if (at == VAL_STRING)
+                arg_vregs[p] = ir_compile_string(bound[p], st, prog, NULL, &fresh);
+            else if (at == VAL_ARRAY && param->type == VAL_ARRAY)
+                arg_vregs[p] = ir_compile_array(bound[p], st, prog, NULL, &fresh);
+            else if (at == VAL_MAP && param->type == VAL_MAP)
+                arg_vregs[p] = ir_compile_map(bound[p], st, prog, &fresh);
+            else if (at == VAL_OBJECT && param->type == VAL_OBJECT)
+                arg_vregs[p] = ir_compile_object(bound[p], st, prog, &fresh);
+            else
+                arg_vregs[p] = ir_compile_expr(bound[p], st, prog);
+            arg_fresh[p] = (char)fresh;
+            ValueType et = at == VAL_ARRAY ? ir_array_elem_type(bound[p], st) : VAL_VOID;
+            if (at == param->type && et != VAL_VOID && et != param->array_elem_type)
+                diag_emit(loc, DIAG_ERROR, "%s '%s' parameter '%s' expects 'Array<%s>', got 'Array<%s>'",
+                          what, fn_name, param->name, value_type_name(param->array_elem_type),
+                          value_type_name(et));
+            if (at == VAL_MAP && param->type == VAL_MAP) {
+                ValueType kt, vt;
+                ir_map_types(bound[p], st, &kt, &vt);
+                if (kt != param->map_key_type || vt != param->array_elem_type)
+                    diag_emit(loc, DIAG_ERROR, "%s '%s' parameter '%s' expects 'Map<%s, %s>', got 'Map<%s, %s>'",
+                              what, fn_name, param->name, value_type_name(param->map_key_type),
+                              value_type_name(param->array_elem_type),
+                              value_type_name(kt), value_type_name(vt));
+                /* The callee may change the map's entries */
+                if (bound[p]->kind == EXPR_VAR_REF)
+                    sym_find(st, bound[p]->as.var_ref.name)->val.map_val->guessed = 1;
+            }
+            if (at == VAL_OBJECT && param->type == VAL_OBJECT) {
+                ClassDef *cls = expr_is_runtime(bound[p], st) ? ir_object_class(bound[p], st)
+                              : class_table_find(g_ct, eval_expr(bound[p], st).obj_val->class_name);
+                if (strcmp(cls->name, param->class_type_name) != 0)
+                    diag_emit(loc, DIAG_ERROR, "%s '%s' parameter '%s' expects '%s', got '%s'",
+                              what, fn_name, param->name, param->class_type_name, cls->name);
+                /* The callee may change the object's fields */
+                if (bound[p]->kind == EXPR_VAR_REF)
+                    sym_find(st, bound[p]->as.var_ref.name)->val.obj_val->guessed = 1;
+            }
+        } else {
+            EvalResult r = eval_expr(bound[p], st);
+            at = r.type;
+            if (r.type == VAL_STRING)
+                arg_vregs[p] = ir_emit_const_str(prog, r.str_val, r.str_len);
+            else
+                arg_vregs[p] = ir_emit_const_int(prog, ir_value_bits(&r));
+        }
+        if (at != param->type)
+            diag_emit(loc, DIAG_ERROR, "%s '%s' parameter '%s' expects '%s', got '%s'",
+                      what, fn_name, param->name, value_type_name(param->type), value_type_name(at));
+    }
+
+    int first_arg = self_cls ? 1 : 0;
+    if (self_cls) ir_emit_arg(prog, 0, self);
+    for (int p = 0; p < decl->param_count; p++)
+        ir_emit_arg(prog, first_arg + p, arg_vregs[p]);
+    int dst = ir_emit_call(prog, label, first_arg + decl->param_count, decl->has_return_type);
+    for (int p = 0; p < decl->param_count; p++) {
+        if (!arg_fresh[p]) continue;
+        if (decl->params[p].type == VAL_ARRAY) ir_emit_arr_release(prog, arg_vregs[p]);
+        else if (decl->params[p].type == VAL_MAP) ir_emit_map_release(prog, arg_vregs[p]);
+        else if (decl->params[p].type == VAL_OBJECT) ir_emit_obj_release(prog, arg_vregs[p]);
+        else ir_emit_str_release(prog, arg_vregs[p]);
+    }
+    if (!require_value && decl->has_return_type && decl->return_type == VAL_STRING)
+        ir_emit_str_release(prog, dst);
+    if (!require_value && decl->has_return_type && decl->return_type == VAL_ARRAY)
+        ir_emit_arr_release(prog, dst);
+    if (!require_value && decl->has_return_type && decl->return_type == VAL_MAP)
+        ir_emit_map_release(prog, dst);
+    if (!require_value && decl->has_return_type && decl->return_type == VAL_OBJECT)
+        ir_emit_obj_release(prog, dst);
+
+    free(arg_fresh);
+    free(bound);
+    free(arg_vregs);
+    return dst;
+}
+
+/* Compile a call to user function fn_name with runtime arguments */
+static int ir_compile_call(const char *fn_name, SourceLoc loc, Expr **args,
+                           char **arg_names, int arg_count, SymTable *st,
+                           IRProgram *prog, int require_value) {
+    return ir_compile_call_decl(fn_table_find(g_ft, fn_name)->decl, NULL, -1, loc, args, arg_names,
+                                arg_count, st, prog, require_value);
+}
+
+/* Compile a call to method fn_name of the runtime object held by
+ * variable obj_name.  The method may change the object's fields, which
+ * become a guess. */
+static int ir_compile_method_call(const char *obj_name, const char *fn_name, SourceLoc loc,
+                                  Expr **args, char **arg_names, int arg_count, SymTable *st,
+                                  IRProgram *prog, int require_value) {
+    Symbol *sym = sym_find(st, obj_name);
+    ObjData *obj = sym->val.obj_val;
+    ClassDef *cls = class_table_find(g_ct, obj->class_name);
+    ASTNode *decl = ir_find_method(cls, fn_name);
+    if (!decl)
+        diag_emit(loc, DIAG_ERROR, "no method '%s' on class '%s'", fn_name, obj->class_name);
+    if (!sym_in_ir_frame(st, obj_name))
+        diag_emit(loc, DIAG_ERROR,
+                  "function '%s' cannot read runtime variable '%s' from an enclosing scope; pass it as a parameter",
+                  g_ir_frame_fn->fn_name, obj_name);
+    int self = ir_emit_load(prog, sym->slot);
+    int dst = ir_compile_call_decl(decl, cls, self, loc, args, arg_names, arg_count, st, prog,
+                                   require_value);
+    obj->guessed = 1;
+    sym->mutated = 1;
+    return dst;
+}
+
+/* Compile a call expression to a user function or a method of a
+ * runtime object */
+static int ir_compile_user_call(Expr *expr, SymTable *st, IRProgram *prog, int require_value) {
+    if (expr->as.fn_call.obj_name)
+        return ir_compile_method_call(expr->as.fn_call.obj_name, expr->as.fn_call.fn_name,
+                                      expr->loc, expr->as.fn_call.args,
+                                      expr->as.fn_call.arg_names, expr->as.fn_call.arg_count,
+                                      st, prog, require_value);
+    return ir_compile_call(expr->as.fn_call.fn_name, expr->loc, expr->as.fn_call.args,
+                           expr->as.fn_call.arg_names, expr->as.fn_call.arg_count, st, prog,
+                           require_value);
+}
+
+/* Compile method call statement n on a runtime object.  In
+ * straight-line code (exact), on an object and arguments known at
+ * compile time, the method runs on the compile-time copy and only the
+ * fields it changed are stored; otherwise it is called at runtime. */
+static void ir_compile_method_stmt(ASTNode *n, SymTable *st, IRProgram *prog, int exact) {
+    Symbol *sym = sym_find(st, n->obj_name);
+    ObjData *obj = sym->val.obj_val;
+    int known = exact && !sym->guessed && !obj->guessed;
+    for (int i = 0; i < n->call_arg_count; i++) {
+        /* The method would change another runtime object's copy only */
+        if (expr_is_guessed(n->call_arg_exprs[i], st) ||
+            (expr_is_runtime(n->call_arg_exprs[i], st) &&
+             expr_runtime_type(n->call_arg_exprs[i], st) == VAL_OBJECT))
+            known = 0;
+    }
+    if (!known) {
+        ir_compile_method_call(n->obj_name, n->fn_name, n->loc, n->call_arg_exprs,
+                               n->call_arg_names, n->call_arg_count, st, prog, 0);
+        return;
+    }
+    EvalResult *before = malloc((obj->field_count > 0 ? obj->field_count : 1) * sizeof(EvalResult));
+    memcpy(before, obj->field_values, obj->field_count * sizeof(EvalResult));
+    (void)evaluate_method_call(n, st, g_ft, g_ct, g_prints, 0);
+    for (int f = 0; f < obj->field_count; f++) {
+        EvalResult *v = &obj->field_values[f];
+        if (v->type == before[f].type && v->int_val == before[f].int_val &&
+            v->bool_val == before[f].bool_val)
+            continue;
+        ir_emit_obj_store(prog, ir_emit_load(prog, sym->slot), ir_field_offset(f),
+                          ir_emit_const_int(prog, ir_value_bits(v)));
+    }
+    free(before);
+}
+
+/* Check if a call statement (NODE_FN_CALL) targets a user function
+ * with at least one runtime argument */
+static int ir_stmt_call_is_runtime(ASTNode *n, SymTable *st) {
+    if (!fn_table_find(g_ft, n->fn_name) || !n->call_arg_exprs)
+        return 0;
+    for (int i = 0; i < n->call_arg_count; i++) {
+        if (expr_is_runtime(n->call_arg_exprs[i], st))
+            return 1;
+    }
+    return 0;
+}
+
+/* Release the runtime function table without emitting it */
+static void ir_functions_free(void) {
+    for (int i = 0; i < g_ir_fn_count; i++)
+        free(g_ir_fns[i].instrs);
+    free(g_ir_fns);
+    g_ir_fns = NULL;
+    g_ir_fn_count = g_ir_fn_cap = 0;
+}
+
+/* Append the compiled runtime functions after the main body (which must
+ * already end in IR_EXIT) and release the function table. */
+static void ir_functions_finish(IRProgram *prog) {
+    for (int i = 0; i < g_ir_fn_count; i++) {
+        for (int j = 0; j < g_ir_fns[i].instr_count; j++)
+            ir_emit(prog, g_ir_fns[i].instrs[j]);
+    }
+    ir_functions_free();
+}
+
+/* Compile a match on a runtime scrutinee.  When every pattern is known
+ * at compile time (literals, enum variants, constants) the arms are
+ * reached through one IR_SWITCH; otherwise each arm compares in turn.
+ * As at compile time, the first arm that matches runs. */
+static void ir_compile_match(ASTNode *n, SymTable *st, IRProgram *prog,
+                             int break_label, int continue_label) {
+    int is_string = expr_runtime_type(n->match_expr, st) == VAL_STRING;
+    int is_float = expr_runtime_type(n->match_expr, st) == VAL_FLOAT;
+    int scrutinee_fresh = 0;
+    int scrutinee_vreg = is_string ? ir_compile_string(n->match_expr, st, prog, NULL, &scrutinee_fresh)
+                                   : ir_compile_expr(n->match_expr, st, prog);
+    int end_label = ir_alloc_label(prog);
+    int arm_count = n->match_arm_count;
+
+    /* Strings and floats (-0 matches 0, nan nothing) are compared arm by
+     * arm */
+    int constant = !is_string && !is_float;
+    for (int a = 0; a < arm_count && constant; a++) {
+        MatchArm *arm = &n->match_arms[a];
+        if (!arm->is_wildcard && expr_is_runtime(arm->pattern, st)) constant = 0;
+    }
+
+    int *arm_labels = malloc((arm_count > 0 ? arm_count : 1) * sizeof(int));
+    for (int a = 0; a < arm_count; a++) arm_labels[a] = ir_alloc_label(prog);
+
+    if (constant) {
+        /* Arms after a wildcard and repeated patterns never match */
+        int64_t *values = malloc((arm_count > 0 ? arm_count : 1) * sizeof(int64_t));
+        int *labels = malloc((arm_count > 0 ? arm_count : 1) * sizeof(int));
+        int count = 0, default_label = end_label;
+        for (int a = 0; a < arm_count; a++) {
+            MatchArm *arm = &n->match_arms[a];
+            if (arm->is_wildcard) {
+                default_label = arm_labels[a];
+                break;
+            }
+            EvalResult pat = eval_expr(arm->pattern, st);
+            int64_t v = pat.type == VAL_BOOL ? (int64_t)pat.bool_val : pat.int_val;
+            int seen = 0;
+            for (int k = 0; k < count; k++)
+                if (values[k] == v) seen = 1;
+            if (seen) continue;
+            values[count] = v;
+            labels[count++] = arm_labels[a];
+        }
+        ir_emit_switch(prog, scrutinee_vreg, values, labels, count, default_label);
+        free(labels);
+        free(values);
+    }
+
+    for (int a = 0; a < arm_count; a++) {
+        MatchArm *arm = &n->match_arms[a];
+        int next_arm_label = a + 1 < arm_count ? arm_labels[a + 1] : end_label;
+        ir_emit_label(prog, arm_labels[a]);
+
+        if (is_string && !arm->is_wildcard) {
+            int pattern_fresh;
+            int pattern_vreg = ir_compile_string(arm->pattern, st, prog, NULL, &pattern_fresh);
+            int equal = ir_emit_binop(prog, IR_STR_EQ, scrutinee_vreg, pattern_vreg);
+            if (pattern_fresh) ir_emit_str_release(prog, pattern_vreg);
+            ir_emit_jz(prog, equal, next_arm_label);
+        } else if (is_float && !arm->is_wildcard) {
+            int pattern_vreg = ir_compile_float_operand(arm->pattern, st, prog);
+            ir_emit_jz(prog, ir_emit_fcmp(prog, IR_CMP_EQ, scrutinee_vreg, pattern_vreg),
+                       next_arm_label);
+        } else if (!constant && !arm->is_wildcard) {
+            /* Compare scrutinee against pattern */
+            int pattern_vreg = ir_compile_expr(arm->pattern, st, prog);
+            ir_emit_br_cmp(prog, IR_CMP_NE, scrutinee_vreg, pattern_vreg, next_arm_label);
+        }
 
-/* ================================================================
- * Flush pending compile-time prints to IR
- * ================================================================ */
+        /* Compile arm body */
+        SymTable match_st;
+        sym_table_init(&match_st);
+        match_st.parent = st;
+        ir_compile_stmts(arm->body, &match_st, prog, break_label, continue_label);
+        ir_release_vars(&match_st, st, prog);
+        sym_table_free(&match_st);
+        ir_emit_jmp(prog, end_label);
+    }
 
-static void flush_prints_to_ir(PrintList *prints) {
-    if (!g_ir_mode && g_ir) {
-        for (int pi = 0; pi < prints->count; pi++) {
-            ir_emit_print_str(g_ir, prints->strings[pi], prints->lengths[pi]);
+    ir_emit_label(prog, end_label);
+    if (scrutinee_fresh) ir_emit_str_release(prog, scrutinee_vreg);
+    free(arm_labels);
+}
+
+/* Compile `return` of an object from the function being compiled: a
+ * new one is built on the heap, any other must be of the declared
+ * class */
+static void ir_compile_object_return(ASTNode *n, SymTable *st, IRProgram *prog) {
+    ASTNode *decl = g_ir_fn_decl;
+    int result;
+    if (n->is_new_expr) {
+        if (strcmp(n->fn_name, decl->return_class_name) != 0)
+            diag_emit(n->loc, DIAG_ERROR, "function '%s' returns '%s', expected '%s'",
+                      decl->fn_name, n->fn_name, decl->return_class_name);
+        EvalResult shadow;
+        result = ir_compile_new(n, st, prog, 0, &shadow);
+    } else {
+        if (!n->expr)
+            diag_emit(n->loc, DIAG_ERROR, "function '%s' must return a value of type '%s'",
+                      decl->fn_name, decl->return_class_name);
+        ValueType rt = expr_is_runtime(n->expr, st) ? expr_runtime_type(n->expr, st)
+                                                    : eval_expr(n->expr, st).type;
+        if (rt != VAL_OBJECT)
+            diag_emit(n->loc, DIAG_ERROR, "function '%s' returns '%s', expected '%s'",
+                      decl->fn_name, value_type_name(rt), decl->return_class_name);
+        ClassDef *cls = ir_object_class(n->expr, st);
+        if (!cls) {
+            EvalResult r = eval_expr(n->expr, st);
+            cls = class_table_find(g_ct, r.obj_val->class_name);
         }
-        g_ir_mode = 1;
+        if (strcmp(cls->name, decl->return_class_name) != 0)
+            diag_emit(n->loc, DIAG_ERROR, "function '%s' returns '%s', expected '%s'",
+                      decl->fn_name, cls->name, decl->return_class_name);
+        result = ir_compile_owned_object(n->expr, st, prog);
     }
+    ir_store_self(prog);
+    ir_release_vars(st, g_ir_fn_scope->parent, prog);
+    ir_emit_ret(prog, result);
 }
 
 /* ================================================================
@@ -1523,18 +4402,75 @@ static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
             continue;
 
         if (n->type == NODE_BREAK) {
-            if (break_label >= 0)
+            if (break_label >= 0) {
+                ir_release_vars(st, g_ir_loop_scope, prog);
                 ir_emit_jmp(prog, break_label);
+            }
             return;
         }
 
         if (n->type == NODE_CONTINUE) {
-            if (continue_label >= 0)
+            if (continue_label >= 0) {
+                ir_release_vars(st, g_ir_loop_scope, prog);
                 ir_emit_jmp(prog, continue_label);
+            }
+            return;
+        }
+
+        if (n->type == NODE_RETURN) {
+            /* Only out-of-line functions have a runtime frame to return from */
+            if (!g_ir_fn_decl) continue;
+            ASTNode *decl = g_ir_fn_decl;
+            if (!decl->has_return_type) {
+                if (n->expr)
+                    diag_emit(n->loc, DIAG_ERROR, "function '%s' has no return type but returns a value",
+                              decl->fn_name);
+                ir_store_self(prog);
+                ir_release_vars(st, g_ir_fn_scope->parent, prog);
+                ir_emit_ret(prog, -1);
+                return;
+            }
+            if (decl->return_type == VAL_OBJECT) {
+                ir_compile_object_return(n, st, prog);
+                return;
+            }
+            if (!n->expr || n->is_fn_call)
+                diag_emit(n->loc, DIAG_ERROR, "function '%s' must return a value of type '%s'",
+                          decl->fn_name, value_type_name(decl->return_type));
+            ValueType rt = expr_is_runtime(n->expr, st) ? expr_runtime_type(n->expr, st)
+                                                        : eval_expr(n->expr, st).type;
+            if (rt != decl->return_type)
+                diag_emit(n->loc, DIAG_ERROR, "function '%s' returns '%s', expected '%s'",
+                          decl->fn_name, value_type_name(rt), value_type_name(decl->return_type));
+            if (rt == VAL_ARRAY) {
+                ValueType et = ir_array_elem_type(n->expr, st);
+                if (et != VAL_VOID && et != decl->return_array_elem_type)
+                    diag_emit(n->loc, DIAG_ERROR, "function '%s' returns 'Array<%s>', expected 'Array<%s>'",
+                              decl->fn_name, value_type_name(et),
+                              value_type_name(decl->return_array_elem_type));
+            }
+            if (rt == VAL_MAP) {
+                ValueType kt, vt;
+                ir_map_types(n->expr, st, &kt, &vt);
+                if (kt != decl->return_map_key_type || vt != decl->return_array_elem_type)
+                    diag_emit(n->loc, DIAG_ERROR, "function '%s' returns 'Map<%s, %s>', expected 'Map<%s, %s>'",
+                              decl->fn_name, value_type_name(kt), value_type_name(vt),
+                              value_type_name(decl->return_map_key_type),
+                              value_type_name(decl->return_array_elem_type));
+            }
+            int result = rt == VAL_STRING ? ir_compile_owned_string(n->expr, st, prog, NULL)
+                       : rt == VAL_ARRAY ? ir_compile_owned_array(n->expr, st, prog, NULL)
+                       : rt == VAL_MAP ? ir_compile_owned_map(n->expr, st, prog)
+                                         : ir_compile_expr(n->expr, st, prog);
+            ir_store_self(prog);
+            ir_release_vars(st, g_ir_fn_scope->parent, prog);
+            ir_emit_ret(prog, result);
             return;
         }
 
-        if (n->type == NODE_VAR_DECL) {
+        if (n->type == NODE_VAR_DECL && n->is_new_expr && ir_new_is_runtime(n, st)) {
+            ir_declare_new_object(n, st, prog);
+        } else if (n->type == NODE_VAR_DECL) {
             /* Evaluate initializer at compile time, add to symbol table,
              * then allocate an IR slot for mutable int/bool */
             EvalResult val;
@@ -1544,32 +4480,63 @@ static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
                 val = evaluate_method_call(n, st, g_ft, g_ct, g_prints, 1);
             } else if (n->is_fn_call) {
                 val = eval_fn_call_result(n, st, g_ft, g_ct, g_prints, 1);
+            } else if (expr_is_runtime(n->expr, st)) {
+                val = ir_shadow_value(n->expr, st);
             } else {
                 val = eval_expr(n->expr, st);
             }
+            int is_rt = n->expr && expr_is_runtime(n->expr, st);
+            int guessed = expr_is_guessed(n->expr, st);
+            val = array_declared_as(val, n->var_array_elem_type);
+            if (is_rt && val.type == VAL_OBJECT)
+                ir_check_class(ir_object_class(n->expr, st), n->loc);
             sym_add(st, n->var_name, val, n->is_const, n->loc);
 
-            if (!n->is_const && (val.type == VAL_INT || val.type == VAL_BOOL)) {
+            /* Runtime-valued consts need a slot too: their value isn't
+             * known yet, and neither are the entries of a const map.
+             * Objects only known at compile time stay there. */
+            if ((!n->is_const || is_rt || val.type == VAL_MAP) &&
+                (is_rt || val.type != VAL_OBJECT) && ir_slot_value(val)) {
                 int slot = ir_alloc_slot(prog);
                 st->syms[st->count - 1].has_slot = 1;
                 st->syms[st->count - 1].slot = slot;
+                st->syms[st->count - 1].guessed = guessed;
                 int init_vreg;
-                if (n->expr && expr_is_runtime(n->expr, st)) {
+                if (val.type == VAL_STRING) {
+                    init_vreg = is_rt ? ir_compile_owned_string(n->expr, st, prog, NULL)
+                                      : ir_emit_const_str(prog, val.str_val, val.str_len);
+                } else if (val.type == VAL_ARRAY) {
+                    init_vreg = is_rt ? ir_compile_owned_array(n->expr, st, prog, NULL)
+                                      : ir_emit_unop(prog, IR_ARR_COPY,
+                                                     ir_emit_const_arr(prog, ir_array_table(prog, val.arr_val)));
+                } else if (val.type == VAL_MAP) {
+                    init_vreg = is_rt ? ir_compile_owned_map(n->expr, st, prog)
+                                      : ir_compile_map_const(prog, val.map_val);
+                } else if (val.type == VAL_OBJECT) {
+                    init_vreg = ir_compile_owned_object(n->expr, st, prog);
+                } else if (is_rt) {
                     init_vreg = ir_compile_expr(n->expr, st, prog);
                 } else {
-                    int64_t iv = (val.type == VAL_INT) ? val.int_val : (int64_t)val.bool_val;
-                    init_vreg = ir_emit_const_int(prog, iv);
+                    init_vreg = ir_emit_const_int(prog, ir_value_bits(&val));
                 }
                 ir_emit_store(prog, slot, init_vreg);
             }
         } else if (n->type == NODE_ASSIGN) {
-            if (n->field_name) {
-                /* Field assignment: obj.field = value; — compile-time only in IR mode */
+            if (n->index_expr) {
+                assign_element(n, st, prog);
+                sym_find(st, n->var_name)->guessed = 1;
+            } else if (n->field_name) {
+                /* Field assignment: obj.field = value; — stored at runtime
+                 * into a runtime object, otherwise compile-time only */
                 Symbol *sym = sym_find(st, n->var_name);
                 if (!sym) diag_emit(n->loc, DIAG_ERROR, "undefined variable '%s'", n->var_name);
                 if (sym->is_const) diag_emit(n->loc, DIAG_ERROR, "cannot mutate fields of const variable '%s'", n->var_name);
                 if (sym->val.type != VAL_OBJECT || !sym->val.obj_val)
                     diag_emit(n->loc, DIAG_ERROR, "'%s' is not an object", n->var_name);
+                if (sym->has_slot) {
+                    ir_compile_field_assign(n, sym, st, prog, 0);
+                    continue;
+                }
                 ObjData *obj = sym->val.obj_val;
                 int found = 0;
                 for (int i = 0; i < obj->field_count; i++) {
@@ -1590,22 +4557,23 @@ static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
                 if (!sym) diag_emit(n->loc, DIAG_ERROR, "undefined variable '%s'", n->var_name);
                 if (sym->is_const) diag_emit(n->loc, DIAG_ERROR, "cannot reassign const variable '%s'", n->var_name);
 
-                if (sym->has_slot) {
+                if (sym->has_slot && sym->val.type == VAL_OBJECT) {
+                    ir_compile_object_assign(n, sym, st, prog, 0);
+                } else if (sym->has_slot) {
+                    if (!sym_in_ir_frame(st, n->var_name))
+                        diag_emit(n->loc, DIAG_ERROR,
+                                  "function '%s' cannot assign runtime variable '%s' from an enclosing scope",
+                                  g_ir_frame_fn->fn_name, n->var_name);
                     /* Emit IR store */
-                    EvalResult val = eval_expr(n->expr, st);
+                    EvalResult val = expr_is_runtime(n->expr, st) ? ir_shadow_value(n->expr, st)
+                                                                  : eval_expr(n->expr, st);
                     if (sym->val.type != val.type)
                         diag_emit(n->loc, DIAG_ERROR, "type mismatch: variable '%s' has type '%s', cannot assign '%s'",
                                   n->var_name, value_type_name(sym->val.type), value_type_name(val.type));
-                    sym->val = val;
+                    sym->val = ir_slot_assigned(n, sym, val);
                     sym->mutated = 1;
-                    int src_vreg;
-                    if (n->expr && expr_is_runtime(n->expr, st)) {
-                        src_vreg = ir_compile_expr(n->expr, st, prog);
-                    } else {
-                        int64_t cv = (val.type == VAL_INT) ? val.int_val : (int64_t)val.bool_val;
-                        src_vreg = ir_emit_const_int(prog, cv);
-                    }
-                    ir_emit_store(prog, sym->slot, src_vreg);
+                    sym->guessed = 1;
+                    ir_compile_assign(n, sym, st, prog);
                 } else {
                     EvalResult val = eval_expr(n->expr, st);
                     if (sym->val.type != val.type)
@@ -1617,13 +4585,7 @@ static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
             }
         } else if (n->type == NODE_PRINT) {
             if (n->expr && expr_is_runtime(n->expr, st)) {
-                int vreg = ir_compile_expr(n->expr, st, prog);
-                ValueType rt = expr_runtime_type(n->expr, st);
-                if (rt == VAL_BOOL) {
-                    ir_emit_print_bool(prog, vreg);
-                } else {
-                    ir_emit_print_int(prog, vreg);
-                }
+                ir_compile_print(n->expr, st, prog);
             } else {
                 EvalResult val;
                 if (n->is_fn_call && n->obj_name) {
@@ -1646,15 +4608,15 @@ static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
             int end_label = ir_alloc_label(prog);
 
             while (branch && branch->type == NODE_IF_STMT && branch->if_cond) {
-                int cond_vreg = ir_compile_expr(branch->if_cond, st, prog);
                 int else_label = ir_alloc_label(prog);
-                ir_emit_jz(prog, cond_vreg, else_label);
+                ir_compile_branch(branch->if_cond, st, prog, else_label, 0);
 
                 /* Compile if-body */
                 SymTable if_st;
                 sym_table_init(&if_st);
                 if_st.parent = st;
                 ir_compile_stmts(branch->if_body, &if_st, prog, break_label, continue_label);
+                ir_release_vars(&if_st, st, prog);
                 sym_table_free(&if_st);
                 ir_emit_jmp(prog, end_label);
 
@@ -1668,6 +4630,7 @@ static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
                 sym_table_init(&else_st);
                 else_st.parent = st;
                 ir_compile_stmts(branch, &else_st, prog, break_label, continue_label);
+                ir_release_vars(&else_st, st, prog);
                 sym_table_free(&else_st);
             }
 
@@ -1688,14 +4651,20 @@ static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
             ir_emit_label(prog, loop_start);
 
             /* Compile condition */
-            int cond_vreg = ir_compile_expr(n->for_cond, &loop_st, prog);
-            ir_emit_jz(prog, cond_vreg, loop_end);
+            ir_compile_branch(n->for_cond, &loop_st, prog, loop_end, 0);
 
             /* Compile body */
             SymTable body_st;
             sym_table_init(&body_st);
             body_st.parent = &loop_st;
+            SymTable *saved_loop_scope = g_ir_loop_scope;
+            g_ir_loop_scope = &loop_st;
+            IRFrozen frozen;
+            ir_freeze_objects(st, &frozen);
             ir_compile_stmts(n->body, &body_st, prog, loop_end, loop_continue);
+            ir_check_frozen(&frozen, n->loc, "inside a runtime loop");
+            g_ir_loop_scope = saved_loop_scope;
+            ir_release_vars(&body_st, &loop_st, prog);
             sym_table_free(&body_st);
 
             /* Continue label */
@@ -1708,41 +4677,17 @@ static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
 
             ir_emit_label(prog, loop_end);
 
+            ir_release_vars(&loop_st, st, prog);
             sym_table_free(&loop_st);
         } else if (n->type == NODE_BLOCK) {
             SymTable child;
             sym_table_init(&child);
             child.parent = st;
             ir_compile_stmts(n->body, &child, prog, break_label, continue_label);
+            ir_release_vars(&child, st, prog);
             sym_table_free(&child);
         } else if (n->type == NODE_MATCH_STMT) {
-            /* Compile match statement to IR */
-            int scrutinee_vreg = ir_compile_expr(n->match_expr, st, prog);
-            int end_label = ir_alloc_label(prog);
-
-            for (int a = 0; a < n->match_arm_count; a++) {
-                MatchArm *arm = &n->match_arms[a];
-                int next_arm_label = ir_alloc_label(prog);
-
-                if (!arm->is_wildcard) {
-                    /* Compare scrutinee against pattern */
-                    int pattern_vreg = ir_compile_expr(arm->pattern, st, prog);
-                    int cmp_vreg = ir_emit_binop(prog, IR_CMP_NE, scrutinee_vreg, pattern_vreg);
-                    ir_emit_jnz(prog, cmp_vreg, next_arm_label);
-                }
-
-                /* Compile arm body */
-                SymTable match_st;
-                sym_table_init(&match_st);
-                match_st.parent = st;
-                ir_compile_stmts(arm->body, &match_st, prog, break_label, continue_label);
-                sym_table_free(&match_st);
-                ir_emit_jmp(prog, end_label);
-
-                ir_emit_label(prog, next_arm_label);
-            }
-
-            ir_emit_label(prog, end_label);
+            ir_compile_match(n, st, prog, break_label, continue_label);
         } else if (n->type == NODE_SPAWN) {
             /* spawn fn_call; — execute at compile time, discard result (same as eval_stmts) */
             Expr *call_expr = n->spawn_expr;
@@ -1770,8 +4715,15 @@ static void ir_compile_stmts(ASTNode *stmts, SymTable *st, IRProgram *prog,
                 free(arg_results);
             }
         } else if (n->type == NODE_FN_CALL) {
-            if (n->obj_name) {
+            if (n->obj_name && ir_is_runtime_receiver(n->obj_name, st)) {
+                ir_compile_method_stmt(n, st, prog, 0);
+            } else if (n->obj_name) {
                 evaluate_method_call(n, st, g_ft, g_ct, g_prints, 0);
+            } else if (ir_stmt_is_map_update(n, st)) {
+                ir_compile_map_update(n, st, prog, 0);
+            } else if (ir_stmt_call_is_runtime(n, st)) {
+                ir_compile_call(n->fn_name, n->loc, n->call_arg_exprs, n->call_arg_names,
+                                n->call_arg_count, st, prog, 0);
             } else {
                 EvalResult *arg_results = resolve_call_args_eval(n, st);
                 (void)evaluate_fn_call(g_ft, g_ct, st, n->fn_name, n->loc,
@@ -1807,7 +4759,10 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
                 diag_emit(n->loc, DIAG_ERROR, "return statement outside of function");
                 return;
             }
-            if (n->is_fn_call && n->obj_name) {
+            if (n->is_new_expr) {
+                /* return new ClassName(args); */
+                ret->return_result = eval_new_expr(n, st, ct);
+            } else if (n->is_fn_call && n->obj_name) {
                 /* return obj.method(args); */
                 ret->return_result = evaluate_method_call(n, st, ft, ct, prints, 1);
             } else if (n->is_fn_call) {
@@ -1823,7 +4778,10 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
             return;
         }
 
-        if (n->type == NODE_VAR_DECL) {
+        if (n->type == NODE_VAR_DECL && g_ir && n->is_new_expr && ir_new_is_runtime(n, st)) {
+            /* IR: an object with runtime field values */
+            ir_declare_new_object(n, st, g_ir);
+        } else if (n->type == NODE_VAR_DECL) {
             EvalResult val;
             if (n->is_new_expr) {
                 val = eval_new_expr(n, st, ct);
@@ -1831,28 +4789,55 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
                 val = evaluate_method_call(n, st, ft, ct, prints, 1);
             } else if (n->is_fn_call) {
                 val = eval_fn_call_result(n, st, ft, ct, prints, 1);
+            } else if (g_ir && expr_is_runtime(n->expr, st)) {
+                val = ir_shadow_value(n->expr, st);
             } else {
                 val = eval_expr(n->expr, st);
             }
+            int is_rt = g_ir && n->expr && expr_is_runtime(n->expr, st);
+            int guessed = is_rt && expr_is_guessed(n->expr, st);
+            val = array_declared_as(val, n->var_array_elem_type);
+            if (is_rt && val.type == VAL_OBJECT)
+                ir_check_class(ir_object_class(n->expr, st), n->loc);
             sym_add(st, n->var_name, val, n->is_const, n->loc);
 
-            /* IR: allocate a runtime slot for mutable int/bool variables */
-            if (g_ir && !n->is_const && (val.type == VAL_INT || val.type == VAL_BOOL)) {
+            /* IR: allocate a runtime slot for mutable int/bool/string
+             * variables and Array<int>/Array<bool> ones, for consts
+             * whose value is only known at runtime, for maps of int
+             * and bool, whose entries may change at runtime, and for
+             * objects initialized from a runtime one */
+            if (g_ir && (!n->is_const || is_rt || val.type == VAL_MAP) &&
+                (is_rt || val.type != VAL_OBJECT) && ir_slot_value(val)) {
                 int slot = ir_alloc_slot(g_ir);
                 st->syms[st->count - 1].has_slot = 1;
                 st->syms[st->count - 1].slot = slot;
+                st->syms[st->count - 1].guessed = guessed;
                 /* Emit initial store */
                 int init_vreg;
-                if (n->expr && expr_is_runtime(n->expr, st)) {
+                if (val.type == VAL_STRING) {
+                    init_vreg = is_rt ? ir_compile_owned_string(n->expr, st, g_ir, NULL)
+                                      : ir_emit_const_str(g_ir, val.str_val, val.str_len);
+                } else if (val.type == VAL_ARRAY) {
+                    init_vreg = is_rt ? ir_compile_owned_array(n->expr, st, g_ir, NULL)
+                                      : ir_emit_unop(g_ir, IR_ARR_COPY,
+                                                     ir_emit_const_arr(g_ir, ir_array_table(g_ir, val.arr_val)));
+                } else if (val.type == VAL_MAP) {
+                    init_vreg = is_rt ? ir_compile_owned_map(n->expr, st, g_ir)
+                                      : ir_compile_map_const(g_ir, val.map_val);
+                } else if (val.type == VAL_OBJECT) {
+                    init_vreg = ir_compile_owned_object(n->expr, st, g_ir);
+                } else if (is_rt) {
                     init_vreg = ir_compile_expr(n->expr, st, g_ir);
                 } else {
-                    int64_t init_val = (val.type == VAL_INT) ? val.int_val : (int64_t)val.bool_val;
-                    init_vreg = ir_emit_const_int(g_ir, init_val);
+                    init_vreg = ir_emit_const_int(g_ir, ir_value_bits(&val));
                 }
                 ir_emit_store(g_ir, slot, init_vreg);
             }
         } else if (n->type == NODE_ASSIGN) {
-            if (n->field_name) {
+            if (n->index_expr) {
+                /* Element assignment: arr[index] = value; */
+                assign_element(n, st, g_ir);
+            } else if (n->field_name) {
                 /* Field assignment: obj.field = value; */
                 Symbol *sym = sym_find(st, n->var_name);
                 if (!sym)
@@ -1861,6 +4846,11 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
                     diag_emit(n->loc, DIAG_ERROR, "cannot mutate fields of const variable '%s'", n->var_name);
                 if (sym->val.type != VAL_OBJECT || !sym->val.obj_val)
                     diag_emit(n->loc, DIAG_ERROR, "'%s' is not an object", n->var_name);
+                if (g_ir && sym->has_slot) {
+                    /* IR: store into the runtime object */
+                    ir_compile_field_assign(n, sym, st, g_ir, !g_ir_loop_scope && !g_ir_fn_decl);
+                    continue;
+                }
                 ObjData *obj = sym->val.obj_val;
                 int found = 0;
                 for (int i = 0; i < obj->field_count; i++) {
@@ -1896,29 +4886,27 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
                     diag_emit(n->loc, DIAG_ERROR, "cannot reassign const variable '%s'", n->var_name);
 
                 /* IR path: if the target has a slot, compile the RHS to IR */
-                if (g_ir && sym->has_slot) {
+                if (g_ir && sym->has_slot && sym->val.type == VAL_OBJECT) {
+                    ir_compile_object_assign(n, sym, st, g_ir, !g_ir_loop_scope && !g_ir_fn_decl);
+                } else if (g_ir && sym->has_slot) {
                     EvalResult val;
                     if (n->is_fn_call && n->obj_name) {
                         val = evaluate_method_call(n, st, ft, ct, prints, 1);
                     } else if (n->is_fn_call) {
                         val = eval_fn_call_result(n, st, ft, ct, prints, 1);
+                    } else if (expr_is_runtime(n->expr, st)) {
+                        val = ir_shadow_value(n->expr, st);
                     } else {
                         val = eval_expr(n->expr, st);
                     }
                     if (sym->val.type != val.type)
                         diag_emit(n->loc, DIAG_ERROR, "type mismatch: variable '%s' has type '%s', cannot assign '%s'",
                                   n->var_name, value_type_name(sym->val.type), value_type_name(val.type));
-                    sym->val = val;
+                    sym->val = ir_slot_assigned(n, sym, val);
                     sym->mutated = 1;
+                    sym->guessed = expr_is_guessed(n->expr, st);
                     /* Emit IR store */
-                    int src_vreg;
-                    if (n->expr && expr_is_runtime(n->expr, st)) {
-                        src_vreg = ir_compile_expr(n->expr, st, g_ir);
-                    } else {
-                        int64_t cv = (val.type == VAL_INT) ? val.int_val : (int64_t)val.bool_val;
-                        src_vreg = ir_emit_const_int(g_ir, cv);
-                    }
-                    ir_emit_store(g_ir, sym->slot, src_vreg);
+                    ir_compile_assign(n, sym, st, g_ir);
                 } else {
                     EvalResult val;
                     if (n->is_fn_call && n->obj_name) {
@@ -1948,13 +4936,7 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
                     g_ir_mode = 1;
                 }
                 /* Compile expr to IR and emit appropriate print */
-                int vreg = ir_compile_expr(n->expr, st, g_ir);
-                ValueType rt = expr_runtime_type(n->expr, st);
-                if (rt == VAL_BOOL) {
-                    ir_emit_print_bool(g_ir, vreg);
-                } else {
-                    ir_emit_print_int(g_ir, vreg);
-                }
+                ir_compile_print(n->expr, st, g_ir);
                 if (n->print_newline) {
                     ir_emit_print_str(g_ir, "\n", 1);
                 }
@@ -1984,9 +4966,19 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
                 }
             }
         } else if (n->type == NODE_FN_CALL) {
-            if (n->obj_name) {
+            if (g_ir && n->obj_name && ir_is_runtime_receiver(n->obj_name, st)) {
+                /* Method call on a runtime object */
+                ir_compile_method_stmt(n, st, g_ir, !g_ir_loop_scope && !g_ir_fn_decl);
+            } else if (n->obj_name) {
                 /* Standalone method call: obj.method(args); */
                 evaluate_method_call(n, st, ft, ct, prints, 0);
+            } else if (g_ir && ir_stmt_is_map_update(n, st)) {
+                /* set() or remove() on a runtime map */
+                ir_compile_map_update(n, st, g_ir, 1);
+            } else if (g_ir && ir_stmt_call_is_runtime(n, st)) {
+                /* Runtime arguments — call the compiled function */
+                ir_compile_call(n->fn_name, n->loc, n->call_arg_exprs, n->call_arg_names,
+                                n->call_arg_count, st, g_ir, 0);
             } else {
                 EvalResult *arg_results = resolve_call_args_eval(n, st);
                 (void)evaluate_fn_call(ft, ct, st, n->fn_name, n->loc,
@@ -2058,13 +5050,19 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
 
                 ir_emit_label(g_ir, loop_start);
 
-                int cond_vreg = ir_compile_expr(n->for_cond, &loop_st, g_ir);
-                ir_emit_jz(g_ir, cond_vreg, loop_end);
+                ir_compile_branch(n->for_cond, &loop_st, g_ir, loop_end, 0);
 
                 SymTable body_st;
                 sym_table_init(&body_st);
                 body_st.parent = &loop_st;
+                SymTable *saved_loop_scope = g_ir_loop_scope;
+                g_ir_loop_scope = &loop_st;
+                IRFrozen frozen;
+                ir_freeze_objects(st, &frozen);
                 ir_compile_stmts(n->body, &body_st, g_ir, loop_end, loop_continue);
+                ir_check_frozen(&frozen, n->loc, "inside a runtime loop");
+                g_ir_loop_scope = saved_loop_scope;
+                ir_release_vars(&body_st, &loop_st, g_ir);
                 sym_table_free(&body_st);
 
                 ir_emit_label(g_ir, loop_continue);
@@ -2075,6 +5073,7 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
 
                 ir_emit_label(g_ir, loop_end);
 
+                ir_release_vars(&loop_st, st, g_ir);
                 sym_table_free(&loop_st);
             } else {
                 /* Compile-time for loop — original path */
@@ -2125,14 +5124,14 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
                 int end_label = ir_alloc_label(g_ir);
 
                 while (branch && branch->type == NODE_IF_STMT && branch->if_cond) {
-                    int cond_vreg = ir_compile_expr(branch->if_cond, st, g_ir);
                     int else_label = ir_alloc_label(g_ir);
-                    ir_emit_jz(g_ir, cond_vreg, else_label);
+                    ir_compile_branch(branch->if_cond, st, g_ir, else_label, 0);
 
                     SymTable if_st;
                     sym_table_init(&if_st);
                     if_st.parent = st;
                     ir_compile_stmts(branch->if_body, &if_st, g_ir, -1, -1);
+                    ir_release_vars(&if_st, st, g_ir);
                     sym_table_free(&if_st);
                     ir_emit_jmp(g_ir, end_label);
 
@@ -2145,6 +5144,7 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
                     sym_table_init(&else_st);
                     else_st.parent = st;
                     ir_compile_stmts(branch, &else_st, g_ir, -1, -1);
+                    ir_release_vars(&else_st, st, g_ir);
                     sym_table_free(&else_st);
                 }
 
@@ -2185,30 +5185,7 @@ static void eval_stmts(ASTNode *stmts, SymTable *st, FnTable *ft, ClassTable *ct
             if (has_rt_scrutinee) {
                 /* Runtime match — compile to IR */
                 flush_prints_to_ir(prints);
-                int scrutinee_vreg = ir_compile_expr(n->match_expr, st, g_ir);
-                int end_label = ir_alloc_label(g_ir);
-
-                for (int a = 0; a < n->match_arm_count; a++) {
-                    MatchArm *arm = &n->match_arms[a];
-                    int next_arm_label = ir_alloc_label(g_ir);
-
-                    if (!arm->is_wildcard) {
-                        int pattern_vreg = ir_compile_expr(arm->pattern, st, g_ir);
-                        int cmp_vreg = ir_emit_binop(g_ir, IR_CMP_NE, scrutinee_vreg, pattern_vreg);
-                        ir_emit_jnz(g_ir, cmp_vreg, next_arm_label);
-                    }
-
-                    SymTable match_st;
-                    sym_table_init(&match_st);
-                    match_st.parent = st;
-                    ir_compile_stmts(arm->body, &match_st, g_ir, -1, -1);
-                    sym_table_free(&match_st);
-                    ir_emit_jmp(g_ir, end_label);
-
-                    ir_emit_label(g_ir, next_arm_label);
-                }
-
-                ir_emit_label(g_ir, end_label);
+                ir_compile_match(n, st, g_ir, -1, -1);
             } else {
                 /* Compile-time match — original path */
                 EvalResult scrutinee = eval_expr(n->match_expr, st);
@@ -2454,6 +5431,26 @@ static int eval_builtin_string_fn(const char *fn_name, SourceLoc call_loc,
  * Built-in array functions (EvalResult-based)
  * ================================================================ */
 
+/* Sum of an Array<float> in the order the runtime's vector routine
+ * adds it, so a sum folded at compile time and one computed at runtime
+ * agree: the elements up to a multiple of 16 go into 16 lanes by index
+ * mod 16, the lanes are folded in halves, then the rest are added one
+ * at a time */
+static double eval_float_sum(ArrayData *arr) {
+    double lanes[16] = {0};
+    int count = arr ? arr->count : 0;
+    int whole = count & ~15;
+    for (int i = 0; i < whole; i++)
+        lanes[i & 15] += arr->elements[i].float_val;
+    for (int w = 8; w > 0; w /= 2)
+        for (int k = 0; k < w; k++)
+            lanes[k] += lanes[k + w];
+    double sum = lanes[0];
+    for (int i = whole; i < count; i++)
+        sum += arr->elements[i].float_val;
+    return sum;
+}
+
 static EvalResult eval_builtin_array_fn(const char *fn_name, SourceLoc call_loc,
                                         int arg_count, EvalResult *args) {
     EvalResult r;
@@ -2646,6 +5643,42 @@ static EvalResult eval_builtin_array_fn(const char *fn_name, SourceLoc call_loc,
         r.str_len = pos;
         return r;
     }
+    /* sum(arr) -> int or float */
+    if (strcmp(fn_name, "sum") == 0) {
+        if (arg_count != 1) diag_emit(call_loc, DIAG_ERROR, "sum() expects 1 argument");
+        if (args[0].type != VAL_ARRAY) diag_emit(call_loc, DIAG_ERROR, "sum() expects an array argument");
+        ArrayData *arr = args[0].arr_val;
+        ValueType et = arr && arr->elem_type != VAL_VOID ? arr->elem_type : VAL_INT;
+        if (et != VAL_INT && et != VAL_FLOAT)
+            diag_emit(call_loc, DIAG_ERROR, "sum() expects an Array<int> or Array<float>, got Array<%s>",
+                      value_type_name(et));
+        r.type = et;
+        if (et == VAL_FLOAT) {
+            r.float_val = eval_float_sum(arr);
+            return r;
+        }
+        for (int i = 0; arr && i < arr->count; i++)
+            r.int_val += arr->elements[i].int_val;
+        return r;
+    }
+    /* min(arr), max(arr) -> element (the array must not be empty) */
+    if (strcmp(fn_name, "min") == 0 || strcmp(fn_name, "max") == 0) {
+        int is_max = fn_name[1] == 'a';
+        if (arg_count != 1) diag_emit(call_loc, DIAG_ERROR, "%s() expects 1 argument", fn_name);
+        if (args[0].type != VAL_ARRAY) diag_emit(call_loc, DIAG_ERROR, "%s() expects an array argument", fn_name);
+        ArrayData *arr = args[0].arr_val;
+        if (!arr || arr->count == 0)
+            diag_emit(call_loc, DIAG_ERROR, "%s() on empty array", fn_name);
+        if (arr->elem_type != VAL_INT && arr->elem_type != VAL_FLOAT)
+            diag_emit(call_loc, DIAG_ERROR, "%s() expects an Array<int> or Array<float>, got Array<%s>",
+                      fn_name, value_type_name(arr->elem_type));
+        r = arr->elements[0];
+        for (int i = 1; i < arr->count; i++) {
+            EvalResult cmp = eval_binary(is_max ? BINOP_GT : BINOP_LT, arr->elements[i], r, call_loc);
+            if (cmp.bool_val) r = arr->elements[i];
+        }
+        return r;
+    }
     /* remove(arr, index) -> Array<T> */
     if (strcmp(fn_name, "remove") == 0) {
         if (arg_count != 2) diag_emit(call_loc, DIAG_ERROR, "remove() expects 2 arguments");
@@ -2751,6 +5784,84 @@ static EvalResult eval_builtin_concurrency_fn(const char *fn_name, SourceLoc cal
     return r;
 }
 
+/* ================================================================
+ * Built-in map functions (std/map)
+ * ================================================================ */
+
+static EvalResult eval_builtin_map_fn(const char *fn_name, SourceLoc call_loc,
+                                      int arg_count, EvalResult *args) {
+    EvalResult r;
+    memset(&r, 0, sizeof(r));
+
+    int expected = strcmp(fn_name, "set") == 0 ? 3
+                 : strcmp(fn_name, "len") == 0 || strcmp(fn_name, "keys") == 0 ? 1 : 2;
+    if (arg_count != expected)
+        diag_emit(call_loc, DIAG_ERROR, "%s() expects %d argument(s), got %d",
+                  fn_name, expected, arg_count);
+    if (args[0].type != VAL_MAP || !args[0].map_val)
+        diag_emit(call_loc, DIAG_ERROR, "%s() first argument must be a map", fn_name);
+    MapData *m = args[0].map_val;
+    if (expected > 1 && args[1].type != m->key_type)
+        diag_emit(call_loc, DIAG_ERROR, "%s() key type '%s' does not match map key type '%s'",
+                  fn_name, value_type_name(args[1].type), value_type_name(m->key_type));
+
+    /* len(m) -> int */
+    if (strcmp(fn_name, "len") == 0) {
+        r.type = VAL_INT;
+        r.int_val = m->count;
+        return r;
+    }
+
+    /* keys(m) -> Array<K>, in insertion order */
+    if (strcmp(fn_name, "keys") == 0) {
+        ArrayData *arr = malloc(sizeof(ArrayData));
+        arr->count = m->count;
+        arr->elem_type = m->key_type;
+        arr->elements = malloc((m->count > 0 ? m->count : 1) * sizeof(EvalResult));
+        memcpy(arr->elements, m->keys, m->count * sizeof(EvalResult));
+        r.type = VAL_ARRAY;
+        r.arr_val = arr;
+        return r;
+    }
+
+    /* has(m, key) -> bool */
+    if (strcmp(fn_name, "has") == 0) {
+        r.type = VAL_BOOL;
+        r.bool_val = map_data_find(m, &args[1], NULL) >= 0;
+        return r;
+    }
+
+    /* get(m, key) -> V; a guess at a runtime map may lack the key, and
+     * then guesses the zero value */
+    if (strcmp(fn_name, "get") == 0) {
+        int e = map_data_find(m, &args[1], NULL);
+        if (e >= 0) return m->values[e];
+        if (!m->guessed) {
+            int klen;
+            char *kstr = eval_to_string(&args[1], &klen);
+            diag_emit(call_loc, DIAG_ERROR, "map key %s not found", kstr);
+        }
+        r.type = m->value_type;
+        if (r.type == VAL_STRING) r.str_val = "";
+        return r;
+    }
+
+    /* set(m, key, value) -> void */
+    if (strcmp(fn_name, "set") == 0) {
+        if (args[2].type != m->value_type)
+            diag_emit(call_loc, DIAG_ERROR, "set() value type '%s' does not match map value type '%s'",
+                      value_type_name(args[2].type), value_type_name(m->value_type));
+        map_data_set(m, args[1], args[2]);
+    }
+
+    /* remove(m, key) -> void; removing a missing key does nothing */
+    if (strcmp(fn_name, "remove") == 0)
+        map_data_remove(m, args[1]);
+
+    r.type = VAL_VOID;
+    return r;
+}
+
 /* ================================================================
  * Built-in HTTP functions (std/http)
  * ================================================================ */
@@ -2957,6 +6068,10 @@ static EvalResult evaluate_fn_call(FnTable *ft, ClassTable *ct, SymTable *outer_
     FnEntry *fn = fn_table_find(ft, fn_name);
     if (!fn) {
         /* Fall back to stdlib built-ins if imported */
+        /* Map functions: get, remove and len on a map */
+        if (stdlib_map_call(fn_name, arg_count > 0 ? arg_results[0].type : VAL_VOID)) {
+            return eval_builtin_map_fn(fn_name, call_loc, arg_count, arg_results);
+        }
         /* Array-only functions */
         if (stdlib_array_fn_is_imported(fn_name)) {
             return eval_builtin_array_fn(fn_name, call_loc, arg_count, arg_results);
@@ -3061,6 +6176,14 @@ static EvalResult evaluate_fn_call(FnTable *ft, ClassTable *ct, SymTable *outer_
                       fn_name, decl->params[i].name,
                       value_type_name(decl->params[i].type),
                       value_type_name(final_results[i].type));
+        MapData *m = final_results[i].type == VAL_MAP ? final_results[i].map_val : NULL;
+        if (m && (m->key_type != decl->params[i].map_key_type ||
+                  m->value_type != decl->params[i].array_elem_type))
+            diag_emit(call_loc, DIAG_ERROR, "function '%s' parameter '%s' expects 'Map<%s, %s>', got 'Map<%s, %s>'",
+                      fn_name, decl->params[i].name,
+                      value_type_name(decl->params[i].map_key_type),
+                      value_type_name(decl->params[i].array_elem_type),
+                      value_type_name(m->key_type), value_type_name(m->value_type));
     }
 
     /* Recursion depth limit */
@@ -3084,8 +6207,23 @@ static EvalResult evaluate_fn_call(FnTable *ft, ClassTable *ct, SymTable *outer_
     ReturnCtx ret_ctx;
     memset(&ret_ctx, 0, sizeof(ret_ctx));
 
+    /* The body runs once, here, even when the call is compiled into a
+     * runtime function or loop: its variables are compile-time values,
+     * not guesses about the caller's frame.  Its prints still go to the
+     * caller's IR, and inside a runtime function only its own variables
+     * are in that function's frame. */
+    ASTNode *saved_ir_decl = g_ir_fn_decl;
+    SymTable *saved_ir_scope = g_ir_fn_scope;
+    SymTable *saved_ir_loop_scope = g_ir_loop_scope;
+    g_ir_fn_decl = NULL;
+    g_ir_fn_scope = saved_ir_scope ? &local_st : NULL;
+    g_ir_loop_scope = NULL;
+
     eval_stmts(decl->body, &local_st, ft, ct, prints, &ret_ctx);
 
+    g_ir_fn_decl = saved_ir_decl;
+    g_ir_fn_scope = saved_ir_scope;
+    g_ir_loop_scope = saved_ir_loop_scope;
     ft->eval_count--;
 
     if (decl->has_return_type && !ret_ctx.has_return)
@@ -3191,6 +6329,516 @@ typedef struct {
     int is_const;
 } ImportedVar;
 
+static void process_imports(ASTNode *ast, const char *source_file,
+                            FnTable *fn_table, ClassTable *class_table,
+                            EnumTable *enum_table,
+                            ImportedVar **imp_vars, int *imp_var_count, int *imp_var_cap);
+
+/* ================================================================
+ * Evaluated module cache
+ *
+ * Imported modules are evaluated on demand.  Opening a module
+ * processes its own imports and collects its declarations, but runs
+ * none of its top-level statements.  Each import then evaluates only
+ * the statements its requested symbols transitively depend on (see
+ * the dependency graph below).  Declaration tables, top-level symbols
+ * and evaluation progress are kept per absolute path, so later
+ * imports of the same module only evaluate what is still missing.
+ * ================================================================ */
+
+/* Insertion-ordered set of borrowed names.  Most sets are small and
+   searched in order; past NAME_SET_LINEAR names a hash index takes
+   over. */
+#define NAME_SET_LINEAR 8
+
+typedef struct {
+    const char **names;
+    int count;
+    int cap;
+    PathTable index;        /* name -> position, once count > NAME_SET_LINEAR */
+} NameSet;
+
+static int name_set_has(NameSet *s, const char *name) {
+    if (s->index.slots)
+        return path_table_find(&s->index, name) != NULL;
+    for (int i = 0; i < s->count; i++)
+        if (strcmp(s->names[i], name) == 0)
+            return 1;
+    return 0;
+}
+
+static int name_set_add(NameSet *s, const char *name) {
+    if (!name || name_set_has(s, name))
+        return 0;
+    if (s->count == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 8;
+        s->names = realloc(s->names, s->cap * sizeof(char *));
+    }
+    s->names[s->count++] = name;
+    if (s->index.slots) {
+        path_table_put(&s->index, name, s->count - 1);
+    } else if (s->count > NAME_SET_LINEAR) {
+        path_table_init(&s->index);
+        for (int i = 0; i < s->count; i++)
+            path_table_put(&s->index, s->names[i], i);
+    }
+    return 1;
+}
+
+static void name_set_free(NameSet *s) {
+    free(s->names);
+    if (s->index.slots)
+        path_table_free(&s->index);
+}
+
+/* Builtins that never change the values passed to them */
+static int builtin_reads_args(const char *fn_name) {
+    static const char *const pure[] = {
+        "len", "get", "has", "keys", "contains", "index_of", "sum", "min",
+        "max", "push", "pop", "shift", "concat", "reverse", "sort", "join",
+        "trim", "to_upper", "to_lower", "substr", "starts_with", "ends_with",
+        "replace", "char_at",
+    };
+    for (size_t i = 0; fn_name && i < sizeof(pure) / sizeof(pure[0]); i++)
+        if (strcmp(fn_name, pure[i]) == 0)
+            return 1;
+    return 0;
+}
+
+static void collect_expr_names(Expr *e, NameSet *uses, NameSet *writes);
+
+/* A call may change what its variable arguments and its object refer
+   to: channels, maps and objects are shared, so send(ch, 1), set(m, k,
+   v) or a function filling a map all count as writes to them */
+static void collect_call_writes(const char *fn_name, const char *obj_name,
+                                Expr **args, int arg_count, NameSet *writes) {
+    if (!writes || (!obj_name && builtin_reads_args(fn_name)))
+        return;
+    name_set_add(writes, obj_name);
+    for (int i = 0; args && i < arg_count; i++)
+        if (args[i] && args[i]->kind == EXPR_VAR_REF)
+            name_set_add(writes, args[i]->as.var_ref.name);
+}
+
+static void collect_expr_names(Expr *e, NameSet *uses, NameSet *writes) {
+    if (!e) return;
+    switch (e->kind) {
+        case EXPR_VAR_REF:
+            name_set_add(uses, e->as.var_ref.name);
+            break;
+        case EXPR_BINARY:
+            collect_expr_names(e->as.binary.left, uses, writes);
+            collect_expr_names(e->as.binary.right, uses, writes);
+            break;
+        case EXPR_MEMBER_ACCESS:
+            collect_expr_names(e->as.member_access.object, uses, writes);
+            break;
+        case EXPR_UNARY:
+            collect_expr_names(e->as.unary.operand, uses, writes);
+            break;
+        case EXPR_INDEX:
+            collect_expr_names(e->as.index_access.object, uses, writes);
+            collect_expr_names(e->as.index_access.index, uses, writes);
+            break;
+        case EXPR_SLICE:
+            collect_expr_names(e->as.slice.object, uses, writes);
+            collect_expr_names(e->as.slice.start, uses, writes);
+            collect_expr_names(e->as.slice.end, uses, writes);
+            break;
+        case EXPR_FN_CALL:
+            name_set_add(uses, e->as.fn_call.fn_name);
+            name_set_add(uses, e->as.fn_call.obj_name);
+            for (int i = 0; i < e->as.fn_call.arg_count; i++)
+                collect_expr_names(e->as.fn_call.args[i], uses, writes);
+            collect_call_writes(e->as.fn_call.fn_name, e->as.fn_call.obj_name,
+                                e->as.fn_call.args, e->as.fn_call.arg_count, writes);
+            break;
+        case EXPR_ARRAY_LIT:
+            for (int i = 0; i < e->as.array_lit.count; i++)
+                collect_expr_names(e->as.array_lit.elements[i], uses, writes);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Collect every name a statement list reads and assigns, the variables
+   passed to calls included.  Local declarations are not filtered out,
+   which only over-approximates. */
+static void collect_stmt_names(ASTNode *n, NameSet *uses, NameSet *writes) {
+    for (; n; n = n->next) {
+        if (n->type == NODE_ASSIGN) {
+            name_set_add(uses, n->var_name);
+            name_set_add(writes, n->var_name);
+        }
+        if (n->type == NODE_CLASS_DECL)
+            name_set_add(uses, n->parent_class_name);
+        if (n->type != NODE_IMPORT && n->type != NODE_FN_DECL) {
+            name_set_add(uses, n->fn_name);
+            name_set_add(uses, n->obj_name);
+        }
+        collect_expr_names(n->expr, uses, writes);
+        collect_expr_names(n->for_cond, uses, writes);
+        collect_expr_names(n->if_cond, uses, writes);
+        collect_expr_names(n->match_expr, uses, writes);
+        collect_expr_names(n->spawn_expr, uses, writes);
+        for (int i = 0; n->call_arg_exprs && i < n->call_arg_count; i++)
+            collect_expr_names(n->call_arg_exprs[i], uses, writes);
+        if (n->type == NODE_FN_CALL)
+            collect_call_writes(n->fn_name, n->obj_name, n->call_arg_exprs,
+                                n->call_arg_count, writes);
+        for (int i = 0; i < n->match_arm_count; i++) {
+            collect_expr_names(n->match_arms[i].pattern, uses, writes);
+            collect_stmt_names(n->match_arms[i].body, uses, writes);
+        }
+        collect_stmt_names(n->body, uses, writes);
+        collect_stmt_names(n->for_init, uses, writes);
+        collect_stmt_names(n->for_update, uses, writes);
+        collect_stmt_names(n->if_body, uses, writes);
+        collect_stmt_names(n->else_body, uses, writes);
+        collect_stmt_names(n->class_methods, uses, writes);
+    }
+}
+
+/* One top-level statement of a module in the dependency graph */
+typedef struct {
+    ASTNode *node;
+    const char *defines;    /* declared name, NULL for plain statements */
+    NameSet uses;
+    NameSet writes;         /* including writes made by called functions */
+} ModuleStmt;
+
+/* Statement indices, in increasing order */
+typedef struct {
+    int *items;
+    int count;
+    int cap;
+} StmtList;
+
+static void stmt_list_add(StmtList *l, int i) {
+    if (l->count == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 4;
+        l->items = realloc(l->items, l->cap * sizeof(int));
+    }
+    l->items[l->count++] = i;
+}
+
+/* The top-level statements of a module that bear on one name */
+typedef struct {
+    StmtList provides;      /* declare code for it: a fn, class or method */
+    StmtList affects;       /* declare it or, directly or through calls, assign it */
+} ModuleName;
+
+/* Index from each name to its ModuleName, built once per module */
+typedef struct {
+    PathTable index;        /* name -> position in names */
+    ModuleName *names;
+    int count;
+    int cap;
+} ModuleNames;
+
+/* The entry for name, added if create is set; NULL if absent */
+static ModuleName *module_name(ModuleNames *mn, const char *name, int create) {
+    PathSlot *slot = path_table_find(&mn->index, name);
+    if (slot)
+        return &mn->names[slot->value];
+    if (!create)
+        return NULL;
+    if (mn->count == mn->cap) {
+        mn->cap = mn->cap ? mn->cap * 2 : 64;
+        mn->names = realloc(mn->names, mn->cap * sizeof(ModuleName));
+    }
+    memset(&mn->names[mn->count], 0, sizeof(ModuleName));
+    path_table_put(&mn->index, name, mn->count);
+    return &mn->names[mn->count++];
+}
+
+static void module_names_free(ModuleNames *mn) {
+    for (int i = 0; i < mn->count; i++) {
+        free(mn->names[i].provides.items);
+        free(mn->names[i].affects.items);
+    }
+    free(mn->names);
+    path_table_free(&mn->index);
+}
+
+/* Split a module into top-level statements, collect the names each one
+   reads and writes, and index them in names */
+static ModuleStmt *module_stmts_build(ASTNode *ast, int *out_count, ModuleNames *names) {
+    int count = 0;
+    for (ASTNode *n = ast; n; n = n->next)
+        count++;
+    ModuleStmt *stmts = calloc(count > 0 ? count : 1, sizeof(ModuleStmt));
+
+    int i = 0;
+    for (ASTNode *n = ast; n; n = n->next, i++) {
+        ModuleStmt *s = &stmts[i];
+        s->node = n;
+        switch (n->type) {
+            case NODE_VAR_DECL:   s->defines = n->var_name; break;
+            case NODE_FN_DECL:    s->defines = n->fn_name; break;
+            case NODE_CLASS_DECL: s->defines = n->class_name; break;
+            case NODE_ENUM_DECL:  s->defines = n->enum_name; break;
+            default: break;
+        }
+        /* Collect this node alone, not the rest of the list */
+        ASTNode *next = n->next;
+        n->next = NULL;
+        collect_stmt_names(n, &s->uses, &s->writes);
+        n->next = next;
+    }
+
+    path_table_init(&names->index);
+    for (i = 0; i < count; i++) {
+        ASTNode *n = stmts[i].node;
+        if (n->type == NODE_FN_DECL)
+            stmt_list_add(&module_name(names, n->fn_name, 1)->provides, i);
+        if (n->type == NODE_CLASS_DECL) {
+            stmt_list_add(&module_name(names, n->class_name, 1)->provides, i);
+            for (ASTNode *m = n->class_methods; m; m = m->next)
+                stmt_list_add(&module_name(names, m->fn_name, 1)->provides, i);
+        }
+    }
+
+    /* Propagate writes made inside called functions and methods to
+       their callers.  callers[j] lists the statements that use code
+       statement j provides; a statement whose writes grow is queued so
+       its own callers pick them up. */
+    StmtList *callers = calloc(count > 0 ? count : 1, sizeof(StmtList));
+    for (i = 0; i < count; i++) {
+        for (int u = 0; u < stmts[i].uses.count; u++) {
+            ModuleName *mn = module_name(names, stmts[i].uses.names[u], 0);
+            for (int p = 0; mn && p < mn->provides.count; p++)
+                if (mn->provides.items[p] != i)
+                    stmt_list_add(&callers[mn->provides.items[p]], i);
+        }
+    }
+    int *queue = malloc((count > 0 ? count : 1) * sizeof(int));
+    char *queued = calloc(count > 0 ? count : 1, 1);
+    int queue_len = 0;
+    for (i = 0; i < count; i++) {
+        if (callers[i].count > 0 && stmts[i].writes.count > 0) {
+            queue[queue_len++] = i;
+            queued[i] = 1;
+        }
+    }
+    while (queue_len > 0) {
+        int j = queue[--queue_len];
+        queued[j] = 0;
+        for (int c = 0; c < callers[j].count; c++) {
+            int k = callers[j].items[c];
+            int changed = 0;
+            for (int w = 0; w < stmts[j].writes.count; w++)
+                changed |= name_set_add(&stmts[k].writes, stmts[j].writes.names[w]);
+            if (changed && callers[k].count > 0 && !queued[k]) {
+                queue[queue_len++] = k;
+                queued[k] = 1;
+            }
+        }
+    }
+    for (i = 0; i < count; i++)
+        free(callers[i].items);
+    free(callers);
+    free(queue);
+    free(queued);
+
+    /* Index the statements that affect each name, in source order */
+    for (i = 0; i < count; i++) {
+        if (stmts[i].defines)
+            stmt_list_add(&module_name(names, stmts[i].defines, 1)->affects, i);
+        for (int w = 0; w < stmts[i].writes.count; w++) {
+            if (stmts[i].defines && strcmp(stmts[i].writes.names[w], stmts[i].defines) == 0)
+                continue;
+            stmt_list_add(&module_name(names, stmts[i].writes.names[w], 1)->affects, i);
+        }
+    }
+
+    *out_count = count;
+    return stmts;
+}
+
+typedef struct {
+    const char *abs_path;   /* owned by the import module cache */
+    ASTNode *ast;
+    const char *source;
+    FnTable ft;
+    ClassTable ct;
+    EnumTable et;
+    SymTable st;            /* evaluated top-level symbols */
+    ImportedVar *nested_vars;
+    int nested_var_count;
+    ModuleStmt *stmts;      /* top-level statements, in source order */
+    int stmt_count;
+    ModuleNames names;      /* statements by the names they bear on */
+    char *needed;           /* per statement: required by some import */
+    char *done;             /* per statement: already evaluated */
+    int last_done;          /* highest evaluated statement index, or -1 */
+} EvaluatedModule;
+
+static EvaluatedModule *g_eval_modules = NULL;
+static int g_eval_module_count = 0;
+static int g_eval_module_cap = 0;
+static PathTable g_eval_module_index;   /* canonical path -> index */
+
+static EvaluatedModule *eval_module_find(const char *abs_path) {
+    if (!g_eval_module_index.slots) return NULL;
+    PathSlot *slot = path_table_find(&g_eval_module_index, abs_path);
+    return slot ? &g_eval_modules[slot->value] : NULL;
+}
+
+/* Start (or restart) top-level evaluation from an empty symbol table
+   holding only the module's own imported variables */
+static void eval_module_reset_symbols(EvaluatedModule *mod) {
+    sym_table_init(&mod->st);
+    for (int i = 0; i < mod->nested_var_count; i++) {
+        sym_add(&mod->st, mod->nested_vars[i].name, mod->nested_vars[i].val,
+                mod->nested_vars[i].is_const, (SourceLoc){0, 0});
+        mod->st.syms[mod->st.count - 1].mutated = 1;
+    }
+    memset(mod->done, 0, mod->stmt_count > 0 ? mod->stmt_count : 1);
+    mod->last_done = -1;
+}
+
+/* Open an imported module: process its own imports, collect its
+   declarations and build its dependency graph, and add it to the
+   cache.  No top-level statement is evaluated yet. */
+static EvaluatedModule *eval_module_load(ASTNode *imported_ast, const char *imported_source,
+                                         const char *imported_filename) {
+    /* Save/restore diagnostic context for the imported file */
+    DiagContext saved_ctx = diag_save();
+    diag_init(imported_filename, imported_source);
+
+    EvaluatedModule mod;
+    mod.abs_path = imported_filename;
+    mod.ast = imported_ast;
+    mod.source = imported_source;
+    fn_table_init(&mod.ft);
+    class_table_init(&mod.ct);
+    enum_table_init(&mod.et);
+
+    /* Recursively process the imported file's own imports first */
+    int nested_var_cap = 8;
+    mod.nested_var_count = 0;
+    mod.nested_vars = malloc(nested_var_cap * sizeof(ImportedVar));
+    import_push_file(imported_filename);
+    process_imports(imported_ast, imported_filename, &mod.ft, &mod.ct, &mod.et,
+                    &mod.nested_vars, &mod.nested_var_count, &nested_var_cap);
+    import_pop_file();
+
+    collect_declarations(imported_ast, &mod.ft, &mod.ct, &mod.et);
+
+    memset(&mod.names, 0, sizeof(mod.names));
+    mod.stmts = module_stmts_build(imported_ast, &mod.stmt_count, &mod.names);
+    mod.needed = calloc(mod.stmt_count > 0 ? mod.stmt_count : 1, 1);
+    mod.done = calloc(mod.stmt_count > 0 ? mod.stmt_count : 1, 1);
+    eval_module_reset_symbols(&mod);
+
+    diag_restore(saved_ctx);
+
+    if (g_eval_module_count == g_eval_module_cap) {
+        g_eval_module_cap = g_eval_module_cap ? g_eval_module_cap * 2 : 8;
+        g_eval_modules = realloc(g_eval_modules, g_eval_module_cap * sizeof(EvaluatedModule));
+    }
+    if (!g_eval_module_index.slots) path_table_init(&g_eval_module_index);
+    path_table_put(&g_eval_module_index, mod.abs_path, g_eval_module_count);
+    g_eval_modules[g_eval_module_count] = mod;
+    return &g_eval_modules[g_eval_module_count++];
+}
+
+/* Evaluate the top-level statements that the given symbols depend on.
+   A statement is needed if it declares or assigns a needed name; the
+   names it reads then become needed in turn. */
+static void eval_module_require(EvaluatedModule *mod, char **names, int name_count) {
+    NameSet work = {0};
+    for (int i = 0; i < name_count; i++)
+        name_set_add(&work, names[i]);
+
+    int restart = 0;
+    for (int w = 0; w < work.count; w++) {
+        ModuleName *mn = module_name(&mod->names, work.names[w], 0);
+        for (int a = 0; mn && a < mn->affects.count; a++) {
+            int i = mn->affects.items[a];
+            ModuleStmt *s = &mod->stmts[i];
+            if (mod->needed[i])
+                continue;
+            mod->needed[i] = 1;
+            /* An earlier statement joining after later ones already ran
+               could observe their effects, so start over in order */
+            if (i < mod->last_done)
+                restart = 1;
+            for (int u = 0; u < s->uses.count; u++)
+                name_set_add(&work, s->uses.names[u]);
+        }
+    }
+    name_set_free(&work);
+
+    if (restart) {
+        sym_table_free(&mod->st);
+        eval_module_reset_symbols(mod);
+    }
+
+    DiagContext saved_ctx = diag_save();
+    diag_init(mod->abs_path, mod->source);
+
+    PrintList imp_prints;
+    print_list_init(&imp_prints);
+
+    FnTable *save_ft = g_ft;
+    ClassTable *save_ct = g_ct;
+    EnumTable *save_et = g_et;
+    PrintList *save_prints = g_prints;
+    g_ft = &mod->ft;
+    g_ct = &mod->ct;
+    g_et = &mod->et;
+    g_prints = &imp_prints;
+
+    for (int i = 0; i < mod->stmt_count; i++) {
+        if (!mod->needed[i] || mod->done[i])
+            continue;
+        ASTNode *n = mod->stmts[i].node;
+        ASTNode *next = n->next;
+        n->next = NULL;
+        eval_stmts(n, &mod->st, &mod->ft, &mod->ct, &imp_prints, NULL);
+        n->next = next;
+        mod->done[i] = 1;
+        mod->last_done = i;
+    }
+
+    g_ft = save_ft;
+    g_ct = save_ct;
+    g_et = save_et;
+    g_prints = save_prints;
+
+    print_list_free(&imp_prints);
+    diag_restore(saved_ctx);
+}
+
+static void eval_module_cache_free(void) {
+    for (int i = 0; i < g_eval_module_count; i++) {
+        EvaluatedModule *mod = &g_eval_modules[i];
+        fn_table_free(&mod->ft);
+        class_table_free(&mod->ct);
+        enum_table_free(&mod->et);
+        sym_table_free(&mod->st);
+        for (int j = 0; j < mod->nested_var_count; j++)
+            free(mod->nested_vars[j].name);
+        free(mod->nested_vars);
+        for (int j = 0; j < mod->stmt_count; j++) {
+            name_set_free(&mod->stmts[j].uses);
+            name_set_free(&mod->stmts[j].writes);
+        }
+        free(mod->stmts);
+        module_names_free(&mod->names);
+        free(mod->needed);
+        free(mod->done);
+    }
+    free(g_eval_modules);
+    g_eval_modules = NULL;
+    g_eval_module_count = 0;
+    g_eval_module_cap = 0;
+    path_table_free(&g_eval_module_index);
+}
+
 /* Process all imports for an AST, recursively handling transitive imports.
    source_file: absolute path of the file being processed.
    Populates fn_table, class_table, and imp_vars with imported symbols. */
@@ -3239,6 +6887,18 @@ static void process_imports(ASTNode *ast, const char *source_file,
             }
             continue;
         }
+        if (strcmp(n->import_path, "std/map") == 0) {
+            for (int i = 0; i < n->import_name_count; i++) {
+                const char *name = n->import_names[i];
+                if (stdlib_map_fn_index(name) >= 0) {
+                    stdlib_map_fn_import(name);
+                } else {
+                    diag_emit(n->loc, DIAG_ERROR, "'%s' not found in module '%s'",
+                              name, n->import_path);
+                }
+            }
+            continue;
+        }
         if (strcmp(n->import_path, "std/http") == 0) {
             for (int i = 0; i < n->import_name_count; i++) {
                 const char *name = n->import_names[i];
@@ -3273,59 +6933,10 @@ static void process_imports(ASTNode *ast, const char *source_file,
             continue;
         }
 
-        /* Save/restore diagnostic context for the imported file */
-        DiagContext saved_ctx = diag_save();
-        diag_init(imported_filename, imported_source);
-
-        /* Build temporary tables for the imported file */
-        FnTable imp_ft;
-        fn_table_init(&imp_ft);
-        ClassTable imp_ct;
-        class_table_init(&imp_ct);
-        EnumTable imp_et;
-        enum_table_init(&imp_et);
-
-        /* Recursively process the imported file's own imports first */
-        ImportedVar *nested_vars = malloc(8 * sizeof(ImportedVar));
-        int nested_var_count = 0, nested_var_cap = 8;
-        import_push_file(imported_filename);
-        process_imports(imported_ast, imported_filename, &imp_ft, &imp_ct, &imp_et,
-                        &nested_vars, &nested_var_count, &nested_var_cap);
-        import_pop_file();
-
-        collect_declarations(imported_ast, &imp_ft, &imp_ct, &imp_et);
-
-        /* Evaluate the imported file to resolve its top-level symbols */
-        SymTable imp_st;
-        sym_table_init(&imp_st);
-
-        /* Add nested imported variables */
-        for (int i = 0; i < nested_var_count; i++) {
-            sym_add(&imp_st, nested_vars[i].name, nested_vars[i].val,
-                    nested_vars[i].is_const, (SourceLoc){0, 0});
-            imp_st.syms[imp_st.count - 1].mutated = 1;
-        }
-
-        PrintList imp_prints;
-        print_list_init(&imp_prints);
-
-        FnTable *save_ft = g_ft;
-        ClassTable *save_ct = g_ct;
-        EnumTable *save_et = g_et;
-        PrintList *save_prints = g_prints;
-        g_ft = &imp_ft;
-        g_ct = &imp_ct;
-        g_et = &imp_et;
-        g_prints = &imp_prints;
-
-        eval_stmts(imported_ast, &imp_st, &imp_ft, &imp_ct, &imp_prints, NULL);
-
-        g_ft = save_ft;
-        g_ct = save_ct;
-        g_et = save_et;
-        g_prints = save_prints;
-
-        diag_restore(saved_ctx);
+        EvaluatedModule *mod = eval_module_find(imported_filename);
+        if (!mod)
+            mod = eval_module_load(imported_ast, imported_source, imported_filename);
+        eval_module_require(mod, n->import_names, n->import_name_count);
 
         /* Copy requested symbols into the caller's tables */
         for (int i = 0; i < n->import_name_count; i++) {
@@ -3347,13 +6958,20 @@ static void process_imports(ASTNode *ast, const char *source_file,
                     if (!imp_n->is_pub)
                         diag_emit(n->loc, DIAG_ERROR, "'%s' is not public in module '%s'",
                                   name, n->import_path);
-                    ClassDef *imp_cd = class_table_find(&imp_ct, name);
+                    ClassDef *imp_cd = class_table_find(&mod->ct, name);
                     if (imp_cd && !class_table_find(class_table, name)) {
                         if (class_table->count == class_table->cap) {
                             class_table->cap *= 2;
                             class_table->entries = realloc(class_table->entries, class_table->cap * sizeof(ClassDef));
                         }
-                        class_table->entries[class_table->count++] = *imp_cd;
+                        /* Field arrays are owned per table, so give the
+                           caller its own copy of the cached ones */
+                        ClassDef *cd = &class_table->entries[class_table->count++];
+                        *cd = *imp_cd;
+                        cd->field_names = malloc(cd->field_count * sizeof(char *));
+                        cd->field_types = malloc(cd->field_count * sizeof(ValueType));
+                        memcpy(cd->field_names, imp_cd->field_names, cd->field_count * sizeof(char *));
+                        memcpy(cd->field_types, imp_cd->field_types, cd->field_count * sizeof(ValueType));
                     }
                     found = 1;
                     break;
@@ -3362,7 +6980,7 @@ static void process_imports(ASTNode *ast, const char *source_file,
                     if (!imp_n->is_pub)
                         diag_emit(n->loc, DIAG_ERROR, "'%s' is not public in module '%s'",
                                   name, n->import_path);
-                    EnumDef *imp_ed = enum_table_find(&imp_et, name);
+                    EnumDef *imp_ed = enum_table_find(&mod->et, name);
                     if (imp_ed && !enum_table_find(enum_table, name)) {
                         if (enum_table->count == enum_table->cap) {
                             enum_table->cap *= 2;
@@ -3381,7 +6999,7 @@ static void process_imports(ASTNode *ast, const char *source_file,
                         if (!imp_n->is_pub)
                             diag_emit(n->loc, DIAG_ERROR, "'%s' is not public in module '%s'",
                                       name, n->import_path);
-                        Symbol *sym = sym_find(&imp_st, name);
+                        Symbol *sym = sym_find(&mod->st, name);
                         if (sym) {
                             if (*imp_var_count == *imp_var_cap) {
                                 *imp_var_cap *= 2;
@@ -3402,21 +7020,39 @@ static void process_imports(ASTNode *ast, const char *source_file,
                 diag_emit(n->loc, DIAG_ERROR, "'%s' not found in module '%s'",
                           name, n->import_path);
         }
+    }
+}
 
-        /* Clean up nested vars names (values are copied) */
-        for (int i = 0; i < nested_var_count; i++)
-            free(nested_vars[i].name);
-        free(nested_vars);
-
-        print_list_free(&imp_prints);
-        fn_table_free(&imp_ft);
-        class_table_free(&imp_ct);
-        enum_table_free(&imp_et);
-        sym_table_free(&imp_st);
+/* --dump-ir: the flat IR, then each function's CFG in SSA form.  The
+ * SSA round trip runs through the verifier on the way. */
+static void dump_ir(IRProgram *prog) {
+    printf("=== IR ===\n");
+    ir_dump(stdout, prog);
+
+    printf("\n=== SSA ===\n");
+    int *starts;
+    int n = ir_program_functions(prog, &starts);
+    for (int f = 0; f < n; f++) {
+        int end = f + 1 < n ? starts[f + 1] : prog->instr_count;
+        IRCfg cfg;
+        ir_cfg_build(&cfg, prog, starts[f], end);
+        if (ir_cfg_verify(&cfg))
+            diag_error_no_loc("internal error: malformed IR");
+        ir_ssa_construct(&cfg);
+        if (ir_cfg_verify(&cfg))
+            diag_error_no_loc("internal error: SSA construction produced invalid IR");
+        ir_cfg_dump(stdout, &cfg);
+        ir_ssa_destruct(&cfg);
+        if (ir_cfg_verify(&cfg))
+            diag_error_no_loc("internal error: leaving SSA produced invalid IR");
+        ir_cfg_free(&cfg);
     }
+    free(starts);
+    fflush(stdout);
 }
 
-int codegen(ASTNode *ast, const char *output_path, const char *source_file) {
+int codegen(ASTNode *ast, const char *output_path, const char *source_file,
+            const CodegenOptions *opts) {
     stdlib_reset();
 
     /* Pass 0: process imports */
@@ -3425,6 +7061,9 @@ int codegen(ASTNode *ast, const char *output_path, const char *source_file) {
         char *dir = dirname(source_copy);
         import_init(dir);
         free(source_copy);
+
+        /* Read and parse the whole import graph up front, in parallel */
+        import_prefetch(source_file, ast);
     }
 
     /* First pass: collect function, class, and enum declarations */
@@ -3575,8 +7214,21 @@ int codegen(ASTNode *ast, const char *output_path, const char *source_file) {
     } else if (g_ir_mode) {
         /* IR mode — emit IR-based binary with runtime code */
         ir_emit_exit(&ir_prog);
+        ir_functions_finish(&ir_prog);
+        if (opts && opts->dump_ir)
+            dump_ir(&ir_prog);
+        if (opts && opts->opt_level > 0) {
+            int before = ir_prog.instr_count;
+            ir_optimize(&ir_prog, opts->opt_level, opts->unroll);
+            if (opts->dump_ir) {
+                printf("\n=== IR -O%d ===\n", opts->opt_level);
+                ir_dump(stdout, &ir_prog);
+                printf("\n%d instructions before, %d after\n", before, ir_prog.instr_count);
+                fflush(stdout);
+            }
+        }
         print_list_free(&prints);
-        result = emit_binary_ir(&ir_prog, output_path);
+        result = emit_binary_ir(&ir_prog, output_path, opts && opts->line_buffered);
     } else {
         /* Normal mode — emit print binary (all compile-time) */
         int string_count = prints.count;
@@ -3602,6 +7254,8 @@ int codegen(ASTNode *ast, const char *output_path, const char *source_file) {
         buf_free(&strings);
     }
 
+    /* Server and net binaries drop any runtime functions */
+    ir_functions_free();
     ir_free(&ir_prog);
     g_ir = NULL;
 
@@ -3612,6 +7266,7 @@ int codegen(ASTNode *ast, const char *output_path, const char *source_file) {
 
     /* Clean up import module cache (must be after codegen since fn_table
        entries may point into cached ASTs) */
+    eval_module_cache_free();
     if (source_file)
         import_cleanup();
 
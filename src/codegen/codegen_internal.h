@@ -115,6 +115,8 @@ int emit_net_binary(NetConfig *config, const char *output_path);
 
 #include "codegen/ir.h"
 
-int emit_binary_ir(IRProgram *prog, const char *output_path);
+/* line_buffered flushes the program's output buffer at every newline
+ * instead of only when it fills up and at exit */
+int emit_binary_ir(IRProgram *prog, const char *output_path, int line_buffered);
 
 #endif
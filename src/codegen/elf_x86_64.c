@@ -2,6 +2,7 @@
 
 #include "codegen_internal.h"
 #include "diagnostic.h"
+#include "codegen/ir_regalloc.h"
 
 #define ELF_HEADER_SIZE  64
 #define PHDR_SIZE        56
@@ -9,52 +10,98 @@
 #define BASE_ADDR        0x400000ULL
 #define ENTRY_ADDR       (BASE_ADDR + ELF_CODE_OFFSET)
 
+/* Helper: emit mov reg32, imm32 */
+static void emit_mov_r32_imm32(Buffer *c, uint8_t reg, uint32_t imm) {
+    buf_write8(c, 0xB8 + reg);  /* B8+rd */
+    buf_write32(c, imm);
+}
+
+/* Helper: emit syscall */
+static void emit_syscall(Buffer *c) {
+    buf_write8(c, 0x0F);
+    buf_write8(c, 0x05);
+}
+
+/* Helper: patch a 32-bit relative displacement at a given offset */
+static void patch_rel32(Buffer *c, int patch_offset, int target) {
+    int32_t disp = target - (patch_offset + 4);
+    memcpy(c->data + patch_offset, &disp, 4);
+}
+
 /*
- * Per print statement (24 bytes):
- *   mov eax, 1              ; B8 01 00 00 00   (sys_write)
- *   mov edi, 1              ; BF 01 00 00 00   (stdout)
+ * Output that is contiguous in the string data is written by one loop
+ * per run (write may be partial, e.g. into a full pipe):
+ *
  *   lea rsi, [rip+disp32]   ; 48 8D 35 XX XX XX XX
  *   mov edx, <len>          ; BA XX XX XX XX
+ * loop:
+ *   test rdx, rdx           ; 48 85 D2
+ *   jle done                ; 7E XX
+ *   mov eax, 1              ; B8 01 00 00 00   (sys_write)
+ *   mov edi, 1              ; BF 01 00 00 00   (stdout)
  *   syscall                 ; 0F 05
+ *   test rax, rax           ; 48 85 C0         (error: give up)
+ *   jle done                ; 7E XX
+ *   add rsi, rax            ; 48 01 C6
+ *   sub rdx, rax            ; 48 29 C2
+ *   jmp loop                ; EB XX
+ * done:
  *
  * Exit (9 bytes):
  *   mov eax, 60             ; B8 3C 00 00 00   (sys_exit)
  *   xor edi, edi            ; 31 FF             (status 0)
  *   syscall                 ; 0F 05
  */
-#define PRINT_INSTR_SIZE 24
-#define EXIT_INSTR_SIZE  9
-
 int emit_binary(int string_count, int *str_offsets, int *str_lengths_arr,
                 Buffer *strings, const char *output_path)
 {
-    int total_instr_size = string_count * PRINT_INSTR_SIZE + EXIT_INSTR_SIZE;
-
     Buffer code;
     buf_init(&code);
 
-    for (int i = 0; i < string_count; i++) {
-        int32_t rip_after_lea = i * PRINT_INSTR_SIZE + 17;
-        int32_t target = total_instr_size + str_offsets[i];
-        int32_t disp = target - rip_after_lea;
+    /* lea displacements to fill in once the data offset is known */
+    int *lea_patch = malloc((string_count > 0 ? string_count : 1) * sizeof(int));
+    int *lea_target = malloc((string_count > 0 ? string_count : 1) * sizeof(int));
+    int runs = 0;
+
+    for (int i = 0; i < string_count; ) {
+        int start = str_offsets[i], len = 0;
+        while (i < string_count && str_offsets[i] == start + len)
+            len += str_lengths_arr[i++];
+        if (len == 0)
+            continue;
 
-        /* mov eax, 1 */
-        buf_write8(&code, 0xB8);
-        buf_write32(&code, 1);
-        /* mov edi, 1 */
-        buf_write8(&code, 0xBF);
-        buf_write32(&code, 1);
         /* lea rsi, [rip+disp32] */
         buf_write8(&code, 0x48);
         buf_write8(&code, 0x8D);
         buf_write8(&code, 0x35);
-        buf_write32(&code, (uint32_t)disp);
+        lea_patch[runs] = code.len;
+        lea_target[runs++] = start;
+        buf_write32(&code, 0);
         /* mov edx, <len> */
         buf_write8(&code, 0xBA);
-        buf_write32(&code, (uint32_t)str_lengths_arr[i]);
-        /* syscall */
-        buf_write8(&code, 0x0F);
-        buf_write8(&code, 0x05);
+        buf_write32(&code, (uint32_t)len);
+
+        int loop = code.len;
+        /* test rdx, rdx; jle done */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x7E);
+        int jle_empty = code.len;
+        buf_write8(&code, 0x00);
+        emit_mov_r32_imm32(&code, 0, 1);    /* sys_write */
+        emit_mov_r32_imm32(&code, 7, 1);    /* stdout */
+        emit_syscall(&code);
+        /* test rax, rax; jle done */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x7E);
+        int jle_error = code.len;
+        buf_write8(&code, 0x00);
+        /* add rsi, rax; sub rdx, rax; jmp loop */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xC6);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x29); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(loop - (code.len + 1)));
+        code.data[jle_empty] = (uint8_t)(code.len - jle_empty - 1);
+        code.data[jle_error] = (uint8_t)(code.len - jle_error - 1);
     }
 
     /* exit(0) */
@@ -65,6 +112,12 @@ int emit_binary(int string_count, int *str_offsets, int *str_lengths_arr,
     buf_write8(&code, 0x0F);
     buf_write8(&code, 0x05);
 
+    /* The string data follows the code */
+    for (int r = 0; r < runs; r++)
+        patch_rel32(&code, lea_patch[r], code.len + lea_target[r]);
+    free(lea_patch);
+    free(lea_target);
+
     buf_write(&code, strings->data, strings->len);
 
     uint64_t file_size = ELF_CODE_OFFSET + code.len;
@@ -148,24 +201,6 @@ int emit_binary(int string_count, int *str_offsets, int *str_lengths_arr,
  *   - sockaddr_in struct
  * ================================================================ */
 
-/* Helper: emit mov reg32, imm32 */
-static void emit_mov_r32_imm32(Buffer *c, uint8_t reg, uint32_t imm) {
-    buf_write8(c, 0xB8 + reg);  /* B8+rd */
-    buf_write32(c, imm);
-}
-
-/* Helper: emit syscall */
-static void emit_syscall(Buffer *c) {
-    buf_write8(c, 0x0F);
-    buf_write8(c, 0x05);
-}
-
-/* Helper: patch a 32-bit relative displacement at a given offset */
-static void patch_rel32(Buffer *c, int patch_offset, int target) {
-    int32_t disp = target - (patch_offset + 4);
-    memcpy(c->data + patch_offset, &disp, 4);
-}
-
 int emit_http_binary(HttpRouteEntry *routes, int route_count, int port,
                      const char *output_path)
 {
@@ -728,7 +763,8 @@ static uint32_t parse_ipv4(const char *host) {
     return (uint32_t)((a) | (b << 8) | (c << 16) | (d << 24));
 }
 
-static void emit_elf_with_code(Buffer *code, const char *output_path) {
+/* bss_size zeroed bytes follow the file image in memory */
+static void emit_elf_with_code(Buffer *code, uint64_t bss_size, const char *output_path) {
     int phdr_count = 1;
     int elf_code_offset = ELF_HEADER_SIZE + PHDR_SIZE * phdr_count;
     uint64_t file_size = elf_code_offset + code->len;
@@ -769,7 +805,7 @@ static void emit_elf_with_code(Buffer *code, const char *output_path) {
     buf_write64(&out, base_addr);     /* p_vaddr */
     buf_write64(&out, base_addr);     /* p_paddr */
     buf_write64(&out, file_size);     /* p_filesz */
-    buf_write64(&out, file_size + 8192); /* p_memsz (extra for stack/buffers) */
+    buf_write64(&out, file_size + 8192 + bss_size); /* p_memsz (extra for stack/buffers) */
     buf_write64(&out, 0x1000);        /* p_align */
 
     buf_write(&out, code->data, code->len);
@@ -1211,7 +1247,7 @@ int emit_net_binary(NetConfig *config, const char *output_path)
     buf_write(&code, data.data, data.len);
 
     /* Emit ELF */
-    emit_elf_with_code(&code, output_path);
+    emit_elf_with_code(&code, 0, output_path);
 
     buf_free(&code);
     buf_free(&data);
@@ -1221,66 +1257,1187 @@ int emit_net_binary(NetConfig *config, const char *output_path)
 /* ================================================================
  * emit_binary_ir — emit an ELF binary from IR instructions
  *
- * Stack frame layout:
+ * The program is the main body (up to its IR_EXIT) followed by the
+ * out-of-line functions, each opened by an IR_FUNC.  Each of them has
+ * its slots and vregs allocated to registers by ir_regalloc (linear
+ * scan over r10, r11, rsi, rdi, r8, r9, rbx, r12, r14, r15, and over
+ * xmm2 .. xmm15 for the floats that only the F-ops read); whatever
+ * does not fit lives in the function's own frame:
+ *
+ *   [rbp + 16 + 8*k]    stack argument 6+k (functions only)
+ *   [rbp + 8]           return address (functions only)
  *   [rbp + 0]           saved rbp
- *   [rbp - 8]           local slot 0
- *   [rbp - 16]          local slot 1
+ *   [rbp - 8]           first spilled value
  *   ...
- *   [rbp - 8*N]         local slot N-1
- *   [rbp - 8*(N+1)]     vreg temp 0
- *   [rbp - 8*(N+2)]     vreg temp 1
+ *   [rbp - 8*N]         last spilled value
+ *   [rbp - 8*(N+1)]     saved callee-saved registers (functions only)
  *   ...
  *
- * All vregs and locals live on the stack (no register allocator).
- * Expressions use rax, rcx, rdx as temporaries.
+ * Calls follow the System V convention: the first six integer
+ * arguments go in rdi, rsi, rdx, rcx, r8, r9, the rest are pushed
+ * right to left, rsp is 16-byte aligned at each call and the result
+ * comes back in rax.  r13 (data base) is never written after startup,
+ * so it survives calls without saving.
+ *
+ * Expressions use rax, rcx, rdx as temporaries, and the F-ops xmm0
+ * and xmm1; those are never allocated.  No xmm register survives a
+ * call, so floats only stay in them between calls.
+ *
+ * Output goes through a buffer in the zero-filled memory after the
+ * data: prints append to it with the out_write routine, which writes
+ * it out when the next piece does not fit, and IR_EXIT flushes what is
+ * left.  In line-buffered mode every print of a string holding a
+ * newline flushes too.
+ *
+ * The constant tables of IR_LOAD_ELEM are in the data section, each at
+ * the narrowest width that holds its values and loaded sign-extended.
+ * A failed bounds check jumps to bounds_fail, which flushes the output,
+ * reports the error on stderr and exits with status 1; a division by
+ * zero or of INT64_MIN by -1 fails the same way instead of trapping.
+ *
+ * Programs with IR_ALLOC or IR_FREE get a heap allocator built on mmap,
+ * its state after the output buffer (see the heap routines below).
+ * String values point at a header in the data section for constants
+ * or in a heap block; the string routines build and compare them.
+ * Arrays are laid out the same way around their first element, which
+ * is 64-byte aligned so the array routines can read whole vectors.
  * ================================================================ */
 
-/* Helper: offset from rbp for a vreg */
-static int vreg_offset(int vreg, int slot_count) {
-    return -8 * (slot_count + vreg + 1);
+/* Registers the allocator may hand out, in order of preference.  The
+ * caller-saved ones come first; ir_x86_clobbers keeps them away from
+ * values live across anything that overwrites them.  rax, rcx and rdx
+ * stay free as scratch for the lowering and r13 holds the data base.
+ * After these come xmm2 .. xmm15, the second class, for floats. */
+static const int ir_x86_regs[] = { 10, 11, 6, 7, 8, 9, 3, 12, 14, 15 };
+#define IR_X86_GPRS 10
+#define IR_X86_CALLER_SAVED 6   /* r10, r11, rsi, rdi, r8, r9 */
+#define IR_X86_XMMS 14          /* xmm2 .. xmm15 */
+#define IR_X86_XMM_MASK (((1u << IR_X86_XMMS) - 1) << IR_X86_GPRS)
+
+/* Pool registers (bits over ir_x86_regs, then the xmm registers) an
+ * instruction destroys.  The runtime routines and calls may use any
+ * vector register. */
+static unsigned ir_x86_clobbers(const IRInstr *ir) {
+    switch (ir->op) {
+    case IR_CALL:
+        return IR_X86_XMM_MASK | ((1u << IR_X86_CALLER_SAVED) - 1);
+    case IR_PRINT_INT:                      /* itoa_print: r11, rsi, rdi, r8, r9 */
+        return IR_X86_XMM_MASK | 0x3E;
+    case IR_PRINT_STR: case IR_PRINT_BOOL:  /* write: r11, rsi, rdi */
+    case IR_PRINT_STR_VAL:
+        return IR_X86_XMM_MASK | 0x0E;
+    case IR_PARAM:                          /* incoming rsi, rdi, r8, r9 */
+        return 0x3C;
+    case IR_ALLOC: case IR_FREE:
+    case IR_STR_CONCAT: case IR_STR_APPEND: case IR_STR_FROM_INT:
+    case IR_STR_FROM_FLOAT: case IR_STR_EQ: case IR_STR_CMP: case IR_STR_RELEASE:
+    case IR_ARR_COPY: case IR_ARR_PUSH: case IR_ARR_SUM: case IR_ARR_MIN:
+    case IR_ARR_MAX: case IR_ARR_INDEX_OF: case IR_ARR_FSUM: case IR_ARR_FMIN:
+    case IR_ARR_FMAX: case IR_ARR_FINDEX_OF: case IR_ARR_RELEASE:
+    case IR_MAP_NEW: case IR_MAP_GET: case IR_MAP_HAS: case IR_MAP_SET:
+    case IR_MAP_REMOVE: case IR_MAP_KEYS: case IR_MAP_RELEASE:
+    case IR_OBJ_RELEASE: case IR_PRINT_FLOAT: case IR_EXIT:
+        return IR_X86_XMM_MASK;
+    default:
+        return 0;
+    }
+}
+
+/* Keys (as in ir_regalloc) that may live in an xmm register: those
+ * defined and read only by the F-ops, constants and copies between
+ * slots and vregs, at least one F-op or a copy of such a key among
+ * them.  Those instructions are the only ones lowered for xmm homes.
+ * A constant copied into a float does not make the other copies of it
+ * floats, since the same vreg may stand for an int 0 too. */
+static char *ir_x86_float_keys(const IRProgram *prog) {
+    int nkeys = prog->next_slot + prog->next_vreg;
+    char *ok = malloc(nkeys > 0 ? nkeys : 1);
+    char *fl = calloc(nkeys > 0 ? nkeys : 1, 1);
+    char *konst = calloc(nkeys > 0 ? nkeys : 1, 1);
+    memset(ok, 1, nkeys);
+    for (int i = 0; i < prog->instr_count; i++) {
+        const IRInstr *ir = &prog->instrs[i];
+        int uses[IR_MAX_USES];
+        int nu = ir_instr_uses(ir, uses);
+        int d = ir_instr_def(ir);
+        switch (ir->op) {
+        case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV:
+            fl[prog->next_slot + ir->dst] = 1;
+            /* fall through */
+        case IR_FCMP:
+            fl[prog->next_slot + ir->lhs] = fl[prog->next_slot + ir->rhs] = 1;
+            break;
+        case IR_INT_TO_FLOAT:
+            fl[prog->next_slot + ir->dst] = 1;
+            ok[prog->next_slot + ir->src] = 0;
+            break;
+        case IR_CONST_INT:
+            konst[prog->next_slot + ir->dst] = 1;
+            break;
+        case IR_LOAD_LOCAL: case IR_STORE_LOCAL:
+            break;
+        default:
+            for (int u = 0; u < nu; u++) ok[prog->next_slot + uses[u]] = 0;
+            if (d >= 0) ok[prog->next_slot + d] = 0;
+            break;
+        }
+        if (ir->op == IR_FCMP) ok[prog->next_slot + ir->dst] = 0;
+    }
+
+    /* Spread along the copies to the keys they connect */
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < prog->instr_count; i++) {
+            const IRInstr *ir = &prog->instrs[i];
+            if (ir->op != IR_LOAD_LOCAL && ir->op != IR_STORE_LOCAL) continue;
+            int a = ir->slot;
+            int b = prog->next_slot + (ir->op == IR_LOAD_LOCAL ? ir->dst : ir->src);
+            if (!ok[a] || !ok[b] || fl[a] == fl[b] || (fl[b] && konst[b])) continue;
+            fl[a] = fl[b] = 1;
+            changed = 1;
+        }
+    }
+    for (int k = 0; k < nkeys; k++) fl[k] = fl[k] && ok[k];
+    free(konst);
+    free(ok);
+    return fl;
+}
+
+/* Operand of an IR_BR_CMP that fits a sign-extended imm32 and is
+ * compared as one: 1 for rhs, 0 for lhs (the comparison is then
+ * swapped), -1 if both need a home */
+static int br_cmp_imm(const IRInstr *ir, const char *is_const, const int64_t *const_val) {
+    if (is_const[ir->rhs] && const_val[ir->rhs] >= INT32_MIN && const_val[ir->rhs] <= INT32_MAX)
+        return 1;
+    if (is_const[ir->lhs] && const_val[ir->lhs] >= INT32_MIN && const_val[ir->lhs] <= INT32_MAX)
+        return 0;
+    return -1;
+}
+
+static const IRRegTarget ir_x86_target = {
+    IR_X86_GPRS + IR_X86_XMMS,
+    IR_X86_GPRS,
+    ir_x86_clobbers,
+};
+
+/* Frame of one IR function.  Values are keyed as in ir_regalloc (slot
+ * s is key s, vreg v is key nslots + v).  Those the allocator left
+ * without a register get an 8-byte stack cell, numbered in order of
+ * first appearance, followed by the save area for the callee-saved
+ * registers the function uses, then the cells of the objects its
+ * IR_STACK_ALLOCs place, in order.  reg[] and cell[] are reused from
+ * one function to the next. */
+typedef struct {
+    int *reg;           /* index into ir_x86_regs, then xmm2 on; -1 if spilled */
+    int *cell;          /* stack cell of spilled values, -1 elsewhere */
+    int nslots;         /* prog->next_slot */
+    int start, end;     /* instructions whose cells are set */
+    unsigned saved;     /* callee-saved registers to preserve (bits over ir_x86_regs) */
+    int save_cell;      /* cell of the first one */
+    int obj_cell;       /* first cell of the next IR_STACK_ALLOC's object */
+    int size;           /* bytes reserved below the saved rbp */
+    char *floats;       /* keys that may live in xmm registers (ir_x86_float_keys) */
+} IRFrame;
+
+static void frame_cell_add(IRFrame *f, int key, int *cells) {
+    if (f->reg[key] < 0 && f->cell[key] < 0) f->cell[key] = (*cells)++;
+}
+
+/* Visit every key of instructions [start, end) */
+static void frame_assign(IRFrame *f, IRProgram *prog, int start, int end,
+                         int *cells, int reset) {
+    for (int i = start; i < end; i++) {
+        IRInstr *ir = &prog->instrs[i];
+        int keys[4];
+        int n = ir_instr_uses(ir, keys);
+        int d = ir_instr_def(ir);
+        for (int k = 0; k < n; k++) keys[k] += f->nslots;
+        if (d >= 0) keys[n++] = f->nslots + d;
+        if (ir->op == IR_LOAD_LOCAL || ir->op == IR_STORE_LOCAL)
+            keys[n++] = ir->slot;
+        for (int k = 0; k < n; k++) {
+            if (reset) f->cell[keys[k]] = -1;
+            else frame_cell_add(f, keys[k], cells);
+        }
+    }
+}
+
+/* Allocate registers and lay out the frame for instructions [start,
+ * end).  is_entry marks the main body, which starts with rsp 16-byte
+ * aligned instead of having a return address pushed, and so needs 8
+ * extra bytes to keep calls aligned; it never returns, so it saves no
+ * registers either. */
+static void ir_frame_layout(IRFrame *f, IRProgram *prog, int start, int end, int is_entry) {
+    if (!f->cell) {
+        int n = prog->next_slot + prog->next_vreg;
+        f->nslots = prog->next_slot;
+        f->reg = malloc((n > 0 ? n : 1) * sizeof(int));
+        f->cell = malloc((n > 0 ? n : 1) * sizeof(int));
+        for (int k = 0; k < n; k++) f->reg[k] = f->cell[k] = -1;
+        f->floats = ir_x86_float_keys(prog);
+    } else {
+        frame_assign(f, prog, f->start, f->end, NULL, 1);
+    }
+    f->start = start;
+    f->end = end;
+
+    unsigned handed = ir_regalloc(prog, start, end, &ir_x86_target, f->floats, f->reg);
+    int cells = 0;
+    frame_assign(f, prog, start, end, &cells, 0);
+    f->saved = is_entry ? 0 : handed & ((1u << IR_X86_GPRS) - 1) & ~((1u << IR_X86_CALLER_SAVED) - 1);
+    f->save_cell = cells;
+    for (int r = 0; r < IR_X86_GPRS; r++)
+        if ((f->saved >> r) & 1) cells++;
+    f->obj_cell = cells;
+    for (int i = start; i < end; i++)
+        if (prog->instrs[i].op == IR_STACK_ALLOC)
+            cells += (int)((prog->instrs[i].imm + 7) / 8);
+
+    /* Align frame size to 16 bytes */
+    f->size = ((cells * 8) + 15) & ~15;
+    if (is_entry) {
+        if (f->size < 16) f->size = 16;
+        f->size += 8;
+    }
+}
+
+/* Helper: key of a vreg */
+static int vkey(const IRFrame *f, int vreg) {
+    return f->nslots + vreg;
+}
+
+/* Helper: general register holding the value of key, or -1 if it is on
+ * the stack (or in an xmm register) */
+static int home_reg(const IRFrame *f, int key) {
+    return f->reg[key] >= 0 && f->reg[key] < IR_X86_GPRS ? ir_x86_regs[f->reg[key]] : -1;
+}
+
+/* Helper: xmm register holding the value of key, or -1.  Only the keys
+ * of frame.floats get one, and only the instructions that define or
+ * read those handle it. */
+static int home_xmm(const IRFrame *f, int key) {
+    return f->reg[key] >= IR_X86_GPRS ? f->reg[key] - IR_X86_GPRS + 2 : -1;
+}
+
+/* Helper: emit push rbp; mov rbp, rsp; sub rsp, size */
+static void emit_ir_prologue(Buffer *c, int size) {
+    buf_write8(c, 0x55);
+    buf_write8(c, 0x48); buf_write8(c, 0x89); buf_write8(c, 0xE5);
+    buf_write8(c, 0x48); buf_write8(c, 0x81); buf_write8(c, 0xEC);
+    buf_write32(c, (uint32_t)size);
 }
 
-/* Helper: offset from rbp for a local slot */
-static int slot_offset(int slot) {
-    return -8 * (slot + 1);
+/* System V integer argument registers: rdi, rsi, rdx, rcx, r8, r9 */
+static const int sysv_arg_regs[6] = { 7, 6, 2, 1, 8, 9 };
+
+/* Helper: emit REX.W, opcode and a ModRM whose reg field is reg and
+ * whose r/m is the home of key: its register, or [rbp + disp32].
+ * Opcodes above 0xFF are two bytes (0x0F xx). */
+static void emit_op_home(Buffer *c, int opcode, int reg, const IRFrame *f, int key) {
+    int rm = home_reg(f, key);
+    buf_write8(c, 0x48 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0));
+    if (opcode > 0xFF) buf_write8(c, (uint8_t)(opcode >> 8));
+    buf_write8(c, (uint8_t)opcode);
+    if (rm >= 0) {
+        buf_write8(c, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+    } else {
+        buf_write8(c, 0x85 | ((reg & 7) << 3));
+        buf_write32(c, (uint32_t)(int32_t)(-8 * (f->cell[key] + 1)));
+    }
 }
 
-/* Helper: emit mov rax, [rbp + disp32] */
-static void emit_load_rbp(Buffer *c, int disp) {
-    /* mov rax, [rbp + disp32] */
-    buf_write8(c, 0x48); buf_write8(c, 0x8B); buf_write8(c, 0x85);
+/* Helper: emit mov reg, [rbp + disp32] for any of the 16 GPRs */
+static void emit_load_rbp_reg(Buffer *c, int reg, int disp) {
+    buf_write8(c, 0x48 | (reg >= 8 ? 0x04 : 0));
+    buf_write8(c, 0x8B);
+    buf_write8(c, 0x85 | ((reg & 7) << 3));
     buf_write32(c, (uint32_t)(int32_t)disp);
 }
 
-/* Helper: emit mov [rbp + disp32], rax */
-static void emit_store_rbp_rax(Buffer *c, int disp) {
-    /* mov [rbp + disp32], rax */
-    buf_write8(c, 0x48); buf_write8(c, 0x89); buf_write8(c, 0x85);
+/* Helper: emit mov [rbp + disp32], reg for any of the 16 GPRs */
+static void emit_store_rbp_reg(Buffer *c, int reg, int disp) {
+    buf_write8(c, 0x48 | (reg >= 8 ? 0x04 : 0));
+    buf_write8(c, 0x89);
+    buf_write8(c, 0x85 | ((reg & 7) << 3));
     buf_write32(c, (uint32_t)(int32_t)disp);
 }
 
-/* Helper: emit mov rcx, [rbp + disp32] */
-static void emit_load_rbp_rcx(Buffer *c, int disp) {
-    /* mov rcx, [rbp + disp32] */
-    buf_write8(c, 0x48); buf_write8(c, 0x8B); buf_write8(c, 0x8D);
+/* Helper: emit REX.W, opcode and a ModRM whose reg field is reg and
+ * whose r/m is [base + disp32], with the SIB byte rsp and r12 need */
+static void emit_op_mem(Buffer *c, int opcode, int reg, int base, int disp) {
+    buf_write8(c, 0x48 | (reg >= 8 ? 0x04 : 0) | (base >= 8 ? 0x01 : 0));
+    buf_write8(c, (uint8_t)opcode);
+    buf_write8(c, (uint8_t)(0x80 | ((reg & 7) << 3) | (base & 7)));
+    if ((base & 7) == 4) buf_write8(c, 0x24);
     buf_write32(c, (uint32_t)(int32_t)disp);
 }
 
-/* Helper: emit mov rax, imm64 */
-static void emit_mov_rax_imm64(Buffer *c, int64_t imm) {
-    /* movabs rax, imm64 */
-    buf_write8(c, 0x48); buf_write8(c, 0xB8);
-    buf_write64(c, (uint64_t)imm);
+/* Helper: emit REX.W, opcode and a register-direct ModRM (reg, rm);
+ * opcodes above 0xFF are two bytes (0x0F xx) */
+static void emit_op_rr(Buffer *c, int opcode, int reg, int rm) {
+    buf_write8(c, 0x48 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0));
+    if (opcode > 0xFF) buf_write8(c, (uint8_t)(opcode >> 8));
+    buf_write8(c, (uint8_t)opcode);
+    buf_write8(c, (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+/* Helper: emit an SSE2 instruction between xmm and the home of key:
+ * its mandatory prefix, then REX.W, 0x0F, opcode and the ModRM as
+ * emit_op_home writes them.  With REX.W, 66 0F 6E is movq xmm, r/m64,
+ * 66 0F 7E movq r/m64, xmm and F2 0F 2A cvtsi2sd xmm, r/m64. */
+static void emit_sse_home(Buffer *c, int prefix, int opcode, int xmm, const IRFrame *f, int key) {
+    buf_write8(c, (uint8_t)prefix);
+    emit_op_home(c, 0x0F00 | opcode, xmm, f, key);
+}
+
+/* Helper: emit an SSE2 instruction between two xmm registers: prefix,
+ * REX if either is xmm8 or above, 0x0F, opcode, ModRM (reg, rm) */
+static void emit_sse_rr(Buffer *c, int prefix, int opcode, int reg, int rm) {
+    buf_write8(c, (uint8_t)prefix);
+    if (reg >= 8 || rm >= 8)
+        buf_write8(c, 0x40 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0));
+    buf_write8(c, 0x0F);
+    buf_write8(c, (uint8_t)opcode);
+    buf_write8(c, (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+/* Helper: emit the scalar double instruction F2 0F opcode with xmm as
+ * destination and the value of key as source: its xmm register, its
+ * stack cell, or xmm1 after movq xmm1, <its register> */
+static void emit_sd_home(Buffer *c, int opcode, int xmm, const IRFrame *f, int key) {
+    int x = home_xmm(f, key);
+    if (x < 0 && home_reg(f, key) >= 0) {
+        emit_sse_home(c, 0x66, 0x6E, 1, f, key);
+        x = 1;
+    }
+    if (x >= 0) emit_sse_rr(c, 0xF2, opcode, xmm, x);
+    else emit_sse_home(c, 0xF2, opcode, xmm, f, key);
+}
+
+/* Helper: emit movapd xmm, <value of key> (movq from a register or the
+ * stack) */
+static void emit_xmm_load(Buffer *c, int xmm, const IRFrame *f, int key) {
+    int x = home_xmm(f, key);
+    if (x >= 0) {
+        if (x != xmm) emit_sse_rr(c, 0x66, 0x28, xmm, x);
+    } else {
+        emit_sse_home(c, 0x66, 0x6E, xmm, f, key);
+    }
+}
+
+/* Helper: emit movapd <value of key>, xmm (movq to a register or the
+ * stack) */
+static void emit_xmm_store(Buffer *c, const IRFrame *f, int key, int xmm) {
+    int x = home_xmm(f, key);
+    if (x >= 0) {
+        if (x != xmm) emit_sse_rr(c, 0x66, 0x28, x, xmm);
+    } else {
+        emit_sse_home(c, 0x66, 0x7E, xmm, f, key);
+    }
+}
+
+/* Helper: emit mov reg, <value of key> */
+static void emit_load_home(Buffer *c, int reg, const IRFrame *f, int key) {
+    if (home_reg(f, key) != reg)
+        emit_op_home(c, 0x8B, reg, f, key);
+}
+
+/* Helper: emit mov <value of key>, reg */
+static void emit_store_home(Buffer *c, const IRFrame *f, int key, int reg) {
+    if (home_reg(f, key) != reg)
+        emit_op_home(c, 0x89, reg, f, key);
+}
+
+/* Helper: copy the value of key src into key dst (through rax if both
+ * are on the stack) */
+static void emit_move_home(Buffer *c, const IRFrame *f, int dst, int src) {
+    int d = home_reg(f, dst), s = home_reg(f, src);
+    if (home_xmm(f, dst) >= 0) {
+        emit_xmm_load(c, home_xmm(f, dst), f, src);
+    } else if (home_xmm(f, src) >= 0) {
+        emit_xmm_store(c, f, dst, home_xmm(f, src));
+    } else if (d >= 0) {
+        emit_load_home(c, d, f, src);
+    } else if (s >= 0) {
+        emit_store_home(c, f, dst, s);
+    } else {
+        emit_load_home(c, 0, f, src);
+        emit_store_home(c, f, dst, 0);
+    }
+}
+
+/* Helper: set the value of key to imm */
+static void emit_const_home(Buffer *c, const IRFrame *f, int key, int64_t imm) {
+    int r = home_reg(f, key);
+    if (home_xmm(f, key) >= 0 && imm == 0) {
+        /* pxor x, x */
+        emit_sse_rr(c, 0x66, 0xEF, home_xmm(f, key), home_xmm(f, key));
+    } else if (home_xmm(f, key) >= 0) {
+        /* movabs rax, imm64; movq x, rax */
+        buf_write8(c, 0x48); buf_write8(c, 0xB8);
+        buf_write64(c, (uint64_t)imm);
+        buf_write8(c, 0x66);
+        emit_op_rr(c, 0x0F6E, home_xmm(f, key), 0);
+    } else if (r >= 0 && imm == 0) {
+        /* xor r32, r32 */
+        if (r >= 8) buf_write8(c, 0x45);
+        buf_write8(c, 0x31);
+        buf_write8(c, 0xC0 | ((r & 7) << 3) | (r & 7));
+    } else if (imm >= INT32_MIN && imm <= INT32_MAX) {
+        /* mov r/m64, simm32 */
+        emit_op_home(c, 0xC7, 0, f, key);
+        buf_write32(c, (uint32_t)(int32_t)imm);
+    } else {
+        /* movabs r, imm64 (through rax for a stack home) */
+        int t = r >= 0 ? r : 0;
+        buf_write8(c, 0x48 | (t >= 8 ? 0x01 : 0));
+        buf_write8(c, 0xB8 + (t & 7));
+        buf_write64(c, (uint64_t)imm);
+        emit_store_home(c, f, key, t);
+    }
+}
+
+/* Helper: save (or restore) the callee-saved registers of the frame */
+static void emit_callee_saves(Buffer *c, const IRFrame *f, int restore) {
+    int k = 0;
+    for (int r = 0; r < IR_X86_GPRS; r++) {
+        if (!((f->saved >> r) & 1)) continue;
+        int disp = -8 * (f->save_cell + k + 1);
+        if (restore) emit_load_rbp_reg(c, ir_x86_regs[r], disp);
+        else emit_store_rbp_reg(c, ir_x86_regs[r], disp);
+        k++;
+    }
+}
+
+/* Helper: save (or restore) the registers the map routines use
+ * besides rax, rcx and rdx: rbx, rsi, rdi and r8-r11 */
+static void emit_map_saves(Buffer *c, int restore) {
+    static const int regs[] = { 3, 6, 7, 8, 9, 10, 11 };
+    for (int k = 0; k < 7; k++) {
+        int r = regs[restore ? 6 - k : k];
+        if (r >= 8) buf_write8(c, 0x41);
+        buf_write8(c, (uint8_t)((restore ? 0x58 : 0x50) + (r & 7)));
+    }
+}
+
+/* Output buffer after the data (data_len bytes from r13): its fill
+ * count, then the bytes.  It starts a page past the end of the code;
+ * stores into a page that holds code make the CPU flush its pipeline
+ * for self-modifying code. */
+#define OUT_BUF_SIZE        65536
+#define OUT_FILL_OFFSET(data_len)   ((((data_len) + 15) & ~15) + 4096)
+#define OUT_BUF_OFFSET(data_len)    (OUT_FILL_OFFSET(data_len) + 16)
+
+/* Heap state after the output buffer: the next free address of the
+ * bump arena and its end, then the free list of each size class.  A
+ * block of class c is 2^c bytes, a 16-byte header followed by the
+ * memory handed out; requests too large for the biggest class get
+ * pages of their own. */
+#define HEAP_OFFSET(data_len)       (OUT_BUF_OFFSET(data_len) + OUT_BUF_SIZE)
+#define HEAP_FREE_LISTS     16      /* heads by class, from the state */
+#define HEAP_MIN_CLASS      5       /* 32-byte blocks */
+#define HEAP_MAX_CLASS      16      /* 64 KiB blocks */
+#define HEAP_STATE_SIZE     (HEAP_FREE_LISTS + 8 * (HEAP_MAX_CLASS + 1))
+#define HEAP_CHUNK          (1 << 20)   /* bytes mapped per arena refill */
+
+/* Flags of the array routines after the heap state: nonzero in the
+ * first byte if the CPU and the kernel support AVX2 */
+#define ARR_FLAGS_OFFSET(data_len)  (HEAP_OFFSET(data_len) + HEAP_STATE_SIZE)
+#define ARR_FLAGS_SIZE      8
+
+/* Pseudo labels for calls to the runtime routines */
+#define LABEL_ITOA      (-1)
+#define LABEL_OUT_WRITE (-2)
+#define LABEL_OUT_FLUSH (-3)
+#define LABEL_BOUNDS_FAIL (-4)
+#define LABEL_ALLOC     (-5)
+#define LABEL_FREE      (-6)
+#define LABEL_STR_CONCAT (-7)
+#define LABEL_STR_APPEND (-8)
+#define LABEL_STR_FROM_INT (-9)
+#define LABEL_STR_EQ    (-10)
+#define LABEL_STR_CMP   (-11)
+#define LABEL_ARR_COPY  (-12)
+#define LABEL_ARR_PUSH  (-13)
+#define LABEL_ARR_SUM   (-14)
+#define LABEL_ARR_MIN   (-15)
+#define LABEL_ARR_MAX   (-16)
+#define LABEL_ARR_INDEX_OF (-17)
+#define LABEL_MAP_NEW   (-18)
+#define LABEL_MAP_GET   (-19)
+#define LABEL_MAP_HAS   (-20)
+#define LABEL_MAP_SET   (-21)
+#define LABEL_MAP_REMOVE (-22)
+#define LABEL_MAP_KEYS  (-23)
+#define LABEL_MAP_RELEASE (-24)
+#define LABEL_PRINT_FLOAT (-25)
+#define LABEL_STR_FROM_FLOAT (-26)
+#define LABEL_ARR_FSUM  (-27)
+#define LABEL_ARR_FMIN  (-28)
+#define LABEL_ARR_FMAX  (-29)
+#define LABEL_ARR_FINDEX_OF (-30)
+#define LABEL_DIV_ZERO  (-31)
+#define LABEL_DIV_OVERFLOW (-32)
+
+/* A 32-bit field to fill in once every label has an offset: the rel32
+ * of a jump or call (a LABEL_* for the runtime routines), or a jump
+ * table entry, which holds its target relative to the table at base */
+typedef struct {
+    int code_offset;
+    int label_id;
+    int base;           /* start of the jump table, -1 for a rel32 */
+} JmpPatch;
+
+typedef struct {
+    JmpPatch *items;
+    int count;
+    int cap;
+} JmpPatchList;
+
+/* Helper: write a 32-bit placeholder to be patched to label_id */
+static void emit_patch32(Buffer *c, JmpPatchList *l, int label_id, int base) {
+    if (l->count == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 64;
+        l->items = realloc(l->items, l->cap * sizeof(JmpPatch));
+    }
+    l->items[l->count].code_offset = c->len;
+    l->items[l->count].label_id = label_id;
+    l->items[l->count].base = base;
+    l->count++;
+    buf_write32(c, 0);
+}
+
+/* Helper: emit jcc rel32 (cc is the second opcode byte, 0x84 for je) */
+static void emit_jcc_label(Buffer *c, JmpPatchList *l, uint8_t cc, int label_id) {
+    buf_write8(c, 0x0F);
+    buf_write8(c, cc);
+    emit_patch32(c, l, label_id, -1);
+}
+
+/* Helper: emit call rel32 to one of the runtime routines */
+static void emit_call_routine(Buffer *c, JmpPatchList *l, int routine) {
+    buf_write8(c, 0xE8);
+    emit_patch32(c, l, routine, -1);
+}
+
+/* Helper: emit an r13-relative ModRM (reg, [r13 + disp32]) after REX.WB
+ * and opcode */
+static void emit_r13_modrm(Buffer *c, int reg, int disp) {
+    buf_write8(c, 0x85 | ((reg & 7) << 3));
+    buf_write32(c, (uint32_t)disp);
+}
+
+/* Helper: emit cmp rax, imm (through rcx when imm needs 64 bits) */
+static void emit_cmp_rax_imm(Buffer *c, int64_t imm) {
+    if (imm >= INT32_MIN && imm <= INT32_MAX) {
+        buf_write8(c, 0x48); buf_write8(c, 0x3D);
+        buf_write32(c, (uint32_t)(int32_t)imm);
+    } else {
+        buf_write8(c, 0x48); buf_write8(c, 0xB9);          /* movabs rcx, imm64 */
+        buf_write64(c, (uint64_t)imm);
+        buf_write8(c, 0x48); buf_write8(c, 0x39); buf_write8(c, 0xC8); /* cmp rax, rcx */
+    }
+}
+
+/* Cases [lo, hi) of a switch on rax as a binary search: at most three
+ * compares in a row, otherwise split around the middle case */
+static void emit_switch_search(Buffer *c, JmpPatchList *l, const IRSwitch *sw,
+                               int lo, int hi, int default_label) {
+    if (hi - lo <= 3) {
+        for (int k = lo; k < hi; k++) {
+            emit_cmp_rax_imm(c, sw->values[k]);
+            emit_jcc_label(c, l, 0x84, sw->labels[k]);          /* je */
+        }
+        buf_write8(c, 0xE9);                                    /* jmp default */
+        emit_patch32(c, l, default_label, -1);
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    emit_cmp_rax_imm(c, sw->values[mid]);
+    emit_jcc_label(c, l, 0x84, sw->labels[mid]);                /* je */
+    buf_write8(c, 0x0F); buf_write8(c, 0x8C);                   /* jl lower half */
+    int lower = c->len;
+    buf_write32(c, 0);
+    emit_switch_search(c, l, sw, mid + 1, hi, default_label);
+    patch_rel32(c, lower, c->len);
+    emit_switch_search(c, l, sw, lo, mid, default_label);
+}
+
+/* Bytes per element of a constant table: the narrowest signed width
+ * that holds every value */
+static int table_width(const IRTable *t) {
+    int w = 1;
+    for (int k = 0; k < t->count; k++) {
+        int64_t v = t->values[k];
+        if (v < INT32_MIN || v > INT32_MAX) return 8;
+        if ((v < INT16_MIN || v > INT16_MAX) && w < 4) w = 4;
+        else if ((v < INT8_MIN || v > INT8_MAX) && w < 2) w = 2;
+    }
+    return w;
+}
+
+/* Helper: emit a sign-extending load of element index of a table that
+ * is width bytes per element at [r13 + offset] into reg */
+static void emit_load_table(Buffer *c, int reg, int index, int width, int offset) {
+    buf_write8(c, 0x49 | (reg >= 8 ? 0x04 : 0) | (index >= 8 ? 0x02 : 0));
+    switch (width) {
+    case 1:  buf_write8(c, 0x0F); buf_write8(c, 0xBE); break;  /* movsx r64, byte */
+    case 2:  buf_write8(c, 0x0F); buf_write8(c, 0xBF); break;  /* movsx r64, word */
+    case 4:  buf_write8(c, 0x63); break;                       /* movsxd r64, dword */
+    default: buf_write8(c, 0x8B); break;                       /* mov r64, qword */
+    }
+    int scale = width == 1 ? 0 : width == 2 ? 1 : width == 4 ? 2 : 3;
+    buf_write8(c, 0x84 | ((reg & 7) << 3));                    /* [SIB + disp32] */
+    buf_write8(c, (uint8_t)((scale << 6) | ((index & 7) << 3) | 5));
+    buf_write32(c, (uint32_t)offset);
+}
+
+/* Decimal digits of the signed value in rax, written right to left
+ * ending just before r8; r8 is left at the first character.  Two
+ * digits at a time: q = n / 100 by multiplying with the reciprocal
+ * (mulhi(n >> 2, 0x28F5C28F5C28F5C3) >> 2), the pair n - 100q copied
+ * from the "00".."99" table at [r13 + digits_offset].  INT64_MIN stays
+ * 2^63 as unsigned after the negation.  Clobbers rax, rcx, rdx, rsi, r9
+ * and r11. */
+static void emit_format_int(Buffer *c, int digits_offset) {
+    /* xor r9d, r9d (sign flag); test rax, rax; jns positive */
+    buf_write8(c, 0x45); buf_write8(c, 0x31); buf_write8(c, 0xC9);
+    buf_write8(c, 0x48); buf_write8(c, 0x85); buf_write8(c, 0xC0);
+    buf_write8(c, 0x79);
+    int jns_patch = c->len;
+    buf_write8(c, 0x00);
+    /* neg rax; mov r9d, 1 */
+    buf_write8(c, 0x48); buf_write8(c, 0xF7); buf_write8(c, 0xD8);
+    buf_write8(c, 0x41); buf_write8(c, 0xB9); buf_write32(c, 1);
+    c->data[jns_patch] = (uint8_t)(c->len - jns_patch - 1);
+
+    /* lea r11, [r13 + digits]; mov rsi, reciprocal of 100 */
+    buf_write8(c, 0x4D); buf_write8(c, 0x8D); emit_r13_modrm(c, 3, digits_offset);
+    buf_write8(c, 0x48); buf_write8(c, 0xBE); buf_write64(c, 0x28F5C28F5C28F5C3ULL);
+
+    /* === pair_loop: while rax >= 100 === */
+    int pair_loop = c->len;
+    /* cmp rax, 100; jb last_digits */
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xF8); buf_write8(c, 100);
+    buf_write8(c, 0x72);
+    int jb_last_patch = c->len;
+    buf_write8(c, 0x00);
+    /* mov rcx, rax; shr rax, 2; mul rsi; shr rdx, 2 (rdx = n / 100) */
+    buf_write8(c, 0x48); buf_write8(c, 0x89); buf_write8(c, 0xC1);
+    buf_write8(c, 0x48); buf_write8(c, 0xC1); buf_write8(c, 0xE8); buf_write8(c, 2);
+    buf_write8(c, 0x48); buf_write8(c, 0xF7); buf_write8(c, 0xE6);
+    buf_write8(c, 0x48); buf_write8(c, 0xC1); buf_write8(c, 0xEA); buf_write8(c, 2);
+    /* imul rax, rdx, 100; sub rcx, rax (rcx = n % 100) */
+    buf_write8(c, 0x48); buf_write8(c, 0x6B); buf_write8(c, 0xC2); buf_write8(c, 100);
+    buf_write8(c, 0x48); buf_write8(c, 0x29); buf_write8(c, 0xC1);
+    /* movzx eax, word [r11 + rcx*2]; sub r8, 2; mov [r8], ax */
+    buf_write8(c, 0x41); buf_write8(c, 0x0F); buf_write8(c, 0xB7); buf_write8(c, 0x04); buf_write8(c, 0x4B);
+    buf_write8(c, 0x49); buf_write8(c, 0x83); buf_write8(c, 0xE8); buf_write8(c, 2);
+    buf_write8(c, 0x66); buf_write8(c, 0x41); buf_write8(c, 0x89); buf_write8(c, 0x00);
+    /* mov rax, rdx; jmp pair_loop */
+    buf_write8(c, 0x48); buf_write8(c, 0x89); buf_write8(c, 0xD0);
+    buf_write8(c, 0xEB);
+    buf_write8(c, (uint8_t)(pair_loop - (c->len + 1)));
+
+    /* === last_digits: rax < 100 === */
+    c->data[jb_last_patch] = (uint8_t)(c->len - jb_last_patch - 1);
+    /* cmp rax, 10; jb one_digit */
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xF8); buf_write8(c, 10);
+    buf_write8(c, 0x72);
+    int jb_one_patch = c->len;
+    buf_write8(c, 0x00);
+    /* movzx eax, word [r11 + rax*2]; sub r8, 2; mov [r8], ax; jmp sign */
+    buf_write8(c, 0x41); buf_write8(c, 0x0F); buf_write8(c, 0xB7); buf_write8(c, 0x04); buf_write8(c, 0x43);
+    buf_write8(c, 0x49); buf_write8(c, 0x83); buf_write8(c, 0xE8); buf_write8(c, 2);
+    buf_write8(c, 0x66); buf_write8(c, 0x41); buf_write8(c, 0x89); buf_write8(c, 0x00);
+    buf_write8(c, 0xEB);
+    int jmp_sign_patch = c->len;
+    buf_write8(c, 0x00);
+    /* one_digit: add al, '0'; dec r8; mov [r8], al */
+    c->data[jb_one_patch] = (uint8_t)(c->len - jb_one_patch - 1);
+    buf_write8(c, 0x04); buf_write8(c, '0');
+    buf_write8(c, 0x49); buf_write8(c, 0xFF); buf_write8(c, 0xC8);
+    buf_write8(c, 0x41); buf_write8(c, 0x88); buf_write8(c, 0x00);
+
+    /* === sign: test r9d, r9d; jz done; dec r8; mov byte [r8], '-' === */
+    c->data[jmp_sign_patch] = (uint8_t)(c->len - jmp_sign_patch - 1);
+    buf_write8(c, 0x45); buf_write8(c, 0x85); buf_write8(c, 0xC9);
+    buf_write8(c, 0x74);
+    int jz_done_patch = c->len;
+    buf_write8(c, 0x00);
+    buf_write8(c, 0x49); buf_write8(c, 0xFF); buf_write8(c, 0xC8);
+    buf_write8(c, 0x41); buf_write8(c, 0xC6); buf_write8(c, 0x00); buf_write8(c, '-');
+    c->data[jz_done_patch] = (uint8_t)(c->len - jz_done_patch - 1);
+}
+
+/* reg = the high 64 bits of g * reg with bit 0 set when any bit below
+ * them is (rounded to odd), g the power of ten whose words as
+ * ir_float_pow10 gives them are in r14 and r15.  Clobbers rax, rdx and
+ * r12. */
+static void emit_float_round_to_odd(Buffer *c, int reg) {
+    /* mov rax, r15; mul reg; mov r12, rdx (x1) */
+    emit_op_rr(c, 0x89, 15, 0);
+    emit_op_rr(c, 0xF7, 4, reg);
+    emit_op_rr(c, 0x89, 2, 12);
+    /* mov rax, r14; mul reg (y1:y0); shr rax, 1; add rax, r12 (z) */
+    emit_op_rr(c, 0x89, 14, 0);
+    emit_op_rr(c, 0xF7, 4, reg);
+    emit_op_rr(c, 0xD1, 5, 0);
+    emit_op_rr(c, 0x01, 12, 0);
+    /* mov r12, rax; shr rax, 63; add rdx, rax (y1 + carry) */
+    emit_op_rr(c, 0x89, 0, 12);
+    emit_op_rr(c, 0xC1, 5, 0); buf_write8(c, 63);
+    emit_op_rr(c, 0x01, 0, 2);
+    /* add r12, r12; neg r12 (CF: any of the low 63 bits of z set);
+     * sbb eax, eax; and eax, 1; or rdx, rax; mov reg, rdx */
+    emit_op_rr(c, 0x01, 12, 12);
+    emit_op_rr(c, 0xF7, 3, 12);
+    buf_write8(c, 0x19); buf_write8(c, 0xC0);
+    buf_write8(c, 0x83); buf_write8(c, 0xE0); buf_write8(c, 0x01);
+    emit_op_rr(c, 0x09, 0, 2);
+    emit_op_rr(c, 0x89, 2, reg);
+}
+
+/* Helper: emit jmp rel32 (cc 0) or jcc rel32 to a spot not emitted yet,
+ * recording the rel32 in at[] to patch once it is */
+static void emit_jump_forward(Buffer *c, uint8_t cc, int *at, int *count) {
+    if (cc) {
+        buf_write8(c, 0x0F);
+        buf_write8(c, cc);
+    } else {
+        buf_write8(c, 0xE9);
+    }
+    at[(*count)++] = c->len;
+    buf_write32(c, 0);
+}
+
+/* The float_format routine: rax = the bits of a double, rdi = at least
+ * 32 bytes to write its text to; returns the length in rax.  The same
+ * steps as ir_format_float in ir.c, on the power-of-ten table of
+ * ir_float_pow10 at [r13 + table_offset] (high and low half of each
+ * entry, k = IR_FLOAT_K_MIN first).  Clobbers rax, rcx and rdx only. */
+static void emit_format_float(Buffer *c, int table_offset, int digits_offset) {
+    static const int saved[] = { 3, 6, 7, 8, 9, 10, 11, 12, 14, 15 };
+    int to_done[4], n_done = 0, to_found[6], n_found = 0, to_laid_out[3], n_laid_out = 0;
+    for (int k = 0; k < 10; k++) {
+        if (saved[k] >= 8) buf_write8(c, 0x41);
+        buf_write8(c, (uint8_t)(0x50 + (saved[k] & 7)));
+    }
+    /* push rdi (the start, for the length) */
+    buf_write8(c, 0x57);
+
+    /* === Special values === */
+    /* mov rcx, rax; btr rcx, 63; mov rdx, exponent mask; cmp rcx, rdx;
+     * jbe number; mov dword [rdi], "nan"; add rdi, 3; jmp done */
+    emit_op_rr(c, 0x89, 0, 1);
+    buf_write8(c, 0x48); buf_write8(c, 0x0F); buf_write8(c, 0xBA); buf_write8(c, 0xF1); buf_write8(c, 63);
+    buf_write8(c, 0x48); buf_write8(c, 0xBA); buf_write64(c, 0x7FF0000000000000ULL);
+    emit_op_rr(c, 0x39, 2, 1);
+    buf_write8(c, 0x76);
+    int jbe_number_patch = c->len;
+    buf_write8(c, 0x00);
+    buf_write8(c, 0xC7); buf_write8(c, 0x07); buf_write32(c, 0x006E616E);
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xC7); buf_write8(c, 3);
+    emit_jump_forward(c, 0, to_done, &n_done);
+    /* number: test rax, rax; jns positive; mov byte [rdi], '-'; inc rdi */
+    c->data[jbe_number_patch] = (uint8_t)(c->len - jbe_number_patch - 1);
+    buf_write8(c, 0x48); buf_write8(c, 0x85); buf_write8(c, 0xC0);
+    buf_write8(c, 0x79); buf_write8(c, 6);
+    buf_write8(c, 0xC6); buf_write8(c, 0x07); buf_write8(c, '-');
+    buf_write8(c, 0x48); buf_write8(c, 0xFF); buf_write8(c, 0xC7);
+    /* cmp rcx, rdx; jne finite; mov dword [rdi], "inf"; add rdi, 3;
+     * jmp done */
+    emit_op_rr(c, 0x39, 2, 1);
+    buf_write8(c, 0x75);
+    int jne_finite_patch = c->len;
+    buf_write8(c, 0x00);
+    buf_write8(c, 0xC7); buf_write8(c, 0x07); buf_write32(c, 0x00666E69);
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xC7); buf_write8(c, 3);
+    emit_jump_forward(c, 0, to_done, &n_done);
+    /* finite: test rcx, rcx; jnz nonzero; mov byte [rdi], '0'; inc rdi;
+     * jmp done */
+    c->data[jne_finite_patch] = (uint8_t)(c->len - jne_finite_patch - 1);
+    buf_write8(c, 0x48); buf_write8(c, 0x85); buf_write8(c, 0xC9);
+    buf_write8(c, 0x75);
+    int jnz_nonzero_patch = c->len;
+    buf_write8(c, 0x00);
+    buf_write8(c, 0xC6); buf_write8(c, 0x07); buf_write8(c, '0');
+    buf_write8(c, 0x48); buf_write8(c, 0xFF); buf_write8(c, 0xC7);
+    emit_jump_forward(c, 0, to_done, &n_done);
+    c->data[jnz_nonzero_patch] = (uint8_t)(c->len - jnz_nonzero_patch - 1);
+
+    /* === Shortest decimal f * 10^e of rcx: rax = f, r8 = e === */
+    /* push rdi (the cursor, while rdi is a temporary); mov r8, rcx;
+     * shr r8, 52 (biased exponent); mov rsi, mantissa mask; and rsi, rcx;
+     * test r8, r8; jz subnormal */
+    buf_write8(c, 0x57);
+    emit_op_rr(c, 0x89, 1, 8);
+    emit_op_rr(c, 0xC1, 5, 8); buf_write8(c, 52);
+    buf_write8(c, 0x48); buf_write8(c, 0xBE); buf_write64(c, 0x000FFFFFFFFFFFFFULL);
+    emit_op_rr(c, 0x21, 1, 6);
+    emit_op_rr(c, 0x85, 8, 8);
+    buf_write8(c, 0x74);
+    int jz_subnormal_patch = c->len;
+    buf_write8(c, 0x00);
+    /* bts rsi, 52 (c); mov ecx, 1075; sub rcx, r8 (mq); an integer below
+     * 2^53 is its own decimal: mov rax, rcx; dec rax; cmp rax, 52;
+     * jae general; mov rax, rsi; shr rax, cl; mov rdx, rax; shl rdx, cl;
+     * cmp rdx, rsi; jne general; xor r8d, r8d; jmp found */
+    buf_write8(c, 0x48); buf_write8(c, 0x0F); buf_write8(c, 0xBA); buf_write8(c, 0xEE); buf_write8(c, 52);
+    emit_mov_r32_imm32(c, 1, 1075);
+    emit_op_rr(c, 0x29, 8, 1);
+    emit_op_rr(c, 0x89, 1, 0);
+    emit_op_rr(c, 0xFF, 1, 0);
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xF8); buf_write8(c, 52);
+    buf_write8(c, 0x73);
+    int jae_general_patch = c->len;
+    buf_write8(c, 0x00);
+    emit_op_rr(c, 0x89, 6, 0);
+    emit_op_rr(c, 0xD3, 5, 0);
+    emit_op_rr(c, 0x89, 0, 2);
+    emit_op_rr(c, 0xD3, 4, 2);
+    emit_op_rr(c, 0x39, 6, 2);
+    buf_write8(c, 0x75);
+    int jne_general_patch = c->len;
+    buf_write8(c, 0x00);
+    buf_write8(c, 0x45); buf_write8(c, 0x31); buf_write8(c, 0xC0);
+    emit_jump_forward(c, 0, to_found, &n_found);
+    /* general: neg rcx (q); jmp have_q */
+    c->data[jae_general_patch] = (uint8_t)(c->len - jae_general_patch - 1);
+    c->data[jne_general_patch] = (uint8_t)(c->len - jne_general_patch - 1);
+    emit_op_rr(c, 0xF7, 3, 1);
+    buf_write8(c, 0xEB);
+    int jmp_have_q_patch = c->len;
+    buf_write8(c, 0x00);
+    /* subnormal: mov rcx, -1074 */
+    c->data[jz_subnormal_patch] = (uint8_t)(c->len - jz_subnormal_patch - 1);
+    emit_op_rr(c, 0xC7, 0, 1); buf_write32(c, (uint32_t)-1074);
+    c->data[jmp_have_q_patch] = (uint8_t)(c->len - jmp_have_q_patch - 1);
+
+    /* have_q: mov r9, rsi; and r9, 1 (odd); mov rbx, rsi; shl rbx, 2 (cb);
+     * lea r11, [rbx - 2] (cbl); mov rax, log10(2) * 2^41; imul rax, rcx */
+    emit_op_rr(c, 0x89, 6, 9);
+    emit_op_rr(c, 0x83, 4, 9); buf_write8(c, 1);
+    emit_op_rr(c, 0x89, 6, 3);
+    emit_op_rr(c, 0xC1, 4, 3); buf_write8(c, 2);
+    buf_write8(c, 0x4C); buf_write8(c, 0x8D); buf_write8(c, 0x5B); buf_write8(c, 0xFE);
+    buf_write8(c, 0x48); buf_write8(c, 0xB8); buf_write64(c, 661971961083ULL);
+    emit_op_rr(c, 0x0FAF, 0, 1);
+    /* Below a power of two the interval is half as wide: mov rdx, 2^52;
+     * cmp rsi, rdx; jne regular; cmp rcx, -1074; je regular;
+     * mov rdx, log10(4/3) * 2^41; sub rax, rdx; inc r11 */
+    buf_write8(c, 0x48); buf_write8(c, 0xBA); buf_write64(c, 1ULL << 52);
+    emit_op_rr(c, 0x39, 2, 6);
+    buf_write8(c, 0x75);
+    int jne_regular_patch = c->len;
+    buf_write8(c, 0x00);
+    emit_op_rr(c, 0x81, 7, 1); buf_write32(c, (uint32_t)-1074);
+    buf_write8(c, 0x74);
+    int je_regular_patch = c->len;
+    buf_write8(c, 0x00);
+    buf_write8(c, 0x48); buf_write8(c, 0xBA); buf_write64(c, 274743187321ULL);
+    emit_op_rr(c, 0x29, 2, 0);
+    emit_op_rr(c, 0xFF, 0, 11);
+    c->data[jne_regular_patch] = (uint8_t)(c->len - jne_regular_patch - 1);
+    c->data[je_regular_patch] = (uint8_t)(c->len - je_regular_patch - 1);
+    /* regular: sar rax, 41 (k); mov r8, rax; h = q + flog2(10^-k) + 2:
+     * neg rax; mov rdx, log2(10) * 2^38; imul rax, rdx; sar rax, 38;
+     * add rcx, rax; add rcx, 2 */
+    emit_op_rr(c, 0xC1, 7, 0); buf_write8(c, 41);
+    emit_op_rr(c, 0x89, 0, 8);
+    emit_op_rr(c, 0xF7, 3, 0);
+    buf_write8(c, 0x48); buf_write8(c, 0xBA); buf_write64(c, 913124641741ULL);
+    emit_op_rr(c, 0x0FAF, 0, 2);
+    emit_op_rr(c, 0xC1, 7, 0); buf_write8(c, 38);
+    emit_op_rr(c, 0x01, 0, 1);
+    emit_op_rr(c, 0x83, 0, 1); buf_write8(c, 2);
+    /* mov rax, r8; shl rax, 4; mov r14, [r13 + rax + g(0)];
+     * mov r15, [r13 + rax + g(0) + 8] */
+    emit_op_rr(c, 0x89, 8, 0);
+    emit_op_rr(c, 0xC1, 4, 0); buf_write8(c, 4);
+    int g0 = table_offset - 16 * IR_FLOAT_K_MIN;
+    buf_write8(c, 0x4D); buf_write8(c, 0x8B); buf_write8(c, 0xB4); buf_write8(c, 0x05);
+    buf_write32(c, (uint32_t)g0);
+    buf_write8(c, 0x4D); buf_write8(c, 0x8B); buf_write8(c, 0xBC); buf_write8(c, 0x05);
+    buf_write32(c, (uint32_t)(g0 + 8));
+    /* r10 = vb: mov r10, rbx; shl r10, cl; rdi = vbr: lea rdi, [rbx + 2];
+     * shl rdi, cl; rbx = vbl: mov rbx, r11; shl rbx, cl */
+    emit_op_rr(c, 0x89, 3, 10);
+    emit_op_rr(c, 0xD3, 4, 10);
+    emit_float_round_to_odd(c, 10);
+    buf_write8(c, 0x48); buf_write8(c, 0x8D); buf_write8(c, 0x7B); buf_write8(c, 2);
+    emit_op_rr(c, 0xD3, 4, 7);
+    emit_float_round_to_odd(c, 7);
+    emit_op_rr(c, 0x89, 11, 3);
+    emit_op_rr(c, 0xD3, 4, 3);
+    emit_float_round_to_odd(c, 3);
+
+    /* mov rsi, r10; shr rsi, 2 (s); cmp rsi, 10; jb neighbours */
+    emit_op_rr(c, 0x89, 10, 6);
+    emit_op_rr(c, 0xC1, 5, 6); buf_write8(c, 2);
+    emit_op_rr(c, 0x83, 7, 6); buf_write8(c, 10);
+    buf_write8(c, 0x72);
+    int jb_neighbours_patch = c->len;
+    buf_write8(c, 0x00);
+    /* One digit fewer: mov rax, rsi; mov rdx, reciprocal of 10; mul rdx;
+     * shr rdx, 3; lea rax, [rdx + rdx*4]; add rax, rax (sp10) */
+    emit_op_rr(c, 0x89, 6, 0);
+    buf_write8(c, 0x48); buf_write8(c, 0xBA); buf_write64(c, 0xCCCCCCCCCCCCCCCDULL);
+    emit_op_rr(c, 0xF7, 4, 2);
+    emit_op_rr(c, 0xC1, 5, 2); buf_write8(c, 3);
+    buf_write8(c, 0x48); buf_write8(c, 0x8D); buf_write8(c, 0x04); buf_write8(c, 0x92);
+    emit_op_rr(c, 0x01, 0, 0);
+    /* mov rcx, rax; shl rcx, 2; lea rdx, [rbx + r9]; xor r12d, r12d;
+     * cmp rdx, rcx; setbe r12b (sp10 inside); lea rdx, [rcx + r9 + 40];
+     * xor ecx, ecx; cmp rdx, rdi; setbe cl (sp10 + 10 inside) */
+    emit_op_rr(c, 0x89, 0, 1);
+    emit_op_rr(c, 0xC1, 4, 1); buf_write8(c, 2);
+    buf_write8(c, 0x4A); buf_write8(c, 0x8D); buf_write8(c, 0x14); buf_write8(c, 0x0B);
+    buf_write8(c, 0x45); buf_write8(c, 0x31); buf_write8(c, 0xE4);
+    emit_op_rr(c, 0x39, 1, 2);
+    buf_write8(c, 0x41); buf_write8(c, 0x0F); buf_write8(c, 0x96); buf_write8(c, 0xC4);
+    buf_write8(c, 0x4A); buf_write8(c, 0x8D); buf_write8(c, 0x54); buf_write8(c, 0x09); buf_write8(c, 40);
+    buf_write8(c, 0x31); buf_write8(c, 0xC9);
+    emit_op_rr(c, 0x39, 7, 2);
+    buf_write8(c, 0x0F); buf_write8(c, 0x96); buf_write8(c, 0xC1);
+    /* Exactly one inside decides: cmp rcx, r12; je neighbours;
+     * test r12, r12; jnz found; add rax, 10; jmp found */
+    emit_op_rr(c, 0x39, 12, 1);
+    buf_write8(c, 0x74);
+    int je_neighbours_patch = c->len;
+    buf_write8(c, 0x00);
+    emit_op_rr(c, 0x85, 12, 12);
+    emit_jump_forward(c, 0x85, to_found, &n_found);
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xC0); buf_write8(c, 10);
+    emit_jump_forward(c, 0, to_found, &n_found);
+
+    /* neighbours: s or s + 1, likewise: mov rcx, rsi; shl rcx, 2;
+     * lea rdx, [rbx + r9]; xor r12d, r12d; cmp rdx, rcx; setbe r12b;
+     * lea rdx, [rcx + r9 + 4]; xor ecx, ecx; cmp rdx, rdi; setbe cl;
+     * mov rax, rsi; cmp rcx, r12; je closer; test r12, r12; jnz found;
+     * inc rax; jmp found */
+    c->data[jb_neighbours_patch] = (uint8_t)(c->len - jb_neighbours_patch - 1);
+    c->data[je_neighbours_patch] = (uint8_t)(c->len - je_neighbours_patch - 1);
+    emit_op_rr(c, 0x89, 6, 1);
+    emit_op_rr(c, 0xC1, 4, 1); buf_write8(c, 2);
+    buf_write8(c, 0x4A); buf_write8(c, 0x8D); buf_write8(c, 0x14); buf_write8(c, 0x0B);
+    buf_write8(c, 0x45); buf_write8(c, 0x31); buf_write8(c, 0xE4);
+    emit_op_rr(c, 0x39, 1, 2);
+    buf_write8(c, 0x41); buf_write8(c, 0x0F); buf_write8(c, 0x96); buf_write8(c, 0xC4);
+    buf_write8(c, 0x4A); buf_write8(c, 0x8D); buf_write8(c, 0x54); buf_write8(c, 0x09); buf_write8(c, 4);
+    buf_write8(c, 0x31); buf_write8(c, 0xC9);
+    emit_op_rr(c, 0x39, 7, 2);
+    buf_write8(c, 0x0F); buf_write8(c, 0x96); buf_write8(c, 0xC1);
+    emit_op_rr(c, 0x89, 6, 0);
+    emit_op_rr(c, 0x39, 12, 1);
+    buf_write8(c, 0x74);
+    int je_closer_patch = c->len;
+    buf_write8(c, 0x00);
+    emit_op_rr(c, 0x85, 12, 12);
+    emit_jump_forward(c, 0x85, to_found, &n_found);
+    emit_op_rr(c, 0xFF, 0, 0);
+    emit_jump_forward(c, 0, to_found, &n_found);
+    /* closer: both inside, the nearer to vb, ties to even:
+     * lea rdx, [rsi*4 + 2]; mov rcx, r10; sub rcx, rdx; jl found;
+     * jg up; test al, 1; jz found; up: inc rax */
+    c->data[je_closer_patch] = (uint8_t)(c->len - je_closer_patch - 1);
+    buf_write8(c, 0x48); buf_write8(c, 0x8D); buf_write8(c, 0x14); buf_write8(c, 0xB5); buf_write32(c, 2);
+    emit_op_rr(c, 0x89, 10, 1);
+    emit_op_rr(c, 0x29, 2, 1);
+    emit_jump_forward(c, 0x8C, to_found, &n_found);
+    buf_write8(c, 0x7F); buf_write8(c, 4);
+    buf_write8(c, 0xA8); buf_write8(c, 0x01);
+    buf_write8(c, 0x74); buf_write8(c, 3);
+    emit_op_rr(c, 0xFF, 0, 0);
+
+    /* === found: strip the trailing zeros off rax, counting them in r8 === */
+    for (int k = 0; k < n_found; k++) patch_rel32(c, to_found[k], c->len);
+    /* pop rdi; mov rsi, reciprocal of 10 */
+    buf_write8(c, 0x5F);
+    buf_write8(c, 0x48); buf_write8(c, 0xBE); buf_write64(c, 0xCCCCCCCCCCCCCCCDULL);
+    /* strip: mov rcx, rax; mul rsi; shr rdx, 3; lea rax, [rdx + rdx*4];
+     * add rax, rax; cmp rax, rcx; jne stripped; mov rax, rdx; inc r8;
+     * jmp strip */
+    int strip_loop = c->len;
+    emit_op_rr(c, 0x89, 0, 1);
+    emit_op_rr(c, 0xF7, 4, 6);
+    emit_op_rr(c, 0xC1, 5, 2); buf_write8(c, 3);
+    buf_write8(c, 0x48); buf_write8(c, 0x8D); buf_write8(c, 0x04); buf_write8(c, 0x92);
+    emit_op_rr(c, 0x01, 0, 0);
+    emit_op_rr(c, 0x39, 1, 0);
+    buf_write8(c, 0x75);
+    int jne_stripped_patch = c->len;
+    buf_write8(c, 0x00);
+    emit_op_rr(c, 0x89, 2, 0);
+    emit_op_rr(c, 0xFF, 0, 8);
+    buf_write8(c, 0xEB);
+    buf_write8(c, (uint8_t)(strip_loop - (c->len + 1)));
+    /* stripped: mov rax, rcx; mov rbx, r8; the digits right to left:
+     * sub rsp, 32; lea r8, [rsp + 32]; format */
+    c->data[jne_stripped_patch] = (uint8_t)(c->len - jne_stripped_patch - 1);
+    emit_op_rr(c, 0x89, 1, 0);
+    emit_op_rr(c, 0x89, 8, 3);
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xEC); buf_write8(c, 32);
+    buf_write8(c, 0x4C); buf_write8(c, 0x8D); buf_write8(c, 0x44); buf_write8(c, 0x24); buf_write8(c, 32);
+    emit_format_int(c, digits_offset);
+    /* lea r10, [rsp + 32]; sub r10, r8 (length); lea rbx, [rbx + r10 - 1]
+     * (exponent of the first digit) */
+    buf_write8(c, 0x4C); buf_write8(c, 0x8D); buf_write8(c, 0x54); buf_write8(c, 0x24); buf_write8(c, 32);
+    emit_op_rr(c, 0x29, 8, 10);
+    buf_write8(c, 0x4A); buf_write8(c, 0x8D); buf_write8(c, 0x5C); buf_write8(c, 0x13); buf_write8(c, 0xFF);
+
+    /* === Layout: rdi = cursor, r8 = digits, r10 = their count,
+     * rbx = exponent === */
+    /* cmp rbx, -4; jl scientific; cmp rbx, 16; jge scientific;
+     * test rbx, rbx; jns whole */
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xFB); buf_write8(c, 0xFC);
+    buf_write8(c, 0x7C);
+    int jl_sci_patch = c->len;
+    buf_write8(c, 0x00);
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xFB); buf_write8(c, 16);
+    buf_write8(c, 0x7D);
+    int jge_sci_patch = c->len;
+    buf_write8(c, 0x00);
+    buf_write8(c, 0x48); buf_write8(c, 0x85); buf_write8(c, 0xDB);
+    buf_write8(c, 0x79);
+    int jns_whole_patch = c->len;
+    buf_write8(c, 0x00);
+    /* "0." and -exponent - 1 zeros, then the digits:
+     * mov word [rdi], "0."; add rdi, 2; mov rcx, rbx; not rcx;
+     * mov al, '0'; rep stosb; mov rsi, r8; mov rcx, r10; rep movsb;
+     * jmp laid_out */
+    buf_write8(c, 0x66); buf_write8(c, 0xC7); buf_write8(c, 0x07); buf_write8(c, '0'); buf_write8(c, '.');
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xC7); buf_write8(c, 2);
+    emit_op_rr(c, 0x89, 3, 1);
+    emit_op_rr(c, 0xF7, 2, 1);
+    buf_write8(c, 0xB0); buf_write8(c, '0');
+    buf_write8(c, 0xF3); buf_write8(c, 0xAA);
+    emit_op_rr(c, 0x89, 8, 6);
+    emit_op_rr(c, 0x89, 10, 1);
+    buf_write8(c, 0xF3); buf_write8(c, 0xA4);
+    emit_jump_forward(c, 0, to_laid_out, &n_laid_out);
+    /* whole: lea rcx, [rbx + 1]; cmp r10, rcx; jg point; the digits, then
+     * zeros up to the point: mov rsi, r8; mov rcx, r10; rep movsb;
+     * lea rcx, [rbx + 1]; sub rcx, r10; mov al, '0'; rep stosb;
+     * jmp laid_out */
+    c->data[jns_whole_patch] = (uint8_t)(c->len - jns_whole_patch - 1);
+    buf_write8(c, 0x48); buf_write8(c, 0x8D); buf_write8(c, 0x4B); buf_write8(c, 1);
+    emit_op_rr(c, 0x39, 1, 10);
+    buf_write8(c, 0x7F);
+    int jg_point_patch = c->len;
+    buf_write8(c, 0x00);
+    emit_op_rr(c, 0x89, 8, 6);
+    emit_op_rr(c, 0x89, 10, 1);
+    buf_write8(c, 0xF3); buf_write8(c, 0xA4);
+    buf_write8(c, 0x48); buf_write8(c, 0x8D); buf_write8(c, 0x4B); buf_write8(c, 1);
+    emit_op_rr(c, 0x29, 10, 1);
+    buf_write8(c, 0xB0); buf_write8(c, '0');
+    buf_write8(c, 0xF3); buf_write8(c, 0xAA);
+    emit_jump_forward(c, 0, to_laid_out, &n_laid_out);
+    /* point: mov rsi, r8; rep movsb (exponent + 1 digits);
+     * mov byte [rdi], '.'; inc rdi; mov rcx, r10; sub rcx, rbx; dec rcx;
+     * rep movsb; jmp laid_out */
+    c->data[jg_point_patch] = (uint8_t)(c->len - jg_point_patch - 1);
+    emit_op_rr(c, 0x89, 8, 6);
+    buf_write8(c, 0xF3); buf_write8(c, 0xA4);
+    buf_write8(c, 0xC6); buf_write8(c, 0x07); buf_write8(c, '.');
+    buf_write8(c, 0x48); buf_write8(c, 0xFF); buf_write8(c, 0xC7);
+    emit_op_rr(c, 0x89, 10, 1);
+    emit_op_rr(c, 0x29, 3, 1);
+    emit_op_rr(c, 0xFF, 1, 1);
+    buf_write8(c, 0xF3); buf_write8(c, 0xA4);
+    emit_jump_forward(c, 0, to_laid_out, &n_laid_out);
+    /* scientific: mov al, [r8]; stosb; cmp r10, 1; je exponent;
+     * mov byte [rdi], '.'; inc rdi; lea rsi, [r8 + 1]; lea rcx, [r10 - 1];
+     * rep movsb */
+    c->data[jl_sci_patch] = (uint8_t)(c->len - jl_sci_patch - 1);
+    c->data[jge_sci_patch] = (uint8_t)(c->len - jge_sci_patch - 1);
+    buf_write8(c, 0x41); buf_write8(c, 0x8A); buf_write8(c, 0x00);
+    buf_write8(c, 0xAA);
+    emit_op_rr(c, 0x83, 7, 10); buf_write8(c, 1);
+    buf_write8(c, 0x74);
+    int je_exponent_patch = c->len;
+    buf_write8(c, 0x00);
+    buf_write8(c, 0xC6); buf_write8(c, 0x07); buf_write8(c, '.');
+    buf_write8(c, 0x48); buf_write8(c, 0xFF); buf_write8(c, 0xC7);
+    buf_write8(c, 0x49); buf_write8(c, 0x8D); buf_write8(c, 0x70); buf_write8(c, 1);
+    buf_write8(c, 0x49); buf_write8(c, 0x8D); buf_write8(c, 0x4A); buf_write8(c, 0xFF);
+    buf_write8(c, 0xF3); buf_write8(c, 0xA4);
+    /* exponent: mov word [rdi], "e+"; test rbx, rbx; jns positive;
+     * mov byte [rdi + 1], '-'; neg rbx; positive: add rdi, 2 */
+    c->data[je_exponent_patch] = (uint8_t)(c->len - je_exponent_patch - 1);
+    buf_write8(c, 0x66); buf_write8(c, 0xC7); buf_write8(c, 0x07); buf_write8(c, 'e'); buf_write8(c, '+');
+    buf_write8(c, 0x48); buf_write8(c, 0x85); buf_write8(c, 0xDB);
+    buf_write8(c, 0x79); buf_write8(c, 7);
+    buf_write8(c, 0xC6); buf_write8(c, 0x47); buf_write8(c, 0x01); buf_write8(c, '-');
+    emit_op_rr(c, 0xF7, 3, 3);
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xC7); buf_write8(c, 2);
+    /* At least two digits: cmp rbx, 100; jb pair; imul eax, ebx, 41;
+     * shr eax, 12 (/ 100); imul ecx, eax, 100; sub ebx, ecx; add al, '0';
+     * stosb; pair: movzx eax, word [r13 + rbx*2 + digits];
+     * mov [rdi], ax; add rdi, 2 */
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xFB); buf_write8(c, 100);
+    buf_write8(c, 0x72); buf_write8(c, 14);
+    buf_write8(c, 0x6B); buf_write8(c, 0xC3); buf_write8(c, 41);
+    buf_write8(c, 0xC1); buf_write8(c, 0xE8); buf_write8(c, 12);
+    buf_write8(c, 0x6B); buf_write8(c, 0xC8); buf_write8(c, 100);
+    buf_write8(c, 0x29); buf_write8(c, 0xCB);
+    buf_write8(c, 0x04); buf_write8(c, '0');
+    buf_write8(c, 0xAA);
+    buf_write8(c, 0x41); buf_write8(c, 0x0F); buf_write8(c, 0xB7); buf_write8(c, 0x84); buf_write8(c, 0x5D);
+    buf_write32(c, (uint32_t)digits_offset);
+    buf_write8(c, 0x66); buf_write8(c, 0x89); buf_write8(c, 0x07);
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xC7); buf_write8(c, 2);
+
+    /* laid_out: add rsp, 32 */
+    for (int k = 0; k < n_laid_out; k++) patch_rel32(c, to_laid_out[k], c->len);
+    buf_write8(c, 0x48); buf_write8(c, 0x83); buf_write8(c, 0xC4); buf_write8(c, 32);
+
+    /* done: pop rcx; mov rax, rdi; sub rax, rcx; restore; ret */
+    for (int k = 0; k < n_done; k++) patch_rel32(c, to_done[k], c->len);
+    buf_write8(c, 0x59);
+    emit_op_rr(c, 0x89, 7, 0);
+    emit_op_rr(c, 0x29, 1, 0);
+    for (int k = 9; k >= 0; k--) {
+        if (saved[k] >= 8) buf_write8(c, 0x41);
+        buf_write8(c, (uint8_t)(0x58 + (saved[k] & 7)));
+    }
+    buf_write8(c, 0xC3);
+}
+
+/* Condition code of a comparison opcode: the low nibble of its jcc,
+ * setcc and cmovcc */
+static uint8_t x86_cc(IROpcode cmp) {
+    switch (cmp) {
+    case IR_CMP_EQ: return 0x04;
+    case IR_CMP_NE: return 0x05;
+    case IR_CMP_LT: return 0x0C;
+    case IR_CMP_LE: return 0x0E;
+    case IR_CMP_GT: return 0x0F;
+    default:        return 0x0D;   /* ge */
+    }
+}
+
+/* 1 if the compare at index i is only read by the IR_SELECT right after
+ * it, which then uses its flags instead of a 0/1 value */
+static int select_fuses_cmp(const IRProgram *prog, const char *needed, int i) {
+    const IRInstr *ir = &prog->instrs[i];
+    if (ir->op < IR_CMP_EQ || ir->op > IR_CMP_GE || i + 1 >= prog->instr_count)
+        return 0;
+    const IRInstr *next = &prog->instrs[i + 1];
+    return next->op == IR_SELECT && next->src == ir->dst && needed[ir->dst] == 1;
 }
 
-int emit_binary_ir(IRProgram *prog, const char *output_path)
+int emit_binary_ir(IRProgram *prog, const char *output_path, int line_buffered)
 {
-    int slot_count = prog->next_slot;
-    int vreg_count = prog->next_vreg;
-    int total_slots = slot_count + vreg_count;
-    /* Align frame size to 16 bytes */
-    int frame_size = ((total_slots * 8) + 15) & ~15;
-    if (frame_size < 16) frame_size = 16;
+    /* The main body runs up to the first IR_FUNC */
+    int region_end = 0;
+    while (region_end < prog->instr_count && prog->instrs[region_end].op != IR_FUNC)
+        region_end++;
+    IRFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    ir_frame_layout(&frame, prog, 0, region_end, 1);
 
     Buffer code;
     buf_init(&code);
@@ -1300,289 +2457,917 @@ int emit_binary_ir(IRProgram *prog, const char *output_path)
     buf_write(&data, "true", 4);
     int bool_false_offset = data.len;
     buf_write(&data, "false", 5);
+    static const char bounds_msg[] = "error: array index out of range\n";
+    int bounds_msg_offset = data.len;
+    buf_write(&data, bounds_msg, sizeof(bounds_msg) - 1);
+    static const char oom_msg[] = "error: out of memory\n";
+    int oom_msg_offset = data.len;
+    buf_write(&data, oom_msg, sizeof(oom_msg) - 1);
+    static const char empty_msg[] = "error: min() or max() on empty array\n";
+    int empty_msg_offset = data.len;
+    buf_write(&data, empty_msg, sizeof(empty_msg) - 1);
+    static const char missing_msg[] = "error: map key not found\n";
+    int missing_msg_offset = data.len;
+    buf_write(&data, missing_msg, sizeof(missing_msg) - 1);
+    static const char div_zero_msg[] = "error: division by zero\n";
+    int div_zero_msg_offset = data.len;
+    buf_write(&data, div_zero_msg, sizeof(div_zero_msg) - 1);
+    static const char div_overflow_msg[] = "error: integer overflow in division\n";
+    int div_overflow_msg_offset = data.len;
+    buf_write(&data, div_overflow_msg, sizeof(div_overflow_msg) - 1);
+
+    /* Constant tables for IR_LOAD_ELEM, each aligned to its width */
+    int *table_offsets = malloc((prog->table_count > 0 ? prog->table_count : 1) * sizeof(int));
+    int *table_widths = malloc((prog->table_count > 0 ? prog->table_count : 1) * sizeof(int));
+    for (int t = 0; t < prog->table_count; t++) {
+        const IRTable *tab = &prog->tables[t];
+        int w = table_widths[t] = table_width(tab);
+        while (data.len % w) buf_write8(&data, 0);
+        table_offsets[t] = data.len;
+        for (int k = 0; k < tab->count; k++) {
+            uint64_t v = (uint64_t)tab->values[k];
+            for (int byte = 0; byte < w; byte++)
+                buf_write8(&data, (uint8_t)(v >> (8 * byte)));
+        }
+    }
+
+    /* String values of IR_CONST_STR: a header of the length and a zero
+     * capacity, which marks them as never freed, then the bytes.  Equal
+     * strings share one. */
+    int *str_obj_offsets = malloc((prog->string_count > 0 ? prog->string_count : 1) * sizeof(int));
+    for (int i = 0; i < prog->string_count; i++) str_obj_offsets[i] = -1;
+    for (int i = 0; i < prog->instr_count; i++) {
+        const IRInstr *ir = &prog->instrs[i];
+        if (ir->op != IR_CONST_STR || str_obj_offsets[ir->str_idx] >= 0) continue;
+        const IRString *str = &prog->strings[ir->str_idx];
+        for (int j = 0; j < prog->string_count && str_obj_offsets[ir->str_idx] < 0; j++) {
+            const IRString *other = &prog->strings[j];
+            if (str_obj_offsets[j] >= 0 && other->len == str->len &&
+                memcmp(other->data, str->data, str->len) == 0)
+                str_obj_offsets[ir->str_idx] = str_obj_offsets[j];
+        }
+        if (str_obj_offsets[ir->str_idx] >= 0) continue;
+        while (data.len % 16) buf_write8(&data, 0);
+        str_obj_offsets[ir->str_idx] = data.len;
+        buf_write64(&data, (uint64_t)str->len);
+        buf_write64(&data, 0);
+        buf_write(&data, str->data, str->len);
+    }
+
+    /* Array values of IR_CONST_ARR: the elements at full width behind
+     * a header of no block, a zero capacity (never freed, nor written in
+     * place) and the length, the first element 64-byte aligned */
+    int *arr_obj_offsets = malloc((prog->table_count > 0 ? prog->table_count : 1) * sizeof(int));
+    for (int t = 0; t < prog->table_count; t++) arr_obj_offsets[t] = -1;
+    for (int i = 0; i < prog->instr_count; i++) {
+        const IRInstr *ir = &prog->instrs[i];
+        if (ir->op != IR_CONST_ARR || arr_obj_offsets[ir->imm] >= 0) continue;
+        const IRTable *tab = &prog->tables[ir->imm];
+        while ((data.len + 24) % 64) buf_write8(&data, 0);
+        buf_write64(&data, 0);
+        buf_write64(&data, 0);
+        buf_write64(&data, (uint64_t)tab->count);
+        arr_obj_offsets[ir->imm] = data.len;
+        for (int k = 0; k < tab->count; k++)
+            buf_write64(&data, (uint64_t)tab->values[k]);
+    }
 
     /* Reserve space for label offsets — we'll patch jumps after code gen */
     int *label_offsets = calloc(prog->next_label, sizeof(int));
 
     /* Track jump instructions that need patching */
-    typedef struct { int code_offset; int label_id; } JmpPatch;
-    JmpPatch *patches = malloc(prog->instr_count * sizeof(JmpPatch));
-    int patch_count = 0;
+    JmpPatchList patches = { NULL, 0, 0 };
+
+    /* The heap, string, array, map and float formatting routines are
+     * only emitted for programs that use them; all but the first and the
+     * last allocate through the heap */
+    int uses_heap = 0, uses_strings = 0, uses_arrays = 0, uses_maps = 0, uses_floats = 0;
+    for (int i = 0; i < prog->instr_count; i++) {
+        IROpcode op = prog->instrs[i].op;
+        if (op == IR_ALLOC || op == IR_FREE || op == IR_OBJ_RELEASE) uses_heap = 1;
+        if (op == IR_STR_CONCAT || op == IR_STR_APPEND || op == IR_STR_FROM_INT ||
+            op == IR_STR_FROM_FLOAT || op == IR_STR_EQ || op == IR_STR_CMP ||
+            op == IR_STR_RELEASE)
+            uses_heap = uses_strings = 1;
+        if (op == IR_PRINT_FLOAT || op == IR_STR_FROM_FLOAT) uses_floats = 1;
+        if (op == IR_ARR_COPY || op == IR_ARR_PUSH || op == IR_ARR_SUM ||
+            op == IR_ARR_MIN || op == IR_ARR_MAX || op == IR_ARR_INDEX_OF ||
+            op == IR_ARR_FSUM || op == IR_ARR_FMIN || op == IR_ARR_FMAX ||
+            op == IR_ARR_FINDEX_OF || op == IR_ARR_RELEASE)
+            uses_heap = uses_arrays = 1;
+        if (op == IR_MAP_NEW || op == IR_MAP_GET || op == IR_MAP_HAS ||
+            op == IR_MAP_SET || op == IR_MAP_REMOVE || op == IR_MAP_KEYS ||
+            op == IR_MAP_RELEASE)
+            uses_heap = uses_maps = 1;
+        if (op == IR_MAP_KEYS) uses_arrays = 1;
+    }
+
+    /* Vregs defined by IR_CONST_INT, for immediate operands; those only
+     * ever used as shift counts, array indices or compared against by a
+     * branch never need a register.  needed[] counts uses up to 2, so a
+     * compare read once by the IR_SELECT right after it can hand over
+     * its flags. */
+    char *is_const = calloc(prog->next_vreg + 1, 1);
+    char *needed = calloc(prog->next_vreg + 1, 1);
+    int64_t *const_val = malloc((prog->next_vreg > 0 ? prog->next_vreg : 1) * sizeof(int64_t));
+    for (int i = 0; i < prog->instr_count; i++) {
+        const IRInstr *ir = &prog->instrs[i];
+        if (ir->op == IR_CONST_INT) {
+            is_const[ir->dst] = 1;
+            const_val[ir->dst] = ir->imm;
+        }
+    }
+    for (int i = 0; i < prog->instr_count; i++) {
+        const IRInstr *ir = &prog->instrs[i];
+        int uses[IR_MAX_USES];
+        int nu = ir_instr_uses(ir, uses);
+        if (ir->op == IR_SHL || ir->op == IR_SHR) nu = 1;
+        if ((ir->op == IR_ARR_LOAD || ir->op == IR_ARR_STORE) && is_const[ir->rhs] &&
+            const_val[ir->rhs] >= 0 && const_val[ir->rhs] < (1 << 28))
+            nu--;
+        for (int u = 0; u < nu; u++)
+            if ((ir->op != IR_BR_CMP || u != br_cmp_imm(ir, is_const, const_val)) &&
+                needed[uses[u]] < 2)
+                needed[uses[u]]++;
+    }
+
+    /* Outgoing argument vregs collected from IR_ARG until their IR_CALL */
+    int *call_args = malloc((prog->instr_count > 0 ? prog->instr_count : 1) * sizeof(int));
 
     /* === Prologue === */
-    /* push rbp */
-    buf_write8(&code, 0x55);
-    /* mov rbp, rsp */
-    buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xE5);
-    /* sub rsp, frame_size */
-    buf_write8(&code, 0x48); buf_write8(&code, 0x81); buf_write8(&code, 0xEC);
-    buf_write32(&code, (uint32_t)frame_size);
+    emit_ir_prologue(&code, frame.size);
 
     /* Load data base address into r13 */
     buf_write8(&code, 0x4C); buf_write8(&code, 0x8D); buf_write8(&code, 0x2D);
     int data_base_patch = code.len;
     buf_write32(&code, 0); /* patched after code gen */
 
+    int arr_flags_patch = -1;
+    if (uses_arrays) {
+        /* AVX2 needs the CPU bit (cpuid leaf 7, ebx bit 5) and the OS
+         * saving the ymm state (OSXSAVE and AVX in leaf 1 ecx, then
+         * XCR0 bits 1 and 2):
+         * push rbx; mov eax, 1; cpuid; and ecx, mask; cmp ecx, mask;
+         * jne no; xor ecx, ecx; xgetbv; and eax, 6; cmp eax, 6; jne no;
+         * mov eax, 7; xor ecx, ecx; cpuid; bt ebx, 5;
+         * setc [r13 + flags]; no: pop rbx */
+        buf_write8(&code, 0x53);
+        emit_mov_r32_imm32(&code, 0, 1);
+        buf_write8(&code, 0x0F); buf_write8(&code, 0xA2);
+        buf_write8(&code, 0x81); buf_write8(&code, 0xE1); buf_write32(&code, 0x18000000);
+        buf_write8(&code, 0x81); buf_write8(&code, 0xF9); buf_write32(&code, 0x18000000);
+        buf_write8(&code, 0x75);
+        int jne_no_cpu = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x0F); buf_write8(&code, 0x01); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x83); buf_write8(&code, 0xE0); buf_write8(&code, 0x06);
+        buf_write8(&code, 0x83); buf_write8(&code, 0xF8); buf_write8(&code, 0x06);
+        buf_write8(&code, 0x75);
+        int jne_no_os = code.len;
+        buf_write8(&code, 0x00);
+        emit_mov_r32_imm32(&code, 0, 7);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x0F); buf_write8(&code, 0xA2);
+        buf_write8(&code, 0x0F); buf_write8(&code, 0xBA); buf_write8(&code, 0xE3); buf_write8(&code, 5);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x0F); buf_write8(&code, 0x92);
+        arr_flags_patch = code.len + 1;     /* the data grows until the routines */
+        emit_r13_modrm(&code, 0, 0);
+        code.data[jne_no_cpu] = (uint8_t)(code.len - jne_no_cpu - 1);
+        code.data[jne_no_os] = (uint8_t)(code.len - jne_no_os - 1);
+        buf_write8(&code, 0x5B);
+    }
+
     /* === Lower each IR instruction === */
     for (int i = 0; i < prog->instr_count; i++) {
         IRInstr *ir = &prog->instrs[i];
 
         switch (ir->op) {
 
-        case IR_CONST_INT: {
-            /* mov rax, imm64; mov [rbp + vreg_off], rax */
-            emit_mov_rax_imm64(&code, ir->imm);
-            emit_store_rbp_rax(&code, vreg_offset(ir->dst, slot_count));
+        case IR_CONST_INT:
+            if (needed[ir->dst])
+                emit_const_home(&code, &frame, vkey(&frame, ir->dst), ir->imm);
             break;
-        }
 
         case IR_CONST_STR:
-            /* String data is in the data section; we just record the index.
-             * This opcode doesn't produce a runtime value used by other
-             * instructions (strings are only used by IR_PRINT_STR). */
+            /* lea r, [r13 + object] */
+            if (needed[ir->dst]) {
+                int dst = vkey(&frame, ir->dst);
+                int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+                buf_write8(&code, r >= 8 ? 0x4D : 0x49); buf_write8(&code, 0x8D);
+                emit_r13_modrm(&code, r & 7, str_obj_offsets[ir->str_idx]);
+                emit_store_home(&code, &frame, dst, r);
+            }
             break;
 
-        case IR_LOAD_LOCAL: {
-            /* mov rax, [rbp + slot_off]; mov [rbp + vreg_off], rax */
-            emit_load_rbp(&code, slot_offset(ir->slot));
-            emit_store_rbp_rax(&code, vreg_offset(ir->dst, slot_count));
+        case IR_LOAD_LOCAL:
+            emit_move_home(&code, &frame, vkey(&frame, ir->dst), ir->slot);
             break;
-        }
 
-        case IR_STORE_LOCAL: {
-            /* mov rax, [rbp + src_vreg_off]; mov [rbp + slot_off], rax */
-            emit_load_rbp(&code, vreg_offset(ir->src, slot_count));
-            emit_store_rbp_rax(&code, slot_offset(ir->slot));
+        case IR_STORE_LOCAL:
+            emit_move_home(&code, &frame, ir->slot, vkey(&frame, ir->src));
             break;
-        }
-
-        case IR_ADD: case IR_SUB: case IR_MUL:
-        case IR_BIT_AND: case IR_BIT_OR: case IR_BIT_XOR:
-        case IR_SHL: case IR_SHR: {
-            /* mov rax, [rbp + lhs]; mov rcx, [rbp + rhs]; OP rax, rcx; mov [rbp + dst], rax */
-            emit_load_rbp(&code, vreg_offset(ir->lhs, slot_count));
-            emit_load_rbp_rcx(&code, vreg_offset(ir->rhs, slot_count));
 
-            switch (ir->op) {
-            case IR_ADD:
-                /* add rax, rcx */
-                buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xC8);
-                break;
-            case IR_SUB:
-                /* sub rax, rcx */
-                buf_write8(&code, 0x48); buf_write8(&code, 0x29); buf_write8(&code, 0xC8);
-                break;
-            case IR_MUL:
-                /* imul rax, rcx */
-                buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0xAF); buf_write8(&code, 0xC1);
-                break;
-            case IR_BIT_AND:
-                /* and rax, rcx */
-                buf_write8(&code, 0x48); buf_write8(&code, 0x21); buf_write8(&code, 0xC8);
-                break;
-            case IR_BIT_OR:
-                /* or rax, rcx */
-                buf_write8(&code, 0x48); buf_write8(&code, 0x09); buf_write8(&code, 0xC8);
-                break;
-            case IR_BIT_XOR:
-                /* xor rax, rcx */
-                buf_write8(&code, 0x48); buf_write8(&code, 0x31); buf_write8(&code, 0xC8);
-                break;
-            case IR_SHL:
-                /* shl rax, cl */
-                buf_write8(&code, 0x48); buf_write8(&code, 0xD3); buf_write8(&code, 0xE0);
-                break;
-            case IR_SHR:
-                /* sar rax, cl (arithmetic shift right) */
-                buf_write8(&code, 0x48); buf_write8(&code, 0xD3); buf_write8(&code, 0xF8);
-                break;
-            default: break;
+        case IR_LOAD_ELEM: case IR_LOAD_ELEM_UNCHECKED: {
+            /* Checked: mov rax, src; lea rcx, [rax + count]; test rax, rax;
+             * cmovs rax, rcx; cmp rax, count; jae bounds_fail.  Either way
+             * the element is then loaded with the index as SIB index, the
+             * source register itself when unchecked. */
+            int count = prog->tables[ir->imm].count;
+            int src = vkey(&frame, ir->src);
+            int x = home_reg(&frame, src);
+            if (ir->op == IR_LOAD_ELEM || x < 0) {
+                emit_load_home(&code, 0, &frame, src);
+                x = 0;
             }
-
-            emit_store_rbp_rax(&code, vreg_offset(ir->dst, slot_count));
+            if (ir->op == IR_LOAD_ELEM) {
+                buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x88);
+                buf_write32(&code, (uint32_t)count);
+                buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+                buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0x48); buf_write8(&code, 0xC1);
+                buf_write8(&code, 0x48); buf_write8(&code, 0x3D); buf_write32(&code, (uint32_t)count);
+                emit_jcc_label(&code, &patches, 0x83, LABEL_BOUNDS_FAIL);
+            }
+            int dst = vkey(&frame, ir->dst);
+            int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+            emit_load_table(&code, r, x, table_widths[ir->imm], table_offsets[ir->imm]);
+            emit_store_home(&code, &frame, dst, r);
             break;
         }
 
-        case IR_DIV: case IR_MOD: {
-            /* mov rax, [rbp + lhs]; cqo; mov rcx, [rbp + rhs]; idiv rcx */
-            emit_load_rbp(&code, vreg_offset(ir->lhs, slot_count));
-            /* cqo (sign-extend rax into rdx:rax) */
-            buf_write8(&code, 0x48); buf_write8(&code, 0x99);
-            emit_load_rbp_rcx(&code, vreg_offset(ir->rhs, slot_count));
-            /* idiv rcx */
-            buf_write8(&code, 0x48); buf_write8(&code, 0xF7); buf_write8(&code, 0xF9);
+        case IR_ALLOC:
+            /* mov rax, src; call alloc; mov dst, rax */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches, LABEL_ALLOC);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
 
-            if (ir->op == IR_DIV) {
-                /* result in rax */
-                emit_store_rbp_rax(&code, vreg_offset(ir->dst, slot_count));
-            } else {
-                /* remainder in rdx — mov rax, rdx first */
-                buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD0);
-                emit_store_rbp_rax(&code, vreg_offset(ir->dst, slot_count));
-            }
+        case IR_FREE:
+            /* mov rax, src; call free */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches, LABEL_FREE);
             break;
-        }
 
-        case IR_NEG: {
-            /* mov rax, [rbp + src]; neg rax; mov [rbp + dst], rax */
-            emit_load_rbp(&code, vreg_offset(ir->src, slot_count));
-            /* neg rax */
-            buf_write8(&code, 0x48); buf_write8(&code, 0xF7); buf_write8(&code, 0xD8);
-            emit_store_rbp_rax(&code, vreg_offset(ir->dst, slot_count));
+        case IR_STR_CONCAT: case IR_STR_APPEND: case IR_STR_EQ: case IR_STR_CMP:
+            /* mov rax, lhs; mov rdx, rhs; call routine; mov dst, rax */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+            emit_load_home(&code, 2, &frame, vkey(&frame, ir->rhs));
+            emit_call_routine(&code, &patches,
+                              ir->op == IR_STR_CONCAT ? LABEL_STR_CONCAT :
+                              ir->op == IR_STR_APPEND ? LABEL_STR_APPEND :
+                              ir->op == IR_STR_EQ ? LABEL_STR_EQ : LABEL_STR_CMP);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
             break;
-        }
 
-        case IR_BIT_NOT: {
-            /* mov rax, [rbp + src]; not rax; mov [rbp + dst], rax */
-            emit_load_rbp(&code, vreg_offset(ir->src, slot_count));
-            /* not rax */
-            buf_write8(&code, 0x48); buf_write8(&code, 0xF7); buf_write8(&code, 0xD0);
-            emit_store_rbp_rax(&code, vreg_offset(ir->dst, slot_count));
+        case IR_STR_FROM_INT:
+            /* mov rax, src; call str_from_int; mov dst, rax */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches, LABEL_STR_FROM_INT);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+
+        case IR_STR_FROM_FLOAT:
+            /* mov rax, src; call str_from_float; mov dst, rax */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches, LABEL_STR_FROM_FLOAT);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+
+        case IR_STR_LEN: {
+            /* mov rax, src; mov r, [rax] */
+            int dst = vkey(&frame, ir->dst);
+            int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, r >= 8 ? 0x4C : 0x48); buf_write8(&code, 0x8B);
+            buf_write8(&code, (uint8_t)((r & 7) << 3));
+            emit_store_home(&code, &frame, dst, r);
             break;
         }
 
-        case IR_CMP_EQ: case IR_CMP_NE:
-        case IR_CMP_LT: case IR_CMP_LE:
-        case IR_CMP_GT: case IR_CMP_GE: {
-            /* mov rax, [rbp + lhs]; cmp rax, [rbp + rhs]; setCC al; movzx rax, al */
-            emit_load_rbp(&code, vreg_offset(ir->lhs, slot_count));
-            emit_load_rbp_rcx(&code, vreg_offset(ir->rhs, slot_count));
-            /* cmp rax, rcx */
-            buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xC8);
+        case IR_STR_RELEASE:
+            /* mov rax, src; cmp qword [rax + 8], 0; je over; call free */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0x78);
+            buf_write8(&code, 0x08); buf_write8(&code, 0x00);
+            buf_write8(&code, 0x74); buf_write8(&code, 5);
+            emit_call_routine(&code, &patches, LABEL_FREE);
+            break;
 
-            /* setCC al */
-            buf_write8(&code, 0x0F);
-            switch (ir->op) {
-            case IR_CMP_EQ: buf_write8(&code, 0x94); break; /* sete al */
-            case IR_CMP_NE: buf_write8(&code, 0x95); break; /* setne al */
-            case IR_CMP_LT: buf_write8(&code, 0x9C); break; /* setl al */
-            case IR_CMP_LE: buf_write8(&code, 0x9E); break; /* setle al */
-            case IR_CMP_GT: buf_write8(&code, 0x9F); break; /* setg al */
-            case IR_CMP_GE: buf_write8(&code, 0x9D); break; /* setge al */
-            default: buf_write8(&code, 0x94); break;
+        case IR_CONST_ARR:
+            /* lea r, [r13 + object] */
+            if (needed[ir->dst]) {
+                int dst = vkey(&frame, ir->dst);
+                int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+                buf_write8(&code, r >= 8 ? 0x4D : 0x49); buf_write8(&code, 0x8D);
+                emit_r13_modrm(&code, r & 7, arr_obj_offsets[ir->imm]);
+                emit_store_home(&code, &frame, dst, r);
             }
-            buf_write8(&code, 0xC0); /* ModR/M: al */
-
-            /* movzx rax, al */
-            buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0xB6); buf_write8(&code, 0xC0);
+            break;
 
-            emit_store_rbp_rax(&code, vreg_offset(ir->dst, slot_count));
+        case IR_ARR_COPY: case IR_ARR_SUM: case IR_ARR_MIN: case IR_ARR_MAX:
+        case IR_ARR_FSUM: case IR_ARR_FMIN: case IR_ARR_FMAX:
+            /* mov rax, src; call routine; mov dst, rax */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches,
+                              ir->op == IR_ARR_COPY ? LABEL_ARR_COPY :
+                              ir->op == IR_ARR_SUM ? LABEL_ARR_SUM :
+                              ir->op == IR_ARR_MIN ? LABEL_ARR_MIN :
+                              ir->op == IR_ARR_MAX ? LABEL_ARR_MAX :
+                              ir->op == IR_ARR_FSUM ? LABEL_ARR_FSUM :
+                              ir->op == IR_ARR_FMIN ? LABEL_ARR_FMIN : LABEL_ARR_FMAX);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
             break;
-        }
 
-        case IR_LABEL:
-            label_offsets[ir->label_id] = code.len;
+        case IR_ARR_PUSH: case IR_ARR_INDEX_OF: case IR_ARR_FINDEX_OF:
+            /* mov rax, lhs; mov rdx, rhs; call routine; mov dst, rax */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+            emit_load_home(&code, 2, &frame, vkey(&frame, ir->rhs));
+            emit_call_routine(&code, &patches,
+                              ir->op == IR_ARR_PUSH ? LABEL_ARR_PUSH :
+                              ir->op == IR_ARR_INDEX_OF ? LABEL_ARR_INDEX_OF : LABEL_ARR_FINDEX_OF);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+
+        case IR_ARR_LEN: {
+            /* mov rax, src; mov r, [rax - 8] */
+            int dst = vkey(&frame, ir->dst);
+            int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, r >= 8 ? 0x4C : 0x48); buf_write8(&code, 0x8B);
+            buf_write8(&code, (uint8_t)(0x40 | ((r & 7) << 3))); buf_write8(&code, 0xF8);
+            emit_store_home(&code, &frame, dst, r);
+            break;
+        }
+
+        case IR_ARR_LOAD: case IR_ARR_STORE: {
+            /* mov rax, array.  A constant index k >= 0:
+             * cmp qword [rax - 8], k; jbe bounds_fail; then the element
+             * is [rax + 8k].  Otherwise mov rcx, index;
+             * mov rdx, [rax - 8]; add rdx, rcx; test rcx, rcx;
+             * cmovs rcx, rdx; cmp rcx, [rax - 8]; jae bounds_fail; then
+             * the element is [rax + rcx*8]. */
+            int64_t k = is_const[ir->rhs] ? const_val[ir->rhs] : -1;
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+            if (k >= 0 && k < (1 << 28)) {
+                buf_write8(&code, 0x48); buf_write8(&code, 0x81); buf_write8(&code, 0x78);
+                buf_write8(&code, 0xF8); buf_write32(&code, (uint32_t)k);
+                emit_jcc_label(&code, &patches, 0x86, LABEL_BOUNDS_FAIL);
+            } else {
+                k = -1;
+                emit_load_home(&code, 1, &frame, vkey(&frame, ir->rhs));
+                buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+                buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xCA);
+                buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
+                buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0x48); buf_write8(&code, 0xCA);
+                buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+                emit_jcc_label(&code, &patches, 0x83, LABEL_BOUNDS_FAIL);
+            }
+            /* mov r, element (the destination register, else rax), or
+             * mov rdx, src; mov element, rdx */
+            int r = 2, dst = -1;
+            if (ir->op == IR_ARR_LOAD) {
+                dst = vkey(&frame, ir->dst);
+                r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+            } else {
+                emit_load_home(&code, 2, &frame, vkey(&frame, ir->src));
+            }
+            buf_write8(&code, r >= 8 ? 0x4C : 0x48);
+            buf_write8(&code, ir->op == IR_ARR_LOAD ? 0x8B : 0x89);
+            if (k >= 0) {
+                buf_write8(&code, (uint8_t)(0x80 | ((r & 7) << 3)));
+                buf_write32(&code, (uint32_t)(8 * k));
+            } else {
+                buf_write8(&code, (uint8_t)(0x04 | ((r & 7) << 3))); buf_write8(&code, 0xC8);
+            }
+            if (dst >= 0) emit_store_home(&code, &frame, dst, r);
+            break;
+        }
+
+        case IR_ARR_RELEASE:
+            /* mov rax, src; cmp qword [rax - 16], 0; je over;
+             * mov rax, [rax - 24]; call free */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0x78);
+            buf_write8(&code, 0xF0); buf_write8(&code, 0x00);
+            buf_write8(&code, 0x74); buf_write8(&code, 9);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x40); buf_write8(&code, 0xE8);
+            emit_call_routine(&code, &patches, LABEL_FREE);
+            break;
+
+        case IR_MAP_NEW:
+            /* call map_new; mov dst, rax */
+            emit_call_routine(&code, &patches, LABEL_MAP_NEW);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+
+        case IR_MAP_LEN: {
+            /* mov rax, src; mov r, [rax] */
+            int dst = vkey(&frame, ir->dst);
+            int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, r >= 8 ? 0x4C : 0x48); buf_write8(&code, 0x8B);
+            buf_write8(&code, (uint8_t)((r & 7) << 3));
+            emit_store_home(&code, &frame, dst, r);
+            break;
+        }
+
+        case IR_MAP_GET: case IR_MAP_HAS: case IR_MAP_REMOVE:
+            /* mov rax, lhs; mov rdx, rhs; call routine; mov dst, rax */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+            emit_load_home(&code, 2, &frame, vkey(&frame, ir->rhs));
+            emit_call_routine(&code, &patches,
+                              ir->op == IR_MAP_GET ? LABEL_MAP_GET :
+                              ir->op == IR_MAP_HAS ? LABEL_MAP_HAS : LABEL_MAP_REMOVE);
+            if (ir->op != IR_MAP_REMOVE)
+                emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+
+        case IR_MAP_SET:
+            /* mov rax, lhs; mov rdx, rhs; mov rcx, src; call map_set */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+            emit_load_home(&code, 2, &frame, vkey(&frame, ir->rhs));
+            emit_load_home(&code, 1, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches, LABEL_MAP_SET);
+            break;
+
+        case IR_MAP_KEYS:
+            /* mov rax, src; call map_keys; mov dst, rax */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches, LABEL_MAP_KEYS);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+
+        case IR_MAP_RETAIN:
+            /* mov rax, src; inc qword [rax + 8] */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0x40); buf_write8(&code, 0x08);
+            break;
+
+        case IR_MAP_RELEASE:
+            /* mov rax, src; call map_release */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches, LABEL_MAP_RELEASE);
+            break;
+
+        case IR_STACK_ALLOC: {
+            /* lea r, [rbp - 8 * (first cell + cells)] */
+            int n = (int)((ir->imm + 7) / 8);
+            int dst = vkey(&frame, ir->dst);
+            int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+            emit_op_mem(&code, 0x8D, r, 5, -8 * (frame.obj_cell + n));
+            emit_store_home(&code, &frame, dst, r);
+            frame.obj_cell += n;
+            break;
+        }
+
+        case IR_OBJ_LOAD: {
+            /* mov r, [object + imm], through rax unless the object is
+             * in a register */
+            int dst = vkey(&frame, ir->dst);
+            int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+            int base = home_reg(&frame, vkey(&frame, ir->src));
+            if (base < 0) {
+                emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+                base = 0;
+            }
+            emit_op_mem(&code, 0x8B, r, base, (int)ir->imm);
+            emit_store_home(&code, &frame, dst, r);
+            break;
+        }
+
+        case IR_OBJ_STORE: {
+            /* mov [object + imm], src, each through rax or rdx unless it
+             * is in a register */
+            int base = home_reg(&frame, vkey(&frame, ir->lhs));
+            int v = home_reg(&frame, vkey(&frame, ir->src));
+            if (base < 0) {
+                emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+                base = 0;
+            }
+            if (v < 0) {
+                emit_load_home(&code, 2, &frame, vkey(&frame, ir->src));
+                v = 2;
+            }
+            emit_op_mem(&code, 0x89, v, base, (int)ir->imm);
+            break;
+        }
+
+        case IR_OBJ_RETAIN:
+            /* mov rax, src; inc qword [rax] */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0x00);
+            break;
+
+        case IR_OBJ_RELEASE:
+            /* mov rax, src; dec qword [rax]; jnz over; call free */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0x08);
+            buf_write8(&code, 0x75); buf_write8(&code, 5);
+            emit_call_routine(&code, &patches, LABEL_FREE);
+            break;
+
+        case IR_ADD: case IR_SUB: case IR_MUL:
+        case IR_BIT_AND: case IR_BIT_OR: case IR_BIT_XOR: {
+            /* mov r, lhs; OP r, rhs — r is the destination register when
+             * there is one, rax otherwise */
+            int dst = vkey(&frame, ir->dst), rhs = vkey(&frame, ir->rhs);
+            int d = home_reg(&frame, dst);
+            int r = d >= 0 && d != home_reg(&frame, rhs) ? d : 0;
+            int opcode;
+            switch (ir->op) {
+            case IR_ADD:     opcode = 0x03; break;   /* add r, r/m */
+            case IR_SUB:     opcode = 0x2B; break;   /* sub r, r/m */
+            case IR_MUL:     opcode = 0x0FAF; break; /* imul r, r/m */
+            case IR_BIT_AND: opcode = 0x23; break;   /* and r, r/m */
+            case IR_BIT_OR:  opcode = 0x0B; break;   /* or r, r/m */
+            default:         opcode = 0x33; break;   /* xor r, r/m */
+            }
+            emit_load_home(&code, r, &frame, vkey(&frame, ir->lhs));
+            emit_op_home(&code, opcode, r, &frame, rhs);
+            emit_store_home(&code, &frame, dst, r);
+            break;
+        }
+
+        case IR_SHL: case IR_SHR: {
+            if (is_const[ir->rhs]) {
+                /* mov r, lhs; shl/sar r, imm8 */
+                int dst = vkey(&frame, ir->dst);
+                int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+                emit_load_home(&code, r, &frame, vkey(&frame, ir->lhs));
+                buf_write8(&code, 0x48 | (r >= 8 ? 0x01 : 0));
+                buf_write8(&code, 0xC1);
+                buf_write8(&code, (ir->op == IR_SHL ? 0xE0 : 0xF8) | (r & 7));
+                buf_write8(&code, (uint8_t)(const_val[ir->rhs] & 63));
+                emit_store_home(&code, &frame, dst, r);
+                break;
+            }
+            /* mov rax, lhs; mov rcx, rhs; shl/sar rax, cl */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+            emit_load_home(&code, 1, &frame, vkey(&frame, ir->rhs));
+            buf_write8(&code, 0x48); buf_write8(&code, 0xD3);
+            buf_write8(&code, ir->op == IR_SHL ? 0xE0 : 0xF8);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+        }
+
+        case IR_DIV: case IR_MOD: {
+            /* mov rax, lhs; cqo; idiv rhs — quotient in rax, remainder in rdx.
+             * Unless rhs is a constant other than 0 and -1, first
+             * cmp rhs, 0; je div_zero; cmp rhs, -1; jne ok; neg rax;
+             * jo div_overflow (lhs is INT64_MIN); neg rax; ok: */
+            int rhs = vkey(&frame, ir->rhs);
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+            if (!is_const[ir->rhs] || const_val[ir->rhs] == 0 || const_val[ir->rhs] == -1) {
+                emit_op_home(&code, 0x83, 7, &frame, rhs);
+                buf_write8(&code, 0x00);
+                emit_jcc_label(&code, &patches, 0x84, LABEL_DIV_ZERO);
+                emit_op_home(&code, 0x83, 7, &frame, rhs);
+                buf_write8(&code, 0xFF);
+                buf_write8(&code, 0x75); buf_write8(&code, 12);
+                buf_write8(&code, 0x48); buf_write8(&code, 0xF7); buf_write8(&code, 0xD8);
+                emit_jcc_label(&code, &patches, 0x80, LABEL_DIV_OVERFLOW);
+                buf_write8(&code, 0x48); buf_write8(&code, 0xF7); buf_write8(&code, 0xD8);
+            }
+            buf_write8(&code, 0x48); buf_write8(&code, 0x99);
+            emit_op_home(&code, 0xF7, 7, &frame, rhs);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), ir->op == IR_DIV ? 0 : 2);
+            break;
+        }
+
+        case IR_MUL_HI:
+            /* mov rax, lhs; imul rhs — the high half lands in rdx */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+            emit_op_home(&code, 0xF7, 5, &frame, vkey(&frame, ir->rhs));
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 2);
+            break;
+
+        case IR_NEG: case IR_BIT_NOT: {
+            /* mov r, src; neg/not r */
+            int dst = vkey(&frame, ir->dst);
+            int r = home_reg(&frame, dst) >= 0 ? home_reg(&frame, dst) : 0;
+            emit_load_home(&code, r, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, 0x48 | (r >= 8 ? 0x01 : 0));
+            buf_write8(&code, 0xF7);
+            buf_write8(&code, (ir->op == IR_NEG ? 0xD8 : 0xD0) | (r & 7));
+            emit_store_home(&code, &frame, dst, r);
+            break;
+        }
+
+        case IR_CMP_EQ: case IR_CMP_NE:
+        case IR_CMP_LT: case IR_CMP_LE:
+        case IR_CMP_GT: case IR_CMP_GE: {
+            /* mov rax, lhs; cmp rax, rhs; setCC al; movzx eax, al */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->lhs));
+            emit_op_home(&code, 0x3B, 0, &frame, vkey(&frame, ir->rhs));
+            if (select_fuses_cmp(prog, needed, i)) break;
+
+            /* setCC al */
+            buf_write8(&code, 0x0F);
+            switch (ir->op) {
+            case IR_CMP_EQ: buf_write8(&code, 0x94); break; /* sete al */
+            case IR_CMP_NE: buf_write8(&code, 0x95); break; /* setne al */
+            case IR_CMP_LT: buf_write8(&code, 0x9C); break; /* setl al */
+            case IR_CMP_LE: buf_write8(&code, 0x9E); break; /* setle al */
+            case IR_CMP_GT: buf_write8(&code, 0x9F); break; /* setg al */
+            case IR_CMP_GE: buf_write8(&code, 0x9D); break; /* setge al */
+            default: buf_write8(&code, 0x94); break;
+            }
+            buf_write8(&code, 0xC0); /* ModR/M: al */
+
+            /* movzx eax, al */
+            buf_write8(&code, 0x0F); buf_write8(&code, 0xB6); buf_write8(&code, 0xC0);
+
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+        }
+
+        case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: {
+            /* x = lhs; addsd/subsd/mulsd/divsd x, rhs; dst = x, with x
+             * the xmm home of dst unless that holds rhs, else xmm0 */
+            int dst = vkey(&frame, ir->dst), rhs = vkey(&frame, ir->rhs);
+            int d = home_xmm(&frame, dst);
+            int x = d >= 0 && d != home_xmm(&frame, rhs) ? d : 0;
+            emit_xmm_load(&code, x, &frame, vkey(&frame, ir->lhs));
+            emit_sd_home(&code, ir->op == IR_FADD ? 0x58 : ir->op == IR_FSUB ? 0x5C :
+                                ir->op == IR_FMUL ? 0x59 : 0x5E, x, &frame, rhs);
+            emit_xmm_store(&code, &frame, dst, x);
+            break;
+        }
+
+        case IR_FCMP: {
+            /* xmm0 = lhs; cmpsd xmm0, rhs, pred (operands swapped for gt
+             * and ge; eq 0, lt 1, le 2, neq 4: only that one holds for a
+             * nan); movq rax, xmm0; and eax, 1; mov dst, rax */
+            int swap = ir->imm == IR_CMP_GT || ir->imm == IR_CMP_GE;
+            uint8_t pred = ir->imm == IR_CMP_EQ ? 0 : ir->imm == IR_CMP_NE ? 4 :
+                           ir->imm == IR_CMP_LT || ir->imm == IR_CMP_GT ? 1 : 2;
+            emit_xmm_load(&code, 0, &frame, vkey(&frame, swap ? ir->rhs : ir->lhs));
+            emit_sd_home(&code, 0xC2, 0, &frame, vkey(&frame, swap ? ir->lhs : ir->rhs));
+            buf_write8(&code, pred);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x48); buf_write8(&code, 0x0F);
+            buf_write8(&code, 0x7E); buf_write8(&code, 0xC0);
+            buf_write8(&code, 0x83); buf_write8(&code, 0xE0); buf_write8(&code, 0x01);
+            emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+        }
+
+        case IR_INT_TO_FLOAT: {
+            /* pxor x, x (no false dependency); cvtsi2sd x, src; dst = x,
+             * with x the xmm home of dst or xmm0 */
+            int dst = vkey(&frame, ir->dst);
+            int x = home_xmm(&frame, dst) >= 0 ? home_xmm(&frame, dst) : 0;
+            emit_sse_rr(&code, 0x66, 0xEF, x, x);
+            emit_sse_home(&code, 0xF2, 0x2A, x, &frame, vkey(&frame, ir->src));
+            emit_xmm_store(&code, &frame, dst, x);
+            break;
+        }
+
+        case IR_SELECT: {
+            /* Flags from the compare just before, or test src, src;
+             * then mov r, rhs; cmovCC r, lhs */
+            uint8_t cc = 0x05;                          /* ne */
+            if (i > 0 && select_fuses_cmp(prog, needed, i - 1)) {
+                cc = x86_cc((IROpcode)prog->instrs[i - 1].op);
+            } else {
+                emit_op_home(&code, 0x83, 7, &frame, vkey(&frame, ir->src));
+                buf_write8(&code, 0x00);
+            }
+            int dst = vkey(&frame, ir->dst), lhs = vkey(&frame, ir->lhs);
+            int d = home_reg(&frame, dst);
+            int r = d >= 0 && d != home_reg(&frame, lhs) ? d : 0;
+            emit_load_home(&code, r, &frame, vkey(&frame, ir->rhs));
+            emit_op_home(&code, 0x0F40 | cc, r, &frame, lhs);
+            emit_store_home(&code, &frame, dst, r);
+            break;
+        }
+
+        case IR_LABEL:
+            label_offsets[ir->label_id] = code.len;
             break;
 
         case IR_JMP:
             /* jmp rel32 — will be patched */
             buf_write8(&code, 0xE9);
-            patches[patch_count].code_offset = code.len;
-            patches[patch_count].label_id = ir->label_id;
-            patch_count++;
-            buf_write32(&code, 0); /* placeholder */
+            emit_patch32(&code, &patches, ir->label_id, -1);
             break;
 
-        case IR_JZ: {
-            /* mov rax, [rbp + src]; test rax, rax; jz rel32 */
-            emit_load_rbp(&code, vreg_offset(ir->src, slot_count));
-            /* test rax, rax */
-            buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
-            /* je rel32 */
-            buf_write8(&code, 0x0F); buf_write8(&code, 0x84);
-            patches[patch_count].code_offset = code.len;
-            patches[patch_count].label_id = ir->label_id;
-            patch_count++;
-            buf_write32(&code, 0);
+        case IR_JZ: case IR_JNZ: {
+            /* cmp src, 0; je/jne rel32 */
+            emit_op_home(&code, 0x83, 7, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, 0x00);
+            buf_write8(&code, 0x0F); buf_write8(&code, ir->op == IR_JZ ? 0x84 : 0x85);
+            emit_patch32(&code, &patches, ir->label_id, -1);
             break;
         }
 
-        case IR_JNZ: {
-            /* mov rax, [rbp + src]; test rax, rax; jnz rel32 */
-            emit_load_rbp(&code, vreg_offset(ir->src, slot_count));
-            buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
-            /* jne rel32 */
-            buf_write8(&code, 0x0F); buf_write8(&code, 0x85);
-            patches[patch_count].code_offset = code.len;
-            patches[patch_count].label_id = ir->label_id;
-            patch_count++;
+        case IR_BR_CMP: {
+            /* cmp lhs, rhs (or cmp r/m, imm with a small constant on
+             * either side); jcc rel32 */
+            IROpcode cmp = (IROpcode)ir->imm;
+            int imm_side = br_cmp_imm(ir, is_const, const_val);
+            if (imm_side >= 0) {
+                int other = imm_side == 1 ? ir->lhs : ir->rhs;
+                int64_t imm = const_val[imm_side == 1 ? ir->rhs : ir->lhs];
+                if (imm_side == 0) cmp = ir_cmp_swap(cmp);
+                if (imm >= -128 && imm <= 127) {
+                    emit_op_home(&code, 0x83, 7, &frame, vkey(&frame, other));
+                    buf_write8(&code, (uint8_t)(int8_t)imm);
+                } else {
+                    emit_op_home(&code, 0x81, 7, &frame, vkey(&frame, other));
+                    buf_write32(&code, (uint32_t)(int32_t)imm);
+                }
+            } else {
+                int lhs = vkey(&frame, ir->lhs);
+                int r = home_reg(&frame, lhs) >= 0 ? home_reg(&frame, lhs) : 0;
+                emit_load_home(&code, r, &frame, lhs);
+                emit_op_home(&code, 0x3B, r, &frame, vkey(&frame, ir->rhs));
+            }
+            buf_write8(&code, 0x0F);
+            switch (cmp) {
+            case IR_CMP_EQ: buf_write8(&code, 0x84); break; /* je */
+            case IR_CMP_NE: buf_write8(&code, 0x85); break; /* jne */
+            case IR_CMP_LT: buf_write8(&code, 0x8C); break; /* jl */
+            case IR_CMP_LE: buf_write8(&code, 0x8E); break; /* jle */
+            case IR_CMP_GT: buf_write8(&code, 0x8F); break; /* jg */
+            default:        buf_write8(&code, 0x8D); break; /* jge */
+            }
+            emit_patch32(&code, &patches, ir->label_id, -1);
+            break;
+        }
+
+        case IR_SWITCH: {
+            /* Dense cases index a table of offsets, relative to the
+             * table, that follows the indirect jump; sparse ones are
+             * found by binary search */
+            const IRSwitch *sw = &prog->switches[ir->imm];
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            uint64_t range = sw->count > 0 ?
+                (uint64_t)sw->values[sw->count - 1] - (uint64_t)sw->values[0] + 1 : 0;
+            if (sw->count < 4 || range == 0 || range > 3 * (uint64_t)sw->count) {
+                emit_switch_search(&code, &patches, sw, 0, sw->count, ir->label_id);
+                break;
+            }
+            /* sub rax, min; cmp rax, range - 1; ja default */
+            int64_t min = sw->values[0];
+            if (min != 0) {
+                if (min >= INT32_MIN && min <= INT32_MAX) {
+                    buf_write8(&code, 0x48); buf_write8(&code, 0x2D);
+                    buf_write32(&code, (uint32_t)(int32_t)min);
+                } else {
+                    buf_write8(&code, 0x48); buf_write8(&code, 0xB9);   /* movabs rcx, min */
+                    buf_write64(&code, (uint64_t)min);
+                    buf_write8(&code, 0x48); buf_write8(&code, 0x29); buf_write8(&code, 0xC8);
+                }
+            }
+            emit_cmp_rax_imm(&code, (int64_t)(range - 1));
+            emit_jcc_label(&code, &patches, 0x87, ir->label_id);
+            /* lea rcx, [rip + table]; movsxd rax, [rcx + rax*4]; add rax, rcx; jmp rax */
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x0D);
+            int table_patch = code.len;
             buf_write32(&code, 0);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x63);
+            buf_write8(&code, 0x04); buf_write8(&code, 0x81);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xC8);
+            buf_write8(&code, 0xFF); buf_write8(&code, 0xE0);
+            while (code.len % 4) buf_write8(&code, 0xCC);
+            int table = code.len;
+            patch_rel32(&code, table_patch, table);
+            for (uint64_t v = 0, k = 0; v < range; v++) {
+                int label = ir->label_id;
+                if (k < (uint64_t)sw->count && (uint64_t)sw->values[k] - (uint64_t)min == v)
+                    label = sw->labels[k++];
+                emit_patch32(&code, &patches, label, table);
+            }
             break;
         }
 
         case IR_PRINT_STR: {
-            /* write(1, &str_data, len) via syscall */
-            /* lea rsi, [r13 + str_offset] */
-            buf_write8(&code, 0x49); buf_write8(&code, 0x8D); buf_write8(&code, 0xB5);
-            buf_write32(&code, (uint32_t)str_data_offsets[ir->str_idx]);
-            /* mov eax, 1 (sys_write) */
-            emit_mov_r32_imm32(&code, 0, 1);
-            /* mov edi, 1 (stdout) */
-            emit_mov_r32_imm32(&code, 7, 1);
-            /* mov edx, len */
+            /* lea rsi, [r13 + str_offset]; mov edx, len; call out_write */
+            buf_write8(&code, 0x49); buf_write8(&code, 0x8D);
+            emit_r13_modrm(&code, 6, str_data_offsets[ir->str_idx]);
             emit_mov_r32_imm32(&code, 2, (uint32_t)ir->str_len);
-            emit_syscall(&code);
+            emit_call_routine(&code, &patches, LABEL_OUT_WRITE);
+            if (line_buffered && memchr(prog->strings[ir->str_idx].data, '\n', ir->str_len))
+                emit_call_routine(&code, &patches, LABEL_OUT_FLUSH);
             break;
         }
 
+        case IR_PRINT_STR_VAL:
+            /* mov rax, src; lea rsi, [rax + 16]; mov rdx, [rax];
+             * call out_write.  Its bytes are not known here, so a line
+             * buffered program flushes after every one. */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x70); buf_write8(&code, 16);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x10);
+            emit_call_routine(&code, &patches, LABEL_OUT_WRITE);
+            if (line_buffered)
+                emit_call_routine(&code, &patches, LABEL_OUT_FLUSH);
+            break;
+
         case IR_PRINT_INT: {
             /* Load value into rdi, call itoa_print subroutine */
-            /* mov rdi, [rbp + src_vreg_off] */
-            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0xBD);
-            buf_write32(&code, (uint32_t)(int32_t)vreg_offset(ir->src, slot_count));
-            /* call itoa_print (rel32 — patched later) */
-            buf_write8(&code, 0xE8);
-            /* We'll record this position and patch it after we emit the subroutine */
-            patches[patch_count].code_offset = code.len;
-            patches[patch_count].label_id = -1; /* special: itoa */
-            patch_count++;
-            buf_write32(&code, 0);
+            emit_load_home(&code, 7, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches, LABEL_ITOA);
             break;
         }
 
+        case IR_PRINT_FLOAT:
+            /* mov rax, src; call float_print */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            emit_call_routine(&code, &patches, LABEL_PRINT_FLOAT);
+            break;
+
         case IR_PRINT_BOOL: {
-            /* Load vreg value, test, branch to print "true" or "false" */
-            emit_load_rbp(&code, vreg_offset(ir->src, slot_count));
+            /* test src; point rsi/edx at "true", or at "false" when src
+             * is zero; call out_write */
+            emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
             /* test rax, rax */
             buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
-            /* jz print_false (short jump, patched below) */
-            buf_write8(&code, 0x74);
-            int jz_false_patch = code.len;
-            buf_write8(&code, 0x00); /* placeholder */
-
-            /* === print "true" (4 bytes) === */
-            /* lea rsi, [r13 + bool_true_offset] */
-            buf_write8(&code, 0x49); buf_write8(&code, 0x8D); buf_write8(&code, 0xB5);
-            buf_write32(&code, (uint32_t)bool_true_offset);
-            emit_mov_r32_imm32(&code, 0, 1);  /* sys_write */
-            emit_mov_r32_imm32(&code, 7, 1);  /* stdout */
-            emit_mov_r32_imm32(&code, 2, 4);  /* len = 4 */
-            emit_syscall(&code);
-            /* jmp end_print_bool (short) */
-            buf_write8(&code, 0xEB);
-            int jmp_end_patch = code.len;
-            buf_write8(&code, 0x00); /* placeholder */
-
-            /* === print "false" (5 bytes) === */
-            int false_offset_code = code.len;
-            code.data[jz_false_patch] = (uint8_t)(false_offset_code - jz_false_patch - 1);
-
-            /* lea rsi, [r13 + bool_false_offset] */
-            buf_write8(&code, 0x49); buf_write8(&code, 0x8D); buf_write8(&code, 0xB5);
-            buf_write32(&code, (uint32_t)bool_false_offset);
-            emit_mov_r32_imm32(&code, 0, 1);  /* sys_write */
-            emit_mov_r32_imm32(&code, 7, 1);  /* stdout */
-            emit_mov_r32_imm32(&code, 2, 5);  /* len = 5 */
-            emit_syscall(&code);
+            /* lea rsi, [r13 + bool_true_offset]; mov edx, 4 */
+            buf_write8(&code, 0x49); buf_write8(&code, 0x8D);
+            emit_r13_modrm(&code, 6, bool_true_offset);
+            emit_mov_r32_imm32(&code, 2, 4);
+            /* jnz over the "false" operands (lea 7 bytes + mov 5 bytes) */
+            buf_write8(&code, 0x75); buf_write8(&code, 12);
+            buf_write8(&code, 0x49); buf_write8(&code, 0x8D);
+            emit_r13_modrm(&code, 6, bool_false_offset);
+            emit_mov_r32_imm32(&code, 2, 5);
+            emit_call_routine(&code, &patches, LABEL_OUT_WRITE);
+            break;
+        }
+
+        case IR_FUNC: {
+            /* New function: allocate and lay out its frame, then the
+             * standard prologue and the callee-saved registers it uses */
+            region_end = i + 1;
+            while (region_end < prog->instr_count && prog->instrs[region_end].op != IR_FUNC)
+                region_end++;
+            ir_frame_layout(&frame, prog, i, region_end, 0);
+            label_offsets[ir->label_id] = code.len;
+            emit_ir_prologue(&code, frame.size);
+            emit_callee_saves(&code, &frame, 0);
+            break;
+        }
+
+        case IR_PARAM: {
+            int idx = (int)ir->imm;
+            if (idx < 6) {
+                emit_store_home(&code, &frame, vkey(&frame, ir->dst), sysv_arg_regs[idx]);
+            } else {
+                /* mov rax, [rbp + 16 + 8*(idx-6)] */
+                emit_load_rbp_reg(&code, 0, 16 + 8 * (idx - 6));
+                emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            }
+            break;
+        }
 
-            /* end_print_bool: */
-            int end_print_bool = code.len;
-            code.data[jmp_end_patch] = (uint8_t)(end_print_bool - jmp_end_patch - 1);
+        case IR_ARG:
+            call_args[ir->imm] = ir->src;
+            break;
+
+        case IR_CALL: {
+            /* Argument values are never in caller-saved registers (the
+             * allocator sees them live across the call), so loading the
+             * argument registers cannot overwrite a pending argument */
+            int argc = (int)ir->imm;
+            int stack_args = argc > 6 ? argc - 6 : 0;
+            int pad = (stack_args & 1) ? 8 : 0;
+            if (pad) {
+                /* sub rsp, 8 (keep rsp 16-byte aligned at the call) */
+                buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xEC); buf_write8(&code, 8);
+            }
+            for (int a = argc - 1; a >= 6; a--) {
+                /* push arg */
+                emit_op_home(&code, 0xFF, 6, &frame, vkey(&frame, call_args[a]));
+            }
+            for (int a = 0; a < argc && a < 6; a++)
+                emit_load_home(&code, sysv_arg_regs[a], &frame, vkey(&frame, call_args[a]));
+            /* call rel32 — patched like a jump */
+            buf_write8(&code, 0xE8);
+            emit_patch32(&code, &patches, ir->label_id, -1);
+            if (stack_args) {
+                /* add rsp, 8*stack_args + pad */
+                buf_write8(&code, 0x48); buf_write8(&code, 0x81); buf_write8(&code, 0xC4);
+                buf_write32(&code, (uint32_t)(8 * stack_args + pad));
+            }
+            if (ir->dst >= 0)
+                emit_store_home(&code, &frame, vkey(&frame, ir->dst), 0);
+            break;
+        }
+
+        case IR_RET: {
+            if (ir->src >= 0)
+                emit_load_home(&code, 0, &frame, vkey(&frame, ir->src));
+            emit_callee_saves(&code, &frame, 1);
+            /* leave; ret */
+            buf_write8(&code, 0xC9);
+            buf_write8(&code, 0xC3);
             break;
         }
 
         case IR_EXIT: {
-            /* mov eax, 60; xor edi, edi; syscall */
+            /* call out_flush; mov eax, 60; xor edi, edi; syscall */
+            emit_call_routine(&code, &patches, LABEL_OUT_FLUSH);
             emit_mov_r32_imm32(&code, 0, 60);
             buf_write8(&code, 0x31); buf_write8(&code, 0xFF);
             emit_syscall(&code);
@@ -1595,166 +3380,2161 @@ int emit_binary_ir(IRProgram *prog, const char *output_path)
     /* === itoa_print subroutine ===
      *
      * Input: rdi = signed 64-bit integer
-     * Clobbers: rax, rcx, rdx, rsi, r8
-     * Writes the decimal representation to stdout, then returns.
+     * Clobbers: rax, rcx, rdx, rsi, rdi, r8, r9, r11
+     * Appends the decimal representation to the output buffer, then
+     * returns.
      *
      * Algorithm:
-     *   1. Handle negative: if rdi < 0, write '-', negate rdi
-     *   2. Build digits on stack buffer (32 bytes) from right to left
-     *   3. write(1, buf, len)
-     *   4. ret
+     *   1. Flush first unless the buffer has room for 24 more bytes
+     *   2. Format the digits and sign into a 32-byte stack buffer,
+     *      right to left (emit_format_int)
+     *   3. Copy 24 bytes from the first character into the buffer (at
+     *      most 20 are real) and advance the fill counter by the length
      */
+    int digits_offset = data.len;
+    for (int d = 0; d < 100; d++) {
+        buf_write8(&data, (uint8_t)('0' + d / 10));
+        buf_write8(&data, (uint8_t)('0' + d % 10));
+    }
+    /* The powers of ten float_format scales by */
+    int float_table_offset = -1;
+    if (uses_floats) {
+        while (data.len % 8) buf_write8(&data, 0);
+        float_table_offset = data.len;
+        for (int k = IR_FLOAT_K_MIN; k <= IR_FLOAT_K_MAX; k++) {
+            uint64_t hi, lo;
+            ir_float_pow10(k, &hi, &lo);
+            buf_write64(&data, hi);
+            buf_write64(&data, lo);
+        }
+    }
+    int fill_offset = OUT_FILL_OFFSET(data.len), buf_offset = OUT_BUF_OFFSET(data.len);
+
     int itoa_offset = code.len;
 
-    /* sub rsp, 32 (local buffer) */
+    /* mov rax, [r13 + fill]; cmp rax, size - 24; jbe room */
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8B); emit_r13_modrm(&code, 0, fill_offset);
+    buf_write8(&code, 0x48); buf_write8(&code, 0x3D); buf_write32(&code, OUT_BUF_SIZE - 24);
+    buf_write8(&code, 0x76);
+    int jbe_room_patch = code.len;
+    buf_write8(&code, 0x00);
+    /* push rdi; call out_flush; pop rdi */
+    buf_write8(&code, 0x57);
+    emit_call_routine(&code, &patches, LABEL_OUT_FLUSH);
+    buf_write8(&code, 0x5F);
+    code.data[jbe_room_patch] = (uint8_t)(code.len - jbe_room_patch - 1);
+
+    /* sub rsp, 32; lea r8, [rsp + 32] (one past the last character) */
     buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xEC); buf_write8(&code, 32);
+    buf_write8(&code, 0x4C); buf_write8(&code, 0x8D); buf_write8(&code, 0x44); buf_write8(&code, 0x24); buf_write8(&code, 32);
 
-    /* mov rax, rdi (value to convert) */
+    /* mov rax, rdi */
     buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xF8);
+    emit_format_int(&code, digits_offset);
+
+    /* === copy === */
+    /* lea rdx, [rsp + 32]; sub rdx, r8 (length) */
+    buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x54); buf_write8(&code, 0x24); buf_write8(&code, 32);
+    buf_write8(&code, 0x4C); buf_write8(&code, 0x29); buf_write8(&code, 0xC2);
+    /* mov rax, [r13 + fill]; lea rdi, [r13 + rax + buf] */
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8B); emit_r13_modrm(&code, 0, fill_offset);
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8D); buf_write8(&code, 0xBC); buf_write8(&code, 0x05);
+    buf_write32(&code, (uint32_t)buf_offset);
+    /* three qword moves through rcx: [rdi + k] = [r8 + k] for k = 0, 8, 16 */
+    for (int k = 0; k < 24; k += 8) {
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, (uint8_t)k);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x4F); buf_write8(&code, (uint8_t)k);
+    }
+    /* add rax, rdx; mov [r13 + fill], rax */
+    buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xD0);
+    buf_write8(&code, 0x49); buf_write8(&code, 0x89); emit_r13_modrm(&code, 0, fill_offset);
 
-    /* lea r8, [rsp + 31] (pointer to end of buffer) */
-    buf_write8(&code, 0x4C); buf_write8(&code, 0x8D); buf_write8(&code, 0x44); buf_write8(&code, 0x24); buf_write8(&code, 31);
+    /* add rsp, 32; ret */
+    buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC4); buf_write8(&code, 32);
+    buf_write8(&code, 0xC3);
 
-    /* mov byte [r8], 0 (null terminator — not used, just a sentinel) */
+    /* === Output buffer routines ===
+     *
+     * out_write: rsi = bytes, rdx = length.  Appends to the buffer,
+     * flushing first if they do not fit; a piece as large as the buffer
+     * itself is written straight out.
+     * out_flush: writes the buffer out and empties it.
+     * write_all: write(1, rsi, rdx), repeated after partial writes; gives
+     * up on an error.
+     * All three clobber rax, rcx, rdx, rsi, rdi and r11 only.
+     */
+    int write_all_offset = code.len;
+    /* test rdx, rdx; jle done */
+    buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xD2);
+    buf_write8(&code, 0x7E);
+    int jle_done_patch = code.len;
+    buf_write8(&code, 0x00);
+    emit_mov_r32_imm32(&code, 0, 1);  /* sys_write */
+    emit_mov_r32_imm32(&code, 7, 1);  /* stdout */
+    emit_syscall(&code);
+    /* test rax, rax; jle done */
+    buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+    buf_write8(&code, 0x7E);
+    int jle_err_patch = code.len;
+    buf_write8(&code, 0x00);
+    /* add rsi, rax; sub rdx, rax; jmp write_all */
+    buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xC6);
+    buf_write8(&code, 0x48); buf_write8(&code, 0x29); buf_write8(&code, 0xC2);
+    buf_write8(&code, 0xEB);
+    buf_write8(&code, (uint8_t)(write_all_offset - (code.len + 1)));
+    code.data[jle_done_patch] = (uint8_t)(code.len - jle_done_patch - 1);
+    code.data[jle_err_patch] = (uint8_t)(code.len - jle_err_patch - 1);
+    buf_write8(&code, 0xC3);          /* ret */
+
+    int out_flush_offset = code.len;
+    /* lea rsi, [r13 + buf]; mov rdx, [r13 + fill]; mov qword [r13 + fill], 0 */
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8D); emit_r13_modrm(&code, 6, buf_offset);
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8B); emit_r13_modrm(&code, 2, fill_offset);
+    buf_write8(&code, 0x49); buf_write8(&code, 0xC7); emit_r13_modrm(&code, 0, fill_offset);
+    buf_write32(&code, 0);
+    /* jmp write_all */
+    buf_write8(&code, 0xEB);
+    buf_write8(&code, (uint8_t)(write_all_offset - (code.len + 1)));
+
+    int out_write_offset = code.len;
+    /* mov rax, [r13 + fill]; lea rcx, [rax + rdx]; cmp rcx, size; jbe copy */
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8B); emit_r13_modrm(&code, 0, fill_offset);
+    buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x0C); buf_write8(&code, 0x10);
+    buf_write8(&code, 0x48); buf_write8(&code, 0x81); buf_write8(&code, 0xF9);
+    buf_write32(&code, OUT_BUF_SIZE);
+    buf_write8(&code, 0x76);
+    int jbe_copy_patch = code.len;
+    buf_write8(&code, 0x00);
+    /* push rsi; push rdx; call out_flush; pop rdx; pop rsi */
+    buf_write8(&code, 0x56); buf_write8(&code, 0x52);
+    buf_write8(&code, 0xE8);
+    buf_write32(&code, 0);
+    patch_rel32(&code, code.len - 4, out_flush_offset);
+    buf_write8(&code, 0x5A); buf_write8(&code, 0x5E);
+    /* xor eax, eax; cmp rdx, size; jb copy; jmp write_all */
+    buf_write8(&code, 0x31); buf_write8(&code, 0xC0);
+    buf_write8(&code, 0x48); buf_write8(&code, 0x81); buf_write8(&code, 0xFA);
+    buf_write32(&code, OUT_BUF_SIZE);
+    buf_write8(&code, 0x72);
+    int jb_copy_patch = code.len;
+    buf_write8(&code, 0x00);
+    buf_write8(&code, 0xE9);
+    buf_write32(&code, 0);
+    patch_rel32(&code, code.len - 4, write_all_offset);
+    /* copy: lea rdi, [r13 + rax + buf]; mov rcx, rdx; rep movsb;
+     * add rax, rdx; mov [r13 + fill], rax; ret */
+    code.data[jbe_copy_patch] = (uint8_t)(code.len - jbe_copy_patch - 1);
+    code.data[jb_copy_patch] = (uint8_t)(code.len - jb_copy_patch - 1);
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8D); buf_write8(&code, 0xBC); buf_write8(&code, 0x05);
+    buf_write32(&code, (uint32_t)buf_offset);
+    buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD1);
+    buf_write8(&code, 0xF3); buf_write8(&code, 0xA4);
+    buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xD0);
+    buf_write8(&code, 0x49); buf_write8(&code, 0x89); emit_r13_modrm(&code, 0, fill_offset);
+    buf_write8(&code, 0xC3);
 
-    /* xor ecx, ecx (digit count = 0) */
-    buf_write8(&code, 0x31); buf_write8(&code, 0xC9);
+    /* === bounds_fail: reached by a jump from a failed IR_LOAD_ELEM ===
+     *
+     * Sets rsi and rdx to its message and falls into runtime_fail, which
+     * flushes what was printed so far, writes the message to stderr and
+     * exits with status 1.
+     */
+    int bounds_fail_offset = code.len;
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8D); emit_r13_modrm(&code, 6, bounds_msg_offset);
+    emit_mov_r32_imm32(&code, 2, (uint32_t)(sizeof(bounds_msg) - 1));
+
+    int runtime_fail_offset = code.len;
+    /* push rsi; push rdx; call out_flush; pop rdx; pop rsi */
+    buf_write8(&code, 0x56); buf_write8(&code, 0x52);
+    emit_call_routine(&code, &patches, LABEL_OUT_FLUSH);
+    buf_write8(&code, 0x5A); buf_write8(&code, 0x5E);
+    emit_mov_r32_imm32(&code, 0, 1);  /* sys_write */
+    emit_mov_r32_imm32(&code, 7, 2);  /* stderr */
+    emit_syscall(&code);
+    emit_mov_r32_imm32(&code, 0, 60); /* sys_exit */
+    emit_mov_r32_imm32(&code, 7, 1);
+    emit_syscall(&code);
 
-    /* test rax, rax */
-    buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+    /* div_zero, div_overflow: reached by a jump from a failed IR_DIV or
+     * IR_MOD check; lea rsi, [r13 + msg]; mov edx, len; jmp runtime_fail */
+    int div_zero_offset = code.len;
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8D); emit_r13_modrm(&code, 6, div_zero_msg_offset);
+    emit_mov_r32_imm32(&code, 2, (uint32_t)(sizeof(div_zero_msg) - 1));
+    buf_write8(&code, 0xE9);
+    buf_write32(&code, 0);
+    patch_rel32(&code, code.len - 4, runtime_fail_offset);
+    int div_overflow_offset = code.len;
+    buf_write8(&code, 0x49); buf_write8(&code, 0x8D); emit_r13_modrm(&code, 6, div_overflow_msg_offset);
+    emit_mov_r32_imm32(&code, 2, (uint32_t)(sizeof(div_overflow_msg) - 1));
+    buf_write8(&code, 0xE9);
+    buf_write32(&code, 0);
+    patch_rel32(&code, code.len - 4, runtime_fail_offset);
+
+    int float_format_offset = -1, float_print_offset = -1;
+    if (uses_floats) {
+        /* === Float routines ===
+         *
+         * float_format: rax = the bits of a double, rdi = room for 32
+         * bytes; writes its shortest round-trip text there (the format
+         * of ir_format_float) and returns the length.
+         * float_print: rax = the bits; appends the text to the output
+         * buffer, flushing first unless 32 bytes fit.
+         * Both clobber rax, rcx and rdx only.
+         */
+        float_format_offset = code.len;
+        emit_format_float(&code, float_table_offset, digits_offset);
+
+        float_print_offset = code.len;
+        /* push rsi, rdi, r11, rax; mov rcx, [r13 + fill];
+         * cmp rcx, size - 32; jbe room; call out_flush */
+        buf_write8(&code, 0x56); buf_write8(&code, 0x57);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x53); buf_write8(&code, 0x50);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8B); emit_r13_modrm(&code, 1, fill_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x81); buf_write8(&code, 0xF9);
+        buf_write32(&code, OUT_BUF_SIZE - 32);
+        buf_write8(&code, 0x76);
+        int jbe_float_room_patch = code.len;
+        buf_write8(&code, 0x00);
+        emit_call_routine(&code, &patches, LABEL_OUT_FLUSH);
+        code.data[jbe_float_room_patch] = (uint8_t)(code.len - jbe_float_room_patch - 1);
+        /* room: mov rcx, [r13 + fill]; lea rdi, [r13 + rcx + buf]; pop rax;
+         * call float_format; add [r13 + fill], rax */
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8B); emit_r13_modrm(&code, 1, fill_offset);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8D); buf_write8(&code, 0xBC); buf_write8(&code, 0x0D);
+        buf_write32(&code, (uint32_t)buf_offset);
+        buf_write8(&code, 0x58);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, float_format_offset);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x01); emit_r13_modrm(&code, 0, fill_offset);
+        /* pop r11, rdi, rsi; ret */
+        buf_write8(&code, 0x41); buf_write8(&code, 0x5B); buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
+    }
 
-    /* jns positive (if >= 0, skip negation) */
-    buf_write8(&code, 0x79);
-    int jns_patch = code.len;
-    buf_write8(&code, 0x00); /* placeholder */
+    int alloc_offset = -1, free_offset = -1;
+    if (uses_heap) {
+        int heap = HEAP_OFFSET(data.len), lists = heap + HEAP_FREE_LISTS;
+
+        /* === Heap routines ===
+         *
+         * alloc: rax = size in bytes; returns the block in rax.  Takes
+         * the head of the free list of its class, else bumps the arena,
+         * mapping a fresh HEAP_CHUNK when the current one is used up
+         * (the rest of it is left unused).  A block too large for any
+         * class is mapped on its own, its header holding the length of
+         * the mapping instead of a class.
+         * free: rax = block, or 0.  Pushes it on the free list of its
+         * class, through the second word of its header; one with pages
+         * of its own is unmapped.
+         * map_pages: rax = length; returns the mapping in rax and exits
+         * through runtime_fail when there is none.
+         * alloc and free clobber rax, rcx and rdx only.
+         */
+        int map_offset = code.len;
+        /* push rdi, rsi, rdx, r8, r9, r10, r11 */
+        buf_write8(&code, 0x57); buf_write8(&code, 0x56); buf_write8(&code, 0x52);
+        for (int r = 0; r < 4; r++) { buf_write8(&code, 0x41); buf_write8(&code, (uint8_t)(0x50 + r)); }
+        /* mmap(0, rax, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC6);   /* mov rsi, rax */
+        buf_write8(&code, 0x31); buf_write8(&code, 0xFF);                           /* xor edi, edi */
+        emit_mov_r32_imm32(&code, 2, 3);
+        buf_write8(&code, 0x41); buf_write8(&code, 0xBA); buf_write32(&code, 0x22);  /* mov r10d, 0x22 */
+        buf_write8(&code, 0x49); buf_write8(&code, 0xC7); buf_write8(&code, 0xC0);   /* mov r8, -1 */
+        buf_write32(&code, 0xFFFFFFFF);
+        buf_write8(&code, 0x45); buf_write8(&code, 0x31); buf_write8(&code, 0xC9);   /* xor r9d, r9d */
+        emit_mov_r32_imm32(&code, 0, 9);  /* sys_mmap */
+        emit_syscall(&code);
+        /* pop r11, r10, r9, r8, rdx, rsi, rdi */
+        for (int r = 3; r >= 0; r--) { buf_write8(&code, 0x41); buf_write8(&code, (uint8_t)(0x58 + r)); }
+        buf_write8(&code, 0x5A); buf_write8(&code, 0x5E); buf_write8(&code, 0x5F);
+        /* cmp rax, -4096; ja oom; ret */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3D); buf_write32(&code, (uint32_t)-4096);
+        buf_write8(&code, 0x77);
+        int ja_oom_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0xC3);
+        /* oom: lea rsi, [r13 + oom_msg]; mov edx, len; jmp runtime_fail */
+        code.data[ja_oom_patch] = (uint8_t)(code.len - ja_oom_patch - 1);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8D); emit_r13_modrm(&code, 6, oom_msg_offset);
+        emit_mov_r32_imm32(&code, 2, (uint32_t)(sizeof(oom_msg) - 1));
+        buf_write8(&code, 0xE9);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, runtime_fail_offset);
+
+        alloc_offset = code.len;
+        /* Class c = bit length of (size + 15) | 31:
+         * lea rcx, [rax + 15]; or rcx, 31; bsr rcx, rcx; inc ecx;
+         * cmp ecx, max; ja large */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x48); buf_write8(&code, 15);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC9);
+        buf_write8(&code, (1 << HEAP_MIN_CLASS) - 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0xBD); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0xFF); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0x83); buf_write8(&code, 0xF9); buf_write8(&code, HEAP_MAX_CLASS);
+        buf_write8(&code, 0x77);
+        int ja_large_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* mov rax, [r13 + rcx*8 + lists]; test rax, rax; jz bump */
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8B); buf_write8(&code, 0x84); buf_write8(&code, 0xCD);
+        buf_write32(&code, (uint32_t)lists);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x74);
+        int jz_bump_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* mov rdx, [rax - 8]; mov [r13 + rcx*8 + lists], rdx; ret */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x89); buf_write8(&code, 0x94); buf_write8(&code, 0xCD);
+        buf_write32(&code, (uint32_t)lists);
+        buf_write8(&code, 0xC3);
+
+        /* bump: mov edx, 1; shl rdx, cl; mov rax, [r13 + next];
+         * add rdx, rax; cmp rdx, [r13 + end]; ja refill */
+        code.data[jz_bump_patch] = (uint8_t)(code.len - jz_bump_patch - 1);
+        int bump = code.len;
+        emit_mov_r32_imm32(&code, 2, 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xD3); buf_write8(&code, 0xE2);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8B); emit_r13_modrm(&code, 0, heap);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x3B); emit_r13_modrm(&code, 2, heap + 8);
+        buf_write8(&code, 0x77);
+        int ja_refill_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* mov [r13 + next], rdx; mov [rax], rcx; add rax, 16; ret */
+        buf_write8(&code, 0x49); buf_write8(&code, 0x89); emit_r13_modrm(&code, 2, heap);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC0); buf_write8(&code, 16);
+        buf_write8(&code, 0xC3);
+
+        /* refill: push rcx; mov eax, chunk; call map_pages; pop rcx;
+         * mov [r13 + next], rax; lea rdx, [rax + chunk];
+         * mov [r13 + end], rdx; jmp bump */
+        code.data[ja_refill_patch] = (uint8_t)(code.len - ja_refill_patch - 1);
+        buf_write8(&code, 0x51);
+        emit_mov_r32_imm32(&code, 0, HEAP_CHUNK);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_offset);
+        buf_write8(&code, 0x59);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x89); emit_r13_modrm(&code, 0, heap);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x90); buf_write32(&code, HEAP_CHUNK);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x89); emit_r13_modrm(&code, 2, heap + 8);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(bump - (code.len + 1)));
+
+        /* large: add rax, 16 + 4095; and rax, -4096; push rax;
+         * call map_pages; pop rcx; mov [rax], rcx; add rax, 16; ret */
+        code.data[ja_large_patch] = (uint8_t)(code.len - ja_large_patch - 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x05); buf_write32(&code, 16 + 4095);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x25); buf_write32(&code, (uint32_t)-4096);
+        buf_write8(&code, 0x50);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_offset);
+        buf_write8(&code, 0x59);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC0); buf_write8(&code, 16);
+        buf_write8(&code, 0xC3);
+
+        free_offset = code.len;
+        /* test rax, rax; jz done; mov rcx, [rax - 16]; cmp rcx, max; ja unmap */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x74);
+        int jz_done_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xF9); buf_write8(&code, HEAP_MAX_CLASS);
+        buf_write8(&code, 0x77);
+        int ja_unmap_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* mov rdx, [r13 + rcx*8 + lists]; mov [rax - 8], rdx;
+         * mov [r13 + rcx*8 + lists], rax */
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8B); buf_write8(&code, 0x94); buf_write8(&code, 0xCD);
+        buf_write32(&code, (uint32_t)lists);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x89); buf_write8(&code, 0x84); buf_write8(&code, 0xCD);
+        buf_write32(&code, (uint32_t)lists);
+        code.data[jz_done_patch] = (uint8_t)(code.len - jz_done_patch - 1);
+        buf_write8(&code, 0xC3);
+        /* unmap: push rdi; push rsi; push r11; lea rdi, [rax - 16];
+         * mov rsi, rcx; munmap; pop r11; pop rsi; pop rdi; ret */
+        code.data[ja_unmap_patch] = (uint8_t)(code.len - ja_unmap_patch - 1);
+        buf_write8(&code, 0x57); buf_write8(&code, 0x56); buf_write8(&code, 0x41); buf_write8(&code, 0x53);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x78); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xCE);
+        emit_mov_r32_imm32(&code, 0, 11); /* sys_munmap */
+        emit_syscall(&code);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x5B); buf_write8(&code, 0x5E); buf_write8(&code, 0x5F);
+        buf_write8(&code, 0xC3);
+    }
+
+    int str_concat_offset = -1, str_append_offset = -1, str_from_int_offset = -1;
+    int str_from_float_offset = -1, str_eq_offset = -1, str_cmp_offset = -1;
+    if (uses_strings) {
+        /* === String routines ===
+         *
+         * str_concat: rax = a, rdx = b; returns a new heap string holding
+         * a then b.
+         * str_append: the same, but a is consumed: the bytes of b go
+         * straight after its own when its capacity has room, otherwise a
+         * is copied into a block of at least twice its length and then
+         * released.  A loop appending to one string is linear overall.
+         * str_from_int: rax = value; returns its decimal form in a fresh
+         * heap string.
+         * str_from_float: rax = the bits of a double; the same with the
+         * text float_format writes.
+         * str_eq: rax = a, rdx = b; returns 1 if they hold the same bytes.
+         * str_cmp: rax = a, rdx = b; returns -1, 0 or 1 as a sorts
+         * before, with or after b, byte by byte.
+         * All of them clobber rax, rcx and rdx only.
+         */
+        str_concat_offset = code.len;
+        /* push rsi, rdi, r8, r9; xor r9d, r9d (nothing to release);
+         * mov rsi, [rax]; add rsi, [rdx] (total length); mov rcx, rsi;
+         * jmp build */
+        buf_write8(&code, 0x56); buf_write8(&code, 0x57);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x50); buf_write8(&code, 0x41); buf_write8(&code, 0x51);
+        buf_write8(&code, 0x45); buf_write8(&code, 0x31); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x30);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x03); buf_write8(&code, 0x32);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xF1);
+        buf_write8(&code, 0xEB);
+        int jmp_build_patch = code.len;
+        buf_write8(&code, 0x00);
 
-    /* === negative path === */
-    /* Save the sign: push 1 onto... actually let's use r9 as sign flag */
-    /* neg rax */
-    buf_write8(&code, 0x48); buf_write8(&code, 0xF7); buf_write8(&code, 0xD8);
+        str_append_offset = code.len;
+        /* push rsi, rdi, r8, r9; mov rsi, [rax]; add rsi, [rdx];
+         * lea rcx, [rsi - 1]; cmp rcx, [rax + 8]; jae grow (an empty
+         * result, or one that does not fit, never goes in place) */
+        buf_write8(&code, 0x56); buf_write8(&code, 0x57);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x50); buf_write8(&code, 0x41); buf_write8(&code, 0x51);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x30);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x03); buf_write8(&code, 0x32);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x4E); buf_write8(&code, 0xFF);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x48); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x73);
+        int jae_grow_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* In place: mov rcx, [rax]; lea rdi, [rax + rcx + 16];
+         * mov rcx, [rdx]; mov [rax], rsi (after reading b, which may be
+         * a itself); lea rsi, [rdx + 16]; rep movsb; jmp done */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x7C); buf_write8(&code, 0x08);
+        buf_write8(&code, 16);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x0A);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x30);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x72); buf_write8(&code, 16);
+        buf_write8(&code, 0xF3); buf_write8(&code, 0xA4);
+        buf_write8(&code, 0xEB);
+        int jmp_done_patch = code.len;
+        buf_write8(&code, 0x00);
 
-    /* mov r9d, 1 (sign flag) */
-    buf_write8(&code, 0x41); buf_write8(&code, 0xB9); buf_write32(&code, 1);
+        /* grow: mov r9, rax (to release); mov rcx, [rax]; add rcx, rcx;
+         * cmp rcx, rsi; jae build; mov rcx, rsi */
+        code.data[jae_grow_patch] = (uint8_t)(code.len - jae_grow_patch - 1);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x89); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xF1);
+        buf_write8(&code, 0x73);
+        int jae_build_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xF1);
+
+        /* build: rsi = length, rcx = capacity wanted.
+         * mov r8, rax; push rdx; lea rax, [rcx + 16]; call alloc; pop rdx;
+         * mov [rax], rsi */
+        code.data[jmp_build_patch] = (uint8_t)(code.len - jmp_build_patch - 1);
+        code.data[jae_build_patch] = (uint8_t)(code.len - jae_build_patch - 1);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x89); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x52);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x41); buf_write8(&code, 16);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, alloc_offset);
+        buf_write8(&code, 0x5A);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x30);
+        /* The capacity is all the block has room for, from its header:
+         * mov rdi, [rax - 16]; cmp rdi, max; ja sized (a mapping length);
+         * mov ecx, edi; mov edi, 1; shl rdi, cl;
+         * sized: sub rdi, 32; mov [rax + 8], rdi */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x78); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xFF); buf_write8(&code, HEAP_MAX_CLASS);
+        buf_write8(&code, 0x77);
+        int ja_sized_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x89); buf_write8(&code, 0xF9);
+        emit_mov_r32_imm32(&code, 7, 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xD3); buf_write8(&code, 0xE7);
+        code.data[ja_sized_patch] = (uint8_t)(code.len - ja_sized_patch - 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xEF); buf_write8(&code, 32);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x78); buf_write8(&code, 0x08);
+        /* lea rdi, [rax + 16]; mov rcx, [r8]; lea rsi, [r8 + 16]; rep movsb;
+         * mov rcx, [rdx]; lea rsi, [rdx + 16]; rep movsb */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x78); buf_write8(&code, 16);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8B); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8D); buf_write8(&code, 0x70); buf_write8(&code, 16);
+        buf_write8(&code, 0xF3); buf_write8(&code, 0xA4);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x0A);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x72); buf_write8(&code, 16);
+        buf_write8(&code, 0xF3); buf_write8(&code, 0xA4);
+        /* Release the old string unless there is none or it is constant:
+         * test r9, r9; jz done; cmp qword [r9 + 8], 0; je done;
+         * push rax; mov rax, r9; call free; pop rax */
+        buf_write8(&code, 0x4D); buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x74);
+        int jz_kept_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x83); buf_write8(&code, 0x79); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x74);
+        int je_const_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x50);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x89); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, free_offset);
+        buf_write8(&code, 0x58);
+        /* done: pop r9, r8, rdi, rsi; ret */
+        code.data[jmp_done_patch] = (uint8_t)(code.len - jmp_done_patch - 1);
+        code.data[jz_kept_patch] = (uint8_t)(code.len - jz_kept_patch - 1);
+        code.data[je_const_patch] = (uint8_t)(code.len - je_const_patch - 1);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x59); buf_write8(&code, 0x41); buf_write8(&code, 0x58);
+        buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
+
+        str_from_int_offset = code.len;
+        /* push rsi, rdi, r8, r9, r11; push rax; mov eax, 48; call alloc
+         * (room for the longest number); mov rdi, rax; pop rax */
+        buf_write8(&code, 0x56); buf_write8(&code, 0x57);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x50); buf_write8(&code, 0x41); buf_write8(&code, 0x51);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x53);
+        buf_write8(&code, 0x50);
+        emit_mov_r32_imm32(&code, 0, 48);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, alloc_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+        buf_write8(&code, 0x58);
+        /* sub rsp, 32; lea r8, [rsp + 32]; format */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xEC); buf_write8(&code, 32);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x8D); buf_write8(&code, 0x44); buf_write8(&code, 0x24);
+        buf_write8(&code, 32);
+        emit_format_int(&code, digits_offset);
+        /* lea rdx, [rsp + 32]; sub rdx, r8; mov [rdi], rdx;
+         * mov qword [rdi + 8], 32 */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x54); buf_write8(&code, 0x24);
+        buf_write8(&code, 32);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x29); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x17);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC7); buf_write8(&code, 0x47); buf_write8(&code, 0x08);
+        buf_write32(&code, 32);
+        /* Copy 24 bytes from the first character:
+         * mov rcx, [r8 + k]; mov [rdi + 16 + k], rcx */
+        for (int k = 0; k < 24; k += 8) {
+            buf_write8(&code, 0x49); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, (uint8_t)k);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x4F); buf_write8(&code, (uint8_t)(16 + k));
+        }
+        /* add rsp, 32; mov rax, rdi; pop r11, r9, r8, rdi, rsi; ret */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC4); buf_write8(&code, 32);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x5B); buf_write8(&code, 0x41); buf_write8(&code, 0x59);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x58); buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
+
+        if (uses_floats) {
+            str_from_float_offset = code.len;
+            /* push rsi, rdi, r8, r9, r11; push rax; mov eax, 48;
+             * call alloc; mov rdi, rax; pop rax */
+            buf_write8(&code, 0x56); buf_write8(&code, 0x57);
+            buf_write8(&code, 0x41); buf_write8(&code, 0x50); buf_write8(&code, 0x41); buf_write8(&code, 0x51);
+            buf_write8(&code, 0x41); buf_write8(&code, 0x53);
+            buf_write8(&code, 0x50);
+            emit_mov_r32_imm32(&code, 0, 48);
+            buf_write8(&code, 0xE8);
+            buf_write32(&code, 0);
+            patch_rel32(&code, code.len - 4, alloc_offset);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+            buf_write8(&code, 0x58);
+            /* push rdi; add rdi, 16; call float_format; pop rdi;
+             * mov [rdi], rax; mov qword [rdi + 8], 32 */
+            buf_write8(&code, 0x57);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC7); buf_write8(&code, 16);
+            buf_write8(&code, 0xE8);
+            buf_write32(&code, 0);
+            patch_rel32(&code, code.len - 4, float_format_offset);
+            buf_write8(&code, 0x5F);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x07);
+            buf_write8(&code, 0x48); buf_write8(&code, 0xC7); buf_write8(&code, 0x47); buf_write8(&code, 0x08);
+            buf_write32(&code, 32);
+            /* mov rax, rdi; pop r11, r9, r8, rdi, rsi; ret */
+            buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xF8);
+            buf_write8(&code, 0x41); buf_write8(&code, 0x5B); buf_write8(&code, 0x41); buf_write8(&code, 0x59);
+            buf_write8(&code, 0x41); buf_write8(&code, 0x58); buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+            buf_write8(&code, 0xC3);
+        }
 
-    /* jmp digit_loop */
-    buf_write8(&code, 0xEB);
-    int jmp_to_loop_patch = code.len;
-    buf_write8(&code, 0x00); /* placeholder */
+        str_eq_offset = code.len;
+        /* cmp rax, rdx; je equal; mov rcx, [rax]; cmp rcx, [rdx];
+         * jne differ */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x74);
+        int je_same_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x0A);
+        buf_write8(&code, 0x75);
+        int jne_len_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* push rsi; push rdi; lea rsi, [rax + 16]; lea rdi, [rdx + 16];
+         * xor eax, eax */
+        buf_write8(&code, 0x56); buf_write8(&code, 0x57);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x70); buf_write8(&code, 16);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x7A); buf_write8(&code, 16);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xC0);
+        /* words: cmp rcx, 8; jb bytes; mov rdx, [rsi + rax];
+         * cmp rdx, [rdi + rax]; jne differ_pop; add rax, 8; sub rcx, 8;
+         * jmp words */
+        int eq_words = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xF9); buf_write8(&code, 8);
+        buf_write8(&code, 0x72);
+        int jb_bytes_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x14); buf_write8(&code, 0x06);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x14); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x75);
+        int jne_word_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC0); buf_write8(&code, 8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE9); buf_write8(&code, 8);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(eq_words - (code.len + 1)));
+        /* bytes: test rcx, rcx; jz equal_pop; mov dl, [rsi + rax];
+         * cmp dl, [rdi + rax]; jne differ_pop; inc rax; dec rcx;
+         * jmp bytes */
+        code.data[jb_bytes_patch] = (uint8_t)(code.len - jb_bytes_patch - 1);
+        int eq_bytes = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x74);
+        int jz_equal_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x8A); buf_write8(&code, 0x14); buf_write8(&code, 0x06);
+        buf_write8(&code, 0x3A); buf_write8(&code, 0x14); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x75);
+        int jne_byte_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(eq_bytes - (code.len + 1)));
+        /* equal_pop: pop rdi; pop rsi; equal: mov eax, 1; ret */
+        code.data[jz_equal_patch] = (uint8_t)(code.len - jz_equal_patch - 1);
+        buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+        code.data[je_same_patch] = (uint8_t)(code.len - je_same_patch - 1);
+        emit_mov_r32_imm32(&code, 0, 1);
+        buf_write8(&code, 0xC3);
+        /* differ_pop: pop rdi; pop rsi; differ: xor eax, eax; ret */
+        code.data[jne_word_patch] = (uint8_t)(code.len - jne_word_patch - 1);
+        code.data[jne_byte_patch] = (uint8_t)(code.len - jne_byte_patch - 1);
+        buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+        code.data[jne_len_patch] = (uint8_t)(code.len - jne_len_patch - 1);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0xC3);
+
+        str_cmp_offset = code.len;
+        /* push rsi; push rdi; lea rsi, [rax + 16]; lea rdi, [rdx + 16];
+         * mov rcx, [rax]; cmp rcx, [rdx]; cmova rcx, [rdx] (the shorter
+         * length); xor edx, edx */
+        buf_write8(&code, 0x56); buf_write8(&code, 0x57);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x70); buf_write8(&code, 16);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x7A); buf_write8(&code, 16);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x0A);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0x47); buf_write8(&code, 0x0A);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xD2);
+        /* Skip the equal words: lea rax, [rdx + 8]; cmp rax, rcx;
+         * ja bytes; mov rax, [rsi + rdx]; cmp rax, [rdi + rdx]; jne bytes;
+         * add rdx, 8; jmp words */
+        int cmp_words = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x42); buf_write8(&code, 8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x77);
+        int ja_bytes_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x04); buf_write8(&code, 0x16);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x04); buf_write8(&code, 0x17);
+        buf_write8(&code, 0x75);
+        int jne_bytes_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 8);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(cmp_words - (code.len + 1)));
+        /* bytes: cmp rdx, rcx; jae tie; mov al, [rsi + rdx];
+         * cmp al, [rdi + rdx]; jne differ; inc rdx; jmp bytes */
+        code.data[ja_bytes_patch] = (uint8_t)(code.len - ja_bytes_patch - 1);
+        code.data[jne_bytes_patch] = (uint8_t)(code.len - jne_bytes_patch - 1);
+        int cmp_bytes = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x73);
+        int jae_tie_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x8A); buf_write8(&code, 0x04); buf_write8(&code, 0x16);
+        buf_write8(&code, 0x3A); buf_write8(&code, 0x04); buf_write8(&code, 0x17);
+        buf_write8(&code, 0x75);
+        int jne_differ_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(cmp_bytes - (code.len + 1)));
+        /* differ: sbb rax, rax; or rax, 1; jmp out (the unsigned borrow
+         * of the byte compare gives -1, else 1) */
+        code.data[jne_differ_patch] = (uint8_t)(code.len - jne_differ_patch - 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x19); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC8); buf_write8(&code, 1);
+        buf_write8(&code, 0xEB);
+        int jmp_out_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* tie: the shorter one sorts first.  mov rax, [rsi - 16];
+         * cmp rax, [rdi - 16]; seta al; setb dl; movzx eax, al;
+         * movzx edx, dl; sub rax, rdx */
+        code.data[jae_tie_patch] = (uint8_t)(code.len - jae_tie_patch - 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x46); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x47); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x0F); buf_write8(&code, 0x97); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x0F); buf_write8(&code, 0x92); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0x0F); buf_write8(&code, 0xB6); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x0F); buf_write8(&code, 0xB6); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x29); buf_write8(&code, 0xD0);
+        /* out: pop rdi; pop rsi; ret */
+        code.data[jmp_out_patch] = (uint8_t)(code.len - jmp_out_patch - 1);
+        buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
+    }
 
-    /* === positive path === */
-    int positive_offset = code.len;
-    code.data[jns_patch] = (uint8_t)(positive_offset - jns_patch - 1);
+    int arr_copy_offset = -1, arr_push_offset = -1, arr_sum_offset = -1;
+    int arr_min_offset = -1, arr_max_offset = -1, arr_index_of_offset = -1;
+    int arr_fsum_offset = -1, arr_fmin_offset = -1, arr_fmax_offset = -1;
+    int arr_findex_of_offset = -1;
+    int arr_new_offset = -1;
+    if (uses_arrays) {
+        int flags = ARR_FLAGS_OFFSET(data.len);
+        memcpy(code.data + arr_flags_patch, &flags, 4);
+
+        /* === Array routines ===
+         *
+         * arr_new: rax = capacity wanted; returns an empty array in rax
+         * with room for at least that many elements: whatever its heap
+         * block holds past the 64-byte aligned first element.
+         * arr_copy: rax = array; returns a new array of its elements.
+         * arr_push: rax = array, rdx = value; returns the array with the
+         * value appended.  The array is consumed: the value goes in place
+         * when the capacity has room, otherwise the elements move to a
+         * block of at least twice the length and the old one is freed.
+         * arr_sum: rax = array; returns the sum of its elements.
+         * arr_min, arr_max: rax = array; return its smallest or largest
+         * element, exiting through runtime_fail when it is empty.
+         * arr_index_of: rax = array, rdx = value; returns the index of
+         * the first element equal to it, or -1.
+         * arr_fsum, arr_fmin, arr_fmax, arr_findex_of: the same for an
+         * array of floats, compared and added as doubles (see ir.h for
+         * the order of the sum).
+         * The scans run on ymm registers when the flags say AVX2 is
+         * there, else on xmm registers (arr_min and arr_max are scalar
+         * then: SSE2 has no 64-bit compare).  All of them clobber rax,
+         * rcx, rdx and the vector registers only.
+         */
+        arr_new_offset = code.len;
+        /* lea rax, [rax*8 + 64 + 24]; call alloc; mov rcx, [rax - 16];
+         * cmp rcx, max; ja sized (the header holds the mapped length);
+         * mov edx, 1; shl rdx, cl; mov rcx, rdx */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x04); buf_write8(&code, 0xC5);
+        buf_write32(&code, 64 + 24);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, alloc_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xF9); buf_write8(&code, HEAP_MAX_CLASS);
+        buf_write8(&code, 0x77);
+        int ja_sized_patch = code.len;
+        buf_write8(&code, 0x00);
+        emit_mov_r32_imm32(&code, 2, 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xD3); buf_write8(&code, 0xE2);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD1);
+        /* sized: lea rcx, [rax + rcx - 16] (end of the block);
+         * lea rdx, [rax + 87]; and rdx, -64; mov [rdx - 24], rax;
+         * mov rax, rdx; sub rcx, rdx; shr rcx, 3; mov [rax - 16], rcx;
+         * mov qword [rax - 8], 0; ret */
+        code.data[ja_sized_patch] = (uint8_t)(code.len - ja_sized_patch - 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x4C); buf_write8(&code, 0x08);
+        buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x50); buf_write8(&code, 64 + 23);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE2); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x42); buf_write8(&code, 0xE8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x29); buf_write8(&code, 0xD1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE9); buf_write8(&code, 3);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x48); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC7); buf_write8(&code, 0x40); buf_write8(&code, 0xF8);
+        buf_write32(&code, 0);
+        buf_write8(&code, 0xC3);
+
+        arr_copy_offset = code.len;
+        /* push rsi; push rdi; mov rsi, rax; mov rax, [rsi - 8];
+         * call arr_new; mov rcx, [rsi - 8]; mov [rax - 8], rcx;
+         * mov rdi, rax; rep movsq; pop rdi; pop rsi; ret */
+        buf_write8(&code, 0x56); buf_write8(&code, 0x57);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC6);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x46); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, arr_new_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x4E); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+        buf_write8(&code, 0xF3); buf_write8(&code, 0x48); buf_write8(&code, 0xA5);
+        buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
+
+        arr_push_offset = code.len;
+        /* mov rcx, [rax - 8]; cmp rcx, [rax - 16]; jae grow (a constant
+         * has no capacity); mov [rax + rcx*8], rdx; inc qword [rax - 8];
+         * ret */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x48); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x73);
+        int jae_push_grow_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x14); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0x40); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0xC3);
+        /* grow: push rsi; push rdi; push rax; push rdx; mov rsi, rax;
+         * lea rax, [rcx + rcx]; call arr_new; mov rcx, [rsi - 8];
+         * lea rdx, [rcx + 1]; mov [rax - 8], rdx; mov rdi, rax;
+         * rep movsq; pop rdx; mov [rdi], rdx; mov rdi, rax; pop rcx */
+        code.data[jae_push_grow_patch] = (uint8_t)(code.len - jae_push_grow_patch - 1);
+        buf_write8(&code, 0x56); buf_write8(&code, 0x57); buf_write8(&code, 0x50); buf_write8(&code, 0x52);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC6);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x04); buf_write8(&code, 0x09);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, arr_new_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x4E); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x51); buf_write8(&code, 0x01);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+        buf_write8(&code, 0xF3); buf_write8(&code, 0x48); buf_write8(&code, 0xA5);
+        buf_write8(&code, 0x5A);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x17);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+        buf_write8(&code, 0x59);
+        /* cmp qword [rcx - 16], 0; je kept; mov rax, [rcx - 24];
+         * call free; kept: mov rax, rdi; pop rdi; pop rsi; ret */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0x79); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x74); buf_write8(&code, 9);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x41); buf_write8(&code, 0xE8);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, free_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
+
+        arr_sum_offset = code.len;
+        /* mov rcx, [rax - 8]; xor edx, edx (index);
+         * cmp byte [r13 + flags], 0; je sse */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x80); emit_r13_modrm(&code, 7, flags); buf_write8(&code, 0x00);
+        buf_write8(&code, 0x74);
+        int je_sum_sse_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* vpxor ymm0..ymm3; and rcx, -16; jz reduce */
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0xEF); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF5); buf_write8(&code, 0xEF); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xED); buf_write8(&code, 0xEF); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xE5); buf_write8(&code, 0xEF); buf_write8(&code, 0xDB);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x74);
+        int jz_sum_reduce_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* 16 elements a round into four accumulators:
+         * vpaddq ymm0..3, ymm0..3, [rax + rdx*8 + 32k]; add rdx, 16;
+         * cmp rdx, rcx; jb loop */
+        int sum_avx_loop = code.len;
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0xD4); buf_write8(&code, 0x04);
+        buf_write8(&code, 0xD0);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF5); buf_write8(&code, 0xD4); buf_write8(&code, 0x4C);
+        buf_write8(&code, 0xD0); buf_write8(&code, 32);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xED); buf_write8(&code, 0xD4); buf_write8(&code, 0x54);
+        buf_write8(&code, 0xD0); buf_write8(&code, 64);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xE5); buf_write8(&code, 0xD4); buf_write8(&code, 0x5C);
+        buf_write8(&code, 0xD0); buf_write8(&code, 96);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 16);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x72);
+        buf_write8(&code, (uint8_t)(sum_avx_loop - (code.len + 1)));
+        /* reduce: vpaddq ymm0, ymm0, ymm1; vpaddq ymm2, ymm2, ymm3;
+         * vpaddq ymm0, ymm0, ymm2; vextracti128 xmm1, ymm0, 1;
+         * vpaddq xmm0, xmm0, xmm1; vzeroupper; jmp tail */
+        code.data[jz_sum_reduce_patch] = (uint8_t)(code.len - jz_sum_reduce_patch - 1);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0xD4); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xED); buf_write8(&code, 0xD4); buf_write8(&code, 0xD3);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0xD4); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0xC4); buf_write8(&code, 0xE3); buf_write8(&code, 0x7D); buf_write8(&code, 0x39);
+        buf_write8(&code, 0xC1); buf_write8(&code, 0x01);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF9); buf_write8(&code, 0xD4); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF8); buf_write8(&code, 0x77);
+        buf_write8(&code, 0xEB);
+        int jmp_sum_tail_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* sse: pxor xmm0..xmm3; and rcx, -8; jz fold; then 8 elements
+         * a round: paddq xmm0..3, [rax + rdx*8 + 16k]; add rdx, 8;
+         * cmp rdx, rcx; jb loop */
+        code.data[je_sum_sse_patch] = (uint8_t)(code.len - je_sum_sse_patch - 1);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xEF); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xEF); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xEF); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xEF); buf_write8(&code, 0xDB);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x74);
+        int jz_sum_fold_patch = code.len;
+        buf_write8(&code, 0x00);
+        int sum_sse_loop = code.len;
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD4); buf_write8(&code, 0x04);
+        buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD4); buf_write8(&code, 0x4C);
+        buf_write8(&code, 0xD0); buf_write8(&code, 16);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD4); buf_write8(&code, 0x54);
+        buf_write8(&code, 0xD0); buf_write8(&code, 32);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD4); buf_write8(&code, 0x5C);
+        buf_write8(&code, 0xD0); buf_write8(&code, 48);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x72);
+        buf_write8(&code, (uint8_t)(sum_sse_loop - (code.len + 1)));
+        /* fold: paddq xmm0, xmm1; paddq xmm2, xmm3; paddq xmm0, xmm2 */
+        code.data[jz_sum_fold_patch] = (uint8_t)(code.len - jz_sum_fold_patch - 1);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD4); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD4); buf_write8(&code, 0xD3);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD4); buf_write8(&code, 0xC2);
+        /* tail: pshufd xmm1, xmm0, 0x4E; paddq xmm0, xmm1; movq rcx, xmm0;
+         * then the rest one at a time: cmp rdx, [rax - 8]; jae out;
+         * add rcx, [rax + rdx*8]; inc rdx; jmp tail;
+         * out: mov rax, rcx; ret */
+        code.data[jmp_sum_tail_patch] = (uint8_t)(code.len - jmp_sum_tail_patch - 1);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x70); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x4E);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD4); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0x7E);
+        buf_write8(&code, 0xC1);
+        int sum_tail = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x73); buf_write8(&code, 9);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x03); buf_write8(&code, 0x0C); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(sum_tail - (code.len + 1)));
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0xC3);
+
+        /* arr_min and arr_max differ only in which side of each compare
+         * wins: vpcmpgtq picks the lanes to replace, cmovg or cmovl the
+         * scalar to replace */
+        for (int is_max = 0; is_max < 2; is_max++) {
+            if (is_max) arr_max_offset = code.len;
+            else arr_min_offset = code.len;
+            /* cmp qword [rax - 8], 0; je empty; mov rcx, [rax];
+             * xor edx, edx; cmp byte [r13 + flags], 0; je tail;
+             * cmp qword [rax - 8], 8; jb tail */
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0x78); buf_write8(&code, 0xF8);
+            buf_write8(&code, 0x00);
+            buf_write8(&code, 0x0F); buf_write8(&code, 0x84);
+            buf_write32(&code, 0);
+            int je_empty_patch = code.len - 4;
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x08);
+            buf_write8(&code, 0x31); buf_write8(&code, 0xD2);
+            buf_write8(&code, 0x41); buf_write8(&code, 0x80); emit_r13_modrm(&code, 7, flags); buf_write8(&code, 0x00);
+            buf_write8(&code, 0x74);
+            int je_tail_patch = code.len;
+            buf_write8(&code, 0x00);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0x78); buf_write8(&code, 0xF8);
+            buf_write8(&code, 8);
+            buf_write8(&code, 0x72);
+            int jb_tail_patch = code.len;
+            buf_write8(&code, 0x00);
+            /* Two accumulators from the first element, 8 elements a
+             * round: vpbroadcastq ymm0, [rax]; vmovdqa ymm1, ymm0;
+             * mov rcx, [rax - 8]; and rcx, -8 */
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, 0x7D); buf_write8(&code, 0x59);
+            buf_write8(&code, 0x00);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0x6F); buf_write8(&code, 0xC8);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xF8);
+            /* loop: vmovdqa ymm2, [rax + rdx*8]; vmovdqa ymm3, [rax + rdx*8 + 32];
+             * vpcmpgtq ymm4, ymm0, ymm2 (ymm2, ymm0 for max);
+             * vpblendvb ymm0, ymm0, ymm2, ymm4;
+             * vpcmpgtq ymm5, ymm1, ymm3 (ymm3, ymm1 for max);
+             * vpblendvb ymm1, ymm1, ymm3, ymm5;
+             * add rdx, 8; cmp rdx, rcx; jb loop */
+            int minmax_loop = code.len;
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0x6F); buf_write8(&code, 0x14);
+            buf_write8(&code, 0xD0);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0x6F); buf_write8(&code, 0x5C);
+            buf_write8(&code, 0xD0); buf_write8(&code, 32);
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, is_max ? 0x6D : 0x7D);
+            buf_write8(&code, 0x37); buf_write8(&code, is_max ? 0xE0 : 0xE2);
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE3); buf_write8(&code, 0x7D); buf_write8(&code, 0x4C);
+            buf_write8(&code, 0xC2); buf_write8(&code, 0x40);
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, is_max ? 0x65 : 0x75);
+            buf_write8(&code, 0x37); buf_write8(&code, is_max ? 0xE9 : 0xEB);
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE3); buf_write8(&code, 0x75); buf_write8(&code, 0x4C);
+            buf_write8(&code, 0xCB); buf_write8(&code, 0x50);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 8);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+            buf_write8(&code, 0x72);
+            buf_write8(&code, (uint8_t)(minmax_loop - (code.len + 1)));
+            /* Fold ymm1 into ymm0, the high lane into the low one and the
+             * high qword into the low one, each by compare and blend:
+             * vpcmpgtq ymm4, ymm0, ymm1; vpblendvb ymm0, ymm0, ymm1, ymm4;
+             * vextracti128 xmm1, ymm0, 1;
+             * vpcmpgtq xmm4, xmm0, xmm1; vpblendvb xmm0, xmm0, xmm1, xmm4;
+             * vpshufd xmm1, xmm0, 0x4E;
+             * vpcmpgtq xmm4, xmm0, xmm1; vpblendvb xmm0, xmm0, xmm1, xmm4;
+             * vmovq rcx, xmm0; vzeroupper */
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, is_max ? 0x75 : 0x7D);
+            buf_write8(&code, 0x37); buf_write8(&code, is_max ? 0xE0 : 0xE1);
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE3); buf_write8(&code, 0x7D); buf_write8(&code, 0x4C);
+            buf_write8(&code, 0xC1); buf_write8(&code, 0x40);
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE3); buf_write8(&code, 0x7D); buf_write8(&code, 0x39);
+            buf_write8(&code, 0xC1); buf_write8(&code, 0x01);
+            for (int fold = 0; fold < 2; fold++) {
+                if (fold) {
+                    buf_write8(&code, 0xC5); buf_write8(&code, 0xF9); buf_write8(&code, 0x70); buf_write8(&code, 0xC8);
+                    buf_write8(&code, 0x4E);
+                }
+                buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, is_max ? 0x71 : 0x79);
+                buf_write8(&code, 0x37); buf_write8(&code, is_max ? 0xE0 : 0xE1);
+                buf_write8(&code, 0xC4); buf_write8(&code, 0xE3); buf_write8(&code, 0x79); buf_write8(&code, 0x4C);
+                buf_write8(&code, 0xC1); buf_write8(&code, 0x40);
+            }
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE1); buf_write8(&code, 0xF9); buf_write8(&code, 0x7E);
+            buf_write8(&code, 0xC1);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xF8); buf_write8(&code, 0x77);
+            /* tail: cmp rdx, [rax - 8]; jae out; cmp rcx, [rax + rdx*8];
+             * cmovg rcx, [rax + rdx*8] (cmovl for max); inc rdx; jmp tail;
+             * out: mov rax, rcx; ret */
+            code.data[je_tail_patch] = (uint8_t)(code.len - je_tail_patch - 1);
+            code.data[jb_tail_patch] = (uint8_t)(code.len - jb_tail_patch - 1);
+            int minmax_tail = code.len;
+            buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+            buf_write8(&code, 0x73); buf_write8(&code, 14);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x0C); buf_write8(&code, 0xD0);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, is_max ? 0x4C : 0x4F);
+            buf_write8(&code, 0x0C); buf_write8(&code, 0xD0);
+            buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC2);
+            buf_write8(&code, 0xEB);
+            buf_write8(&code, (uint8_t)(minmax_tail - (code.len + 1)));
+            buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC8);
+            buf_write8(&code, 0xC3);
+            /* empty: lea rsi, [r13 + empty_msg]; mov edx, len; jmp runtime_fail */
+            patch_rel32(&code, je_empty_patch, code.len);
+            buf_write8(&code, 0x49); buf_write8(&code, 0x8D); emit_r13_modrm(&code, 6, empty_msg_offset);
+            emit_mov_r32_imm32(&code, 2, (uint32_t)(sizeof(empty_msg) - 1));
+            buf_write8(&code, 0xE9);
+            buf_write32(&code, 0);
+            patch_rel32(&code, code.len - 4, runtime_fail_offset);
+        }
 
-    /* xor r9d, r9d (sign flag = 0, positive) */
-    buf_write8(&code, 0x45); buf_write8(&code, 0x31); buf_write8(&code, 0xC9);
+        arr_index_of_offset = code.len;
+        /* push rsi; push rdi; mov rsi, rdx (value); xor edx, edx (index);
+         * cmp byte [r13 + flags], 0; je sse */
+        buf_write8(&code, 0x56); buf_write8(&code, 0x57);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD6);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x80); emit_r13_modrm(&code, 7, flags); buf_write8(&code, 0x00);
+        buf_write8(&code, 0x74);
+        int je_find_sse_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* mov rcx, [rax - 8]; and rcx, -8; jz tail;
+         * vmovq xmm0, rsi; vpbroadcastq ymm0, xmm0 */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x74);
+        int jz_find_tail_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0xC4); buf_write8(&code, 0xE1); buf_write8(&code, 0xF9); buf_write8(&code, 0x6E);
+        buf_write8(&code, 0xC6);
+        buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, 0x7D); buf_write8(&code, 0x59);
+        buf_write8(&code, 0xC0);
+        /* loop: vpcmpeqq ymm1, ymm0, [rax + rdx*8];
+         * vpcmpeqq ymm2, ymm0, [rax + rdx*8 + 32]; vpor ymm1, ymm1, ymm2;
+         * vptest ymm1, ymm1; jnz hit (the tail finds it in this round);
+         * add rdx, 8; cmp rdx, rcx; jb loop; hit: vzeroupper; jmp tail */
+        int find_avx_loop = code.len;
+        buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, 0x7D); buf_write8(&code, 0x29);
+        buf_write8(&code, 0x0C); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, 0x7D); buf_write8(&code, 0x29);
+        buf_write8(&code, 0x54); buf_write8(&code, 0xD0); buf_write8(&code, 32);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF5); buf_write8(&code, 0xEB); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, 0x7D); buf_write8(&code, 0x17);
+        buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x75);
+        int jnz_avx_hit_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x72);
+        buf_write8(&code, (uint8_t)(find_avx_loop - (code.len + 1)));
+        code.data[jnz_avx_hit_patch] = (uint8_t)(code.len - jnz_avx_hit_patch - 1);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF8); buf_write8(&code, 0x77);
+        buf_write8(&code, 0xEB);
+        int jmp_find_tail_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* sse: mov rcx, [rax - 8]; and rcx, -4; jz tail;
+         * movq xmm0, rsi; punpcklqdq xmm0, xmm0 */
+        code.data[je_find_sse_patch] = (uint8_t)(code.len - je_find_sse_patch - 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xFC);
+        buf_write8(&code, 0x74);
+        int jz_find_sse_tail_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0x6E);
+        buf_write8(&code, 0xC6);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6C); buf_write8(&code, 0xC0);
+        /* 4 elements a round, a qword equal when both its dwords are:
+         * movdqa xmm1, [rax + rdx*8]; pcmpeqd xmm1, xmm0;
+         * pshufd xmm2, xmm1, 0xB1; pand xmm1, xmm2;
+         * movdqa xmm3, [rax + rdx*8 + 16]; pcmpeqd xmm3, xmm0;
+         * pshufd xmm2, xmm3, 0xB1; pand xmm3, xmm2; por xmm1, xmm3;
+         * pmovmskb edi, xmm1; test edi, edi; jnz tail;
+         * add rdx, 4; cmp rdx, rcx; jb loop */
+        int find_sse_loop = code.len;
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6F); buf_write8(&code, 0x0C);
+        buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x76); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x70); buf_write8(&code, 0xD1);
+        buf_write8(&code, 0xB1);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xDB); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6F); buf_write8(&code, 0x5C);
+        buf_write8(&code, 0xD0); buf_write8(&code, 16);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x76); buf_write8(&code, 0xD8);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x70); buf_write8(&code, 0xD3);
+        buf_write8(&code, 0xB1);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xDB); buf_write8(&code, 0xDA);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xEB); buf_write8(&code, 0xCB);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD7); buf_write8(&code, 0xF9);
+        buf_write8(&code, 0x85); buf_write8(&code, 0xFF);
+        buf_write8(&code, 0x75);
+        int jnz_sse_hit_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 4);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x72);
+        buf_write8(&code, (uint8_t)(find_sse_loop - (code.len + 1)));
+        /* tail: cmp rdx, [rax - 8]; jae none; cmp rsi, [rax + rdx*8];
+         * je found; inc rdx; jmp tail; none: mov rdx, -1;
+         * found: mov rax, rdx; pop rdi; pop rsi; ret */
+        code.data[jz_find_tail_patch] = (uint8_t)(code.len - jz_find_tail_patch - 1);
+        code.data[jmp_find_tail_patch] = (uint8_t)(code.len - jmp_find_tail_patch - 1);
+        code.data[jz_find_sse_tail_patch] = (uint8_t)(code.len - jz_find_sse_tail_patch - 1);
+        code.data[jnz_sse_hit_patch] = (uint8_t)(code.len - jnz_sse_hit_patch - 1);
+        int find_tail = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x73); buf_write8(&code, 11);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x34); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x74); buf_write8(&code, 12);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(find_tail - (code.len + 1)));
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC7); buf_write8(&code, 0xC2); buf_write32(&code, 0xFFFFFFFF);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x5F); buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
+
+        arr_fsum_offset = code.len;
+        /* mov rcx, [rax - 8]; xor edx, edx (index);
+         * cmp byte [r13 + flags], 0; je sse */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x80); emit_r13_modrm(&code, 7, flags); buf_write8(&code, 0x00);
+        buf_write8(&code, 0x74);
+        int je_fsum_sse_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* Lanes 4k..4k+3 in ymm k: vxorpd ymm0..ymm3; and rcx, -16;
+         * jz fold; then 16 elements a round:
+         * vaddpd ymmk, ymmk, [rax + rdx*8 + 32k]; add rdx, 16;
+         * cmp rdx, rcx; jb loop */
+        for (int k = 0; k < 4; k++) {
+            buf_write8(&code, 0xC5); buf_write8(&code, (uint8_t)(0xFD - 8 * k)); buf_write8(&code, 0x57);
+            buf_write8(&code, (uint8_t)(0xC0 | (k << 3) | k));
+        }
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x74);
+        int jz_fsum_fold_patch = code.len;
+        buf_write8(&code, 0x00);
+        int fsum_avx_loop = code.len;
+        for (int k = 0; k < 4; k++) {
+            buf_write8(&code, 0xC5); buf_write8(&code, (uint8_t)(0xFD - 8 * k)); buf_write8(&code, 0x58);
+            buf_write8(&code, (uint8_t)((k ? 0x44 : 0x04) | (k << 3))); buf_write8(&code, 0xD0);
+            if (k) buf_write8(&code, (uint8_t)(32 * k));
+        }
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 16);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x72);
+        buf_write8(&code, (uint8_t)(fsum_avx_loop - (code.len + 1)));
+        /* fold the lanes in halves: vaddpd ymm0, ymm0, ymm2;
+         * vaddpd ymm1, ymm1, ymm3; vaddpd ymm0, ymm0, ymm1;
+         * vextractf128 xmm1, ymm0, 1; vaddpd xmm0, xmm0, xmm1;
+         * vzeroupper; jmp tail */
+        code.data[jz_fsum_fold_patch] = (uint8_t)(code.len - jz_fsum_fold_patch - 1);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0x58); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF5); buf_write8(&code, 0x58); buf_write8(&code, 0xCB);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0x58); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0xC4); buf_write8(&code, 0xE3); buf_write8(&code, 0x7D); buf_write8(&code, 0x19);
+        buf_write8(&code, 0xC1); buf_write8(&code, 0x01);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF9); buf_write8(&code, 0x58); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF8); buf_write8(&code, 0x77);
+        buf_write8(&code, 0xEB);
+        int jmp_fsum_tail_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* sse: lanes 2k, 2k+1 in xmm k: xorpd xmm0..xmm7; and rcx, -16;
+         * jz fold; then addpd xmmk, [rax + rdx*8 + 16k]; add rdx, 16;
+         * cmp rdx, rcx; jb loop */
+        code.data[je_fsum_sse_patch] = (uint8_t)(code.len - je_fsum_sse_patch - 1);
+        for (int k = 0; k < 8; k++) {
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x57);
+            buf_write8(&code, (uint8_t)(0xC0 | (k << 3) | k));
+        }
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x74);
+        int jz_fsum_sse_fold_patch = code.len;
+        buf_write8(&code, 0x00);
+        int fsum_sse_loop = code.len;
+        for (int k = 0; k < 8; k++) {
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x58);
+            buf_write8(&code, (uint8_t)((k ? 0x44 : 0x04) | (k << 3))); buf_write8(&code, 0xD0);
+            if (k) buf_write8(&code, (uint8_t)(16 * k));
+        }
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 16);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x72);
+        buf_write8(&code, (uint8_t)(fsum_sse_loop - (code.len + 1)));
+        /* fold as the ymm lanes fold: addpd xmmk, xmm(k+4) for k < 4;
+         * addpd xmmk, xmm(k+2) for k < 2; addpd xmm0, xmm1 */
+        code.data[jz_fsum_sse_fold_patch] = (uint8_t)(code.len - jz_fsum_sse_fold_patch - 1);
+        for (int w = 4; w > 0; w /= 2)
+            for (int k = 0; k < w; k++) {
+                buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x58);
+                buf_write8(&code, (uint8_t)(0xC0 | (k << 3) | (k + w)));
+            }
+        /* tail: movapd xmm1, xmm0; unpckhpd xmm1, xmm1; addsd xmm0, xmm1;
+         * then the rest one at a time: cmp rdx, [rax - 8]; jae out;
+         * addsd xmm0, [rax + rdx*8]; inc rdx; jmp rest;
+         * out: movq rax, xmm0; ret */
+        code.data[jmp_fsum_tail_patch] = (uint8_t)(code.len - jmp_fsum_tail_patch - 1);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x15); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0xF2); buf_write8(&code, 0x0F); buf_write8(&code, 0x58); buf_write8(&code, 0xC1);
+        int fsum_tail = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x73); buf_write8(&code, 10);
+        buf_write8(&code, 0xF2); buf_write8(&code, 0x0F); buf_write8(&code, 0x58); buf_write8(&code, 0x04);
+        buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(fsum_tail - (code.len + 1)));
+        buf_write8(&code, 0x66); buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0x7E);
+        buf_write8(&code, 0xC0);
+        buf_write8(&code, 0xC3);
+
+        /* arr_fmin and arr_fmax keep, like the evaluator's scan, the
+         * first element while it is NaN and otherwise skip NaNs:
+         * minpd x, acc gives acc when x is NaN or not smaller.  Lanes
+         * find the value; when it is a zero, its sign comes from the
+         * first element equal to it. */
+        for (int is_max = 0; is_max < 2; is_max++) {
+            uint8_t op = is_max ? 0x5F : 0x5D;
+            if (is_max) arr_fmax_offset = code.len;
+            else arr_fmin_offset = code.len;
+            /* cmp qword [rax - 8], 0; je empty; movsd xmm0, [rax];
+             * ucomisd xmm0, xmm0; jnp scan; mov rax, [rax]; ret */
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0x78); buf_write8(&code, 0xF8);
+            buf_write8(&code, 0x00);
+            buf_write8(&code, 0x0F); buf_write8(&code, 0x84);
+            buf_write32(&code, 0);
+            int je_empty_patch = code.len - 4;
+            buf_write8(&code, 0xF2); buf_write8(&code, 0x0F); buf_write8(&code, 0x10); buf_write8(&code, 0x00);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x2E); buf_write8(&code, 0xC0);
+            buf_write8(&code, 0x7B); buf_write8(&code, 4);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x00);
+            buf_write8(&code, 0xC3);
+            /* scan: xor edx, edx; mov rcx, [rax - 8];
+             * cmp byte [r13 + flags], 0; je sse; and rcx, -8; jz tail;
+             * vbroadcastsd ymm0, xmm0; vmovapd ymm1, ymm0 */
+            buf_write8(&code, 0x31); buf_write8(&code, 0xD2);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+            buf_write8(&code, 0x41); buf_write8(&code, 0x80); emit_r13_modrm(&code, 7, flags); buf_write8(&code, 0x00);
+            buf_write8(&code, 0x74);
+            int je_fminmax_sse_patch = code.len;
+            buf_write8(&code, 0x00);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xF8);
+            buf_write8(&code, 0x0F); buf_write8(&code, 0x84);
+            buf_write32(&code, 0);
+            int jz_fminmax_tail_patch = code.len - 4;
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, 0x7D); buf_write8(&code, 0x19);
+            buf_write8(&code, 0xC0);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0x28); buf_write8(&code, 0xC8);
+            /* loop: vmovapd ymm2, [rax + rdx*8]; vmovapd ymm3, [rax + rdx*8 + 32];
+             * vminpd ymm0, ymm2, ymm0; vminpd ymm1, ymm3, ymm1 (vmaxpd
+             * for max); add rdx, 8; cmp rdx, rcx; jb loop */
+            int fminmax_avx_loop = code.len;
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0x28); buf_write8(&code, 0x14);
+            buf_write8(&code, 0xD0);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0x28); buf_write8(&code, 0x5C);
+            buf_write8(&code, 0xD0); buf_write8(&code, 32);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xED); buf_write8(&code, op); buf_write8(&code, 0xC0);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xE5); buf_write8(&code, op); buf_write8(&code, 0xC9);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 8);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+            buf_write8(&code, 0x72);
+            buf_write8(&code, (uint8_t)(fminmax_avx_loop - (code.len + 1)));
+            /* vminpd ymm0, ymm1, ymm0; vextractf128 xmm1, ymm0, 1;
+             * vminpd xmm0, xmm1, xmm0; vunpckhpd xmm1, xmm0, xmm0;
+             * vminsd xmm0, xmm1, xmm0; vzeroupper; jmp tail */
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xF5); buf_write8(&code, op); buf_write8(&code, 0xC0);
+            buf_write8(&code, 0xC4); buf_write8(&code, 0xE3); buf_write8(&code, 0x7D); buf_write8(&code, 0x19);
+            buf_write8(&code, 0xC1); buf_write8(&code, 0x01);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xF1); buf_write8(&code, op); buf_write8(&code, 0xC0);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xF9); buf_write8(&code, 0x15); buf_write8(&code, 0xC8);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xF3); buf_write8(&code, op); buf_write8(&code, 0xC0);
+            buf_write8(&code, 0xC5); buf_write8(&code, 0xF8); buf_write8(&code, 0x77);
+            buf_write8(&code, 0xEB);
+            int jmp_fminmax_tail_patch = code.len;
+            buf_write8(&code, 0x00);
+            /* sse: and rcx, -4; jz tail; unpcklpd xmm0, xmm0;
+             * movapd xmm1, xmm0; then 4 elements a round:
+             * movapd xmm2, [rax + rdx*8]; movapd xmm3, [rax + rdx*8 + 16];
+             * minpd xmm2, xmm0; minpd xmm3, xmm1; movapd xmm0, xmm2;
+             * movapd xmm1, xmm3; add rdx, 4; cmp rdx, rcx; jb loop */
+            code.data[je_fminmax_sse_patch] = (uint8_t)(code.len - je_fminmax_sse_patch - 1);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xFC);
+            buf_write8(&code, 0x74);
+            int jz_fminmax_sse_tail_patch = code.len;
+            buf_write8(&code, 0x00);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x14); buf_write8(&code, 0xC0);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0xC8);
+            int fminmax_sse_loop = code.len;
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0x14);
+            buf_write8(&code, 0xD0);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0x5C);
+            buf_write8(&code, 0xD0); buf_write8(&code, 16);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, op); buf_write8(&code, 0xD0);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, op); buf_write8(&code, 0xD9);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0xC2);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0xCB);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 4);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+            buf_write8(&code, 0x72);
+            buf_write8(&code, (uint8_t)(fminmax_sse_loop - (code.len + 1)));
+            /* minpd xmm1, xmm0; movapd xmm0, xmm1; unpckhpd xmm1, xmm1;
+             * minsd xmm1, xmm0; movapd xmm0, xmm1 */
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, op); buf_write8(&code, 0xC8);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0xC1);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x15); buf_write8(&code, 0xC9);
+            buf_write8(&code, 0xF2); buf_write8(&code, 0x0F); buf_write8(&code, op); buf_write8(&code, 0xC8);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0xC1);
+            /* tail: cmp rdx, [rax - 8]; jae zero; movsd xmm1, [rax + rdx*8];
+             * minsd xmm1, xmm0; movapd xmm0, xmm1; inc rdx; jmp tail */
+            patch_rel32(&code, jz_fminmax_tail_patch, code.len);
+            code.data[jmp_fminmax_tail_patch] = (uint8_t)(code.len - jmp_fminmax_tail_patch - 1);
+            code.data[jz_fminmax_sse_tail_patch] = (uint8_t)(code.len - jz_fminmax_sse_tail_patch - 1);
+            int fminmax_tail = code.len;
+            buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+            buf_write8(&code, 0x73); buf_write8(&code, 18);
+            buf_write8(&code, 0xF2); buf_write8(&code, 0x0F); buf_write8(&code, 0x10); buf_write8(&code, 0x0C);
+            buf_write8(&code, 0xD0);
+            buf_write8(&code, 0xF2); buf_write8(&code, 0x0F); buf_write8(&code, op); buf_write8(&code, 0xC8);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0xC1);
+            buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC2);
+            buf_write8(&code, 0xEB);
+            buf_write8(&code, (uint8_t)(fminmax_tail - (code.len + 1)));
+            /* zero: xorpd xmm1, xmm1; ucomisd xmm0, xmm1; jne out;
+             * xor edx, edx; find: mov rcx, [rax + rdx*8]; add rcx, rcx;
+             * jz found; inc rdx; jmp find; found: mov rax, [rax + rdx*8];
+             * ret; out: movq rax, xmm0; ret */
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x57); buf_write8(&code, 0xC9);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x2E); buf_write8(&code, 0xC1);
+            buf_write8(&code, 0x75); buf_write8(&code, 21);
+            buf_write8(&code, 0x31); buf_write8(&code, 0xD2);
+            int fminmax_find = code.len;
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x0C); buf_write8(&code, 0xD0);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xC9);
+            buf_write8(&code, 0x74); buf_write8(&code, 5);
+            buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC2);
+            buf_write8(&code, 0xEB);
+            buf_write8(&code, (uint8_t)(fminmax_find - (code.len + 1)));
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x04); buf_write8(&code, 0xD0);
+            buf_write8(&code, 0xC3);
+            buf_write8(&code, 0x66); buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0x7E);
+            buf_write8(&code, 0xC0);
+            buf_write8(&code, 0xC3);
+            /* empty: lea rsi, [r13 + empty_msg]; mov edx, len; jmp runtime_fail */
+            patch_rel32(&code, je_empty_patch, code.len);
+            buf_write8(&code, 0x49); buf_write8(&code, 0x8D); emit_r13_modrm(&code, 6, empty_msg_offset);
+            emit_mov_r32_imm32(&code, 2, (uint32_t)(sizeof(empty_msg) - 1));
+            buf_write8(&code, 0xE9);
+            buf_write32(&code, 0);
+            patch_rel32(&code, code.len - 4, runtime_fail_offset);
+        }
 
-    /* === digit_loop === */
-    int digit_loop = code.len;
-    code.data[jmp_to_loop_patch] = (uint8_t)(digit_loop - jmp_to_loop_patch - 1);
+        arr_findex_of_offset = code.len;
+        /* push rsi; movq xmm0, rdx (value); xor edx, edx (index);
+         * mov rcx, [rax - 8]; cmp byte [r13 + flags], 0; je sse;
+         * and rcx, -8; jz tail; vbroadcastsd ymm0, xmm0 */
+        buf_write8(&code, 0x56);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0x6E);
+        buf_write8(&code, 0xC2);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x80); emit_r13_modrm(&code, 7, flags); buf_write8(&code, 0x00);
+        buf_write8(&code, 0x74);
+        int je_ffind_sse_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x74);
+        int jz_ffind_tail_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, 0x7D); buf_write8(&code, 0x19);
+        buf_write8(&code, 0xC0);
+        /* loop: vcmpeqpd ymm1, ymm0, [rax + rdx*8];
+         * vcmpeqpd ymm2, ymm0, [rax + rdx*8 + 32]; vorpd ymm1, ymm1, ymm2;
+         * vtestpd ymm1, ymm1; jnz hit (the tail finds it in this round);
+         * add rdx, 8; cmp rdx, rcx; jb loop; hit: vzeroupper; jmp tail */
+        int ffind_avx_loop = code.len;
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0xC2); buf_write8(&code, 0x0C);
+        buf_write8(&code, 0xD0); buf_write8(&code, 0x00);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xFD); buf_write8(&code, 0xC2); buf_write8(&code, 0x54);
+        buf_write8(&code, 0xD0); buf_write8(&code, 32); buf_write8(&code, 0x00);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF5); buf_write8(&code, 0x56); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0xC4); buf_write8(&code, 0xE2); buf_write8(&code, 0x7D); buf_write8(&code, 0x0F);
+        buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x75);
+        int jnz_ffind_hit_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x72);
+        buf_write8(&code, (uint8_t)(ffind_avx_loop - (code.len + 1)));
+        code.data[jnz_ffind_hit_patch] = (uint8_t)(code.len - jnz_ffind_hit_patch - 1);
+        buf_write8(&code, 0xC5); buf_write8(&code, 0xF8); buf_write8(&code, 0x77);
+        buf_write8(&code, 0xEB);
+        int jmp_ffind_tail_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* sse: and rcx, -4; jz tail; unpcklpd xmm0, xmm0; then 4
+         * elements a round: movapd xmm1, xmm0; cmpeqpd xmm1, [rax + rdx*8];
+         * movapd xmm2, xmm0; cmpeqpd xmm2, [rax + rdx*8 + 16];
+         * orpd xmm1, xmm2; movmskpd esi, xmm1; test esi, esi; jnz tail;
+         * add rdx, 4; cmp rdx, rcx; jb loop */
+        code.data[je_ffind_sse_patch] = (uint8_t)(code.len - je_ffind_sse_patch - 1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xE1); buf_write8(&code, 0xFC);
+        buf_write8(&code, 0x74);
+        int jz_ffind_sse_tail_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x14); buf_write8(&code, 0xC0);
+        int ffind_sse_loop = code.len;
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xC2); buf_write8(&code, 0x0C);
+        buf_write8(&code, 0xD0); buf_write8(&code, 0x00);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x28); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xC2); buf_write8(&code, 0x54);
+        buf_write8(&code, 0xD0); buf_write8(&code, 16); buf_write8(&code, 0x00);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x56); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x50); buf_write8(&code, 0xF1);
+        buf_write8(&code, 0x85); buf_write8(&code, 0xF6);
+        buf_write8(&code, 0x75);
+        int jnz_ffind_sse_hit_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 4);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x72);
+        buf_write8(&code, (uint8_t)(ffind_sse_loop - (code.len + 1)));
+        /* tail: cmp rdx, [rax - 8]; jae none; ucomisd xmm0, [rax + rdx*8];
+         * jp next; je found; next: inc rdx; jmp tail; none: mov rdx, -1;
+         * found: mov rax, rdx; pop rsi; ret */
+        code.data[jz_ffind_tail_patch] = (uint8_t)(code.len - jz_ffind_tail_patch - 1);
+        code.data[jmp_ffind_tail_patch] = (uint8_t)(code.len - jmp_ffind_tail_patch - 1);
+        code.data[jz_ffind_sse_tail_patch] = (uint8_t)(code.len - jz_ffind_sse_tail_patch - 1);
+        code.data[jnz_ffind_sse_hit_patch] = (uint8_t)(code.len - jnz_ffind_sse_hit_patch - 1);
+        int ffind_tail = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x50); buf_write8(&code, 0xF8);
+        buf_write8(&code, 0x73); buf_write8(&code, 14);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x2E); buf_write8(&code, 0x04);
+        buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x7A); buf_write8(&code, 2);
+        buf_write8(&code, 0x74); buf_write8(&code, 12);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(ffind_tail - (code.len + 1)));
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC7); buf_write8(&code, 0xC2); buf_write32(&code, 0xFFFFFFFF);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
+    }
 
-    /* Handle special case: value == 0 */
-    /* test rax, rax */
-    buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
-    /* jnz do_divide */
-    buf_write8(&code, 0x75);
-    int jnz_do_div_patch = code.len;
-    buf_write8(&code, 0x00);
+    int map_new_offset = -1, map_get_offset = -1, map_has_offset = -1;
+    int map_set_offset = -1, map_remove_offset = -1, map_keys_offset = -1;
+    int map_release_offset = -1;
+    if (uses_maps) {
+        /* === Map routines ===
+         *
+         * A map is a Swiss table: the header (see ir.h) points at groups
+         * of 16 control bytes and 16 entry indices, and at the entries
+         * themselves, (key, value) pairs in insertion order.  A key hashes
+         * to 64 bits; the low 7 go in the control byte, the rest pick the
+         * first group, and later groups follow triangularly.  One pcmpeqb
+         * compares a key's 7 bits against a whole group; a group holding
+         * an EMPTY byte ends the search.
+         *
+         * map_find: rdi = map, rsi = key; returns the entry in rcx (0 if
+         * there is none), its group in rbx and its byte in rdx.
+         * map_free_slot: rdi = map, rsi = key; returns the group of the
+         * first EMPTY or DELETED byte on its probe sequence in rbx, the
+         * byte in rdx and the key's 7 bits in r11.
+         * map_rehash: rdi = map, rcx = groups wanted; moves the entries
+         * to a fresh group table of that many groups.
+         * map_grow_entries: rdi = map; doubles the entry capacity.
+         * These clobber everything but rdi, rsi, r12 and the stack.
+         *
+         * map_new: returns a new empty map in rax.
+         * map_get: rax = map, rdx = key; returns the value, exiting
+         * through runtime_fail when there is none.
+         * map_has: rax = map, rdx = key; returns 1 or 0.
+         * map_set: rax = map, rdx = key, rcx = value.
+         * map_remove: rax = map, rdx = key; the last entry fills the hole.
+         * map_keys: rax = map; returns a new array of its keys.
+         * map_release: rax = map; drops a reference, freeing the map with
+         * the last one.
+         * The public routines clobber rax, rcx, rdx and xmm0-xmm2 only.
+         */
+        int map_find_offset = code.len;
+        /* h = key * 0x9E3779B97F4A7C15 folded to h ^ (h >> 32):
+         * movabs rdx, 0x9E3779B97F4A7C15; imul rdx, rsi; mov rax, rdx;
+         * shr rax, 32; xor rdx, rax */
+        buf_write8(&code, 0x48); buf_write8(&code, 0xBA); buf_write64(&code, 0x9E3779B97F4A7C15ULL);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0xAF); buf_write8(&code, 0xD6);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE8); buf_write8(&code, 0x20);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x31); buf_write8(&code, 0xC2);
+
+        /* xmm1 = h2 (the low 7 bits) in every byte, xmm2 = EMPTY in every
+         * byte: mov eax, edx; and eax, 0x7F; imul eax, eax, 0x01010101;
+         * movd xmm1, eax; pshufd xmm1, xmm1, 0; mov eax, 0x80808080;
+         * movd xmm2, eax; pshufd xmm2, xmm2, 0 */
+        buf_write8(&code, 0x89); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x83); buf_write8(&code, 0xE0); buf_write8(&code, 0x7F);
+        buf_write8(&code, 0x69); buf_write8(&code, 0xC0); buf_write32(&code, 0x1010101);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6E); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x70); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x00);
+        emit_mov_r32_imm32(&code, 0, 0x80808080);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6E); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x70); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x00);
 
-    /* If rax == 0 and ecx == 0, we need to output "0" */
-    /* test ecx, ecx */
-    buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
-    /* jnz done_digits (we have digits, rax just became 0) */
-    buf_write8(&code, 0x75);
-    int jnz_done_patch = code.len;
-    buf_write8(&code, 0x00);
+        /* first group (h >> 7) & mask; r8 = probe step: shr rdx, 7;
+         * mov r9, [rdi + 16]; and rdx, r9; mov r10, [rdi + 24];
+         * mov r11, [rdi + 32]; xor r8d, r8d */
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xEA); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x8B); buf_write8(&code, 0x4F); buf_write8(&code, 0x10);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x21); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x8B); buf_write8(&code, 0x57); buf_write8(&code, 0x18);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x8B); buf_write8(&code, 0x5F); buf_write8(&code, 0x20);
+        buf_write8(&code, 0x45); buf_write8(&code, 0x31); buf_write8(&code, 0xC0);
 
-    /* Write '0' */
-    /* mov byte [r8], '0' */
-    buf_write8(&code, 0x41); buf_write8(&code, 0xC6); buf_write8(&code, 0x00); buf_write8(&code, '0');
-    /* dec r8 */
-    buf_write8(&code, 0x49); buf_write8(&code, 0xFF); buf_write8(&code, 0xC8);
-    /* inc ecx */
-    buf_write8(&code, 0xFF); buf_write8(&code, 0xC1);
-    /* jmp done_digits */
-    buf_write8(&code, 0xEB);
-    int jmp_done2_patch = code.len;
-    buf_write8(&code, 0x00);
+        /* group: lea rbx, [rdx + rdx*4]; shl rbx, 4; add rbx, r10;
+         * movdqa xmm0, [rbx]; pcmpeqb xmm0, xmm1; pmovmskb eax, xmm0;
+         * test eax, eax; jz next */
+        int find_group = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x1C); buf_write8(&code, 0x92);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE3); buf_write8(&code, 0x04);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x01); buf_write8(&code, 0xD3);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6F); buf_write8(&code, 0x03);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x74); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD7); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x74);
+        int jz_find_next_patch = code.len;
+        buf_write8(&code, 0x00);
 
-    /* === do_divide === */
-    int do_divide = code.len;
-    code.data[jnz_do_div_patch] = (uint8_t)(do_divide - jnz_do_div_patch - 1);
+        /* each byte matching h2 names an entry to compare keys with:
+         * match: bsf ecx, eax; mov ecx, [rbx + rcx*4 + 16]; shl rcx, 4;
+         * add rcx, r11; cmp rsi, [rcx]; je hit */
+        int find_match = code.len;
+        buf_write8(&code, 0x0F); buf_write8(&code, 0xBC); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x8B); buf_write8(&code, 0x4C); buf_write8(&code, 0x8B); buf_write8(&code, 0x10);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE1); buf_write8(&code, 0x04);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x01); buf_write8(&code, 0xD9);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x31);
+        buf_write8(&code, 0x74);
+        int je_find_hit_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* lea ecx, [rax - 1]; and eax, ecx; jnz match */
+        buf_write8(&code, 0x8D); buf_write8(&code, 0x48); buf_write8(&code, 0xFF);
+        buf_write8(&code, 0x21); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x75);
+        buf_write8(&code, (uint8_t)(find_match - (code.len + 1)));
+
+        code.data[jz_find_next_patch] = (uint8_t)(code.len - jz_find_next_patch - 1);
+        /* a group with an EMPTY byte ends the probe sequence:
+         * next: movdqa xmm0, [rbx]; pcmpeqb xmm0, xmm2; pmovmskb eax, xmm0;
+         * test eax, eax; jnz miss; inc r8; add rdx, r8; and rdx, r9;
+         * jmp group */
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6F); buf_write8(&code, 0x03);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x74); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD7); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x75);
+        int jnz_find_miss_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x49); buf_write8(&code, 0xFF); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x01); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x21); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(find_group - (code.len + 1)));
+
+        code.data[je_find_hit_patch] = (uint8_t)(code.len - je_find_hit_patch - 1);
+        /* hit: bsf edx, eax; ret */
+        buf_write8(&code, 0x0F); buf_write8(&code, 0xBC); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0xC3);
+        code.data[jnz_find_miss_patch] = (uint8_t)(code.len - jnz_find_miss_patch - 1);
+        /* miss: xor ecx, ecx; ret */
+        buf_write8(&code, 0x31); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0xC3);
+
+        int map_free_slot_offset = code.len;
+        /* movabs rdx, 0x9E3779B97F4A7C15; imul rdx, rsi; mov rax, rdx;
+         * shr rax, 32; xor rdx, rax */
+        buf_write8(&code, 0x48); buf_write8(&code, 0xBA); buf_write64(&code, 0x9E3779B97F4A7C15ULL);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x0F); buf_write8(&code, 0xAF); buf_write8(&code, 0xD6);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE8); buf_write8(&code, 0x20);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x31); buf_write8(&code, 0xC2);
+
+        /* mov r11d, edx; and r11d, 0x7F; shr rdx, 7; mov r9, [rdi + 16];
+         * and rdx, r9; mov r10, [rdi + 24]; xor r8d, r8d */
+        buf_write8(&code, 0x41); buf_write8(&code, 0x89); buf_write8(&code, 0xD3);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x83); buf_write8(&code, 0xE3); buf_write8(&code, 0x7F);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xEA); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x8B); buf_write8(&code, 0x4F); buf_write8(&code, 0x10);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x21); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x8B); buf_write8(&code, 0x57); buf_write8(&code, 0x18);
+        buf_write8(&code, 0x45); buf_write8(&code, 0x31); buf_write8(&code, 0xC0);
 
-    /* xor edx, edx */
-    buf_write8(&code, 0x31); buf_write8(&code, 0xD2);
-    /* mov rsi, 10 */
-    buf_write8(&code, 0x48); buf_write8(&code, 0xC7); buf_write8(&code, 0xC6); buf_write32(&code, 10);
-    /* div rsi (rax = quotient, rdx = remainder) */
-    buf_write8(&code, 0x48); buf_write8(&code, 0xF7); buf_write8(&code, 0xF6);
-    /* add dl, '0' */
-    buf_write8(&code, 0x80); buf_write8(&code, 0xC2); buf_write8(&code, '0');
-    /* mov [r8], dl */
-    buf_write8(&code, 0x41); buf_write8(&code, 0x88); buf_write8(&code, 0x10);
-    /* dec r8 */
-    buf_write8(&code, 0x49); buf_write8(&code, 0xFF); buf_write8(&code, 0xC8);
-    /* inc ecx */
-    buf_write8(&code, 0xFF); buf_write8(&code, 0xC1);
-    /* jmp digit_loop */
-    buf_write8(&code, 0xEB);
-    int jmp_loop_patch = code.len;
-    buf_write8(&code, 0x00);
-    code.data[jmp_loop_patch] = (uint8_t)((digit_loop - jmp_loop_patch - 1) & 0xFF);
+        /* EMPTY and DELETED are the bytes with the top bit set:
+         * group: lea rbx, [rdx + rdx*4]; shl rbx, 4; add rbx, r10;
+         * movdqa xmm0, [rbx]; pmovmskb eax, xmm0; test eax, eax; jnz found */
+        int slot_group = code.len;
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x1C); buf_write8(&code, 0x92);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE3); buf_write8(&code, 0x04);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x01); buf_write8(&code, 0xD3);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6F); buf_write8(&code, 0x03);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD7); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x75);
+        int jnz_slot_found_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* inc r8; add rdx, r8; and rdx, r9; jmp group */
+        buf_write8(&code, 0x49); buf_write8(&code, 0xFF); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x01); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x21); buf_write8(&code, 0xCA);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(slot_group - (code.len + 1)));
+        code.data[jnz_slot_found_patch] = (uint8_t)(code.len - jnz_slot_found_patch - 1);
+        /* found: bsf edx, eax; ret */
+        buf_write8(&code, 0x0F); buf_write8(&code, 0xBC); buf_write8(&code, 0xD0);
+        buf_write8(&code, 0xC3);
+
+        int map_rehash_offset = code.len;
+        /* push r12; push rsi; push qword [rdi + 24]; lea rax, [rcx - 1];
+         * mov [rdi + 16], rax; imul rax, rcx, 14; sub rax, [rdi];
+         * mov [rdi + 48], rax */
+        buf_write8(&code, 0x41); buf_write8(&code, 0x54);
+        buf_write8(&code, 0x56);
+        buf_write8(&code, 0xFF); buf_write8(&code, 0x77); buf_write8(&code, 0x18);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8D); buf_write8(&code, 0x41); buf_write8(&code, 0xFF);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x47); buf_write8(&code, 0x10);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x6B); buf_write8(&code, 0xC1); buf_write8(&code, 0x0E);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x2B); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x47); buf_write8(&code, 0x30);
+
+        /* imul rax, rcx, 80; push rcx; call alloc; pop rcx;
+         * mov [rdi + 24], rax; mov edx, 0x80808080; movd xmm2, edx;
+         * pshufd xmm2, xmm2, 0 */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x6B); buf_write8(&code, 0xC1); buf_write8(&code, 0x50);
+        buf_write8(&code, 0x51);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, alloc_offset);
+        buf_write8(&code, 0x59);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x47); buf_write8(&code, 0x18);
+        emit_mov_r32_imm32(&code, 2, 0x80808080);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6E); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x70); buf_write8(&code, 0xD2);
+        buf_write8(&code, 0x00);
+        /* fill: movdqa [rax], xmm2; add rax, 80; dec rcx; jnz fill */
+        int rehash_fill = code.len;
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x7F); buf_write8(&code, 0x10);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC0); buf_write8(&code, 0x50);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x75);
+        buf_write8(&code, (uint8_t)(rehash_fill - (code.len + 1)));
+
+        /* reinsert entry r12 for every r12 < count: xor r12d, r12d */
+        buf_write8(&code, 0x45); buf_write8(&code, 0x31); buf_write8(&code, 0xE4);
+        /* next: cmp r12, [rdi]; jae done; mov rax, r12; shl rax, 4;
+         * add rax, [rdi + 32]; mov rsi, [rax]; call map_free_slot;
+         * mov [rbx + rdx], r11b; mov [rbx + rdx*4 + 16], r12d; inc r12;
+         * jmp next */
+        int rehash_next = code.len;
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x3B); buf_write8(&code, 0x27);
+        buf_write8(&code, 0x73);
+        int jae_rehash_done_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x89); buf_write8(&code, 0xE0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE0); buf_write8(&code, 0x04);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x03); buf_write8(&code, 0x47); buf_write8(&code, 0x20);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x30);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_free_slot_offset);
+        buf_write8(&code, 0x44); buf_write8(&code, 0x88); buf_write8(&code, 0x1C); buf_write8(&code, 0x13);
+        buf_write8(&code, 0x44); buf_write8(&code, 0x89); buf_write8(&code, 0x64); buf_write8(&code, 0x93);
+        buf_write8(&code, 0x10);
+        buf_write8(&code, 0x49); buf_write8(&code, 0xFF); buf_write8(&code, 0xC4);
+        buf_write8(&code, 0xEB);
+        buf_write8(&code, (uint8_t)(rehash_next - (code.len + 1)));
+        code.data[jae_rehash_done_patch] = (uint8_t)(code.len - jae_rehash_done_patch - 1);
+        /* done: pop rax; call free; pop rsi; pop r12; ret */
+        buf_write8(&code, 0x58);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, free_offset);
+        buf_write8(&code, 0x5E);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x5C);
+        buf_write8(&code, 0xC3);
 
-    /* === done_digits === */
-    int done_digits = code.len;
-    code.data[jnz_done_patch] = (uint8_t)(done_digits - jnz_done_patch - 1);
-    code.data[jmp_done2_patch] = (uint8_t)(done_digits - jmp_done2_patch - 1);
+        int map_grow_entries_offset = code.len;
+        /* push rsi; mov rax, [rdi + 40]; shl rax, 5; call alloc;
+         * mov rsi, [rdi + 32]; push rsi; push rdi; shl qword [rdi + 40], 1;
+         * mov [rdi + 32], rax */
+        buf_write8(&code, 0x56);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x47); buf_write8(&code, 0x28);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE0); buf_write8(&code, 0x05);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, alloc_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x77); buf_write8(&code, 0x20);
+        buf_write8(&code, 0x56);
+        buf_write8(&code, 0x57);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xD1); buf_write8(&code, 0x67); buf_write8(&code, 0x28);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x47); buf_write8(&code, 0x20);
+
+        /* mov rcx, [rdi]; add rcx, rcx; mov rdi, rax; rep movsq; pop rdi;
+         * pop rax; call free; pop rsi; ret */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x0F);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+        buf_write8(&code, 0xF3); buf_write8(&code, 0x48); buf_write8(&code, 0xA5);
+        buf_write8(&code, 0x5F);
+        buf_write8(&code, 0x58);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, free_offset);
+        buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
 
-    /* If sign flag set, prepend '-' */
-    /* test r9d, r9d */
-    buf_write8(&code, 0x45); buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
-    /* jz no_sign */
-    buf_write8(&code, 0x74);
-    int jz_no_sign_patch = code.len;
-    buf_write8(&code, 0x00);
+        map_new_offset = code.len;
+        /* push rsi; mov eax, 64; call alloc; mov rsi, rax; xor eax, eax;
+         * mov [rsi], rax; mov [rsi + 16], rax; inc eax; mov [rsi + 8], rax;
+         * mov qword [rsi + 40], 8; mov qword [rsi + 48], 14 */
+        buf_write8(&code, 0x56);
+        emit_mov_r32_imm32(&code, 0, 0x40);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, alloc_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC6);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x06);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x46); buf_write8(&code, 0x10);
+        buf_write8(&code, 0xFF); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x46); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC7); buf_write8(&code, 0x46); buf_write8(&code, 0x28);
+        buf_write8(&code, 0x08); buf_write8(&code, 0x00); buf_write8(&code, 0x00); buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC7); buf_write8(&code, 0x46); buf_write8(&code, 0x30);
+        buf_write8(&code, 0x0E); buf_write8(&code, 0x00); buf_write8(&code, 0x00); buf_write8(&code, 0x00);
+
+        /* mov eax, 80; call alloc; mov [rsi + 24], rax; mov edx, 0x80808080;
+         * movd xmm0, edx; pshufd xmm0, xmm0, 0; movdqa [rax], xmm0 */
+        emit_mov_r32_imm32(&code, 0, 0x50);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, alloc_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x46); buf_write8(&code, 0x18);
+        emit_mov_r32_imm32(&code, 2, 0x80808080);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6E); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x70); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x7F); buf_write8(&code, 0x00);
 
-    /* mov byte [r8], '-' */
-    buf_write8(&code, 0x41); buf_write8(&code, 0xC6); buf_write8(&code, 0x00); buf_write8(&code, '-');
-    /* dec r8 */
-    buf_write8(&code, 0x49); buf_write8(&code, 0xFF); buf_write8(&code, 0xC8);
-    /* inc ecx */
-    buf_write8(&code, 0xFF); buf_write8(&code, 0xC1);
+        /* mov eax, 128; call alloc; mov [rsi + 32], rax; mov rax, rsi;
+         * pop rsi; ret */
+        emit_mov_r32_imm32(&code, 0, 0x80);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, alloc_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x46); buf_write8(&code, 0x20);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0x5E);
+        buf_write8(&code, 0xC3);
+
+        map_get_offset = code.len;
+        /* mov rdi, rax; mov rsi, rdx; call map_find; test rcx, rcx;
+         * jz missing */
+        emit_map_saves(&code, 0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD6);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_find_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x74);
+        int jz_get_missing_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* mov rax, [rcx + 8]; ret */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x41); buf_write8(&code, 0x08);
+        emit_map_saves(&code, 1);
+        buf_write8(&code, 0xC3);
+        code.data[jz_get_missing_patch] = (uint8_t)(code.len - jz_get_missing_patch - 1);
+        /* missing: lea rsi, [r13 + missing_msg]; mov edx, len; jmp runtime_fail */
+        buf_write8(&code, 0x49); buf_write8(&code, 0x8D); emit_r13_modrm(&code, 6, missing_msg_offset);
+        emit_mov_r32_imm32(&code, 2, (uint32_t)(sizeof(missing_msg) - 1));
+        buf_write8(&code, 0xE9);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, runtime_fail_offset);
+
+        map_has_offset = code.len;
+        /* mov rdi, rax; mov rsi, rdx; call map_find; xor eax, eax;
+         * test rcx, rcx; setnz al; ret */
+        emit_map_saves(&code, 0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD6);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_find_offset);
+        buf_write8(&code, 0x31); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x0F); buf_write8(&code, 0x95); buf_write8(&code, 0xC0);
+        emit_map_saves(&code, 1);
+        buf_write8(&code, 0xC3);
+
+        map_set_offset = code.len;
+        /* push r12; mov rdi, rax; mov rsi, rdx; mov r12, rcx; call map_find;
+         * test rcx, rcx; jz insert */
+        emit_map_saves(&code, 0);
+        buf_write8(&code, 0x41); buf_write8(&code, 0x54);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD6);
+        buf_write8(&code, 0x49); buf_write8(&code, 0x89); buf_write8(&code, 0xCC);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_find_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x74);
+        int jz_set_insert_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* mov [rcx + 8], r12; jmp done */
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x89); buf_write8(&code, 0x61); buf_write8(&code, 0x08);
+        buf_write8(&code, 0xEB);
+        int jmp_set_done_patch = code.len;
+        buf_write8(&code, 0x00);
 
-    /* === no_sign === */
-    int no_sign = code.len;
-    code.data[jz_no_sign_patch] = (uint8_t)(no_sign - jz_no_sign_patch - 1);
+        code.data[jz_set_insert_patch] = (uint8_t)(code.len - jz_set_insert_patch - 1);
+        /* out of room: double the groups when over half are taken, else
+         * rebuild at the same size to clear the DELETED bytes:
+         * insert: cmp qword [rdi + 48], 0; jne room; mov rcx, [rdi + 16];
+         * inc rcx; imul rax, rcx, 7; cmp [rdi], rax; jbe same */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0x7F); buf_write8(&code, 0x30);
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x75);
+        int jne_set_room_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x4F); buf_write8(&code, 0x10);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC1);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x6B); buf_write8(&code, 0xC1); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x76);
+        int jbe_set_same_patch = code.len;
+        buf_write8(&code, 0x00);
+        /* add rcx, rcx */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x01); buf_write8(&code, 0xC9);
+        code.data[jbe_set_same_patch] = (uint8_t)(code.len - jbe_set_same_patch - 1);
+        /* same: call map_rehash */
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_rehash_offset);
+
+        code.data[jne_set_room_patch] = (uint8_t)(code.len - jne_set_room_patch - 1);
+        /* room: mov rax, [rdi]; cmp rax, [rdi + 40]; jb entries;
+         * call map_grow_entries */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x3B); buf_write8(&code, 0x47); buf_write8(&code, 0x28);
+        buf_write8(&code, 0x72);
+        int jb_set_entries_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_grow_entries_offset);
 
-    /* r8 points one before the first char. rsi = r8 + 1, rdx = ecx */
-    /* lea rsi, [r8 + 1] */
-    buf_write8(&code, 0x49); buf_write8(&code, 0x8D); buf_write8(&code, 0x70); buf_write8(&code, 0x01);
-    /* mov edx, ecx */
-    buf_write8(&code, 0x89); buf_write8(&code, 0xCA);
+        code.data[jb_set_entries_patch] = (uint8_t)(code.len - jb_set_entries_patch - 1);
+        /* taking an EMPTY byte uses up growth, a DELETED one does not:
+         * entries: call map_free_slot; cmp byte [rbx + rdx], 0x80;
+         * jne reuse; dec qword [rdi + 48] */
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_free_slot_offset);
+        buf_write8(&code, 0x80); buf_write8(&code, 0x3C); buf_write8(&code, 0x13); buf_write8(&code, 0x80);
+        buf_write8(&code, 0x75);
+        int jne_set_reuse_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0x4F); buf_write8(&code, 0x30);
+        code.data[jne_set_reuse_patch] = (uint8_t)(code.len - jne_set_reuse_patch - 1);
+        /* reuse: mov [rbx + rdx], r11b; mov rax, [rdi];
+         * mov [rbx + rdx*4 + 16], eax; shl rax, 4; add rax, [rdi + 32];
+         * mov [rax], rsi; mov [rax + 8], r12; inc qword [rdi] */
+        buf_write8(&code, 0x44); buf_write8(&code, 0x88); buf_write8(&code, 0x1C); buf_write8(&code, 0x13);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x89); buf_write8(&code, 0x44); buf_write8(&code, 0x93); buf_write8(&code, 0x10);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE0); buf_write8(&code, 0x04);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x03); buf_write8(&code, 0x47); buf_write8(&code, 0x20);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x30);
+        buf_write8(&code, 0x4C); buf_write8(&code, 0x89); buf_write8(&code, 0x60); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0x07);
+        code.data[jmp_set_done_patch] = (uint8_t)(code.len - jmp_set_done_patch - 1);
+        /* done: pop r12; ret */
+        buf_write8(&code, 0x41); buf_write8(&code, 0x5C);
+        emit_map_saves(&code, 1);
+        buf_write8(&code, 0xC3);
+
+        map_remove_offset = code.len;
+        /* mov rdi, rax; mov rsi, rdx; call map_find; test rcx, rcx; jz done */
+        emit_map_saves(&code, 0);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xD6);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_find_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
+        buf_write8(&code, 0x74);
+        int jz_remove_done_patch = code.len;
+        buf_write8(&code, 0x00);
 
-    /* write(1, rsi, rdx) */
-    emit_mov_r32_imm32(&code, 0, 1);  /* sys_write */
-    emit_mov_r32_imm32(&code, 7, 1);  /* stdout */
-    emit_syscall(&code);
+        /* The byte goes back to EMPTY when its group still has one: no
+         * probe sequence has gone on past a group never full.
+         * movdqa xmm0, [rbx]; pcmpeqb xmm0, xmm2; pmovmskb eax, xmm0;
+         * test eax, eax; mov al, 0xFE; jz store; mov al, 0x80;
+         * inc qword [rdi + 48]; store: mov [rbx + rdx], al */
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x6F); buf_write8(&code, 0x03);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0x74); buf_write8(&code, 0xC2);
+        buf_write8(&code, 0x66); buf_write8(&code, 0x0F); buf_write8(&code, 0xD7); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0x85); buf_write8(&code, 0xC0);
+        buf_write8(&code, 0xB0); buf_write8(&code, 0xFE);
+        buf_write8(&code, 0x74); buf_write8(&code, 0x06);
+        buf_write8(&code, 0xB0); buf_write8(&code, 0x80);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0x47); buf_write8(&code, 0x30);
+        buf_write8(&code, 0x88); buf_write8(&code, 0x04); buf_write8(&code, 0x13);
+
+        /* mov rax, [rdi]; dec rax; mov [rdi], rax; shl rax, 4;
+         * add rax, [rdi + 32]; cmp rax, rcx; je done */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x07);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE0); buf_write8(&code, 0x04);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x03); buf_write8(&code, 0x47); buf_write8(&code, 0x20);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x39); buf_write8(&code, 0xC8);
+        buf_write8(&code, 0x74);
+        int je_remove_done_patch = code.len;
+        buf_write8(&code, 0x00);
 
-    /* add rsp, 32 */
-    buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC4); buf_write8(&code, 32);
+        /* the last entry moves into the hole; find its slot and repoint it:
+         * mov rsi, [rax]; mov [rcx], rsi; mov rdx, [rax + 8];
+         * mov [rcx + 8], rdx; push rcx; call map_find; pop rax;
+         * sub rax, [rdi + 32]; shr rax, 4; mov [rbx + rdx*4 + 16], eax */
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x30);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x31);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x50); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x51); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x51);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, map_find_offset);
+        buf_write8(&code, 0x58);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x2B); buf_write8(&code, 0x47); buf_write8(&code, 0x20);
+        buf_write8(&code, 0x48); buf_write8(&code, 0xC1); buf_write8(&code, 0xE8); buf_write8(&code, 0x04);
+        buf_write8(&code, 0x89); buf_write8(&code, 0x44); buf_write8(&code, 0x93); buf_write8(&code, 0x10);
+        code.data[jz_remove_done_patch] = (uint8_t)(code.len - jz_remove_done_patch - 1);
+        code.data[je_remove_done_patch] = (uint8_t)(code.len - je_remove_done_patch - 1);
+        /* done: ret */
+        emit_map_saves(&code, 1);
+        buf_write8(&code, 0xC3);
+
+        if (arr_new_offset >= 0) {
+            map_keys_offset = code.len;
+            /* push rsi; push rdi; mov rsi, rax; mov rax, [rsi]; call arr_new;
+             * mov rcx, [rsi]; mov [rax - 8], rcx; mov rdx, [rsi + 32];
+             * mov rdi, rax */
+            buf_write8(&code, 0x56);
+            buf_write8(&code, 0x57);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC6);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x06);
+            buf_write8(&code, 0xE8);
+            buf_write32(&code, 0);
+            patch_rel32(&code, code.len - 4, arr_new_offset);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x0E);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x48); buf_write8(&code, 0xF8);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x56); buf_write8(&code, 0x20);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC7);
+            /* next: test rcx, rcx; jz done; mov rsi, [rdx]; mov [rdi], rsi;
+             * add rdx, 16; add rdi, 8; dec rcx; jmp next */
+            int keys_next = code.len;
+            buf_write8(&code, 0x48); buf_write8(&code, 0x85); buf_write8(&code, 0xC9);
+            buf_write8(&code, 0x74);
+            int jz_keys_done_patch = code.len;
+            buf_write8(&code, 0x00);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x32);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0x37);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC2); buf_write8(&code, 0x10);
+            buf_write8(&code, 0x48); buf_write8(&code, 0x83); buf_write8(&code, 0xC7); buf_write8(&code, 0x08);
+            buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0xC9);
+            buf_write8(&code, 0xEB);
+            buf_write8(&code, (uint8_t)(keys_next - (code.len + 1)));
+            code.data[jz_keys_done_patch] = (uint8_t)(code.len - jz_keys_done_patch - 1);
+            /* done: pop rdi; pop rsi; ret */
+            buf_write8(&code, 0x5F);
+            buf_write8(&code, 0x5E);
+            buf_write8(&code, 0xC3);
+        }
 
-    /* ret */
-    buf_write8(&code, 0xC3);
+        map_release_offset = code.len;
+        /* dec qword [rax + 8]; jnz kept; push rsi; mov rsi, rax;
+         * mov rax, [rsi + 24]; call free; mov rax, [rsi + 32]; call free;
+         * mov rax, rsi; call free; pop rsi */
+        buf_write8(&code, 0x48); buf_write8(&code, 0xFF); buf_write8(&code, 0x48); buf_write8(&code, 0x08);
+        buf_write8(&code, 0x75);
+        int jnz_release_kept_patch = code.len;
+        buf_write8(&code, 0x00);
+        buf_write8(&code, 0x56);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xC6);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x46); buf_write8(&code, 0x18);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, free_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x8B); buf_write8(&code, 0x46); buf_write8(&code, 0x20);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, free_offset);
+        buf_write8(&code, 0x48); buf_write8(&code, 0x89); buf_write8(&code, 0xF0);
+        buf_write8(&code, 0xE8);
+        buf_write32(&code, 0);
+        patch_rel32(&code, code.len - 4, free_offset);
+        buf_write8(&code, 0x5E);
+        code.data[jnz_release_kept_patch] = (uint8_t)(code.len - jnz_release_kept_patch - 1);
+        /* kept: ret */
+        buf_write8(&code, 0xC3);
+    }
 
     /* === Patch all jumps === */
-    for (int p = 0; p < patch_count; p++) {
-        if (patches[p].label_id == -1) {
-            /* itoa call */
-            patch_rel32(&code, patches[p].code_offset, itoa_offset);
+    for (int p = 0; p < patches.count; p++) {
+        const JmpPatch *jp = &patches.items[p];
+        if (jp->label_id == LABEL_ITOA) {
+            patch_rel32(&code, jp->code_offset, itoa_offset);
+        } else if (jp->label_id == LABEL_OUT_WRITE) {
+            patch_rel32(&code, jp->code_offset, out_write_offset);
+        } else if (jp->label_id == LABEL_OUT_FLUSH) {
+            patch_rel32(&code, jp->code_offset, out_flush_offset);
+        } else if (jp->label_id == LABEL_BOUNDS_FAIL) {
+            patch_rel32(&code, jp->code_offset, bounds_fail_offset);
+        } else if (jp->label_id == LABEL_DIV_ZERO) {
+            patch_rel32(&code, jp->code_offset, div_zero_offset);
+        } else if (jp->label_id == LABEL_DIV_OVERFLOW) {
+            patch_rel32(&code, jp->code_offset, div_overflow_offset);
+        } else if (jp->label_id == LABEL_ALLOC) {
+            patch_rel32(&code, jp->code_offset, alloc_offset);
+        } else if (jp->label_id == LABEL_FREE) {
+            patch_rel32(&code, jp->code_offset, free_offset);
+        } else if (jp->label_id == LABEL_STR_CONCAT) {
+            patch_rel32(&code, jp->code_offset, str_concat_offset);
+        } else if (jp->label_id == LABEL_STR_APPEND) {
+            patch_rel32(&code, jp->code_offset, str_append_offset);
+        } else if (jp->label_id == LABEL_STR_FROM_INT) {
+            patch_rel32(&code, jp->code_offset, str_from_int_offset);
+        } else if (jp->label_id == LABEL_STR_EQ) {
+            patch_rel32(&code, jp->code_offset, str_eq_offset);
+        } else if (jp->label_id == LABEL_STR_CMP) {
+            patch_rel32(&code, jp->code_offset, str_cmp_offset);
+        } else if (jp->label_id == LABEL_ARR_COPY) {
+            patch_rel32(&code, jp->code_offset, arr_copy_offset);
+        } else if (jp->label_id == LABEL_ARR_PUSH) {
+            patch_rel32(&code, jp->code_offset, arr_push_offset);
+        } else if (jp->label_id == LABEL_ARR_SUM) {
+            patch_rel32(&code, jp->code_offset, arr_sum_offset);
+        } else if (jp->label_id == LABEL_ARR_MIN) {
+            patch_rel32(&code, jp->code_offset, arr_min_offset);
+        } else if (jp->label_id == LABEL_ARR_MAX) {
+            patch_rel32(&code, jp->code_offset, arr_max_offset);
+        } else if (jp->label_id == LABEL_ARR_INDEX_OF) {
+            patch_rel32(&code, jp->code_offset, arr_index_of_offset);
+        } else if (jp->label_id == LABEL_ARR_FSUM) {
+            patch_rel32(&code, jp->code_offset, arr_fsum_offset);
+        } else if (jp->label_id == LABEL_ARR_FMIN) {
+            patch_rel32(&code, jp->code_offset, arr_fmin_offset);
+        } else if (jp->label_id == LABEL_ARR_FMAX) {
+            patch_rel32(&code, jp->code_offset, arr_fmax_offset);
+        } else if (jp->label_id == LABEL_ARR_FINDEX_OF) {
+            patch_rel32(&code, jp->code_offset, arr_findex_of_offset);
+        } else if (jp->label_id == LABEL_MAP_NEW) {
+            patch_rel32(&code, jp->code_offset, map_new_offset);
+        } else if (jp->label_id == LABEL_MAP_GET) {
+            patch_rel32(&code, jp->code_offset, map_get_offset);
+        } else if (jp->label_id == LABEL_MAP_HAS) {
+            patch_rel32(&code, jp->code_offset, map_has_offset);
+        } else if (jp->label_id == LABEL_MAP_SET) {
+            patch_rel32(&code, jp->code_offset, map_set_offset);
+        } else if (jp->label_id == LABEL_MAP_REMOVE) {
+            patch_rel32(&code, jp->code_offset, map_remove_offset);
+        } else if (jp->label_id == LABEL_MAP_KEYS) {
+            patch_rel32(&code, jp->code_offset, map_keys_offset);
+        } else if (jp->label_id == LABEL_MAP_RELEASE) {
+            patch_rel32(&code, jp->code_offset, map_release_offset);
+        } else if (jp->label_id == LABEL_PRINT_FLOAT) {
+            patch_rel32(&code, jp->code_offset, float_print_offset);
+        } else if (jp->label_id == LABEL_STR_FROM_FLOAT) {
+            patch_rel32(&code, jp->code_offset, str_from_float_offset);
+        } else if (jp->base >= 0) {
+            /* jump table entry */
+            int32_t rel = label_offsets[jp->label_id] - jp->base;
+            memcpy(code.data + jp->code_offset, &rel, 4);
         } else {
-            patch_rel32(&code, patches[p].code_offset, label_offsets[patches[p].label_id]);
+            patch_rel32(&code, jp->code_offset, label_offsets[jp->label_id]);
         }
     }
 
+    /* Pad with int3 so the data starts 64-byte aligned when it holds
+     * array constants */
+    if (uses_arrays)
+        while ((ELF_CODE_OFFSET + code.len) % 64) buf_write8(&code, 0xCC);
+
     /* Patch data base lea */
     patch_rel32(&code, data_base_patch, code.len);
 
@@ -1762,13 +5542,25 @@ int emit_binary_ir(IRProgram *prog, const char *output_path)
     buf_write(&code, data.data, data.len);
 
     /* === Build ELF === */
-    emit_elf_with_code(&code, output_path);
+    emit_elf_with_code(&code, HEAP_OFFSET(data.len) + (uses_heap ? HEAP_STATE_SIZE : 0) +
+                       (uses_arrays ? ARR_FLAGS_SIZE : 0) - data.len, output_path);
 
     buf_free(&code);
     buf_free(&data);
     free(str_data_offsets);
+    free(str_obj_offsets);
+    free(arr_obj_offsets);
+    free(table_offsets);
+    free(table_widths);
+    free(frame.cell);
+    free(frame.reg);
+    free(frame.floats);
     free(label_offsets);
-    free(patches);
+    free(patches.items);
+    free(call_args);
+    free(const_val);
+    free(needed);
+    free(is_const);
     return 0;
 }
 
@@ -11,6 +11,14 @@ void ir_init(IRProgram *prog) {
     prog->string_count = 0;
     prog->strings = malloc(prog->string_cap * sizeof(IRString));
 
+    prog->switch_cap = 0;
+    prog->switch_count = 0;
+    prog->switches = NULL;
+
+    prog->table_cap = 0;
+    prog->table_count = 0;
+    prog->tables = NULL;
+
     prog->next_vreg = 0;
     prog->next_label = 0;
     prog->next_slot = 0;
@@ -18,11 +26,25 @@ void ir_init(IRProgram *prog) {
 
 void ir_free(IRProgram *prog) {
     free(prog->instrs);
+    for (int i = 0; i < prog->string_count; i++)
+        if (prog->strings[i].cap > 0) free((char *)prog->strings[i].data);
     free(prog->strings);
+    for (int i = 0; i < prog->switch_count; i++) {
+        free(prog->switches[i].values);
+        free(prog->switches[i].labels);
+    }
+    free(prog->switches);
+    for (int i = 0; i < prog->table_count; i++)
+        free(prog->tables[i].values);
+    free(prog->tables);
     prog->instrs = NULL;
     prog->strings = NULL;
+    prog->switches = NULL;
+    prog->tables = NULL;
     prog->instr_count = prog->instr_cap = 0;
     prog->string_count = prog->string_cap = 0;
+    prog->switch_count = prog->switch_cap = 0;
+    prog->table_count = prog->table_cap = 0;
 }
 
 int ir_alloc_vreg(IRProgram *prog) {
@@ -45,9 +67,27 @@ int ir_add_string(IRProgram *prog, const char *data, int len) {
     int idx = prog->string_count++;
     prog->strings[idx].data = data;
     prog->strings[idx].len = len;
+    prog->strings[idx].cap = 0;
     return idx;
 }
 
+int ir_add_table(IRProgram *prog, const int64_t *values, int count) {
+    for (int i = 0; i < prog->table_count; i++) {
+        const IRTable *t = &prog->tables[i];
+        if (t->count == count && (count == 0 || memcmp(t->values, values, count * sizeof(int64_t)) == 0))
+            return i;
+    }
+    if (prog->table_count == prog->table_cap) {
+        prog->table_cap = prog->table_cap ? prog->table_cap * 2 : 4;
+        prog->tables = realloc(prog->tables, prog->table_cap * sizeof(IRTable));
+    }
+    IRTable *t = &prog->tables[prog->table_count];
+    t->count = count;
+    t->values = malloc((count > 0 ? count : 1) * sizeof(int64_t));
+    if (count > 0) memcpy(t->values, values, count * sizeof(int64_t));
+    return prog->table_count++;
+}
+
 int ir_emit(IRProgram *prog, IRInstr instr) {
     if (prog->instr_count == prog->instr_cap) {
         prog->instr_cap *= 2;
@@ -58,6 +98,544 @@ int ir_emit(IRProgram *prog, IRInstr instr) {
     return idx;
 }
 
+int ir_instr_def(const IRInstr *instr) {
+    switch (instr->op) {
+    case IR_CONST_INT: case IR_CONST_STR: case IR_LOAD_LOCAL:
+    case IR_LOAD_ELEM: case IR_LOAD_ELEM_UNCHECKED:
+    case IR_ALLOC:
+    case IR_STR_CONCAT: case IR_STR_APPEND: case IR_STR_FROM_INT:
+    case IR_STR_FROM_FLOAT: case IR_STR_EQ: case IR_STR_CMP: case IR_STR_LEN:
+    case IR_CONST_ARR: case IR_ARR_COPY: case IR_ARR_LEN: case IR_ARR_LOAD:
+    case IR_ARR_PUSH: case IR_ARR_SUM: case IR_ARR_MIN: case IR_ARR_MAX:
+    case IR_ARR_INDEX_OF: case IR_ARR_FSUM: case IR_ARR_FMIN: case IR_ARR_FMAX:
+    case IR_ARR_FINDEX_OF:
+    case IR_MAP_NEW: case IR_MAP_LEN: case IR_MAP_GET: case IR_MAP_HAS:
+    case IR_MAP_KEYS:
+    case IR_STACK_ALLOC: case IR_OBJ_LOAD:
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_MOD:
+    case IR_MUL_HI:
+    case IR_NEG:
+    case IR_BIT_AND: case IR_BIT_OR: case IR_BIT_XOR: case IR_BIT_NOT:
+    case IR_SHL: case IR_SHR:
+    case IR_CMP_EQ: case IR_CMP_NE: case IR_CMP_LT:
+    case IR_CMP_LE: case IR_CMP_GT: case IR_CMP_GE:
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: case IR_FCMP:
+    case IR_INT_TO_FLOAT:
+    case IR_SELECT:
+    case IR_PARAM: case IR_CALL:
+        return instr->dst;
+    default:
+        return -1;
+    }
+}
+
+int ir_instr_use_refs(IRInstr *instr, int *refs[IR_MAX_USES]) {
+    switch (instr->op) {
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_MOD:
+    case IR_MUL_HI:
+    case IR_BIT_AND: case IR_BIT_OR: case IR_BIT_XOR:
+    case IR_SHL: case IR_SHR:
+    case IR_CMP_EQ: case IR_CMP_NE: case IR_CMP_LT:
+    case IR_CMP_LE: case IR_CMP_GT: case IR_CMP_GE:
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: case IR_FCMP:
+    case IR_BR_CMP:
+    case IR_STR_CONCAT: case IR_STR_APPEND: case IR_STR_EQ: case IR_STR_CMP:
+    case IR_ARR_LOAD: case IR_ARR_PUSH: case IR_ARR_INDEX_OF: case IR_ARR_FINDEX_OF:
+    case IR_MAP_GET: case IR_MAP_HAS: case IR_MAP_REMOVE:
+        refs[0] = &instr->lhs;
+        refs[1] = &instr->rhs;
+        return 2;
+    case IR_SELECT: case IR_ARR_STORE: case IR_MAP_SET:
+        refs[0] = &instr->src;
+        refs[1] = &instr->lhs;
+        refs[2] = &instr->rhs;
+        return 3;
+    case IR_OBJ_STORE:
+        refs[0] = &instr->src;
+        refs[1] = &instr->lhs;
+        return 2;
+    case IR_NEG: case IR_BIT_NOT: case IR_INT_TO_FLOAT: case IR_STORE_LOCAL:
+    case IR_LOAD_ELEM: case IR_LOAD_ELEM_UNCHECKED:
+    case IR_ALLOC: case IR_FREE:
+    case IR_STR_FROM_INT: case IR_STR_FROM_FLOAT: case IR_STR_LEN: case IR_STR_RELEASE:
+    case IR_ARR_COPY: case IR_ARR_LEN: case IR_ARR_SUM: case IR_ARR_MIN:
+    case IR_ARR_MAX: case IR_ARR_FSUM: case IR_ARR_FMIN: case IR_ARR_FMAX:
+    case IR_ARR_RELEASE:
+    case IR_MAP_LEN: case IR_MAP_KEYS: case IR_MAP_RETAIN: case IR_MAP_RELEASE:
+    case IR_OBJ_LOAD: case IR_OBJ_RETAIN: case IR_OBJ_RELEASE:
+    case IR_JZ: case IR_JNZ: case IR_SWITCH:
+    case IR_PRINT_INT: case IR_PRINT_BOOL: case IR_PRINT_STR_VAL: case IR_PRINT_FLOAT:
+    case IR_ARG:
+        refs[0] = &instr->src;
+        return 1;
+    case IR_RET:
+        if (instr->src < 0) return 0;
+        refs[0] = &instr->src;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int ir_instr_uses(const IRInstr *instr, int uses[IR_MAX_USES]) {
+    int *refs[IR_MAX_USES];
+    int n = ir_instr_use_refs((IRInstr *)instr, refs);
+    for (int i = 0; i < n; i++)
+        uses[i] = *refs[i];
+    return n;
+}
+
+const char *ir_op_name(IROpcode op) {
+    switch (op) {
+    case IR_CONST_INT:   return "const";
+    case IR_CONST_STR:   return "const_str";
+    case IR_LOAD_LOCAL:  return "load";
+    case IR_STORE_LOCAL: return "store";
+    case IR_LOAD_ELEM:   return "load_elem";
+    case IR_LOAD_ELEM_UNCHECKED: return "load_elem_unchecked";
+    case IR_ALLOC:       return "alloc";
+    case IR_FREE:        return "free";
+    case IR_STR_CONCAT:  return "str_concat";
+    case IR_STR_APPEND:  return "str_append";
+    case IR_STR_FROM_INT: return "str_from_int";
+    case IR_STR_FROM_FLOAT: return "str_from_float";
+    case IR_STR_EQ:      return "str_eq";
+    case IR_STR_CMP:     return "str_cmp";
+    case IR_STR_LEN:     return "str_len";
+    case IR_STR_RELEASE: return "str_release";
+    case IR_CONST_ARR:   return "const_arr";
+    case IR_ARR_COPY:    return "arr_copy";
+    case IR_ARR_LEN:     return "arr_len";
+    case IR_ARR_LOAD:    return "arr_load";
+    case IR_ARR_STORE:   return "arr_store";
+    case IR_ARR_PUSH:    return "arr_push";
+    case IR_ARR_SUM:     return "arr_sum";
+    case IR_ARR_MIN:     return "arr_min";
+    case IR_ARR_MAX:     return "arr_max";
+    case IR_ARR_INDEX_OF: return "arr_index_of";
+    case IR_ARR_FSUM:    return "arr_fsum";
+    case IR_ARR_FMIN:    return "arr_fmin";
+    case IR_ARR_FMAX:    return "arr_fmax";
+    case IR_ARR_FINDEX_OF: return "arr_findex_of";
+    case IR_ARR_RELEASE: return "arr_release";
+    case IR_MAP_NEW:     return "map_new";
+    case IR_MAP_LEN:     return "map_len";
+    case IR_MAP_GET:     return "map_get";
+    case IR_MAP_HAS:     return "map_has";
+    case IR_MAP_SET:     return "map_set";
+    case IR_MAP_REMOVE:  return "map_remove";
+    case IR_MAP_KEYS:    return "map_keys";
+    case IR_MAP_RETAIN:  return "map_retain";
+    case IR_MAP_RELEASE: return "map_release";
+    case IR_STACK_ALLOC: return "stack_alloc";
+    case IR_OBJ_LOAD:    return "obj_load";
+    case IR_OBJ_STORE:   return "obj_store";
+    case IR_OBJ_RETAIN:  return "obj_retain";
+    case IR_OBJ_RELEASE: return "obj_release";
+    case IR_ADD:         return "add";
+    case IR_SUB:         return "sub";
+    case IR_MUL:         return "mul";
+    case IR_DIV:         return "div";
+    case IR_MOD:         return "mod";
+    case IR_MUL_HI:      return "mulhi";
+    case IR_NEG:         return "neg";
+    case IR_BIT_AND:     return "and";
+    case IR_BIT_OR:      return "or";
+    case IR_BIT_XOR:     return "xor";
+    case IR_BIT_NOT:     return "not";
+    case IR_SHL:         return "shl";
+    case IR_SHR:         return "shr";
+    case IR_CMP_EQ:      return "cmp_eq";
+    case IR_CMP_NE:      return "cmp_ne";
+    case IR_CMP_LT:      return "cmp_lt";
+    case IR_CMP_LE:      return "cmp_le";
+    case IR_CMP_GT:      return "cmp_gt";
+    case IR_CMP_GE:      return "cmp_ge";
+    case IR_FADD:        return "fadd";
+    case IR_FSUB:        return "fsub";
+    case IR_FMUL:        return "fmul";
+    case IR_FDIV:        return "fdiv";
+    case IR_FCMP:        return "fcmp";
+    case IR_INT_TO_FLOAT: return "int_to_float";
+    case IR_SELECT:      return "select";
+    case IR_LABEL:       return "label";
+    case IR_JMP:         return "jmp";
+    case IR_JZ:          return "jz";
+    case IR_JNZ:         return "jnz";
+    case IR_BR_CMP:      return "br";
+    case IR_SWITCH:      return "switch";
+    case IR_PRINT_STR:   return "print_str";
+    case IR_PRINT_INT:   return "print_int";
+    case IR_PRINT_BOOL:  return "print_bool";
+    case IR_PRINT_STR_VAL: return "print_str_val";
+    case IR_PRINT_FLOAT: return "print_float";
+    case IR_FUNC:        return "func";
+    case IR_PARAM:       return "param";
+    case IR_ARG:         return "arg";
+    case IR_CALL:        return "call";
+    case IR_RET:         return "ret";
+    case IR_EXIT:        return "exit";
+    }
+    return "?";
+}
+
+int ir_is_cond_branch(IROpcode op) {
+    return op == IR_JZ || op == IR_JNZ || op == IR_BR_CMP;
+}
+
+IROpcode ir_cmp_negate(IROpcode cmp) {
+    switch (cmp) {
+    case IR_CMP_EQ: return IR_CMP_NE;
+    case IR_CMP_NE: return IR_CMP_EQ;
+    case IR_CMP_LT: return IR_CMP_GE;
+    case IR_CMP_LE: return IR_CMP_GT;
+    case IR_CMP_GT: return IR_CMP_LE;
+    case IR_CMP_GE: return IR_CMP_LT;
+    default:        return cmp;
+    }
+}
+
+IROpcode ir_cmp_swap(IROpcode cmp) {
+    switch (cmp) {
+    case IR_CMP_LT: return IR_CMP_GT;
+    case IR_CMP_LE: return IR_CMP_GE;
+    case IR_CMP_GT: return IR_CMP_LT;
+    case IR_CMP_GE: return IR_CMP_LE;
+    default:        return cmp;     /* EQ and NE are symmetric */
+    }
+}
+
+void ir_invert_branch(IRInstr *instr) {
+    if (instr->op == IR_JZ) instr->op = IR_JNZ;
+    else if (instr->op == IR_JNZ) instr->op = IR_JZ;
+    else if (instr->op == IR_BR_CMP) instr->imm = ir_cmp_negate((IROpcode)instr->imm);
+}
+
+void ir_dump_instr(FILE *out, const IRProgram *prog, const IRInstr *instr) {
+    int def = ir_instr_def(instr);
+    if (def >= 0)
+        fprintf(out, "v%d = ", def);
+    fprintf(out, "%s", ir_op_name(instr->op));
+
+    switch (instr->op) {
+    case IR_CONST_INT:
+        fprintf(out, " %lld", (long long)instr->imm);
+        break;
+    case IR_CONST_STR:
+    case IR_PRINT_STR: {
+        /* Quote the string, escaping anything unprintable */
+        const char *data = prog->strings[instr->str_idx].data;
+        fputs(" \"", out);
+        for (int i = 0; i < instr->str_len; i++) {
+            unsigned char c = (unsigned char)data[i];
+            if (c == '\n') fputs("\\n", out);
+            else if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+            else if (c < 0x20 || c >= 0x7F) fprintf(out, "\\x%02x", c);
+            else fputc(c, out);
+        }
+        fputc('"', out);
+        break;
+    }
+    case IR_LOAD_LOCAL:
+        fprintf(out, " s%d", instr->slot);
+        break;
+    case IR_STORE_LOCAL:
+        fprintf(out, " s%d, v%d", instr->slot, instr->src);
+        break;
+    case IR_LOAD_ELEM: case IR_LOAD_ELEM_UNCHECKED:
+        fprintf(out, " t%lld[v%d] (%d elements)", (long long)instr->imm, instr->src,
+                prog->tables[instr->imm].count);
+        break;
+    case IR_CONST_ARR:
+        fprintf(out, " t%lld (%d elements)", (long long)instr->imm,
+                prog->tables[instr->imm].count);
+        break;
+    case IR_STACK_ALLOC:
+        fprintf(out, " %lld", (long long)instr->imm);
+        break;
+    case IR_OBJ_LOAD:
+        fprintf(out, " v%d+%lld", instr->src, (long long)instr->imm);
+        break;
+    case IR_OBJ_STORE:
+        fprintf(out, " v%d+%lld, v%d", instr->lhs, (long long)instr->imm, instr->src);
+        break;
+    case IR_LABEL: case IR_JMP: case IR_FUNC:
+        fprintf(out, " L%d", instr->label_id);
+        if (instr->op == IR_FUNC)
+            fprintf(out, " (%lld params)", (long long)instr->imm);
+        break;
+    case IR_JZ: case IR_JNZ:
+        fprintf(out, " v%d, L%d", instr->src, instr->label_id);
+        break;
+    case IR_BR_CMP:
+        fprintf(out, " %s v%d, v%d, L%d", ir_op_name((IROpcode)instr->imm),
+                instr->lhs, instr->rhs, instr->label_id);
+        break;
+    case IR_FCMP:
+        fprintf(out, " %s v%d, v%d", ir_op_name((IROpcode)instr->imm), instr->lhs, instr->rhs);
+        break;
+    case IR_SWITCH: {
+        const IRSwitch *sw = &prog->switches[instr->imm];
+        fprintf(out, " v%d [", instr->src);
+        for (int k = 0; k < sw->count; k++)
+            fprintf(out, "%s%lld: L%d", k ? ", " : "", (long long)sw->values[k], sw->labels[k]);
+        fprintf(out, "] else L%d", instr->label_id);
+        break;
+    }
+    case IR_PARAM:
+        fprintf(out, " %lld", (long long)instr->imm);
+        break;
+    case IR_ARG:
+        fprintf(out, " %lld, v%d", (long long)instr->imm, instr->src);
+        break;
+    case IR_CALL:
+        fprintf(out, " L%d (%lld args)", instr->label_id, (long long)instr->imm);
+        break;
+    default: {
+        int uses[IR_MAX_USES];
+        int n = ir_instr_uses(instr, uses);
+        for (int u = 0; u < n; u++)
+            fprintf(out, "%s v%d", u ? "," : "", uses[u]);
+        break;
+    }
+    }
+}
+
+void ir_dump(FILE *out, const IRProgram *prog) {
+    for (int i = 0; i < prog->instr_count; i++) {
+        const IRInstr *instr = &prog->instrs[i];
+        if (instr->op == IR_LABEL) {
+            fprintf(out, "L%d:\n", instr->label_id);
+            continue;
+        }
+        if (instr->op == IR_FUNC) {
+            fputc('\n', out);
+            ir_dump_instr(out, prog, instr);
+            fputs(":\n", out);
+            continue;
+        }
+        fputs("    ", out);
+        ir_dump_instr(out, prog, instr);
+        fputc('\n', out);
+    }
+}
+
+/* ================================================================
+ * Float formatting
+ *
+ * Schubfach (Giulietti, "The Schubfach way to render doubles"): the
+ * decimal closest to a double among the shortest that still round to
+ * it is found by scaling the double and the bounds of its rounding
+ * interval by one 126-bit power of ten, 10^-k with k picked so that
+ * the candidates have 16 or 17 digits, then checking whether one
+ * digit fewer, or the neighbouring candidate, stays inside.  The
+ * runtime routines of the backends do the same steps with the table
+ * below copied into the binary, so both print alike.
+ * ================================================================ */
+
+static uint64_t float_pow10_table[2 * (IR_FLOAT_K_MAX - IR_FLOAT_K_MIN + 1)];
+static int float_pow10_ready = 0;
+
+/* floor(q log10 2), floor(q log10 2 - log10 (4/3)) and floor(e log2 10)
+ * by fixed-point multiplies, exact over the exponents a double has */
+static int flog10_pow2(int q) { return (int)(((int64_t)q * 661971961083LL) >> 41); }
+static int flog10_three_quarters_pow2(int q) {
+    return (int)(((int64_t)q * 661971961083LL - 274743187321LL) >> 41);
+}
+static int flog2_pow10(int e) { return (int)(((int64_t)e * 913124641741LL) >> 38); }
+
+/* g = floor(10^-k 2^-r) + 1 with r = flog2_pow10(-k) - 125, so that
+ * 2^125 <= g < 2^126, worked out exactly on 48 limbs of 32 bits: 10^-k
+ * shifted for k <= 0, 2^-r divided by 10 -k times otherwise */
+static void float_pow10_init(void) {
+    enum { LIMBS = 48 };
+    for (int k = IR_FLOAT_K_MIN; k <= IR_FLOAT_K_MAX; k++) {
+        uint32_t n[LIMBS];
+        memset(n, 0, sizeof(n));
+        int shift = 125 - flog2_pow10(-k);
+        if (k <= 0) {
+            n[0] = 1;
+            for (int i = 0; i < -k; i++) {
+                uint64_t carry = 0;
+                for (int l = 0; l < LIMBS; l++) {
+                    uint64_t x = (uint64_t)n[l] * 10 + carry;
+                    n[l] = (uint32_t)x;
+                    carry = x >> 32;
+                }
+            }
+            uint32_t m[LIMBS];
+            memset(m, 0, sizeof(m));
+            for (int bit = 0; bit < LIMBS * 32; bit++) {
+                int to = bit + shift;
+                if ((n[bit / 32] >> (bit % 32)) & 1 && to >= 0 && to < LIMBS * 32)
+                    m[to / 32] |= 1u << (to % 32);
+            }
+            memcpy(n, m, sizeof(n));
+        } else {
+            n[shift / 32] = 1u << (shift % 32);
+            for (int i = 0; i < k; i++) {
+                uint64_t rem = 0;
+                for (int l = LIMBS - 1; l >= 0; l--) {
+                    uint64_t x = (rem << 32) | n[l];
+                    n[l] = (uint32_t)(x / 10);
+                    rem = x % 10;
+                }
+            }
+        }
+        for (int l = 0; l < LIMBS && ++n[l] == 0; l++) {}
+        uint64_t lo = n[0] | (uint64_t)n[1] << 32, hi = n[2] | (uint64_t)n[3] << 32;
+        float_pow10_table[2 * (k - IR_FLOAT_K_MIN)] = hi << 1 | lo >> 63;
+        float_pow10_table[2 * (k - IR_FLOAT_K_MIN) + 1] = lo & INT64_MAX;
+    }
+    float_pow10_ready = 1;
+}
+
+void ir_float_pow10(int k, uint64_t *hi, uint64_t *lo) {
+    if (!float_pow10_ready) float_pow10_init();
+    *hi = float_pow10_table[2 * (k - IR_FLOAT_K_MIN)];
+    *lo = float_pow10_table[2 * (k - IR_FLOAT_K_MIN) + 1];
+}
+
+static uint64_t mul_hi64(uint64_t a, uint64_t b) {
+    return (uint64_t)(((unsigned __int128)a * b) >> 64);
+}
+
+/* The high 64 bits of g * cp, with bit 0 set when the bits below them
+ * are not all zero (the product rounded to odd) */
+static uint64_t round_to_odd(uint64_t g1, uint64_t g0, uint64_t cp) {
+    uint64_t x1 = mul_hi64(g0, cp);
+    uint64_t y0 = g1 * cp, y1 = mul_hi64(g1, cp);
+    uint64_t z = (y0 >> 1) + x1;
+    return (y1 + (z >> 63)) | (((z & INT64_MAX) + INT64_MAX) >> 63);
+}
+
+/* The shortest decimal f * 10^e of the positive finite double with
+ * bits (f may end in zeros) */
+static void float_shortest(uint64_t bits, uint64_t *f, int *e) {
+    uint64_t t = bits & ((1ULL << 52) - 1);
+    int bq = (int)(bits >> 52), q;
+    uint64_t c;
+    if (bq != 0) {
+        /* An integer below 2^53 is its own shortest decimal */
+        int mq = 1075 - bq;
+        c = 1ULL << 52 | t;
+        if (mq > 0 && mq < 53 && (c >> mq) << mq == c) {
+            *f = c >> mq;
+            *e = 0;
+            return;
+        }
+        q = -mq;
+    } else {
+        q = -1074;      /* subnormal */
+        c = t;
+    }
+    /* Candidates and interval bounds at 4 times scale: the interval
+     * below a power of two is half as wide */
+    uint64_t odd = c & 1, cb = c << 2, cbr = cb + 2, cbl;
+    int k;
+    if (c != 1ULL << 52 || q == -1074) {
+        cbl = cb - 2;
+        k = flog10_pow2(q);
+    } else {
+        cbl = cb - 1;
+        k = flog10_three_quarters_pow2(q);
+    }
+    int h = q + flog2_pow10(-k) + 2;
+    uint64_t g1, g0;
+    ir_float_pow10(k, &g1, &g0);
+    uint64_t vb = round_to_odd(g1, g0, cb << h);
+    uint64_t vbl = round_to_odd(g1, g0, cbl << h);
+    uint64_t vbr = round_to_odd(g1, g0, cbr << h);
+    uint64_t s = vb >> 2;
+    *e = k;
+    if (s >= 10) {
+        /* One digit fewer: the multiples of ten around s */
+        uint64_t sp10 = s / 10 * 10, tp10 = sp10 + 10;
+        int upin = vbl + odd <= sp10 << 2, wpin = (tp10 << 2) + odd <= vbr;
+        if (upin != wpin) {
+            *f = upin ? sp10 : tp10;
+            return;
+        }
+    }
+    /* s or s + 1, whichever is inside, the closer if both are (ties to
+     * even) */
+    uint64_t u = s + 1;
+    int uin = vbl + odd <= s << 2, win = (u << 2) + odd <= vbr;
+    if (uin != win) {
+        *f = uin ? s : u;
+        return;
+    }
+    int64_t cmp = (int64_t)(vb - ((s + u) << 1));
+    *f = cmp < 0 || (cmp == 0 && !(s & 1)) ? s : u;
+}
+
+int ir_format_float(double v, char *out) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    int n = 0;
+    if ((bits & INT64_MAX) > 0x7FF0000000000000ULL) {
+        memcpy(out, "nan", 3);
+        return 3;
+    }
+    if (bits >> 63) out[n++] = '-';
+    bits &= INT64_MAX;
+    if (bits == 0x7FF0000000000000ULL) {
+        memcpy(out + n, "inf", 3);
+        return n + 3;
+    }
+    if (bits == 0) {
+        out[n++] = '0';
+        return n;
+    }
+
+    uint64_t f;
+    int e;
+    float_shortest(bits, &f, &e);
+    while (f % 10 == 0) {
+        f /= 10;
+        e++;
+    }
+    char digits[20];
+    int len = 0;
+    for (uint64_t x = f; x; x /= 10) len++;
+    for (int i = len - 1; i >= 0; i--, f /= 10) digits[i] = (char)('0' + f % 10);
+    int exp10 = e + len - 1;    /* of the first digit */
+
+    if (exp10 >= -4 && exp10 < 16) {
+        if (exp10 < 0) {
+            out[n++] = '0';
+            out[n++] = '.';
+            for (int i = exp10 + 1; i < 0; i++) out[n++] = '0';
+            memcpy(out + n, digits, len);
+            n += len;
+        } else if (len <= exp10 + 1) {
+            memcpy(out + n, digits, len);
+            n += len;
+            for (int i = len; i <= exp10; i++) out[n++] = '0';
+        } else {
+            memcpy(out + n, digits, exp10 + 1);
+            n += exp10 + 1;
+            out[n++] = '.';
+            memcpy(out + n, digits + exp10 + 1, len - exp10 - 1);
+            n += len - exp10 - 1;
+        }
+        return n;
+    }
+    out[n++] = digits[0];
+    if (len > 1) {
+        out[n++] = '.';
+        memcpy(out + n, digits + 1, len - 1);
+        n += len - 1;
+    }
+    out[n++] = 'e';
+    out[n++] = exp10 < 0 ? '-' : '+';
+    if (exp10 < 0) exp10 = -exp10;
+    if (exp10 >= 100) out[n++] = (char)('0' + exp10 / 100);
+    out[n++] = (char)('0' + exp10 / 10 % 10);
+    out[n++] = (char)('0' + exp10 % 10);
+    return n;
+}
+
 int ir_emit_const_int(IRProgram *prog, int64_t value) {
     int dst = ir_alloc_vreg(prog);
     IRInstr instr;
@@ -94,6 +672,23 @@ int ir_emit_binop(IRProgram *prog, IROpcode op, int lhs, int rhs) {
     return dst;
 }
 
+int ir_emit_unop(IRProgram *prog, IROpcode op, int src) {
+    int dst = ir_alloc_vreg(prog);
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = op;
+    instr.dst = dst;
+    instr.src = src;
+    ir_emit(prog, instr);
+    return dst;
+}
+
+int ir_emit_fcmp(IRProgram *prog, IROpcode cmp, int lhs, int rhs) {
+    int dst = ir_emit_binop(prog, IR_FCMP, lhs, rhs);
+    prog->instrs[prog->instr_count - 1].imm = cmp;
+    return dst;
+}
+
 int ir_emit_load(IRProgram *prog, int slot) {
     int dst = ir_alloc_vreg(prog);
     IRInstr instr;
@@ -105,6 +700,38 @@ int ir_emit_load(IRProgram *prog, int slot) {
     return dst;
 }
 
+int ir_emit_load_elem(IRProgram *prog, int table, int index) {
+    int dst = ir_alloc_vreg(prog);
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_LOAD_ELEM;
+    instr.dst = dst;
+    instr.src = index;
+    instr.imm = table;
+    ir_emit(prog, instr);
+    return dst;
+}
+
+int ir_emit_alloc(IRProgram *prog, int size) {
+    int dst = ir_alloc_vreg(prog);
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_ALLOC;
+    instr.dst = dst;
+    instr.src = size;
+    ir_emit(prog, instr);
+    return dst;
+}
+
+void ir_emit_free(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_FREE;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
+
 void ir_emit_store(IRProgram *prog, int slot, int src) {
     IRInstr instr;
     memset(&instr, 0, sizeof(instr));
@@ -125,6 +752,25 @@ void ir_emit_print_int(IRProgram *prog, int src) {
 }
 
 void ir_emit_print_str(IRProgram *prog, const char *data, int len) {
+    if (prog->instr_count > 0 && prog->instrs[prog->instr_count - 1].op == IR_PRINT_STR) {
+        /* Each print has a string of its own, so the previous one can
+         * grow in place; it is copied the first time */
+        IRInstr *prev = &prog->instrs[prog->instr_count - 1];
+        IRString *s = &prog->strings[prev->str_idx];
+        if (s->len + len > s->cap) {
+            int cap = s->cap > 0 ? s->cap : 64;
+            while (cap < s->len + len) cap *= 2;
+            char *grown = malloc(cap);
+            memcpy(grown, s->data, s->len);
+            if (s->cap > 0) free((char *)s->data);
+            s->data = grown;
+            s->cap = cap;
+        }
+        memcpy((char *)s->data + s->len, data, len);
+        s->len += len;
+        prev->str_len = s->len;
+        return;
+    }
     int idx = ir_add_string(prog, data, len);
     IRInstr instr;
     memset(&instr, 0, sizeof(instr));
@@ -144,6 +790,165 @@ void ir_emit_print_bool(IRProgram *prog, int src) {
     ir_emit(prog, instr);
 }
 
+void ir_emit_print_str_val(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_PRINT_STR_VAL;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
+
+void ir_emit_print_float(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_PRINT_FLOAT;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
+
+void ir_emit_str_release(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_STR_RELEASE;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
+
+int ir_emit_const_arr(IRProgram *prog, int table) {
+    int dst = ir_alloc_vreg(prog);
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_CONST_ARR;
+    instr.dst = dst;
+    instr.imm = table;
+    ir_emit(prog, instr);
+    return dst;
+}
+
+void ir_emit_arr_store(IRProgram *prog, int arr, int index, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_ARR_STORE;
+    instr.dst = -1;
+    instr.src = src;
+    instr.lhs = arr;
+    instr.rhs = index;
+    ir_emit(prog, instr);
+}
+
+void ir_emit_arr_release(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_ARR_RELEASE;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
+
+int ir_emit_map_new(IRProgram *prog) {
+    int dst = ir_alloc_vreg(prog);
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_MAP_NEW;
+    instr.dst = dst;
+    ir_emit(prog, instr);
+    return dst;
+}
+
+void ir_emit_map_set(IRProgram *prog, int map, int key, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_MAP_SET;
+    instr.dst = -1;
+    instr.src = src;
+    instr.lhs = map;
+    instr.rhs = key;
+    ir_emit(prog, instr);
+}
+
+void ir_emit_map_remove(IRProgram *prog, int map, int key) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_MAP_REMOVE;
+    instr.dst = -1;
+    instr.lhs = map;
+    instr.rhs = key;
+    ir_emit(prog, instr);
+}
+
+void ir_emit_map_retain(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_MAP_RETAIN;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
+
+void ir_emit_map_release(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_MAP_RELEASE;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
+
+int ir_emit_stack_alloc(IRProgram *prog, int size) {
+    int dst = ir_alloc_vreg(prog);
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_STACK_ALLOC;
+    instr.dst = dst;
+    instr.imm = size;
+    ir_emit(prog, instr);
+    return dst;
+}
+
+int ir_emit_obj_load(IRProgram *prog, int obj, int offset) {
+    int dst = ir_alloc_vreg(prog);
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_OBJ_LOAD;
+    instr.dst = dst;
+    instr.src = obj;
+    instr.imm = offset;
+    ir_emit(prog, instr);
+    return dst;
+}
+
+void ir_emit_obj_store(IRProgram *prog, int obj, int offset, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_OBJ_STORE;
+    instr.dst = -1;
+    instr.src = src;
+    instr.lhs = obj;
+    instr.imm = offset;
+    ir_emit(prog, instr);
+}
+
+void ir_emit_obj_retain(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_OBJ_RETAIN;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
+
+void ir_emit_obj_release(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_OBJ_RELEASE;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
+
 void ir_emit_label(IRProgram *prog, int label_id) {
     IRInstr instr;
     memset(&instr, 0, sizeof(instr));
@@ -182,6 +987,51 @@ void ir_emit_jnz(IRProgram *prog, int src, int label_id) {
     ir_emit(prog, instr);
 }
 
+void ir_emit_br_cmp(IRProgram *prog, IROpcode cmp, int lhs, int rhs, int label_id) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_BR_CMP;
+    instr.dst = -1;
+    instr.lhs = lhs;
+    instr.rhs = rhs;
+    instr.imm = cmp;
+    instr.label_id = label_id;
+    ir_emit(prog, instr);
+}
+
+void ir_emit_switch(IRProgram *prog, int src, const int64_t *values, const int *labels,
+                    int count, int default_label) {
+    if (prog->switch_count == prog->switch_cap) {
+        prog->switch_cap = prog->switch_cap ? prog->switch_cap * 2 : 4;
+        prog->switches = realloc(prog->switches, prog->switch_cap * sizeof(IRSwitch));
+    }
+    IRSwitch *sw = &prog->switches[prog->switch_count];
+    sw->count = count;
+    sw->values = malloc((count > 0 ? count : 1) * sizeof(int64_t));
+    sw->labels = malloc((count > 0 ? count : 1) * sizeof(int));
+
+    /* Insertion sort by value: tables are built once and are small */
+    for (int k = 0; k < count; k++) {
+        int j = k;
+        while (j > 0 && sw->values[j - 1] > values[k]) {
+            sw->values[j] = sw->values[j - 1];
+            sw->labels[j] = sw->labels[j - 1];
+            j--;
+        }
+        sw->values[j] = values[k];
+        sw->labels[j] = labels[k];
+    }
+
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_SWITCH;
+    instr.dst = -1;
+    instr.src = src;
+    instr.imm = prog->switch_count++;
+    instr.label_id = default_label;
+    ir_emit(prog, instr);
+}
+
 void ir_emit_exit(IRProgram *prog) {
     IRInstr instr;
     memset(&instr, 0, sizeof(instr));
@@ -189,3 +1039,55 @@ void ir_emit_exit(IRProgram *prog) {
     instr.dst = -1;
     ir_emit(prog, instr);
 }
+
+void ir_emit_func(IRProgram *prog, int label_id, int param_count) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_FUNC;
+    instr.dst = -1;
+    instr.label_id = label_id;
+    instr.imm = param_count;
+    ir_emit(prog, instr);
+}
+
+int ir_emit_param(IRProgram *prog, int index) {
+    int dst = ir_alloc_vreg(prog);
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_PARAM;
+    instr.dst = dst;
+    instr.imm = index;
+    ir_emit(prog, instr);
+    return dst;
+}
+
+void ir_emit_arg(IRProgram *prog, int index, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_ARG;
+    instr.dst = -1;
+    instr.src = src;
+    instr.imm = index;
+    ir_emit(prog, instr);
+}
+
+int ir_emit_call(IRProgram *prog, int label_id, int arg_count, int has_result) {
+    int dst = has_result ? ir_alloc_vreg(prog) : -1;
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_CALL;
+    instr.dst = dst;
+    instr.label_id = label_id;
+    instr.imm = arg_count;
+    ir_emit(prog, instr);
+    return dst;
+}
+
+void ir_emit_ret(IRProgram *prog, int src) {
+    IRInstr instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = IR_RET;
+    instr.dst = -1;
+    instr.src = src;
+    ir_emit(prog, instr);
+}
@@ -2,29 +2,142 @@
 #define IR_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 /* ================================================================
  * IR Instruction Set
  *
  * Virtual-register based IR. Each instruction uses unlimited vregs
- * (SSA-lite). Backends map vregs to stack slots.
+ * (SSA-lite). Backends give vregs and slots machine registers with
+ * ir_regalloc (see ir_regalloc.h) and spill the rest to the stack.
+ *
+ * A runtime string is the address of a 16-byte aligned header: its
+ * length and its capacity (0 for constants in the data section), each
+ * 8 bytes, followed by the bytes themselves.
+ *
+ * A runtime array is the address of its first element, 64-byte aligned,
+ * each element 8 bytes.  The 24 bytes before it hold the heap block to
+ * free, the capacity in elements (0 for constants in the data section)
+ * and the length, in that order.
+ *
+ * A runtime map (of int or bool keys and values) is the address of a
+ * 64-byte header: the entry count, a reference count, the group mask,
+ * the group table, the entry array and its capacity, and the number of
+ * insertions left before the group table must grow.  Each group is 16
+ * control bytes (0x80 empty, 0xFE deleted, otherwise 7 bits of the key's
+ * hash) followed by 16 int32 indices into the entry array, which holds
+ * (key, value) pairs in insertion order.
+ *
+ * A runtime object (of a class whose fields are int, bool or float) is the
+ * address of an 8-byte reference count followed by 8 bytes per field,
+ * in declaration order with the parent's fields first, so an object of
+ * a subclass can be read as one of its parent.  Objects that live in a
+ * stack frame start with a count that never reaches zero.
+ *
+ * A float is a 64-bit IEEE double, held in a vreg, a slot or a field
+ * as its bit pattern like any other value; only the IR_F* opcodes and
+ * the conversions read it as a number.
  * ================================================================ */
 
 typedef enum {
     /* Constants */
     IR_CONST_INT,       /* dst = imm64 */
-    IR_CONST_STR,       /* dst = string_table[str_idx] (len = str_len) */
+    IR_CONST_STR,       /* dst = string_table[str_idx] as a string value
+                         * (len = str_len) */
 
     /* Local variable access */
     IR_LOAD_LOCAL,      /* dst = stack[slot] */
     IR_STORE_LOCAL,     /* stack[slot] = src */
 
+    /* Constant table access */
+    IR_LOAD_ELEM,       /* dst = tables[imm][src]; a negative src counts from
+                         * the end, anything else out of range exits with an
+                         * error */
+    IR_LOAD_ELEM_UNCHECKED, /* dst = tables[imm][src], src known to be in
+                             * [0, count) */
+
+    /* Heap */
+    IR_ALLOC,           /* dst = address of a fresh 16-byte aligned block of
+                         * at least src bytes; exits with an error when the
+                         * system has no memory left */
+    IR_FREE,            /* release the block at src (from IR_ALLOC, or 0) */
+
+    /* Strings (dst = a new string unless stated otherwise) */
+    IR_STR_CONCAT,      /* dst = lhs + rhs */
+    IR_STR_APPEND,      /* dst = lhs + rhs, in the storage of lhs when it has
+                         * room; lhs is not read again */
+    IR_STR_FROM_INT,    /* dst = decimal representation of src */
+    IR_STR_FROM_FLOAT,  /* dst = shortest representation of the double src
+                         * (ir_format_float) */
+    IR_STR_EQ,          /* dst = lhs and rhs hold the same bytes (0 or 1) */
+    IR_STR_CMP,         /* dst = negative, 0 or positive as lhs sorts before,
+                         * with or after rhs */
+    IR_STR_LEN,         /* dst = length of src */
+    IR_STR_RELEASE,     /* free src unless it is a constant; src is not read
+                         * again */
+
+    /* Arrays of int, bool or float, 8-byte elements (dst = a new array
+     * unless stated otherwise) */
+    IR_CONST_ARR,       /* dst = the elements of tables[imm] as an array
+                         * constant */
+    IR_ARR_COPY,        /* dst = the elements of src */
+    IR_ARR_LEN,         /* dst = number of elements of src */
+    IR_ARR_LOAD,        /* dst = lhs[rhs]; a negative rhs counts from the end,
+                         * anything else out of range exits with an error */
+    IR_ARR_STORE,       /* lhs[rhs] = src, rhs checked as for IR_ARR_LOAD;
+                         * lhs must not be a constant */
+    IR_ARR_PUSH,        /* dst = lhs with rhs appended, in the storage of lhs
+                         * when it has room; lhs is not read again */
+    IR_ARR_SUM,         /* dst = sum of the elements of src (wrapping) */
+    IR_ARR_MIN,         /* dst = smallest element of src; exits with an error
+                         * when src is empty */
+    IR_ARR_MAX,         /* dst = largest element of src, likewise */
+    IR_ARR_INDEX_OF,    /* dst = index of the first element of lhs equal to
+                         * rhs, -1 if there is none */
+    IR_ARR_FSUM,        /* dst = sum of the float elements of src: those up
+                         * to a multiple of 16 added into 16 lanes by index
+                         * mod 16, the lanes folded in halves, the rest
+                         * added in order (the evaluator's order too) */
+    IR_ARR_FMIN,        /* dst = the element of src that a scan from the
+                         * first keeping each smaller one ends on; exits with
+                         * an error when src is empty */
+    IR_ARR_FMAX,        /* dst = likewise keeping each larger one */
+    IR_ARR_FINDEX_OF,   /* dst = index of the first element of lhs equal to
+                         * rhs as doubles, -1 if there is none */
+    IR_ARR_RELEASE,     /* free src unless it is a constant; src is not read
+                         * again */
+
+    /* Maps of int or bool keys and values */
+    IR_MAP_NEW,         /* dst = a new empty map */
+    IR_MAP_LEN,         /* dst = number of entries of src */
+    IR_MAP_GET,         /* dst = value of key rhs in lhs; exits with an error
+                         * when there is none */
+    IR_MAP_HAS,         /* dst = lhs has key rhs (0 or 1) */
+    IR_MAP_SET,         /* lhs[rhs] = src, adding the key when it is new */
+    IR_MAP_REMOVE,      /* remove key rhs from lhs, if present; the last
+                         * entry takes its place in the key order */
+    IR_MAP_KEYS,        /* dst = a new array of the keys of src, in order */
+    IR_MAP_RETAIN,      /* add a reference to src */
+    IR_MAP_RELEASE,     /* drop a reference to src, freeing it with the
+                         * last one; src is not read again */
+
+    /* Objects */
+    IR_STACK_ALLOC,     /* dst = address of imm bytes, 8-byte aligned, in
+                         * the frame of the enclosing function; the same
+                         * address each time the instruction runs in a call */
+    IR_OBJ_LOAD,        /* dst = the 8 bytes at src + imm */
+    IR_OBJ_STORE,       /* the 8 bytes at lhs + imm = src */
+    IR_OBJ_RETAIN,      /* add a reference to the object src */
+    IR_OBJ_RELEASE,     /* drop a reference to the object src, freeing it
+                         * with the last one; src is not read again */
+
     /* Arithmetic (dst = lhs OP rhs) */
     IR_ADD,
     IR_SUB,
     IR_MUL,
     IR_DIV,
     IR_MOD,
+    IR_MUL_HI,          /* dst = high 64 bits of the signed 128-bit lhs * rhs */
 
     /* Unary */
     IR_NEG,             /* dst = -src */
@@ -45,16 +158,39 @@ typedef enum {
     IR_CMP_GT,
     IR_CMP_GE,
 
+    /* Floating point: vregs hold the bits of IEEE doubles */
+    IR_FADD,            /* dst = lhs + rhs */
+    IR_FSUB,            /* dst = lhs - rhs */
+    IR_FMUL,            /* dst = lhs * rhs */
+    IR_FDIV,            /* dst = lhs / rhs (inf or nan for a zero rhs) */
+    IR_FCMP,            /* dst = lhs CMP rhs (0 or 1), CMP the IR_CMP_* in
+                         * imm; only IR_CMP_NE holds for a nan */
+    IR_INT_TO_FLOAT,    /* dst = src converted to the nearest double */
+
+    /* Selection */
+    IR_SELECT,          /* dst = src != 0 ? lhs : rhs */
+
     /* Control flow */
     IR_LABEL,           /* label_id: */
     IR_JMP,             /* goto label_id */
     IR_JZ,              /* if src == 0 goto label_id */
     IR_JNZ,             /* if src != 0 goto label_id */
+    IR_BR_CMP,          /* if lhs CMP rhs goto label_id; CMP is the IR_CMP_* in imm */
+    IR_SWITCH,          /* goto the label of src in switches[imm], else label_id */
 
     /* Output */
     IR_PRINT_STR,       /* write(1, string[str_idx], str_len) */
     IR_PRINT_INT,       /* write(1, itoa(src), computed_len) */
     IR_PRINT_BOOL,      /* write(1, src ? "true" : "false", 4 or 5) */
+    IR_PRINT_STR_VAL,   /* write(1, bytes of string src, its length) */
+    IR_PRINT_FLOAT,     /* write(1, ir_format_float(src), its length) */
+
+    /* Functions */
+    IR_FUNC,            /* start of function label_id taking imm params */
+    IR_PARAM,           /* dst = incoming parameter #imm */
+    IR_ARG,             /* outgoing argument #imm = src (precedes IR_CALL) */
+    IR_CALL,            /* dst = call label_id with imm args (dst -1 if void) */
+    IR_RET,             /* return src (src -1 if void) */
 
     /* Terminator */
     IR_EXIT,            /* exit(0) */
@@ -66,9 +202,13 @@ typedef struct {
     int src;            /* source vreg (for unary / store / jumps) */
     int lhs;            /* left operand vreg (for binary ops) */
     int rhs;            /* right operand vreg (for binary ops) */
-    int64_t imm;        /* immediate value (IR_CONST_INT) */
+    int64_t imm;        /* immediate value (CONST_INT), arg/param index or count,
+                         * compare opcode (BR_CMP, FCMP), case table (SWITCH),
+                         * constant table (LOAD_ELEM, CONST_ARR), byte size
+                         * (STACK_ALLOC) or offset (OBJ_LOAD, OBJ_STORE) */
     int slot;           /* local variable slot (LOAD/STORE_LOCAL) */
-    int label_id;       /* label identifier (LABEL/JMP/JZ/JNZ) */
+    int label_id;       /* label identifier (LABEL/JMP/JZ/JNZ/BR_CMP/FUNC/CALL),
+                         * default target (SWITCH) */
     int str_idx;        /* string table index (CONST_STR/PRINT_STR) */
     int str_len;        /* string length (CONST_STR/PRINT_STR) */
 } IRInstr;
@@ -77,8 +217,25 @@ typedef struct {
 typedef struct {
     const char *data;
     int len;
+    int cap;            /* bytes malloc'd for data when the program owns
+                         * it (joined prints), 0 when borrowed */
 } IRString;
 
+/* Case table of an IR_SWITCH: values in ascending order, each with
+ * the label it jumps to */
+typedef struct {
+    int64_t *values;
+    int *labels;
+    int count;
+} IRSwitch;
+
+/* Constant table read by IR_LOAD_ELEM or copied by IR_CONST_ARR: the
+ * elements of a compile-time Array<int> or Array<bool> */
+typedef struct {
+    int64_t *values;
+    int count;
+} IRTable;
+
 typedef struct {
     IRInstr *instrs;
     int instr_count;
@@ -88,6 +245,14 @@ typedef struct {
     int string_count;
     int string_cap;
 
+    IRSwitch *switches;
+    int switch_count;
+    int switch_cap;
+
+    IRTable *tables;
+    int table_count;
+    int table_cap;
+
     int next_vreg;      /* next virtual register number */
     int next_label;     /* next label number */
     int next_slot;      /* next local variable slot */
@@ -111,9 +276,72 @@ int ir_alloc_slot(IRProgram *prog);
 /* Add a string to the string table, returns string index */
 int ir_add_string(IRProgram *prog, const char *data, int len);
 
+/* Add a constant table (copied), returns its index; a table with the
+ * same elements as an earlier one shares its index */
+int ir_add_table(IRProgram *prog, const int64_t *values, int count);
+
 /* Emit an instruction and return its index */
 int ir_emit(IRProgram *prog, IRInstr instr);
 
+/* Operand queries, for passes and backends that walk instructions.
+ * ir_instr_def returns the vreg written by instr (-1 if none);
+ * ir_instr_uses stores the vregs read by instr in uses[] and returns
+ * how many there are (at most IR_MAX_USES); ir_instr_use_refs does the
+ * same with pointers to the operand fields, so passes can rewrite them. */
+#define IR_MAX_USES 3
+int ir_instr_def(const IRInstr *instr);
+int ir_instr_uses(const IRInstr *instr, int uses[IR_MAX_USES]);
+int ir_instr_use_refs(IRInstr *instr, int *refs[IR_MAX_USES]);
+
+/* Printable name of an opcode ("add", "jz", ...) */
+const char *ir_op_name(IROpcode op);
+
+/* 1 if op is a two-way branch (JZ, JNZ, BR_CMP): it goes to label_id
+ * or falls through */
+int ir_is_cond_branch(IROpcode op);
+
+/* For a comparison opcode (IR_CMP_*): the comparison that is true
+ * exactly when cmp is false, and the one that gives the same result
+ * with its operands swapped */
+IROpcode ir_cmp_negate(IROpcode cmp);
+IROpcode ir_cmp_swap(IROpcode cmp);
+
+/* Invert a conditional branch in place, so that it is taken exactly
+ * when it used to fall through (label_id is left for the caller) */
+void ir_invert_branch(IRInstr *instr);
+
+/* Write one instruction in textual form (no trailing newline) */
+void ir_dump_instr(FILE *out, const IRProgram *prog, const IRInstr *instr);
+
+/* Write the whole program, one instruction per line */
+void ir_dump(FILE *out, const IRProgram *prog);
+
+/* ================================================================
+ * Float formatting
+ *
+ * The one textual form of a float, shared by compile-time evaluation
+ * and the runtime routines of the backends: the shortest digits that
+ * read back as the same double (Schubfach), in fixed notation when the
+ * decimal exponent E of the first digit is in [-4, 16) ("120", "0.001",
+ * "3.25") and as d.ddde+XX otherwise ("1e+16", "2.5e-07"); "-0", "nan",
+ * "inf" and "-inf" for the special values.
+ * ================================================================ */
+
+/* Longest text ir_format_float writes */
+#define IR_FLOAT_TEXT_MAX 24
+
+/* Decimal exponents of the power-of-ten table */
+#define IR_FLOAT_K_MIN (-324)
+#define IR_FLOAT_K_MAX 292
+
+/* Write the text of v to out (no terminator), return its length */
+int ir_format_float(double v, char *out);
+
+/* The 126-bit approximation of 10^-k the digit search multiplies by,
+ * as its high 63 bits and low 63 bits, for k in [IR_FLOAT_K_MIN,
+ * IR_FLOAT_K_MAX] */
+void ir_float_pow10(int k, uint64_t *hi, uint64_t *lo);
+
 /* Convenience: emit IR_CONST_INT */
 int ir_emit_const_int(IRProgram *prog, int64_t value);
 
@@ -123,6 +351,26 @@ int ir_emit_const_str(IRProgram *prog, const char *data, int len);
 /* Convenience: emit binary op (ADD, SUB, MUL, DIV, MOD, etc.) */
 int ir_emit_binop(IRProgram *prog, IROpcode op, int lhs, int rhs);
 
+/* Convenience: emit IR_FCMP (lhs cmp rhs as doubles, cmp an IR_CMP_*),
+ * returns its vreg */
+int ir_emit_fcmp(IRProgram *prog, IROpcode cmp, int lhs, int rhs);
+
+/* Convenience: emit an op of one operand with a result (NEG, BIT_NOT,
+ * INT_TO_FLOAT, STR_FROM_INT, STR_FROM_FLOAT, STR_LEN, ARR_COPY, ARR_LEN,
+ * ARR_SUM, ARR_MIN, ARR_MAX, ARR_FSUM, ARR_FMIN, ARR_FMAX, MAP_LEN,
+ * MAP_KEYS) */
+int ir_emit_unop(IRProgram *prog, IROpcode op, int src);
+
+/* Convenience: emit IR_LOAD_ELEM (bounds-checked), returns its vreg */
+int ir_emit_load_elem(IRProgram *prog, int table, int index);
+
+/* Convenience: emit IR_ALLOC of size bytes, returns the vreg holding
+ * the address */
+int ir_emit_alloc(IRProgram *prog, int size);
+
+/* Convenience: emit IR_FREE */
+void ir_emit_free(IRProgram *prog, int src);
+
 /* Convenience: emit IR_LOAD_LOCAL */
 int ir_emit_load(IRProgram *prog, int slot);
 
@@ -132,12 +380,63 @@ void ir_emit_store(IRProgram *prog, int slot, int src);
 /* Convenience: emit IR_PRINT_INT */
 void ir_emit_print_int(IRProgram *prog, int src);
 
-/* Convenience: emit IR_PRINT_STR */
+/* Convenience: emit IR_PRINT_STR; joins the IR_PRINT_STR right before
+ * it, if any, so runs of constant output are written at once */
 void ir_emit_print_str(IRProgram *prog, const char *data, int len);
 
 /* Convenience: emit IR_PRINT_BOOL */
 void ir_emit_print_bool(IRProgram *prog, int src);
 
+/* Convenience: emit IR_PRINT_FLOAT */
+void ir_emit_print_float(IRProgram *prog, int src);
+
+/* Convenience: emit IR_PRINT_STR_VAL */
+void ir_emit_print_str_val(IRProgram *prog, int src);
+
+/* Convenience: emit IR_STR_RELEASE */
+void ir_emit_str_release(IRProgram *prog, int src);
+
+/* Convenience: emit IR_CONST_ARR of constant table table, returns its
+ * vreg */
+int ir_emit_const_arr(IRProgram *prog, int table);
+
+/* Convenience: emit IR_ARR_STORE (arr[index] = src) */
+void ir_emit_arr_store(IRProgram *prog, int arr, int index, int src);
+
+/* Convenience: emit IR_ARR_RELEASE */
+void ir_emit_arr_release(IRProgram *prog, int src);
+
+/* Convenience: emit IR_MAP_NEW, returns its vreg */
+int ir_emit_map_new(IRProgram *prog);
+
+/* Convenience: emit IR_MAP_SET (map[key] = src) */
+void ir_emit_map_set(IRProgram *prog, int map, int key, int src);
+
+/* Convenience: emit IR_MAP_REMOVE */
+void ir_emit_map_remove(IRProgram *prog, int map, int key);
+
+/* Convenience: emit IR_MAP_RETAIN */
+void ir_emit_map_retain(IRProgram *prog, int src);
+
+/* Convenience: emit IR_MAP_RELEASE */
+void ir_emit_map_release(IRProgram *prog, int src);
+
+/* Convenience: emit IR_STACK_ALLOC of size bytes, returns its vreg */
+int ir_emit_stack_alloc(IRProgram *prog, int size);
+
+/* Convenience: emit IR_OBJ_LOAD of the field at offset in obj, returns
+ * its vreg */
+int ir_emit_obj_load(IRProgram *prog, int obj, int offset);
+
+/* Convenience: emit IR_OBJ_STORE (the field at offset in obj = src) */
+void ir_emit_obj_store(IRProgram *prog, int obj, int offset, int src);
+
+/* Convenience: emit IR_OBJ_RETAIN */
+void ir_emit_obj_retain(IRProgram *prog, int src);
+
+/* Convenience: emit IR_OBJ_RELEASE */
+void ir_emit_obj_release(IRProgram *prog, int src);
+
 /* Convenience: emit IR_LABEL */
 void ir_emit_label(IRProgram *prog, int label_id);
 
@@ -150,7 +449,30 @@ void ir_emit_jz(IRProgram *prog, int src, int label_id);
 /* Convenience: emit IR_JNZ */
 void ir_emit_jnz(IRProgram *prog, int src, int label_id);
 
+/* Convenience: emit IR_BR_CMP (goto label_id if lhs cmp rhs) */
+void ir_emit_br_cmp(IRProgram *prog, IROpcode cmp, int lhs, int rhs, int label_id);
+
+/* Convenience: emit IR_SWITCH on src over count distinct case values
+ * (in any order) and their labels, going to default_label otherwise */
+void ir_emit_switch(IRProgram *prog, int src, const int64_t *values, const int *labels,
+                    int count, int default_label);
+
 /* Convenience: emit IR_EXIT */
 void ir_emit_exit(IRProgram *prog);
 
+/* Convenience: emit IR_FUNC (entry point of an out-of-line function) */
+void ir_emit_func(IRProgram *prog, int label_id, int param_count);
+
+/* Convenience: emit IR_PARAM, returns vreg holding parameter #index */
+int ir_emit_param(IRProgram *prog, int index);
+
+/* Convenience: emit IR_ARG */
+void ir_emit_arg(IRProgram *prog, int index, int src);
+
+/* Convenience: emit IR_CALL, returns result vreg (or -1 when !has_result) */
+int ir_emit_call(IRProgram *prog, int label_id, int arg_count, int has_result);
+
+/* Convenience: emit IR_RET (src -1 for a void return) */
+void ir_emit_ret(IRProgram *prog, int src);
+
 #endif
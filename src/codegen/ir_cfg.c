@@ -0,0 +1,772 @@
+#include "codegen/ir_cfg.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ================================================================
+ * Block helpers
+ * ================================================================ */
+
+int ir_is_terminator(IROpcode op) {
+    return op == IR_JMP || ir_is_cond_branch(op) ||
+           op == IR_SWITCH || op == IR_RET || op == IR_EXIT;
+}
+
+void ir_block_append(IRBlock *b, IRInstr instr) {
+    ir_block_insert(b, b->instr_count, instr);
+}
+
+void ir_block_insert(IRBlock *b, int pos, IRInstr instr) {
+    if (b->instr_count == b->instr_cap) {
+        b->instr_cap = b->instr_cap ? b->instr_cap * 2 : 8;
+        b->instrs = realloc(b->instrs, b->instr_cap * sizeof(IRInstr));
+    }
+    memmove(&b->instrs[pos + 1], &b->instrs[pos], (b->instr_count - pos) * sizeof(IRInstr));
+    b->instrs[pos] = instr;
+    b->instr_count++;
+}
+
+void ir_block_remove(IRBlock *b, int pos) {
+    memmove(&b->instrs[pos], &b->instrs[pos + 1], (b->instr_count - pos - 1) * sizeof(IRInstr));
+    b->instr_count--;
+}
+
+static IRInstr *block_terminator(const IRBlock *b) {
+    if (b->instr_count == 0) return NULL;
+    IRInstr *last = &b->instrs[b->instr_count - 1];
+    return ir_is_terminator(last->op) ? last : NULL;
+}
+
+static int cfg_new_block(IRCfg *cfg) {
+    if (cfg->block_count == cfg->block_cap) {
+        cfg->block_cap = cfg->block_cap ? cfg->block_cap * 2 : 16;
+        cfg->blocks = realloc(cfg->blocks, cfg->block_cap * sizeof(IRBlock));
+    }
+    int id = cfg->block_count++;
+    IRBlock *b = &cfg->blocks[id];
+    memset(b, 0, sizeof(*b));
+    b->label = -1;
+    b->idom = -1;
+    b->rpo_index = -1;
+    return id;
+}
+
+int ir_cfg_insert_blocks(IRCfg *cfg, int pos, int count) {
+    int n = cfg->block_count;
+    for (int k = 0; k < count; k++) cfg_new_block(cfg);
+    memmove(&cfg->blocks[pos + count], &cfg->blocks[pos], (n - pos) * sizeof(IRBlock));
+    for (int k = 0; k < count; k++) {
+        IRBlock *b = &cfg->blocks[pos + k];
+        memset(b, 0, sizeof(*b));
+        b->label = -1;
+        b->idom = -1;
+        b->rpo_index = -1;
+    }
+    for (int b = 0; b < n + count; b++) {
+        if (b == pos) b += count;
+        if (b >= n + count) break;
+        IRBlock *blk = &cfg->blocks[b];
+        for (int s = 0; s < blk->succ_count; s++)
+            if (blk->succs[s] >= pos) blk->succs[s] += count;
+        for (int p = 0; p < blk->pred_count; p++)
+            if (blk->preds[p] >= pos) blk->preds[p] += count;
+        if (blk->idom >= pos) blk->idom += count;
+    }
+    return pos;
+}
+
+void ir_block_add_pred(IRBlock *b, int pred) {
+    if (b->pred_count == b->pred_cap) {
+        b->pred_cap = b->pred_cap ? b->pred_cap * 2 : 4;
+        b->preds = realloc(b->preds, b->pred_cap * sizeof(int));
+    }
+    b->preds[b->pred_count++] = pred;
+}
+
+void ir_block_add_succ(IRBlock *b, int succ) {
+    if (b->succ_count == b->succ_cap) {
+        b->succ_cap = b->succ_cap ? b->succ_cap * 2 : 2;
+        b->succs = realloc(b->succs, b->succ_cap * sizeof(int));
+    }
+    b->succs[b->succ_count++] = succ;
+}
+
+void ir_cfg_remove_edge(IRCfg *cfg, int from, int succ_index) {
+    IRBlock *src = &cfg->blocks[from];
+    IRBlock *dst = &cfg->blocks[src->succs[succ_index]];
+    for (int s = succ_index; s + 1 < src->succ_count; s++)
+        src->succs[s] = src->succs[s + 1];
+    src->succ_count--;
+
+    /* Duplicate edges carry identical phi arguments, so drop the last */
+    for (int p = dst->pred_count - 1; p >= 0; p--) {
+        if (dst->preds[p] != from) continue;
+        for (int k = p; k + 1 < dst->pred_count; k++) {
+            dst->preds[k] = dst->preds[k + 1];
+            for (int ph = 0; ph < dst->phi_count; ph++)
+                dst->phis[ph].args[k] = dst->phis[ph].args[k + 1];
+        }
+        dst->pred_count--;
+        break;
+    }
+}
+
+static void block_free(IRBlock *b) {
+    for (int i = 0; i < b->phi_count; i++)
+        free(b->phis[i].args);
+    free(b->phis);
+    free(b->instrs);
+    free(b->succs);
+    free(b->preds);
+}
+
+/* ================================================================
+ * Construction
+ * ================================================================ */
+
+int ir_program_functions(const IRProgram *prog, int **starts) {
+    int count = 1;
+    for (int i = 0; i < prog->instr_count; i++)
+        if (prog->instrs[i].op == IR_FUNC) count++;
+
+    *starts = malloc(count * sizeof(int));
+    (*starts)[0] = 0;
+    int n = 1;
+    for (int i = 0; i < prog->instr_count; i++)
+        if (prog->instrs[i].op == IR_FUNC) (*starts)[n++] = i;
+    return count;
+}
+
+void ir_cfg_build(IRCfg *cfg, IRProgram *prog, int start, int end) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->prog = prog;
+    cfg->func_label = -1;
+
+    int i = start;
+    if (i < end && prog->instrs[i].op == IR_FUNC) {
+        cfg->func_label = prog->instrs[i].label_id;
+        cfg->param_count = (int)prog->instrs[i].imm;
+        i++;
+    }
+
+    /* Cut into blocks.  The entry block never starts with a label, so
+     * it has no predecessors even when the first statement is a loop. */
+    int cur = cfg_new_block(cfg);
+    for (; i < end; i++) {
+        IRInstr *ir = &prog->instrs[i];
+        if (ir->op == IR_LABEL) {
+            cur = cfg_new_block(cfg);
+            cfg->blocks[cur].label = ir->label_id;
+            continue;
+        }
+        if (cur < 0)
+            cur = cfg_new_block(cfg);
+        ir_block_append(&cfg->blocks[cur], *ir);
+        if (ir_is_terminator(ir->op))
+            cur = -1;
+    }
+
+    /* Map labels to blocks, then wire up the edges */
+    int *label_block = malloc((prog->next_label > 0 ? prog->next_label : 1) * sizeof(int));
+    for (int l = 0; l < prog->next_label; l++) label_block[l] = -1;
+    for (int b = 0; b < cfg->block_count; b++)
+        if (cfg->blocks[b].label >= 0) label_block[cfg->blocks[b].label] = b;
+
+    for (int b = 0; b < cfg->block_count; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        IRInstr *term = block_terminator(blk);
+        int next = b + 1 < cfg->block_count ? b + 1 : -1;
+        if (!term) {
+            if (next >= 0) ir_block_add_succ(blk, next);
+        } else if (term->op == IR_JMP) {
+            ir_block_add_succ(blk, label_block[term->label_id]);
+        } else if (ir_is_cond_branch(term->op)) {
+            ir_block_add_succ(blk, label_block[term->label_id]);
+            if (next >= 0) ir_block_add_succ(blk, next);
+        } else if (term->op == IR_SWITCH) {
+            const IRSwitch *sw = &prog->switches[term->imm];
+            ir_block_add_succ(blk, label_block[term->label_id]);
+            for (int k = 0; k < sw->count; k++) {
+                int t = label_block[sw->labels[k]], dup = 0;
+                for (int s = 0; s < blk->succ_count; s++)
+                    if (blk->succs[s] == t) dup = 1;
+                if (!dup) ir_block_add_succ(blk, t);
+            }
+        }
+        for (int s = 0; s < blk->succ_count; s++)
+            ir_block_add_pred(&cfg->blocks[blk->succs[s]], b);
+    }
+    free(label_block);
+
+    ir_cfg_compute_dominators(cfg);
+}
+
+void ir_cfg_free(IRCfg *cfg) {
+    for (int b = 0; b < cfg->block_count; b++)
+        block_free(&cfg->blocks[b]);
+    free(cfg->blocks);
+    free(cfg->rpo);
+    memset(cfg, 0, sizeof(*cfg));
+}
+
+/* ================================================================
+ * Reachability, reverse postorder and dominators
+ *
+ * Dominators use the iterative algorithm of Cooper, Harvey and
+ * Kennedy ("A Simple, Fast Dominance Algorithm") over reverse
+ * postorder, which converges in a couple of passes on the reducible
+ * graphs the frontend produces.
+ * ================================================================ */
+
+/* Drop blocks not reachable from the entry, renumbering the rest.
+ * Predecessor lists (and phi arguments) of survivors are filtered in
+ * place so their order is preserved. */
+static void cfg_remove_unreachable(IRCfg *cfg) {
+    int n = cfg->block_count;
+    char *seen = calloc(n, 1);
+    int *stack = malloc(n * sizeof(int));
+    int sp = 0;
+    stack[sp++] = 0;
+    seen[0] = 1;
+    while (sp > 0) {
+        IRBlock *b = &cfg->blocks[stack[--sp]];
+        for (int s = 0; s < b->succ_count; s++) {
+            if (!seen[b->succs[s]]) {
+                seen[b->succs[s]] = 1;
+                stack[sp++] = b->succs[s];
+            }
+        }
+    }
+
+    int *remap = malloc(n * sizeof(int));
+    int kept = 0;
+    for (int b = 0; b < n; b++)
+        remap[b] = seen[b] ? kept++ : -1;
+
+    if (kept < n) {
+        for (int b = 0; b < n; b++) {
+            if (!seen[b]) {
+                block_free(&cfg->blocks[b]);
+                continue;
+            }
+            IRBlock blk = cfg->blocks[b];
+            for (int s = 0; s < blk.succ_count; s++)
+                blk.succs[s] = remap[blk.succs[s]];
+            int pc = 0;
+            for (int p = 0; p < blk.pred_count; p++) {
+                if (remap[blk.preds[p]] < 0) continue;
+                for (int ph = 0; ph < blk.phi_count; ph++)
+                    blk.phis[ph].args[pc] = blk.phis[ph].args[p];
+                blk.preds[pc++] = remap[blk.preds[p]];
+            }
+            blk.pred_count = pc;
+            cfg->blocks[remap[b]] = blk;
+        }
+        cfg->block_count = kept;
+    }
+
+    free(remap);
+    free(stack);
+    free(seen);
+}
+
+static void cfg_compute_rpo(IRCfg *cfg) {
+    int n = cfg->block_count;
+    free(cfg->rpo);
+    cfg->rpo = malloc(n * sizeof(int));
+
+    /* Iterative DFS: stack of (block, next successor to visit) */
+    int *stack_b = malloc(n * sizeof(int));
+    int *stack_s = malloc(n * sizeof(int));
+    char *seen = calloc(n, 1);
+    int sp = 0, post = n;
+    stack_b[sp] = 0; stack_s[sp] = 0; sp++;
+    seen[0] = 1;
+    while (sp > 0) {
+        IRBlock *b = &cfg->blocks[stack_b[sp - 1]];
+        if (stack_s[sp - 1] < b->succ_count) {
+            int s = b->succs[stack_s[sp - 1]++];
+            if (!seen[s]) {
+                seen[s] = 1;
+                stack_b[sp] = s; stack_s[sp] = 0; sp++;
+            }
+        } else {
+            cfg->rpo[--post] = stack_b[--sp];
+        }
+    }
+    for (int i = 0; i < n; i++)
+        cfg->blocks[cfg->rpo[i]].rpo_index = i;
+
+    free(seen);
+    free(stack_s);
+    free(stack_b);
+}
+
+static int dom_intersect(const IRCfg *cfg, int a, int b) {
+    while (a != b) {
+        while (cfg->blocks[a].rpo_index > cfg->blocks[b].rpo_index)
+            a = cfg->blocks[a].idom;
+        while (cfg->blocks[b].rpo_index > cfg->blocks[a].rpo_index)
+            b = cfg->blocks[b].idom;
+    }
+    return a;
+}
+
+void ir_cfg_compute_dominators(IRCfg *cfg) {
+    cfg_remove_unreachable(cfg);
+    cfg_compute_rpo(cfg);
+
+    int n = cfg->block_count;
+    for (int b = 0; b < n; b++)
+        cfg->blocks[b].idom = -1;
+    cfg->blocks[0].idom = 0;
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 1; i < n; i++) {
+            int b = cfg->rpo[i];
+            IRBlock *blk = &cfg->blocks[b];
+            int new_idom = -1;
+            for (int p = 0; p < blk->pred_count; p++) {
+                int pred = blk->preds[p];
+                if (cfg->blocks[pred].idom < 0) continue;
+                new_idom = new_idom < 0 ? pred : dom_intersect(cfg, pred, new_idom);
+            }
+            if (new_idom != blk->idom) {
+                blk->idom = new_idom;
+                changed = 1;
+            }
+        }
+    }
+
+    /* idom precedes its children in reverse postorder */
+    cfg->blocks[0].idom = -1;
+    cfg->blocks[0].dom_depth = 0;
+    for (int i = 1; i < n; i++) {
+        IRBlock *blk = &cfg->blocks[cfg->rpo[i]];
+        blk->dom_depth = cfg->blocks[blk->idom].dom_depth + 1;
+    }
+}
+
+int ir_cfg_dominates(const IRCfg *cfg, int a, int b) {
+    while (b >= 0 && cfg->blocks[b].dom_depth > cfg->blocks[a].dom_depth)
+        b = cfg->blocks[b].idom;
+    return a == b;
+}
+
+int ir_cfg_natural_loop(const IRCfg *cfg, int h, char *in_loop) {
+    memset(in_loop, 0, cfg->block_count);
+    in_loop[h] = 1;
+    int *work = malloc(cfg->block_count * sizeof(int));
+    int back = 0;
+    const IRBlock *hb = &cfg->blocks[h];
+    for (int p = 0; p < hb->pred_count; p++) {
+        int latch = hb->preds[p];
+        if (!ir_cfg_dominates(cfg, h, latch)) continue;
+        back++;
+        /* Everything that reaches the latch without passing through h */
+        int wn = 0;
+        if (!in_loop[latch]) {
+            in_loop[latch] = 1;
+            work[wn++] = latch;
+        }
+        while (wn > 0) {
+            const IRBlock *b = &cfg->blocks[work[--wn]];
+            for (int q = 0; q < b->pred_count; q++) {
+                if (in_loop[b->preds[q]]) continue;
+                in_loop[b->preds[q]] = 1;
+                work[wn++] = b->preds[q];
+            }
+        }
+    }
+    free(work);
+    if (back == 0) in_loop[h] = 0;
+    return back;
+}
+
+/* Send every jump of a switch to old_label to new_label instead */
+static void switch_retarget(IRProgram *prog, IRInstr *term, int old_label, int new_label) {
+    IRSwitch *sw = &prog->switches[term->imm];
+    if (term->label_id == old_label) term->label_id = new_label;
+    for (int k = 0; k < sw->count; k++)
+        if (sw->labels[k] == old_label) sw->labels[k] = new_label;
+}
+
+int ir_cfg_preheader(IRCfg *cfg, int *h) {
+    int n = cfg->block_count;
+    char *in_loop = malloc(n);
+    if (!ir_cfg_natural_loop(cfg, *h, in_loop)) {
+        free(in_loop);
+        return -1;
+    }
+
+    /* Already there: a single entering block that only leads here */
+    IRBlock *hb = &cfg->blocks[*h];
+    int outside = -1, entering = 0;
+    for (int p = 0; p < hb->pred_count; p++) {
+        if (in_loop[hb->preds[p]]) continue;
+        outside = hb->preds[p];
+        entering++;
+    }
+    if (entering == 1 && cfg->blocks[outside].succ_count == 1) {
+        free(in_loop);
+        return outside;
+    }
+
+    /* Laid out right before the header, so it falls through into it */
+    int ph = ir_cfg_insert_blocks(cfg, *h, 1);
+    cfg->blocks[ph].label = ir_alloc_label(cfg->prog);
+    char *was_in = malloc(n + 1);
+    for (int b = 0; b <= n; b++)
+        was_in[b] = b == ph ? 0 : in_loop[b > ph ? b - 1 : b];
+    int header = ph + 1;
+    hb = &cfg->blocks[header];
+    IRBlock *pb = &cfg->blocks[ph];
+
+    /* Entering edges now end at the preheader */
+    for (int p = 0; p < hb->pred_count; p++) {
+        int pred = hb->preds[p];
+        if (was_in[pred]) continue;
+        ir_block_add_pred(pb, pred);
+        IRBlock *from = &cfg->blocks[pred];
+        for (int s = 0; s < from->succ_count; s++) {
+            if (from->succs[s] != header) continue;
+            from->succs[s] = ph;
+            IRInstr *term = block_terminator(from);
+            if (term && term->op == IR_SWITCH)
+                switch_retarget(cfg->prog, term, hb->label, pb->label);
+            else if (s == 0 && term && term->op != IR_RET && term->op != IR_EXIT)
+                term->label_id = pb->label;
+        }
+    }
+
+    /* Header phis take one value from the preheader: the entering
+     * value if there is just one, else a phi merging them there */
+    for (int ph_i = 0; ph_i < hb->phi_count; ph_i++) {
+        IRPhi *phi = &hb->phis[ph_i];
+        int same = -1, k = 0, merged = 1;
+        int *vals = malloc((pb->pred_count > 0 ? pb->pred_count : 1) * sizeof(int));
+        for (int p = 0; p < hb->pred_count; p++) {
+            if (was_in[hb->preds[p]]) continue;
+            vals[k++] = phi->args[p];
+            if (same >= 0 && phi->args[p] != same) merged = 0;
+            same = phi->args[p];
+        }
+        if (!merged) {
+            int dst = ir_alloc_vreg(cfg->prog);
+            IRPhi *outer = ir_block_add_phi(pb, dst, phi->slot);
+            memcpy(outer->args, vals, k * sizeof(int));
+            phi = &hb->phis[ph_i];
+            same = dst;
+        }
+        free(vals);
+        /* Reuse the first entering position, drop the others */
+        int kept = 0, placed = 0;
+        for (int p = 0; p < hb->pred_count; p++) {
+            if (!was_in[hb->preds[p]]) {
+                if (placed) continue;
+                placed = 1;
+                phi->args[kept++] = same;
+            } else {
+                phi->args[kept++] = phi->args[p];
+            }
+        }
+    }
+    int kept = 0, placed = 0;
+    for (int p = 0; p < hb->pred_count; p++) {
+        if (!was_in[hb->preds[p]]) {
+            if (placed) continue;
+            placed = 1;
+            hb->preds[kept++] = ph;
+        } else {
+            hb->preds[kept++] = hb->preds[p];
+        }
+    }
+    hb->pred_count = kept;
+    ir_block_add_succ(pb, header);
+
+    free(was_in);
+    free(in_loop);
+    ir_cfg_compute_dominators(cfg);
+    *h = header;
+    return ph;
+}
+
+void ir_cfg_frontiers(const IRCfg *cfg, int ***df, int **df_count) {
+    int n = cfg->block_count;
+    *df = calloc(n, sizeof(int *));
+    *df_count = calloc(n, sizeof(int));
+    int *cap = calloc(n, sizeof(int));
+
+    for (int b = 0; b < n; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        if (blk->pred_count < 2) continue;
+        for (int p = 0; p < blk->pred_count; p++) {
+            for (int r = blk->preds[p]; r >= 0 && r != blk->idom; r = cfg->blocks[r].idom) {
+                int dup = 0;
+                for (int k = 0; k < (*df_count)[r]; k++)
+                    if ((*df)[r][k] == b) { dup = 1; break; }
+                if (dup) break; /* already walked from here */
+                if ((*df_count)[r] == cap[r]) {
+                    cap[r] = cap[r] ? cap[r] * 2 : 4;
+                    (*df)[r] = realloc((*df)[r], cap[r] * sizeof(int));
+                }
+                (*df)[r][(*df_count)[r]++] = b;
+            }
+        }
+    }
+    free(cap);
+}
+
+void ir_cfg_free_frontiers(const IRCfg *cfg, int **df, int *df_count) {
+    for (int b = 0; b < cfg->block_count; b++)
+        free(df[b]);
+    free(df);
+    free(df_count);
+}
+
+/* ================================================================
+ * Linearization
+ * ================================================================ */
+
+static int block_label(IRCfg *cfg, int b) {
+    if (cfg->blocks[b].label < 0)
+        cfg->blocks[b].label = ir_alloc_label(cfg->prog);
+    return cfg->blocks[b].label;
+}
+
+void ir_cfg_linearize(IRCfg *cfg, IRProgram *out) {
+    if (cfg->func_label >= 0)
+        ir_emit_func(out, cfg->func_label, cfg->param_count);
+
+    for (int b = 0; b < cfg->block_count; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        IRInstr *term = block_terminator(blk);
+        int next = b + 1;
+
+        /* A branch to the next block is turned around so that the
+         * next block is reached by falling through */
+        if (term && ir_is_cond_branch(term->op) && blk->succ_count == 2 &&
+            blk->succs[0] == next && blk->succs[1] != next) {
+            ir_invert_branch(term);
+            blk->succs[0] = blk->succs[1];
+            blk->succs[1] = next;
+        }
+
+        /* Labels for everything this block jumps to */
+        if (term && (term->op == IR_JMP || ir_is_cond_branch(term->op)))
+            term->label_id = block_label(cfg, blk->succs[0]);
+        int fall = -1;
+        if (!term && blk->succ_count == 1) fall = blk->succs[0];
+        if (term && ir_is_cond_branch(term->op) && blk->succ_count == 2)
+            fall = blk->succs[1];
+        if (fall >= 0 && fall != next)
+            block_label(cfg, fall);
+
+        if (blk->label >= 0)
+            ir_emit_label(out, blk->label);
+        for (int i = 0; i < blk->instr_count; i++)
+            ir_emit(out, blk->instrs[i]);
+        if (fall >= 0 && fall != next)
+            ir_emit_jmp(out, cfg->blocks[fall].label);
+    }
+}
+
+/* ================================================================
+ * Verifier
+ * ================================================================ */
+
+static int verify_fail(const IRCfg *cfg, int block, const char *fmt, ...) {
+    va_list ap;
+    fprintf(stderr, "IR verify: ");
+    if (cfg->func_label >= 0) fprintf(stderr, "func L%d: ", cfg->func_label);
+    else fprintf(stderr, "main: ");
+    if (block >= 0) fprintf(stderr, "b%d: ", block);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    return 1;
+}
+
+int ir_cfg_verify(const IRCfg *cfg) {
+    int errors = 0;
+    int n = cfg->block_count;
+    int nv = cfg->prog->next_vreg;
+
+    if (n == 0)
+        return verify_fail(cfg, -1, "no blocks");
+    if (cfg->blocks[0].pred_count != 0)
+        errors += verify_fail(cfg, 0, "entry block has predecessors");
+
+    /* Edges: each successor lists this block as a predecessor as many
+     * times as this block lists the successor */
+    for (int b = 0; b < n; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        if (blk->rpo_index < 0 || blk->rpo_index >= n || cfg->rpo[blk->rpo_index] != b)
+            errors += verify_fail(cfg, b, "unreachable or missing from reverse postorder");
+        for (int s = 0; s < blk->succ_count; s++) {
+            int succ = blk->succs[s];
+            if (succ < 0 || succ >= n) {
+                errors += verify_fail(cfg, b, "successor %d out of range", succ);
+                continue;
+            }
+            int out_edges = 0, in_edges = 0;
+            for (int k = 0; k < blk->succ_count; k++)
+                if (blk->succs[k] == succ) out_edges++;
+            for (int k = 0; k < cfg->blocks[succ].pred_count; k++)
+                if (cfg->blocks[succ].preds[k] == b) in_edges++;
+            if (out_edges != in_edges)
+                errors += verify_fail(cfg, b, "edge to b%d not mirrored in its predecessors", succ);
+        }
+        for (int p = 0; p < blk->pred_count; p++) {
+            const IRBlock *pred = &cfg->blocks[blk->preds[p]];
+            int found = 0;
+            for (int k = 0; k < pred->succ_count; k++)
+                if (pred->succs[k] == b) found = 1;
+            if (!found)
+                errors += verify_fail(cfg, b, "predecessor b%d has no edge here", blk->preds[p]);
+        }
+
+        /* Instructions and terminator shape */
+        for (int i = 0; i < blk->instr_count; i++) {
+            IROpcode op = blk->instrs[i].op;
+            if (op == IR_LABEL || op == IR_FUNC)
+                errors += verify_fail(cfg, b, "%s inside a block", ir_op_name(op));
+            if (ir_is_terminator(op) && i != blk->instr_count - 1)
+                errors += verify_fail(cfg, b, "terminator %s is not last", ir_op_name(op));
+            if (cfg->is_ssa && (op == IR_LOAD_LOCAL || op == IR_STORE_LOCAL))
+                errors += verify_fail(cfg, b, "%s in SSA form", ir_op_name(op));
+        }
+        const IRInstr *term = block_terminator(blk);
+        int want_succs = 1;
+        if (term) {
+            if (ir_is_cond_branch(term->op)) want_succs = 2;
+            else if (term->op == IR_RET || term->op == IR_EXIT) want_succs = 0;
+            else if (term->op == IR_SWITCH) {
+                const IRSwitch *sw = &cfg->prog->switches[term->imm];
+                want_succs = blk->succ_count > 0 ? blk->succ_count : 1;
+                for (int k = 0; k < sw->count; k++) {
+                    int found = 0;
+                    for (int s = 0; s < blk->succ_count; s++)
+                        if (cfg->blocks[blk->succs[s]].label == sw->labels[k]) found = 1;
+                    if (!found)
+                        errors += verify_fail(cfg, b, "switch case %lld to L%d is no successor",
+                                              (long long)sw->values[k], sw->labels[k]);
+                }
+            }
+            if (want_succs > 0 && blk->succ_count > 0 &&
+                cfg->blocks[blk->succs[0]].label != term->label_id)
+                errors += verify_fail(cfg, b, "%s to L%d but successor b%d is L%d",
+                                      ir_op_name(term->op), term->label_id, blk->succs[0],
+                                      cfg->blocks[blk->succs[0]].label);
+        } else if (b == n - 1 && blk->succ_count == 0) {
+            errors += verify_fail(cfg, b, "last block falls off the end");
+            want_succs = 0;
+        }
+        if (blk->succ_count != want_succs)
+            errors += verify_fail(cfg, b, "%d successors, expected %d", blk->succ_count, want_succs);
+
+        for (int ph = 0; ph < blk->phi_count; ph++) {
+            if (!cfg->is_ssa)
+                errors += verify_fail(cfg, b, "phi outside SSA form");
+            for (int p = 0; p < blk->pred_count; p++)
+                if (blk->phis[ph].args[p] < 0)
+                    errors += verify_fail(cfg, b, "phi v%d has no value from b%d",
+                                          blk->phis[ph].dst, blk->preds[p]);
+        }
+    }
+    if (errors) return errors;
+
+    /* Single definitions */
+    int *def_block = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    int *def_pos = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    for (int v = 0; v < nv; v++) def_block[v] = -1;
+    for (int b = 0; b < n; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        for (int i = -blk->phi_count; i < blk->instr_count; i++) {
+            int d = i < 0 ? blk->phis[blk->phi_count + i].dst : ir_instr_def(&blk->instrs[i]);
+            if (d < 0) continue;
+            if (d >= nv) {
+                errors += verify_fail(cfg, b, "v%d out of range", d);
+            } else if (def_block[d] >= 0) {
+                errors += verify_fail(cfg, b, "v%d defined more than once", d);
+            } else {
+                def_block[d] = b;
+                def_pos[d] = i;
+            }
+        }
+    }
+
+    /* Every use dominated by its definition */
+    for (int b = 0; b < n && !errors; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count; i++) {
+            int uses[IR_MAX_USES];
+            int nu = ir_instr_uses(&blk->instrs[i], uses);
+            for (int u = 0; u < nu; u++) {
+                int v = uses[u];
+                if (v < 0 || v >= nv || def_block[v] < 0)
+                    errors += verify_fail(cfg, b, "v%d used but never defined", v);
+                else if (def_block[v] == b ? def_pos[v] >= i
+                                           : !ir_cfg_dominates(cfg, def_block[v], b))
+                    errors += verify_fail(cfg, b, "use of v%d not dominated by its definition", v);
+            }
+        }
+        for (int ph = 0; ph < blk->phi_count; ph++) {
+            for (int p = 0; p < blk->pred_count; p++) {
+                int v = blk->phis[ph].args[p];
+                if (v >= nv || def_block[v] < 0)
+                    errors += verify_fail(cfg, b, "phi argument v%d never defined", v);
+                else if (!ir_cfg_dominates(cfg, def_block[v], blk->preds[p]))
+                    errors += verify_fail(cfg, b, "phi argument v%d does not reach from b%d",
+                                          v, blk->preds[p]);
+            }
+        }
+    }
+
+    free(def_block);
+    free(def_pos);
+    return errors;
+}
+
+/* ================================================================
+ * Dump
+ * ================================================================ */
+
+void ir_cfg_dump(FILE *out, const IRCfg *cfg) {
+    if (cfg->func_label >= 0)
+        fprintf(out, "func L%d (%d params)%s:\n", cfg->func_label, cfg->param_count,
+                cfg->is_ssa ? " [ssa]" : "");
+    else
+        fprintf(out, "main%s:\n", cfg->is_ssa ? " [ssa]" : "");
+
+    for (int b = 0; b < cfg->block_count; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        fprintf(out, "  b%d", b);
+        if (blk->label >= 0) fprintf(out, " (L%d)", blk->label);
+        fprintf(out, "  preds:");
+        if (blk->pred_count == 0) fprintf(out, " -");
+        for (int p = 0; p < blk->pred_count; p++) fprintf(out, " b%d", blk->preds[p]);
+        fprintf(out, "  succs:");
+        if (blk->succ_count == 0) fprintf(out, " -");
+        for (int s = 0; s < blk->succ_count; s++) fprintf(out, " b%d", blk->succs[s]);
+        if (blk->idom >= 0) fprintf(out, "  idom: b%d", blk->idom);
+        fputc('\n', out);
+
+        for (int ph = 0; ph < blk->phi_count; ph++) {
+            const IRPhi *phi = &blk->phis[ph];
+            fprintf(out, "      v%d = phi", phi->dst);
+            for (int p = 0; p < blk->pred_count; p++)
+                fprintf(out, "%s [b%d: v%d]", p ? "," : "", blk->preds[p], phi->args[p]);
+            if (phi->slot >= 0) fprintf(out, "  ; s%d", phi->slot);
+            fputc('\n', out);
+        }
+        for (int i = 0; i < blk->instr_count; i++) {
+            fputs("      ", out);
+            ir_dump_instr(out, cfg->prog, &blk->instrs[i]);
+            fputc('\n', out);
+        }
+    }
+}
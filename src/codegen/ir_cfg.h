@@ -0,0 +1,167 @@
+#ifndef IR_CFG_H
+#define IR_CFG_H
+
+#include "codegen/ir.h"
+
+/* ================================================================
+ * Control-flow graph and SSA form over IRProgram
+ *
+ * An IRProgram is a flat list: the main body up to its IR_EXIT, then
+ * one out-of-line function per IR_FUNC.  ir_cfg_build cuts one of
+ * those functions into basic blocks, computes predecessors/successors
+ * and the dominator tree; ir_ssa_construct promotes its slots to
+ * vregs joined by phis, and ir_ssa_destruct turns the phis back into
+ * slot traffic so the backends never see them.  ir_cfg_linearize
+ * writes the blocks back out as flat instructions.
+ *
+ * Block invariants (checked by ir_cfg_verify):
+ *   - blocks[0] is the entry; every block is reachable from it
+ *   - IR_LABEL never appears inside a block, it becomes block->label
+ *   - only the last instruction may be a terminator (JMP, JZ, JNZ,
+ *     BR_CMP, SWITCH, RET, EXIT); a block without one falls through to
+ *     succs[0]
+ *   - JZ/JNZ/BR_CMP: succs[0] is the branch target, succs[1] the
+ *     fallthrough
+ *   - SWITCH: succs[0] is the default target, then every other block
+ *     of its case table once, in table order
+ *   - the label_id of a branch equals the label of its target block
+ *   - every vreg has exactly one definition, which dominates its uses
+ * ================================================================ */
+
+typedef struct {
+    int dst;            /* vreg defined by the phi */
+    int slot;           /* slot this phi merges (-1 if none) */
+    int *args;          /* incoming vreg per predecessor, parallel to preds */
+} IRPhi;
+
+typedef struct {
+    int label;          /* label that starts the block (-1 if none) */
+
+    IRInstr *instrs;    /* body, terminator last (if any) */
+    int instr_count;
+    int instr_cap;
+
+    IRPhi *phis;        /* SSA form only */
+    int phi_count;
+    int phi_cap;
+
+    int *succs;
+    int succ_count;
+    int succ_cap;
+    int *preds;
+    int pred_count;
+    int pred_cap;
+
+    int idom;           /* immediate dominator (-1 for the entry) */
+    int dom_depth;      /* depth in the dominator tree (entry = 0) */
+    int rpo_index;      /* position in cfg->rpo */
+} IRBlock;
+
+typedef struct {
+    IRProgram *prog;    /* owns vreg/slot/label numbering and strings */
+    int func_label;     /* IR_FUNC label, -1 for the main body */
+    int param_count;
+
+    IRBlock *blocks;
+    int block_count;
+    int block_cap;
+
+    int *rpo;           /* block ids in reverse postorder */
+    int is_ssa;
+} IRCfg;
+
+/* Split prog into functions: fills starts[] (main body first, then each
+ * IR_FUNC) and returns the count.  Function i covers instructions
+ * [starts[i], starts[i + 1]), the last one ends at instr_count. */
+int ir_program_functions(const IRProgram *prog, int **starts);
+
+/* Build the CFG of instructions [start, end) of prog, drop unreachable
+ * blocks and compute dominators */
+void ir_cfg_build(IRCfg *cfg, IRProgram *prog, int start, int end);
+
+/* Free a CFG (the IRProgram is untouched) */
+void ir_cfg_free(IRCfg *cfg);
+
+/* Recompute reverse postorder and the dominator tree after the shape
+ * of the graph changed.  Unreachable blocks are removed first. */
+void ir_cfg_compute_dominators(IRCfg *cfg);
+
+/* 1 if block a dominates block b */
+int ir_cfg_dominates(const IRCfg *cfg, int a, int b);
+
+/* Natural loop headed by block h: sets in_loop[b] (block_count
+ * entries) for every block on some path from h back to h, and clears
+ * it elsewhere.  Returns the number of back edges into h, 0 if h does
+ * not head a loop. */
+int ir_cfg_natural_loop(const IRCfg *cfg, int h, char *in_loop);
+
+/* Preheader of the loop headed by *h: the one block outside the loop
+ * that enters it and leads nowhere else.  If there is none, one is
+ * inserted right before the header (shifting block ids from *h up by
+ * one; *h is updated), the entering edges are redirected to it and
+ * dominators are recomputed.  Returns -1 if *h heads no loop. */
+int ir_cfg_preheader(IRCfg *cfg, int *h);
+
+/* Dominance frontier of every block: df[b] is a malloc'd list of
+ * df_count[b] block ids.  Free with ir_cfg_free_frontiers. */
+void ir_cfg_frontiers(const IRCfg *cfg, int ***df, int **df_count);
+void ir_cfg_free_frontiers(const IRCfg *cfg, int **df, int *df_count);
+
+/* Append an instruction to the end of block b */
+void ir_block_append(IRBlock *b, IRInstr instr);
+
+/* Insert an instruction into block b at position pos */
+void ir_block_insert(IRBlock *b, int pos, IRInstr instr);
+
+/* Remove the instruction at position pos of block b */
+void ir_block_remove(IRBlock *b, int pos);
+
+/* Append pred to the predecessors of block b (phi arguments are the
+ * caller's to extend) */
+void ir_block_add_pred(IRBlock *b, int pred);
+
+/* Append succ to the successors of block b (the matching predecessor
+ * is the caller's to add) */
+void ir_block_add_succ(IRBlock *b, int succ);
+
+/* Append a phi defining dst to block b; its arguments (one per
+ * predecessor) start out as -1 for the caller to fill in */
+IRPhi *ir_block_add_phi(IRBlock *b, int dst, int slot);
+
+/* Insert count empty blocks at index pos, renumbering the blocks from
+ * pos on and every edge into them.  Returns pos.  The new blocks have
+ * no edges; reverse postorder and dominators are stale until
+ * ir_cfg_compute_dominators. */
+int ir_cfg_insert_blocks(IRCfg *cfg, int pos, int count);
+
+/* Remove edge succs[succ_index] of block from, along with the matching
+ * predecessor entry (and phi arguments) of its target.  Terminators
+ * are left alone; callers rewrite them to match. */
+void ir_cfg_remove_edge(IRCfg *cfg, int from, int succ_index);
+
+/* 1 if op ends a basic block */
+int ir_is_terminator(IROpcode op);
+
+/* Write the blocks back out as flat instructions appended to out.
+ * Must not be in SSA form.  Emits IR_FUNC first for functions, allocates
+ * labels where needed, inverts branches whose target is the next block
+ * and adds jumps where layout no longer matches a fallthrough edge. */
+void ir_cfg_linearize(IRCfg *cfg, IRProgram *out);
+
+/* Check the invariants above; prints each problem to stderr and
+ * returns how many were found */
+int ir_cfg_verify(const IRCfg *cfg);
+
+/* Textual dump of blocks, edges, dominators and phis */
+void ir_cfg_dump(FILE *out, const IRCfg *cfg);
+
+/* Promote every slot of the function to SSA vregs, inserting phis at
+ * the iterated dominance frontier of its stores (semi-pruned: only for
+ * slots read in some block before being written there) */
+void ir_ssa_construct(IRCfg *cfg);
+
+/* Leave SSA form: each phi gets a fresh slot, stored at the end of
+ * every predecessor and loaded into the phi's vreg on block entry */
+void ir_ssa_destruct(IRCfg *cfg);
+
+#endif
@@ -0,0 +1,2279 @@
+#include "codegen/ir_opt.h"
+#include "diagnostic.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ================================================================
+ * Use lists
+ *
+ * Sparse passes need to get from a vreg to the instructions and phis
+ * that read it.  Uses are stored compressed: the sites of vreg v are
+ * sites[start[v] .. start[v + 1]).  A site is a block plus an index
+ * into its instrs, or -(phi + 1) for a phi.
+ * ================================================================ */
+
+typedef struct {
+    int block;
+    int index;
+} UseSite;
+
+typedef struct {
+    int *start;
+    UseSite *sites;
+} UseLists;
+
+static void use_lists_build(const IRCfg *cfg, UseLists *ul) {
+    int nv = cfg->prog->next_vreg;
+    ul->start = calloc(nv + 2, sizeof(int));
+
+    for (int pass = 0; pass < 2; pass++) {
+        int *fill = NULL;
+        if (pass == 1) {
+            for (int v = 0; v < nv; v++) ul->start[v + 1] += ul->start[v];
+            ul->sites = malloc((ul->start[nv] > 0 ? ul->start[nv] : 1) * sizeof(UseSite));
+            fill = malloc((nv > 0 ? nv : 1) * sizeof(int));
+            memcpy(fill, ul->start, nv * sizeof(int));
+        }
+        for (int b = 0; b < cfg->block_count; b++) {
+            const IRBlock *blk = &cfg->blocks[b];
+            for (int ph = 0; ph < blk->phi_count; ph++) {
+                for (int p = 0; p < blk->pred_count; p++) {
+                    int v = blk->phis[ph].args[p];
+                    if (pass == 0) ul->start[v + 1]++;
+                    else ul->sites[fill[v]++] = (UseSite){ b, -(ph + 1) };
+                }
+            }
+            for (int i = 0; i < blk->instr_count; i++) {
+                int uses[IR_MAX_USES];
+                int nu = ir_instr_uses(&blk->instrs[i], uses);
+                for (int u = 0; u < nu; u++) {
+                    if (pass == 0) ul->start[uses[u] + 1]++;
+                    else ul->sites[fill[uses[u]]++] = (UseSite){ b, i };
+                }
+            }
+        }
+        free(fill);
+    }
+}
+
+static void use_lists_free(UseLists *ul) {
+    free(ul->start);
+    free(ul->sites);
+}
+
+void ir_opt_replace_uses(IRCfg *cfg, const int *map) {
+    for (int b = 0; b < cfg->block_count; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        for (int ph = 0; ph < blk->phi_count; ph++)
+            for (int p = 0; p < blk->pred_count; p++)
+                if (map[blk->phis[ph].args[p]] >= 0)
+                    blk->phis[ph].args[p] = map[blk->phis[ph].args[p]];
+        for (int i = 0; i < blk->instr_count; i++) {
+            int *refs[IR_MAX_USES];
+            int nr = ir_instr_use_refs(&blk->instrs[i], refs);
+            for (int r = 0; r < nr; r++)
+                if (map[*refs[r]] >= 0)
+                    *refs[r] = map[*refs[r]];
+        }
+    }
+}
+
+static void block_remove_phi(IRBlock *b, int ph) {
+    free(b->phis[ph].args);
+    memmove(&b->phis[ph], &b->phis[ph + 1], (b->phi_count - ph - 1) * sizeof(IRPhi));
+    b->phi_count--;
+}
+
+static IRInstr make_const(int dst, int64_t value) {
+    IRInstr c;
+    memset(&c, 0, sizeof(c));
+    c.op = IR_CONST_INT;
+    c.dst = dst;
+    c.imm = value;
+    return c;
+}
+
+/* ================================================================
+ * Constant folding
+ *
+ * Folds follow what the x86-64 backend computes at run time: wrapping
+ * two's complement arithmetic, shift counts masked to 6 bits and
+ * truncating division.  Division by zero and INT64_MIN / -1 trap at
+ * run time, so they are never folded.  Floats fold in the same IEEE
+ * double arithmetic as SSE2, where nothing traps.
+ * ================================================================ */
+
+static double fold_double(int64_t bits) {
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static int64_t fold_bits(double d) {
+    int64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return bits;
+}
+
+static int fold_unary(IROpcode op, int64_t a, int64_t *out) {
+    switch (op) {
+    case IR_NEG:     *out = (int64_t)(0 - (uint64_t)a); return 1;
+    case IR_BIT_NOT: *out = ~a; return 1;
+    case IR_INT_TO_FLOAT: *out = fold_bits((double)a); return 1;
+    default:         return 0;
+    }
+}
+
+/* lhs cmp rhs as doubles: false for a nan except IR_CMP_NE */
+static int64_t fold_fcmp(IROpcode cmp, int64_t a, int64_t b) {
+    double x = fold_double(a), y = fold_double(b);
+    switch (cmp) {
+    case IR_CMP_EQ: return x == y;
+    case IR_CMP_NE: return x != y;
+    case IR_CMP_LT: return x < y;
+    case IR_CMP_LE: return x <= y;
+    case IR_CMP_GT: return x > y;
+    default:        return x >= y;
+    }
+}
+
+static int fold_binary(IROpcode op, int64_t a, int64_t b, int64_t *out) {
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    switch (op) {
+    case IR_ADD:     *out = (int64_t)(ua + ub); return 1;
+    case IR_SUB:     *out = (int64_t)(ua - ub); return 1;
+    case IR_MUL:     *out = (int64_t)(ua * ub); return 1;
+    case IR_MUL_HI:  *out = (int64_t)(((__int128)a * b) >> 64); return 1;
+    case IR_DIV:
+    case IR_MOD:
+        if (b == 0 || (a == INT64_MIN && b == -1)) return 0;
+        *out = op == IR_DIV ? a / b : a % b;
+        return 1;
+    case IR_BIT_AND: *out = a & b; return 1;
+    case IR_BIT_OR:  *out = a | b; return 1;
+    case IR_BIT_XOR: *out = a ^ b; return 1;
+    case IR_SHL:     *out = (int64_t)(ua << (b & 63)); return 1;
+    case IR_SHR:     *out = a >> (b & 63); return 1;
+    case IR_CMP_EQ:  *out = a == b; return 1;
+    case IR_CMP_NE:  *out = a != b; return 1;
+    case IR_CMP_LT:  *out = a < b; return 1;
+    case IR_CMP_LE:  *out = a <= b; return 1;
+    case IR_CMP_GT:  *out = a > b; return 1;
+    case IR_CMP_GE:  *out = a >= b; return 1;
+    case IR_FADD:    *out = fold_bits(fold_double(a) + fold_double(b)); return 1;
+    case IR_FSUB:    *out = fold_bits(fold_double(a) - fold_double(b)); return 1;
+    case IR_FMUL:    *out = fold_bits(fold_double(a) * fold_double(b)); return 1;
+    case IR_FDIV:    *out = fold_bits(fold_double(a) / fold_double(b)); return 1;
+    default:         return 0;
+    }
+}
+
+/* ================================================================
+ * Sparse conditional constant propagation
+ *
+ * Wegman and Zadeck's algorithm: every vreg starts at TOP (no value
+ * seen yet) and only ever moves down to a constant and then to BOTTOM
+ * (varying).  Blocks are evaluated only once an edge into them is
+ * known to execute, so constants that depend on a branch never taken
+ * are still found, and such branches are removed afterwards.
+ * ================================================================ */
+
+enum { LAT_TOP, LAT_CONST, LAT_BOTTOM };
+
+typedef struct {
+    IRCfg *cfg;
+    UseLists uses;
+    char *state;        /* per vreg */
+    int64_t *value;     /* per vreg, valid when state == LAT_CONST */
+    char *block_live;   /* block has an executable incoming edge */
+    char *edge_live;    /* per edge: successor k of block b is edge_base[b] + k */
+    int *edge_base;
+
+    int *flow;          /* worklist of newly executable edges (block, succ) */
+    int flow_count;
+    int *ssa;           /* worklist of vregs whose state dropped */
+    int ssa_count;
+} SCCP;
+
+static void sccp_set(SCCP *s, int v, int state, int64_t value) {
+    if (state == s->state[v] && (state != LAT_CONST || value == s->value[v]))
+        return;
+    /* Two different constants meet at BOTTOM */
+    if (state == LAT_CONST && s->state[v] == LAT_CONST) state = LAT_BOTTOM;
+    if (state < s->state[v]) return;
+    s->state[v] = (char)state;
+    s->value[v] = value;
+    s->ssa[s->ssa_count++] = v;
+}
+
+static void sccp_mark_edge(SCCP *s, int b, int succ) {
+    if (s->edge_live[s->edge_base[b] + succ]) return;
+    s->edge_live[s->edge_base[b] + succ] = 1;
+    s->flow[s->flow_count++] = b;
+    s->flow[s->flow_count++] = succ;
+}
+
+static int sccp_edge_live(const SCCP *s, int pred, int b) {
+    const IRBlock *p = &s->cfg->blocks[pred];
+    for (int k = 0; k < p->succ_count; k++)
+        if (p->succs[k] == b && s->edge_live[s->edge_base[pred] + k]) return 1;
+    return 0;
+}
+
+static void sccp_visit_phi(SCCP *s, int b, int ph) {
+    const IRBlock *blk = &s->cfg->blocks[b];
+    const IRPhi *phi = &blk->phis[ph];
+    for (int p = 0; p < blk->pred_count; p++) {
+        if (!sccp_edge_live(s, blk->preds[p], b)) continue;
+        int a = phi->args[p];
+        if (s->state[a] == LAT_TOP) continue;
+        sccp_set(s, phi->dst, s->state[a], s->value[a]);
+        if (s->state[phi->dst] == LAT_BOTTOM) return;
+    }
+}
+
+/* Successor index an IR_SWITCH ending block b takes for value v */
+static int switch_target(const IRCfg *cfg, int b, const IRInstr *ir, int64_t v) {
+    const IRSwitch *sw = &cfg->prog->switches[ir->imm];
+    const IRBlock *blk = &cfg->blocks[b];
+    int label = ir->label_id;
+    for (int k = 0; k < sw->count; k++)
+        if (sw->values[k] == v) label = sw->labels[k];
+    for (int k = 0; k < blk->succ_count; k++)
+        if (cfg->blocks[blk->succs[k]].label == label) return k;
+    return 0;
+}
+
+/* Element index of table t reads for index, counting negative ones
+ * from the end, or -1 if it is out of range */
+static int64_t table_slot(const IRTable *t, int64_t index) {
+    if (index < 0) index += t->count;
+    return index >= 0 && index < t->count ? index : -1;
+}
+
+/* Lattice state of whether a conditional branch is taken; when it is
+ * LAT_CONST, *taken says which way it goes */
+static int sccp_branch(const SCCP *s, const IRInstr *ir, int *taken) {
+    if (ir->op == IR_BR_CMP) {
+        int ls = s->state[ir->lhs], rs = s->state[ir->rhs];
+        if (ls == LAT_BOTTOM || rs == LAT_BOTTOM) return LAT_BOTTOM;
+        if (ls == LAT_TOP || rs == LAT_TOP) return LAT_TOP;
+        int64_t r = 0;
+        fold_binary((IROpcode)ir->imm, s->value[ir->lhs], s->value[ir->rhs], &r);
+        *taken = r != 0;
+        return LAT_CONST;
+    }
+    int c = ir->src;
+    if (s->state[c] == LAT_CONST)
+        *taken = (s->value[c] == 0) == (ir->op == IR_JZ);
+    return s->state[c];
+}
+
+static void sccp_visit_instr(SCCP *s, int b, int i) {
+    const IRBlock *blk = &s->cfg->blocks[b];
+    const IRInstr *ir = &blk->instrs[i];
+
+    if (ir_is_cond_branch(ir->op)) {
+        int taken = 0;
+        int state = sccp_branch(s, ir, &taken);
+        if (state == LAT_BOTTOM) {
+            sccp_mark_edge(s, b, 0);
+            if (blk->succ_count > 1) sccp_mark_edge(s, b, 1);
+        } else if (state == LAT_CONST) {
+            if (taken) sccp_mark_edge(s, b, 0);
+            else if (blk->succ_count > 1) sccp_mark_edge(s, b, 1);
+        }
+        return;
+    }
+    if (ir->op == IR_JMP) {
+        sccp_mark_edge(s, b, 0);
+        return;
+    }
+    if (ir->op == IR_SWITCH) {
+        if (s->state[ir->src] == LAT_BOTTOM) {
+            for (int k = 0; k < blk->succ_count; k++) sccp_mark_edge(s, b, k);
+        } else if (s->state[ir->src] == LAT_CONST) {
+            sccp_mark_edge(s, b, switch_target(s->cfg, b, ir, s->value[ir->src]));
+        }
+        return;
+    }
+
+    int d = ir_instr_def(ir);
+    if (d < 0) return;
+    int64_t r;
+    switch (ir->op) {
+    case IR_CONST_INT:
+        sccp_set(s, d, LAT_CONST, ir->imm);
+        break;
+    case IR_NEG: case IR_BIT_NOT: case IR_INT_TO_FLOAT:
+        if (s->state[ir->src] == LAT_CONST && fold_unary(ir->op, s->value[ir->src], &r))
+            sccp_set(s, d, LAT_CONST, r);
+        else if (s->state[ir->src] == LAT_BOTTOM)
+            sccp_set(s, d, LAT_BOTTOM, 0);
+        break;
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_MOD:
+    case IR_MUL_HI:
+    case IR_BIT_AND: case IR_BIT_OR: case IR_BIT_XOR:
+    case IR_SHL: case IR_SHR:
+    case IR_CMP_EQ: case IR_CMP_NE: case IR_CMP_LT:
+    case IR_CMP_LE: case IR_CMP_GT: case IR_CMP_GE:
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: case IR_FCMP: {
+        int ls = s->state[ir->lhs], rs = s->state[ir->rhs];
+        if (ls == LAT_BOTTOM || rs == LAT_BOTTOM)
+            sccp_set(s, d, LAT_BOTTOM, 0);
+        else if (ls == LAT_CONST && rs == LAT_CONST && ir->op == IR_FCMP)
+            sccp_set(s, d, LAT_CONST,
+                     fold_fcmp((IROpcode)ir->imm, s->value[ir->lhs], s->value[ir->rhs]));
+        else if (ls == LAT_CONST && rs == LAT_CONST) {
+            if (fold_binary(ir->op, s->value[ir->lhs], s->value[ir->rhs], &r))
+                sccp_set(s, d, LAT_CONST, r);
+            else
+                sccp_set(s, d, LAT_BOTTOM, 0);
+        }
+        break;
+    }
+    case IR_LOAD_ELEM: case IR_LOAD_ELEM_UNCHECKED: {
+        /* A known index in range reads a known element; one out of
+         * range is left to fail at run time */
+        const IRTable *t = &s->cfg->prog->tables[ir->imm];
+        int64_t k = s->state[ir->src] == LAT_CONST ? table_slot(t, s->value[ir->src]) : -1;
+        if (k >= 0)
+            sccp_set(s, d, LAT_CONST, t->values[k]);
+        else if (s->state[ir->src] != LAT_TOP)
+            sccp_set(s, d, LAT_BOTTOM, 0);
+        break;
+    }
+    case IR_SELECT: {
+        /* A known condition picks one value, otherwise both meet as
+         * they would at a phi */
+        int cs = s->state[ir->src];
+        if (cs == LAT_TOP) break;
+        for (int k = 0; k < 2; k++) {
+            int v = k == 0 ? ir->lhs : ir->rhs;
+            if (cs == LAT_CONST && (s->value[ir->src] != 0) != (k == 0)) continue;
+            if (s->state[v] != LAT_TOP) sccp_set(s, d, s->state[v], s->value[v]);
+        }
+        break;
+    }
+    default:
+        /* params, calls, strings: unknown at compile time */
+        sccp_set(s, d, LAT_BOTTOM, 0);
+        break;
+    }
+}
+
+static void sccp_visit_block(SCCP *s, int b) {
+    const IRBlock *blk = &s->cfg->blocks[b];
+    for (int ph = 0; ph < blk->phi_count; ph++)
+        sccp_visit_phi(s, b, ph);
+    for (int i = 0; i < blk->instr_count; i++)
+        sccp_visit_instr(s, b, i);
+    if (blk->instr_count == 0 || !ir_is_terminator(blk->instrs[blk->instr_count - 1].op))
+        if (blk->succ_count > 0) sccp_mark_edge(s, b, 0);
+}
+
+int ir_opt_sccp(IRCfg *cfg) {
+    int nv = cfg->prog->next_vreg;
+    int n = cfg->block_count;
+    SCCP s;
+    memset(&s, 0, sizeof(s));
+    s.cfg = cfg;
+    use_lists_build(cfg, &s.uses);
+    s.state = calloc(nv + 1, 1);
+    s.value = calloc(nv + 1, sizeof(int64_t));
+    s.block_live = calloc(n, 1);
+    s.edge_base = malloc((n + 1) * sizeof(int));
+    s.edge_base[0] = 0;
+    for (int b = 0; b < n; b++)
+        s.edge_base[b + 1] = s.edge_base[b] + cfg->blocks[b].succ_count;
+    s.edge_live = calloc(s.edge_base[n] + 1, 1);
+    /* Each edge and each lowering of a vreg is queued at most once
+     * (a vreg drops at most twice) */
+    s.flow = malloc((2 * s.edge_base[n] + 2) * sizeof(int));
+    s.ssa = malloc((2 * nv + 1) * sizeof(int));
+
+    s.block_live[0] = 1;
+    sccp_visit_block(&s, 0);
+    while (s.flow_count > 0 || s.ssa_count > 0) {
+        while (s.flow_count > 0) {
+            int succ = s.flow[--s.flow_count];
+            int b = s.flow[--s.flow_count];
+            int t = cfg->blocks[b].succs[succ];
+            if (!s.block_live[t]) {
+                s.block_live[t] = 1;
+                sccp_visit_block(&s, t);
+            } else {
+                for (int ph = 0; ph < cfg->blocks[t].phi_count; ph++)
+                    sccp_visit_phi(&s, t, ph);
+            }
+        }
+        while (s.ssa_count > 0) {
+            int v = s.ssa[--s.ssa_count];
+            for (int k = s.uses.start[v]; k < s.uses.start[v + 1]; k++) {
+                UseSite u = s.uses.sites[k];
+                if (!s.block_live[u.block]) continue;
+                if (u.index < 0) sccp_visit_phi(&s, u.block, -u.index - 1);
+                else sccp_visit_instr(&s, u.block, u.index);
+            }
+        }
+    }
+
+    /* Rewrite: constant results become IR_CONST_INT, decided branches
+     * become jumps or fallthroughs, and blocks never reached drop out
+     * when the dominator tree is rebuilt */
+    int changed = 0;
+    for (int b = 0; b < n; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        if (!s.block_live[b]) {
+            changed = 1;
+            continue;
+        }
+        for (int ph = blk->phi_count - 1; ph >= 0; ph--) {
+            int d = blk->phis[ph].dst;
+            if (s.state[d] != LAT_CONST) continue;
+            ir_block_insert(blk, 0, make_const(d, s.value[d]));
+            block_remove_phi(blk, ph);
+            changed = 1;
+        }
+        for (int i = 0; i < blk->instr_count; i++) {
+            IRInstr *ir = &blk->instrs[i];
+            int d = ir_instr_def(ir);
+            if (d >= 0 && ir->op != IR_CONST_INT && s.state[d] == LAT_CONST) {
+                *ir = make_const(d, s.value[d]);
+                changed = 1;
+            }
+        }
+        IRInstr *term = blk->instr_count > 0 ? &blk->instrs[blk->instr_count - 1] : NULL;
+        int taken = 0;
+        if (term && ir_is_cond_branch(term->op) &&
+            sccp_branch(&s, term, &taken) == LAT_CONST) {
+            if (s.edge_live[s.edge_base[b]]) {
+                /* Always taken */
+                term->op = IR_JMP;
+                term->src = -1;
+                if (blk->succ_count > 1) ir_cfg_remove_edge(cfg, b, 1);
+            } else {
+                /* Never taken */
+                ir_block_remove(blk, blk->instr_count - 1);
+                ir_cfg_remove_edge(cfg, b, 0);
+            }
+            changed = 1;
+        } else if (term && term->op == IR_SWITCH && s.state[term->src] == LAT_CONST) {
+            /* Only the case taken is left, as a jump */
+            int k = switch_target(cfg, b, term, s.value[term->src]);
+            int target = blk->succs[k];
+            for (int e = blk->succ_count - 1; e >= 0; e--)
+                if (e != k) ir_cfg_remove_edge(cfg, b, e);
+            term->op = IR_JMP;
+            term->src = -1;
+            term->label_id = cfg->blocks[target].label;
+            changed = 1;
+        }
+    }
+
+    /* Cut edges out of dead blocks so they become unreachable */
+    for (int b = 0; b < n; b++) {
+        if (s.block_live[b]) continue;
+        while (cfg->blocks[b].succ_count > 0)
+            ir_cfg_remove_edge(cfg, b, 0);
+    }
+    if (changed)
+        ir_cfg_compute_dominators(cfg);
+
+    free(s.ssa);
+    free(s.flow);
+    free(s.edge_live);
+    free(s.edge_base);
+    free(s.block_live);
+    free(s.value);
+    free(s.state);
+    use_lists_free(&s.uses);
+    return changed;
+}
+
+/* ================================================================
+ * Copy propagation
+ *
+ * The IR has no move instruction: after SSA construction every copy
+ * left over from a slot is a phi that merges one value with itself.
+ * ================================================================ */
+
+int ir_opt_copy_prop(IRCfg *cfg) {
+    int nv = cfg->prog->next_vreg;
+    int *map = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    int changed = 0, again = 1;
+
+    while (again) {
+        again = 0;
+        for (int v = 0; v < nv; v++) map[v] = -1;
+        for (int b = 0; b < cfg->block_count; b++) {
+            IRBlock *blk = &cfg->blocks[b];
+            for (int ph = blk->phi_count - 1; ph >= 0; ph--) {
+                IRPhi *phi = &blk->phis[ph];
+                int same = -1, trivial = 1;
+                for (int p = 0; p < blk->pred_count && trivial; p++) {
+                    int a = phi->args[p];
+                    while (map[a] >= 0) a = map[a];
+                    if (a == phi->dst || a == same) continue;
+                    if (same >= 0) trivial = 0;
+                    same = a;
+                }
+                if (!trivial || same < 0) continue;
+                map[phi->dst] = same;
+                block_remove_phi(blk, ph);
+                again = 1;
+            }
+        }
+        if (again) {
+            /* Chase chains so one sweep rewrites everything */
+            for (int v = 0; v < nv; v++)
+                while (map[v] >= 0 && map[map[v]] >= 0) map[v] = map[map[v]];
+            ir_opt_replace_uses(cfg, map);
+            changed = 1;
+        }
+    }
+    free(map);
+    return changed;
+}
+
+/* ================================================================
+ * Dead-code elimination
+ *
+ * Mark and sweep: instructions with effects outside their result are
+ * live, and so is the definition of every operand of something live.
+ * Divisions stay unless their divisor is a constant that cannot trap,
+ * table loads unless their bounds check is gone.
+ * ================================================================ */
+
+static int instr_has_effect(const IRInstr *ir, const char *safe_divisor) {
+    switch (ir->op) {
+    case IR_CONST_INT: case IR_CONST_STR: case IR_LOAD_LOCAL:
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_MUL_HI:
+    case IR_NEG:
+    case IR_BIT_AND: case IR_BIT_OR: case IR_BIT_XOR: case IR_BIT_NOT:
+    case IR_SHL: case IR_SHR:
+    case IR_CMP_EQ: case IR_CMP_NE: case IR_CMP_LT:
+    case IR_CMP_LE: case IR_CMP_GT: case IR_CMP_GE:
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: case IR_FCMP:
+    case IR_INT_TO_FLOAT:
+    case IR_SELECT:
+    case IR_LOAD_ELEM_UNCHECKED:
+    case IR_PARAM: case IR_STACK_ALLOC:
+        return 0;
+    case IR_DIV: case IR_MOD:
+        return !safe_divisor[ir->rhs];
+    default:
+        return 1;
+    }
+}
+
+int ir_opt_dce(IRCfg *cfg) {
+    int nv = cfg->prog->next_vreg;
+    int n = cfg->block_count;
+
+    /* Where each vreg is defined: block and instr index (phi -(k + 1)) */
+    int *def_block = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    int *def_index = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    char *safe_divisor = calloc(nv + 1, 1);
+    for (int v = 0; v < nv; v++) def_block[v] = -1;
+    for (int b = 0; b < n; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        for (int ph = 0; ph < blk->phi_count; ph++) {
+            def_block[blk->phis[ph].dst] = b;
+            def_index[blk->phis[ph].dst] = -(ph + 1);
+        }
+        for (int i = 0; i < blk->instr_count; i++) {
+            int d = ir_instr_def(&blk->instrs[i]);
+            if (d < 0) continue;
+            def_block[d] = b;
+            def_index[d] = i;
+            if (blk->instrs[i].op == IR_CONST_INT)
+                safe_divisor[d] = blk->instrs[i].imm != 0 && blk->instrs[i].imm != -1;
+        }
+    }
+
+    char *live = calloc(nv + 1, 1);
+    int *work = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    int wn = 0;
+
+#define MARK(v) do { int v_ = (v); if (v_ >= 0 && !live[v_]) { live[v_] = 1; work[wn++] = v_; } } while (0)
+
+    for (int b = 0; b < n; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count; i++) {
+            IRInstr *ir = &blk->instrs[i];
+            if (!instr_has_effect(ir, safe_divisor)) continue;
+            int uses[IR_MAX_USES];
+            int nu = ir_instr_uses(ir, uses);
+            for (int u = 0; u < nu; u++) MARK(uses[u]);
+            MARK(ir_instr_def(ir));
+        }
+    }
+    while (wn > 0) {
+        int v = work[--wn];
+        if (def_block[v] < 0) continue;
+        IRBlock *blk = &cfg->blocks[def_block[v]];
+        if (def_index[v] < 0) {
+            const IRPhi *phi = &blk->phis[-def_index[v] - 1];
+            for (int p = 0; p < blk->pred_count; p++) MARK(phi->args[p]);
+        } else {
+            int uses[IR_MAX_USES];
+            int nu = ir_instr_uses(&blk->instrs[def_index[v]], uses);
+            for (int u = 0; u < nu; u++) MARK(uses[u]);
+        }
+    }
+#undef MARK
+
+    int changed = 0;
+    for (int b = 0; b < n; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        for (int ph = blk->phi_count - 1; ph >= 0; ph--) {
+            if (live[blk->phis[ph].dst]) continue;
+            block_remove_phi(blk, ph);
+            changed = 1;
+        }
+        int out = 0;
+        for (int i = 0; i < blk->instr_count; i++) {
+            int d = ir_instr_def(&blk->instrs[i]);
+            if (d >= 0 && !live[d] && !instr_has_effect(&blk->instrs[i], safe_divisor)) {
+                changed = 1;
+                continue;
+            }
+            blk->instrs[out++] = blk->instrs[i];
+        }
+        blk->instr_count = out;
+    }
+
+    free(work);
+    free(live);
+    free(safe_divisor);
+    free(def_index);
+    free(def_block);
+    return changed;
+}
+
+/* ================================================================
+ * CFG simplification
+ * ================================================================ */
+
+static IRInstr *block_terminator(IRBlock *b) {
+    if (b->instr_count == 0) return NULL;
+    IRInstr *last = &b->instrs[b->instr_count - 1];
+    return ir_is_terminator(last->op) ? last : NULL;
+}
+
+/* Successor of an empty block that only passes control on, or -1 */
+static int forwarding_target(IRCfg *cfg, int b) {
+    IRBlock *blk = &cfg->blocks[b];
+    if (b == 0 || blk->phi_count > 0 || blk->succ_count != 1) return -1;
+    if (blk->instr_count > 1) return -1;
+    if (blk->instr_count == 1 && blk->instrs[0].op != IR_JMP) return -1;
+    int t = blk->succs[0];
+    if (t == b || cfg->blocks[t].phi_count > 0) return -1;
+    return t;
+}
+
+int ir_opt_simplify_cfg(IRCfg *cfg) {
+    int changed = 0;
+
+    /* Jumps to an empty forwarding block go straight to its target */
+    for (int b = 0; b < cfg->block_count; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        IRInstr *term = block_terminator(blk);
+        if (!term || (term->op != IR_JMP && !ir_is_cond_branch(term->op)))
+            continue;
+        int e = blk->succs[0];
+        int t = forwarding_target(cfg, e);
+        if (t < 0 || e == b) continue;
+
+        IRBlock *eb = &cfg->blocks[e];
+        for (int p = 0; p < eb->pred_count; p++) {
+            if (eb->preds[p] != b) continue;
+            memmove(&eb->preds[p], &eb->preds[p + 1], (eb->pred_count - p - 1) * sizeof(int));
+            eb->pred_count--;
+            break;
+        }
+        IRBlock *tb = &cfg->blocks[t];
+        if (tb->pred_count == tb->pred_cap) {
+            tb->pred_cap = tb->pred_cap ? tb->pred_cap * 2 : 4;
+            tb->preds = realloc(tb->preds, tb->pred_cap * sizeof(int));
+        }
+        tb->preds[tb->pred_count++] = b;
+        blk->succs[0] = t;
+        if (tb->label < 0) tb->label = ir_alloc_label(cfg->prog);
+        term->label_id = tb->label;
+        changed = 1;
+    }
+
+    /* A block whose only successor has no other predecessor absorbs it */
+    for (int b = 0; b < cfg->block_count; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        while (blk->succ_count == 1) {
+            int s = blk->succs[0];
+            IRBlock *sb = &cfg->blocks[s];
+            IRInstr *term = block_terminator(blk);
+            if (s == b || s == 0 || sb->pred_count != 1 || sb->phi_count > 0) break;
+            if (term && term->op != IR_JMP) break;
+            if (term) blk->instr_count--;
+
+            for (int i = 0; i < sb->instr_count; i++)
+                ir_block_append(blk, sb->instrs[i]);
+            sb->instr_count = 0;
+            blk->succ_count = 0;
+            for (int k = 0; k < sb->succ_count; k++) {
+                ir_block_add_succ(blk, sb->succs[k]);
+                IRBlock *t = &cfg->blocks[sb->succs[k]];
+                for (int p = 0; p < t->pred_count; p++)
+                    if (t->preds[p] == s) { t->preds[p] = b; break; }
+            }
+            sb->succ_count = 0;
+            sb->pred_count = 0;
+            changed = 1;
+        }
+    }
+
+    if (changed)
+        ir_cfg_compute_dominators(cfg);
+    return changed;
+}
+
+/* ================================================================
+ * Bounds-check elimination
+ *
+ * An IR_LOAD_ELEM whose index provably lies in [0, count) becomes
+ * IR_LOAD_ELEM_UNCHECKED.  The range of a value comes from its
+ * definition: a constant, a constant offset, multiple, shift, mask or
+ * remainder of a value whose range is known, or a phi that only steps
+ * one way from constant starting values.  It is then narrowed by the
+ * comparisons against constants that decide the branches into the
+ * dominating blocks, which is how `i < n` in a loop header bounds i in
+ * the body.
+ * ================================================================ */
+
+#define BOUNDS_DEPTH 8          /* definitions followed back from an index */
+
+typedef struct {
+    const IRCfg *cfg;
+    int *def_block;     /* per vreg, -1 if none */
+    int *def_index;     /* instr index, -(phi + 1) for a phi */
+} Bounds;
+
+/* Inclusive; INT64_MIN and INT64_MAX stand for no bound on that side */
+typedef struct {
+    int64_t lo, hi;
+} Range;
+
+static const Range range_all = { INT64_MIN, INT64_MAX };
+
+static int bounds_const(const Bounds *bd, int v, int64_t *value) {
+    if (bd->def_block[v] < 0 || bd->def_index[v] < 0) return 0;
+    const IRInstr *ir = &bd->cfg->blocks[bd->def_block[v]].instrs[bd->def_index[v]];
+    if (ir->op != IR_CONST_INT) return 0;
+    *value = ir->imm;
+    return 1;
+}
+
+/* Narrow r by what the branches into block b and its dominators say
+ * about v: a block whose only predecessor ends in an IR_BR_CMP of v is
+ * entered only when that compare went its way */
+static void bounds_narrow(const Bounds *bd, int v, int b, Range *r) {
+    const IRCfg *cfg = bd->cfg;
+    for (int x = b; x >= 0; x = cfg->blocks[x].idom) {
+        const IRBlock *xb = &cfg->blocks[x];
+        if (xb->pred_count != 1) continue;
+        const IRBlock *pb = &cfg->blocks[xb->preds[0]];
+        if (pb->succ_count != 2 || pb->succs[0] == pb->succs[1]) continue;
+        const IRInstr *br = &pb->instrs[pb->instr_count - 1];
+        if (br->op != IR_BR_CMP) continue;
+        IROpcode cmp = pb->succs[0] == x ? (IROpcode)br->imm : ir_cmp_negate((IROpcode)br->imm);
+        int other;
+        if (br->lhs == v) {
+            other = br->rhs;
+        } else if (br->rhs == v) {
+            other = br->lhs;
+            cmp = ir_cmp_swap(cmp);
+        } else {
+            continue;
+        }
+        int64_t c;
+        if (!bounds_const(bd, other, &c)) {
+            /* Below (above) anything is still below INT64_MAX (above
+             * INT64_MIN), enough for a step of one not to wrap */
+            if (cmp == IR_CMP_LT) c = INT64_MAX;
+            else if (cmp == IR_CMP_GT) c = INT64_MIN;
+            else continue;
+        }
+        switch (cmp) {
+        case IR_CMP_EQ:
+            if (c > r->lo) r->lo = c;
+            if (c < r->hi) r->hi = c;
+            break;
+        case IR_CMP_LT: if (c != INT64_MIN && c - 1 < r->hi) r->hi = c - 1; break;
+        case IR_CMP_LE: if (c < r->hi) r->hi = c; break;
+        case IR_CMP_GT: if (c != INT64_MAX && c + 1 > r->lo) r->lo = c + 1; break;
+        case IR_CMP_GE: if (c > r->lo) r->lo = c; break;
+        default: break;
+        }
+    }
+}
+
+/* Range of a phi whose arguments are constants or the phi itself plus
+ * a constant step: every step goes the same way, so the constants bound
+ * it on the other side.  A step counts only if the conditions where it
+ * is taken keep it from wrapping. */
+static Range bounds_phi(const Bounds *bd, int b, int ph) {
+    const IRBlock *blk = &bd->cfg->blocks[b];
+    const IRPhi *phi = &blk->phis[ph];
+    int64_t lo = INT64_MAX, hi = INT64_MIN;
+    int up = 0, down = 0;
+    for (int p = 0; p < blk->pred_count; p++) {
+        int a = phi->args[p];
+        int64_t c;
+        if (bounds_const(bd, a, &c)) {
+            if (c < lo) lo = c;
+            if (c > hi) hi = c;
+            continue;
+        }
+        if (a == phi->dst) continue;
+        if (bd->def_block[a] < 0 || bd->def_index[a] < 0) return range_all;
+        const IRInstr *ir = &bd->cfg->blocks[bd->def_block[a]].instrs[bd->def_index[a]];
+        int64_t step = 0;
+        int steps = 0;
+        if (ir->op == IR_ADD && ir->lhs == phi->dst)
+            steps = bounds_const(bd, ir->rhs, &step);
+        else if (ir->op == IR_ADD && ir->rhs == phi->dst)
+            steps = bounds_const(bd, ir->lhs, &step);
+        else if (ir->op == IR_SUB && ir->lhs == phi->dst && bounds_const(bd, ir->rhs, &step))
+            steps = step != INT64_MIN;
+        if (!steps) return range_all;
+        if (ir->op == IR_SUB) step = -step;
+        Range at = range_all;
+        bounds_narrow(bd, phi->dst, bd->def_block[a], &at);
+        if (step >= 0) {
+            if (at.hi > INT64_MAX - step) return range_all;
+            up = 1;
+        } else {
+            if (at.lo < INT64_MIN - step) return range_all;
+            down = 1;
+        }
+    }
+    if (lo > hi || (up && down)) return range_all;
+    Range r = { lo, hi };
+    if (up) r.hi = INT64_MAX;
+    if (down) r.lo = INT64_MIN;
+    return r;
+}
+
+/* Range of v on entry to block b */
+static Range bounds_of(const Bounds *bd, int v, int b, int depth) {
+    Range r = range_all;
+    int db = bd->def_block[v];
+    if (db >= 0 && depth > 0 && bd->def_index[v] < 0) {
+        r = bounds_phi(bd, db, -bd->def_index[v] - 1);
+    } else if (db >= 0 && depth > 0) {
+        const IRInstr *ir = &bd->cfg->blocks[db].instrs[bd->def_index[v]];
+        int64_t c;
+        int x = -1;
+        if (ir->op == IR_CONST_INT) {
+            r.lo = r.hi = ir->imm;
+        } else if (ir->op == IR_BIT_AND && (bounds_const(bd, ir->rhs, &c) ||
+                                            bounds_const(bd, ir->lhs, &c)) && c >= 0) {
+            r.lo = 0;
+            r.hi = c;
+        } else if (ir->op == IR_MOD && bounds_const(bd, ir->rhs, &c) && c > 0) {
+            /* The remainder takes the sign of the dividend */
+            Range xr = bounds_of(bd, ir->lhs, b, depth - 1);
+            r.lo = xr.lo >= 0 ? 0 : 1 - c;
+            r.hi = c - 1;
+        } else if ((ir->op == IR_ADD || ir->op == IR_SUB || ir->op == IR_MUL) &&
+                   bounds_const(bd, ir->rhs, &c)) {
+            x = ir->lhs;
+        } else if ((ir->op == IR_ADD || ir->op == IR_MUL) && bounds_const(bd, ir->lhs, &c)) {
+            x = ir->rhs;
+        } else if (ir->op == IR_SHL && bounds_const(bd, ir->rhs, &c) && c >= 0 && c < 63) {
+            x = ir->lhs;
+        }
+        if (x >= 0) {
+            /* A bounded operand moved by a constant, if nothing wraps */
+            Range xr = bounds_of(bd, x, b, depth - 1);
+            int64_t a, z;
+            int wraps = xr.lo == INT64_MIN || xr.hi == INT64_MAX;
+            switch (ir->op) {
+            case IR_ADD:
+                wraps = wraps || __builtin_add_overflow(xr.lo, c, &a) ||
+                        __builtin_add_overflow(xr.hi, c, &z);
+                break;
+            case IR_SUB:
+                wraps = wraps || __builtin_sub_overflow(xr.lo, c, &a) ||
+                        __builtin_sub_overflow(xr.hi, c, &z);
+                break;
+            default:
+                if (ir->op == IR_SHL) c = (int64_t)1 << c;
+                wraps = wraps || __builtin_mul_overflow(xr.lo, c, &a) ||
+                        __builtin_mul_overflow(xr.hi, c, &z);
+                break;
+            }
+            if (!wraps) {
+                r.lo = a < z ? a : z;
+                r.hi = a < z ? z : a;
+            }
+        }
+    }
+    bounds_narrow(bd, v, b, &r);
+    return r;
+}
+
+int ir_opt_elide_bounds_checks(IRCfg *cfg) {
+    int nv = cfg->prog->next_vreg;
+    Bounds bd;
+    bd.cfg = cfg;
+    bd.def_block = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    bd.def_index = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    for (int v = 0; v < nv; v++) bd.def_block[v] = -1;
+    for (int b = 0; b < cfg->block_count; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        for (int ph = 0; ph < blk->phi_count; ph++) {
+            bd.def_block[blk->phis[ph].dst] = b;
+            bd.def_index[blk->phis[ph].dst] = -(ph + 1);
+        }
+        for (int i = 0; i < blk->instr_count; i++) {
+            int d = ir_instr_def(&blk->instrs[i]);
+            if (d < 0) continue;
+            bd.def_block[d] = b;
+            bd.def_index[d] = i;
+        }
+    }
+
+    int changed = 0;
+    for (int b = 0; b < cfg->block_count; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count; i++) {
+            IRInstr *ir = &blk->instrs[i];
+            if (ir->op != IR_LOAD_ELEM) continue;
+            Range r = bounds_of(&bd, ir->src, b, BOUNDS_DEPTH);
+            if (r.lo >= 0 && r.hi < cfg->prog->tables[ir->imm].count) {
+                ir->op = IR_LOAD_ELEM_UNCHECKED;
+                changed = 1;
+            }
+        }
+    }
+
+    free(bd.def_index);
+    free(bd.def_block);
+    return changed;
+}
+
+/* ================================================================
+ * Strength reduction
+ *
+ * Multiplies, divides and remainders by a constant become shifts,
+ * adds and at most one high multiply (Granlund and Montgomery,
+ * "Division by Invariant Integers using Multiplication"; the magic
+ * numbers are computed as in Hacker's Delight, section 10-4).
+ *
+ * In loops, a multiple k * i of a basic induction variable i (a
+ * header phi that every back edge steps by a constant c), k not a power
+ * of two, gets a phi of its own, started at k * init in front of the
+ * loop and stepped by k * c on every back edge, so the multiply leaves
+ * the body.  Wrapping arithmetic keeps this exact: k * (i + c) ==
+ * k * i + k * c modulo 2^64.
+ * ================================================================ */
+
+typedef struct {
+    IRCfg *cfg;
+    char *known;        /* per vreg: defined by IR_CONST_INT */
+    int64_t *value;
+    int cap;
+} Reducer;
+
+static void reducer_grow(Reducer *r) {
+    int nv = r->cfg->prog->next_vreg;
+    if (nv <= r->cap) return;
+    int cap = r->cap ? r->cap : 64;
+    while (cap < nv) cap *= 2;
+    r->known = realloc(r->known, cap);
+    r->value = realloc(r->value, cap * sizeof(int64_t));
+    memset(r->known + r->cap, 0, cap - r->cap);
+    r->cap = cap;
+}
+
+static int reducer_const(const Reducer *r, int v, int64_t *value) {
+    if (v < 0 || v >= r->cap || !r->known[v]) return 0;
+    *value = r->value[v];
+    return 1;
+}
+
+/* Append dst = value to out, for a fresh dst when dst < 0 */
+static int emit_const(Reducer *r, IRBlock *out, int dst, int64_t value) {
+    if (dst < 0) dst = ir_alloc_vreg(r->cfg->prog);
+    reducer_grow(r);
+    r->known[dst] = 1;
+    r->value[dst] = value;
+    ir_block_append(out, make_const(dst, value));
+    return dst;
+}
+
+/* Append dst = lhs OP rhs (or OP lhs for unary ops) to out */
+static int emit_op(Reducer *r, IRBlock *out, int dst, IROpcode op, int lhs, int rhs) {
+    if (dst < 0) dst = ir_alloc_vreg(r->cfg->prog);
+    IRInstr ir;
+    memset(&ir, 0, sizeof(ir));
+    ir.op = op;
+    ir.dst = dst;
+    if (op == IR_NEG || op == IR_BIT_NOT) {
+        ir.src = lhs;
+    } else {
+        ir.lhs = lhs;
+        ir.rhs = rhs;
+    }
+    ir_block_append(out, ir);
+    return dst;
+}
+
+/* Append dst = lhs OP imm, materializing imm */
+static int emit_op_imm(Reducer *r, IRBlock *out, int dst, IROpcode op, int lhs, int64_t imm) {
+    int c = emit_const(r, out, -1, imm);
+    return emit_op(r, out, dst, op, lhs, c);
+}
+
+/* log2 of x if x is a power of two greater than 1, else -1 */
+static int exact_log2(uint64_t x) {
+    if (x < 2 || (x & (x - 1)) != 0) return -1;
+    int k = 0;
+    while (x >>= 1) k++;
+    return k;
+}
+
+/* Multiplier and post-shift for signed division by d, where |d| >= 2
+ * is not a power of two */
+static void signed_magic(int64_t d, int64_t *mult, int *shift) {
+    const uint64_t two63 = (uint64_t)1 << 63;
+    uint64_t ad = d < 0 ? 0 - (uint64_t)d : (uint64_t)d;
+    uint64_t t = two63 + ((uint64_t)d >> 63);
+    uint64_t anc = t - 1 - t % ad;
+    uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+    uint64_t delta;
+    int p = 63;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) { q1++; r1 -= anc; }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) { q2++; r2 -= ad; }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *mult = (int64_t)(d < 0 ? 0 - (q2 + 1) : q2 + 1);
+    *shift = p - 64;
+}
+
+/* n + (n < 0 ? 2^k - 1 : 0): rounds an arithmetic shift by k toward
+ * zero */
+static int emit_round_bias(Reducer *r, IRBlock *out, int n, int k) {
+    int sign = emit_op_imm(r, out, -1, IR_SHR, n, 63);
+    int bias = emit_op_imm(r, out, -1, IR_BIT_AND, sign, (int64_t)(((uint64_t)1 << k) - 1));
+    return emit_op(r, out, -1, IR_ADD, n, bias);
+}
+
+/* Quotient n / d for a constant d with |d| >= 2 (d != INT64_MIN) */
+static int emit_quotient(Reducer *r, IRBlock *out, int dst, int n, int64_t d) {
+    uint64_t ad = d < 0 ? 0 - (uint64_t)d : (uint64_t)d;
+    int k = exact_log2(ad);
+    if (k > 0) {
+        int biased = emit_round_bias(r, out, n, k);
+        if (d > 0) return emit_op_imm(r, out, dst, IR_SHR, biased, k);
+        int q = emit_op_imm(r, out, -1, IR_SHR, biased, k);
+        return emit_op(r, out, dst, IR_NEG, q, -1);
+    }
+
+    int64_t m;
+    int s;
+    signed_magic(d, &m, &s);
+    int q = emit_op_imm(r, out, -1, IR_MUL_HI, n, m);
+    if (d > 0 && m < 0) q = emit_op(r, out, -1, IR_ADD, q, n);
+    if (d < 0 && m > 0) q = emit_op(r, out, -1, IR_SUB, q, n);
+    if (s > 0) q = emit_op_imm(r, out, -1, IR_SHR, q, s);
+    /* Truncate toward zero: add one when the estimate is negative */
+    int sign = emit_op_imm(r, out, -1, IR_SHR, q, 63);
+    return emit_op(r, out, dst, IR_SUB, q, sign);
+}
+
+/* Lower ir, appending the replacement to out.  Returns 0 (and appends
+ * nothing) if ir stays as it is; sets *copy_of when its result is
+ * simply another vreg. */
+static int reduce_instr(Reducer *r, const IRInstr *ir, IRBlock *out, int *copy_of) {
+    int64_t c;
+    int x;
+    if (ir->op == IR_MUL) {
+        if (reducer_const(r, ir->rhs, &c)) x = ir->lhs;
+        else if (reducer_const(r, ir->lhs, &c)) x = ir->rhs;
+        else return 0;
+        uint64_t ac = c < 0 ? 0 - (uint64_t)c : (uint64_t)c;
+        int k = exact_log2(ac);
+        if (c == 0) {
+            emit_const(r, out, ir->dst, 0);
+        } else if (c == 1) {
+            *copy_of = x;
+        } else if (c == -1) {
+            emit_op(r, out, ir->dst, IR_NEG, x, -1);
+        } else if (k > 0 && c > 0) {
+            emit_op_imm(r, out, ir->dst, IR_SHL, x, k);
+        } else if (k > 0 && c != INT64_MIN) {
+            int t = emit_op_imm(r, out, -1, IR_SHL, x, k);
+            emit_op(r, out, ir->dst, IR_NEG, t, -1);
+        } else {
+            return 0;
+        }
+        return 1;
+    }
+
+    if (ir->op != IR_DIV && ir->op != IR_MOD) return 0;
+    /* 0 and -1 (INT64_MIN / -1) trap, INT64_MIN has no magic number */
+    if (!reducer_const(r, ir->rhs, &c) || c == 0 || c == -1 || c == INT64_MIN)
+        return 0;
+    int n = ir->lhs;
+    if (c == 1) {
+        if (ir->op == IR_DIV) *copy_of = n;
+        else emit_const(r, out, ir->dst, 0);
+        return 1;
+    }
+    if (ir->op == IR_DIV) {
+        emit_quotient(r, out, ir->dst, n, c);
+        return 1;
+    }
+
+    /* n % c == n - (n / c) * c; for c = +-2^k the product is the
+     * rounded dividend with its low k bits cleared */
+    uint64_t ac = c < 0 ? 0 - (uint64_t)c : (uint64_t)c;
+    int k = exact_log2(ac);
+    int prod;
+    if (k > 0) {
+        int biased = emit_round_bias(r, out, n, k);
+        prod = emit_op_imm(r, out, -1, IR_BIT_AND, biased, (int64_t)(0 - ac));
+    } else {
+        int q = emit_quotient(r, out, -1, n, c);
+        prod = emit_op_imm(r, out, -1, IR_MUL, q, c);
+    }
+    emit_op(r, out, ir->dst, IR_SUB, n, prod);
+    return 1;
+}
+
+/* A derived induction variable: dst == factor * iv, replaced by phi */
+typedef struct {
+    int dst;
+    int iv;
+    int64_t factor;
+    int phi;
+} Derived;
+
+/* Insert code from scratch before the terminator of block b */
+static void splice_before_end(IRBlock *b, IRBlock *scratch) {
+    int pos = b->instr_count;
+    if (pos > 0 && ir_is_terminator(b->instrs[pos - 1].op)) pos--;
+    for (int i = 0; i < scratch->instr_count; i++)
+        ir_block_insert(b, pos + i, scratch->instrs[i]);
+    scratch->instr_count = 0;
+}
+
+static int reduce_induction(Reducer *r, int *map) {
+    IRCfg *cfg = r->cfg;
+    int nv = cfg->prog->next_vreg;
+
+    /* v = base + step for every add or subtract of a constant */
+    int *base = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    int64_t *step = malloc((nv > 0 ? nv : 1) * sizeof(int64_t));
+    for (int v = 0; v < nv; v++) base[v] = -1;
+    for (int b = 0; b < cfg->block_count; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count; i++) {
+            const IRInstr *ir = &blk->instrs[i];
+            int64_t c;
+            if (ir->op == IR_ADD && reducer_const(r, ir->rhs, &c)) {
+                base[ir->dst] = ir->lhs;
+                step[ir->dst] = c;
+            } else if (ir->op == IR_ADD && reducer_const(r, ir->lhs, &c)) {
+                base[ir->dst] = ir->rhs;
+                step[ir->dst] = c;
+            } else if (ir->op == IR_SUB && reducer_const(r, ir->rhs, &c)) {
+                base[ir->dst] = ir->lhs;
+                step[ir->dst] = (int64_t)(0 - (uint64_t)c);
+            }
+        }
+    }
+
+    /* Basic induction variables: iv_step[v] valid when is_iv[v] */
+    char *is_iv = calloc(nv + 1, 1);
+    int64_t *iv_step = malloc((nv > 0 ? nv : 1) * sizeof(int64_t));
+    int *iv_header = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    char *in_loop = malloc(cfg->block_count);
+    char *body = calloc(cfg->block_count, 1);
+    for (int h = 0; h < cfg->block_count; h++) {
+        if (!ir_cfg_natural_loop(cfg, h, in_loop)) continue;
+        const IRBlock *hb = &cfg->blocks[h];
+        for (int ph = 0; ph < hb->phi_count; ph++) {
+            const IRPhi *phi = &hb->phis[ph];
+            int next = -1, ok = 1;
+            for (int p = 0; p < hb->pred_count && ok; p++) {
+                if (!in_loop[hb->preds[p]]) continue;
+                if (next >= 0 && phi->args[p] != next) ok = 0;
+                next = phi->args[p];
+            }
+            if (!ok || next < 0 || base[next] != phi->dst) continue;
+            is_iv[phi->dst] = 1;
+            iv_step[phi->dst] = step[next];
+            iv_header[phi->dst] = h;
+        }
+        for (int b = 0; b < cfg->block_count; b++) body[b] |= in_loop[b];
+    }
+
+    /* Multiples of them inside their loops */
+    Derived *der = NULL;
+    int nder = 0, dcap = 0;
+    for (int b = 0; b < cfg->block_count; b++) {
+        if (!body[b]) continue;
+        const IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count; i++) {
+            const IRInstr *ir = &blk->instrs[i];
+            int64_t factor;
+            int iv;
+            if (ir->op != IR_MUL) continue;
+            if (is_iv[ir->lhs] && reducer_const(r, ir->rhs, &factor)) iv = ir->lhs;
+            else if (is_iv[ir->rhs] && reducer_const(r, ir->lhs, &factor)) iv = ir->rhs;
+            else continue;
+            /* Powers of two become a shift, which is as cheap as the add */
+            uint64_t af = factor < 0 ? 0 - (uint64_t)factor : (uint64_t)factor;
+            if (af <= 1 || exact_log2(af) > 0) continue;
+            /* Only blocks inside the loop of this particular iv */
+            if (!ir_cfg_dominates(cfg, iv_header[iv], b)) continue;
+            ir_cfg_natural_loop(cfg, iv_header[iv], in_loop);
+            if (!in_loop[b]) continue;
+            if (nder == dcap) {
+                dcap = dcap ? dcap * 2 : 8;
+                der = realloc(der, dcap * sizeof(Derived));
+            }
+            der[nder++] = (Derived){ ir->dst, iv, factor, -1 };
+        }
+    }
+
+    /* One new phi per (iv, factor), shared by every multiply of it */
+    IRBlock scratch;
+    memset(&scratch, 0, sizeof(scratch));
+    for (int k = 0; k < nder; k++) {
+        Derived *d = &der[k];
+        for (int j = 0; j < k && d->phi < 0; j++)
+            if (der[j].iv == d->iv && der[j].factor == d->factor) d->phi = der[j].phi;
+        if (d->phi >= 0) {
+            map[d->dst] = d->phi;
+            continue;
+        }
+
+        int h = iv_header[d->iv];
+        ir_cfg_natural_loop(cfg, h, in_loop);
+        IRBlock *hb = &cfg->blocks[h];
+        int iv_ph = 0;
+        while (hb->phis[iv_ph].dst != d->iv) iv_ph++;
+        d->phi = ir_alloc_vreg(cfg->prog);
+        IRPhi *phi = ir_block_add_phi(hb, d->phi, -1);
+        int64_t inc = (int64_t)((uint64_t)iv_step[d->iv] * (uint64_t)d->factor);
+        for (int p = 0; p < hb->pred_count; p++) {
+            int pred = hb->preds[p];
+            if (in_loop[pred])
+                phi->args[p] = emit_op_imm(r, &scratch, -1, IR_ADD, d->phi, inc);
+            else
+                phi->args[p] = emit_op_imm(r, &scratch, -1, IR_MUL,
+                                           hb->phis[iv_ph].args[p], d->factor);
+            splice_before_end(&cfg->blocks[pred], &scratch);
+        }
+        map[d->dst] = d->phi;
+    }
+    free(scratch.instrs);
+
+    free(der);
+    free(body);
+    free(in_loop);
+    free(iv_header);
+    free(iv_step);
+    free(is_iv);
+    free(step);
+    free(base);
+    return nder > 0;
+}
+
+int ir_opt_strength_reduce(IRCfg *cfg) {
+    Reducer r;
+    memset(&r, 0, sizeof(r));
+    r.cfg = cfg;
+    reducer_grow(&r);
+    for (int b = 0; b < cfg->block_count; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count; i++) {
+            if (blk->instrs[i].op != IR_CONST_INT) continue;
+            r.known[blk->instrs[i].dst] = 1;
+            r.value[blk->instrs[i].dst] = blk->instrs[i].imm;
+        }
+    }
+
+    /* map grows with the vregs the rewrites allocate; entries of new
+     * vregs are never set */
+    int nv = cfg->prog->next_vreg;
+    int *map = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    for (int v = 0; v < nv; v++) map[v] = -1;
+
+    int changed = reduce_induction(&r, map);
+
+    /* Rebuild each block, expanding the instructions that reduce */
+    IRBlock out;
+    memset(&out, 0, sizeof(out));
+    for (int b = 0; b < cfg->block_count; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        out.instr_count = 0;
+        int any = 0;
+        for (int i = 0; i < blk->instr_count; i++) {
+            int copy_of = -1;
+            IRInstr ir = blk->instrs[i];
+            int d = ir_instr_def(&ir);
+            if (d >= 0 && d < nv && map[d] >= 0) {
+                /* Replaced by a derived induction variable */
+                any = 1;
+                continue;
+            }
+            if (reduce_instr(&r, &ir, &out, &copy_of)) {
+                if (copy_of >= 0) map[ir.dst] = copy_of;
+                any = 1;
+                continue;
+            }
+            ir_block_append(&out, ir);
+        }
+        if (!any) continue;
+        /* Swap buffers: the old body becomes the next scratch */
+        IRBlock old = *blk;
+        blk->instrs = out.instrs;
+        blk->instr_count = out.instr_count;
+        blk->instr_cap = out.instr_cap;
+        out.instrs = old.instrs;
+        out.instr_cap = old.instr_cap;
+        changed = 1;
+    }
+    free(out.instrs);
+
+    if (changed) {
+        int total = cfg->prog->next_vreg;
+        map = realloc(map, (total > 0 ? total : 1) * sizeof(int));
+        for (int v = nv; v < total; v++) map[v] = -1;
+        for (int v = 0; v < nv; v++)
+            while (map[v] >= 0 && map[v] < nv && map[map[v]] >= 0) map[v] = map[map[v]];
+        ir_opt_replace_uses(cfg, map);
+    }
+    free(map);
+    free(r.known);
+    free(r.value);
+    return changed;
+}
+
+/* ================================================================
+ * Global value numbering
+ *
+ * Dominator-based: walking the dominator tree, each pure instruction
+ * is looked up by opcode and operands in a table holding the values
+ * computed in the blocks that dominate it.  A hit means the same value
+ * is already available, so the instruction goes and its uses take the
+ * earlier vreg.  Table entries are popped when the walk leaves the
+ * subtree that made them.  Division and checked table loads are
+ * numbered too: a dominating copy traps first if either would.
+ * ================================================================ */
+
+typedef struct {
+    IROpcode op;
+    int lhs, rhs;
+    int64_t imm;
+    int value;
+    int next;           /* next entry in the bucket */
+} VNEntry;
+
+static int gvn_numbered(IROpcode op) {
+    switch (op) {
+    case IR_CONST_INT:
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_MOD:
+    case IR_MUL_HI: case IR_NEG:
+    case IR_BIT_AND: case IR_BIT_OR: case IR_BIT_XOR: case IR_BIT_NOT:
+    case IR_SHL: case IR_SHR:
+    case IR_CMP_EQ: case IR_CMP_NE: case IR_CMP_LT:
+    case IR_CMP_LE: case IR_CMP_GT: case IR_CMP_GE:
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: case IR_FCMP:
+    case IR_INT_TO_FLOAT:
+    case IR_LOAD_ELEM: case IR_LOAD_ELEM_UNCHECKED:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int is_commutative(IROpcode op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_MUL_HI ||
+           op == IR_BIT_AND || op == IR_BIT_OR || op == IR_BIT_XOR ||
+           op == IR_CMP_EQ || op == IR_CMP_NE || op == IR_FADD || op == IR_FMUL;
+}
+
+static unsigned vn_hash(IROpcode op, int lhs, int rhs, int64_t imm) {
+    uint64_t h = (uint64_t)op * 0x9E3779B97F4A7C15ull;
+    h ^= (uint64_t)(unsigned)lhs * 0xC2B2AE3D27D4EB4Full;
+    h ^= (uint64_t)(unsigned)rhs * 0x165667B19E3779F9ull;
+    h ^= (uint64_t)imm * 0x27D4EB2F165667C5ull;
+    return (unsigned)(h ^ (h >> 29));
+}
+
+int ir_opt_gvn(IRCfg *cfg) {
+    int nv = cfg->prog->next_vreg;
+    int n = cfg->block_count;
+    int *map = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    for (int v = 0; v < nv; v++) map[v] = -1;
+#define FIND(v) (map[v] >= 0 ? map[v] : (v))
+
+    int total = 0;
+    for (int b = 0; b < n; b++) total += cfg->blocks[b].instr_count;
+    int nbuckets = 16;
+    while (nbuckets < 2 * total) nbuckets *= 2;
+    int *bucket = malloc(nbuckets * sizeof(int));
+    for (int k = 0; k < nbuckets; k++) bucket[k] = -1;
+    VNEntry *entries = malloc((total > 0 ? total : 1) * sizeof(VNEntry));
+    int nentries = 0;
+
+    /* Dominator tree children, CSR over idom */
+    int *child_start = calloc(n + 1, sizeof(int));
+    int *children = malloc((n > 0 ? n : 1) * sizeof(int));
+    for (int b = 1; b < n; b++) child_start[cfg->blocks[b].idom + 1]++;
+    for (int b = 0; b < n; b++) child_start[b + 1] += child_start[b];
+    int *fill = malloc((n > 0 ? n : 1) * sizeof(int));
+    memcpy(fill, child_start, n * sizeof(int));
+    for (int b = 1; b < n; b++) children[fill[cfg->blocks[b].idom]++] = b;
+
+    /* Iterative preorder walk: stack of (block, next child, table mark) */
+    int *stack = malloc((3 * n + 3) * sizeof(int));
+    int sp = 0, changed = 0;
+    stack[sp++] = 0;
+    stack[sp++] = -1;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        int b = stack[sp - 3];
+        int *cursor = &stack[sp - 2];
+        if (*cursor < 0) {
+            /* First visit: number the block */
+            *cursor = child_start[b];
+            stack[sp - 1] = nentries;
+            IRBlock *blk = &cfg->blocks[b];
+
+            /* Phis of one block merging the same values are one value */
+            for (int ph = blk->phi_count - 1; ph >= 0; ph--) {
+                for (int q = 0; q < ph; q++) {
+                    int same = 1;
+                    for (int p = 0; p < blk->pred_count && same; p++)
+                        same = FIND(blk->phis[q].args[p]) == FIND(blk->phis[ph].args[p]);
+                    if (!same) continue;
+                    map[blk->phis[ph].dst] = FIND(blk->phis[q].dst);
+                    block_remove_phi(blk, ph);
+                    changed = 1;
+                    break;
+                }
+            }
+
+            int out = 0;
+            for (int i = 0; i < blk->instr_count; i++) {
+                IRInstr *ir = &blk->instrs[i];
+                int *refs[IR_MAX_USES];
+                int nr = ir_instr_use_refs(ir, refs);
+                for (int r = 0; r < nr; r++) *refs[r] = FIND(*refs[r]);
+                if (gvn_numbered(ir->op)) {
+                    int lhs = -1, rhs = -1;
+                    int64_t imm = ir->op == IR_CONST_INT || ir->op == IR_LOAD_ELEM ||
+                                  ir->op == IR_LOAD_ELEM_UNCHECKED || ir->op == IR_FCMP
+                                  ? ir->imm : 0;
+                    if (ir->op == IR_NEG || ir->op == IR_BIT_NOT || ir->op == IR_INT_TO_FLOAT ||
+                        ir->op == IR_LOAD_ELEM || ir->op == IR_LOAD_ELEM_UNCHECKED) {
+                        lhs = ir->src;
+                    } else if (ir->op != IR_CONST_INT) {
+                        lhs = ir->lhs;
+                        rhs = ir->rhs;
+                        if (is_commutative(ir->op) && lhs > rhs) {
+                            int t = lhs; lhs = rhs; rhs = t;
+                        }
+                    }
+                    unsigned k = vn_hash(ir->op, lhs, rhs, imm) & (nbuckets - 1);
+                    int e = bucket[k];
+                    while (e >= 0 && !(entries[e].op == ir->op && entries[e].lhs == lhs &&
+                                       entries[e].rhs == rhs && entries[e].imm == imm))
+                        e = entries[e].next;
+                    if (e >= 0) {
+                        map[ir->dst] = entries[e].value;
+                        changed = 1;
+                        continue;
+                    }
+                    entries[nentries] = (VNEntry){ ir->op, lhs, rhs, imm, ir->dst, bucket[k] };
+                    bucket[k] = nentries++;
+                }
+                blk->instrs[out++] = *ir;
+            }
+            blk->instr_count = out;
+        }
+        if (*cursor < child_start[b + 1]) {
+            int c = children[(*cursor)++];
+            stack[sp++] = c;
+            stack[sp++] = -1;
+            stack[sp++] = 0;
+            continue;
+        }
+        /* Leaving the subtree: its entries are the newest in every
+         * bucket, so popping them restores the dominator's table */
+        int mark = stack[sp - 1];
+        while (nentries > mark) {
+            const VNEntry *e = &entries[--nentries];
+            bucket[vn_hash(e->op, e->lhs, e->rhs, e->imm) & (nbuckets - 1)] = e->next;
+        }
+        sp -= 3;
+    }
+#undef FIND
+
+    if (changed)
+        ir_opt_replace_uses(cfg, map);
+
+    free(stack);
+    free(fill);
+    free(children);
+    free(child_start);
+    free(entries);
+    free(bucket);
+    free(map);
+    return changed;
+}
+
+/* ================================================================
+ * Loop-invariant code motion
+ *
+ * Every loop gets a preheader, then loops are visited inner first (in
+ * reverse of the order their headers appear in reverse postorder).  A
+ * pure instruction whose operands are all defined outside the loop
+ * moves to the end of the preheader; code hoisted out of an inner loop
+ * lands in the outer loop and may move again.  Since everything hoisted
+ * also runs when the loop body would not, only instructions that
+ * cannot trap qualify: division needs a constant divisor other than 0
+ * and -1, and table loads keep their bounds check.  Slot loads need no
+ * special case, SSA form has already turned slots not stored in a loop
+ * into values defined outside it.
+ * ================================================================ */
+
+/* Give every loop a preheader.  Done before anything else, since
+ * inserting them renumbers blocks. */
+static void add_preheaders(IRCfg *cfg) {
+    for (int b = 0; b < cfg->block_count; b++) {
+        int h = b;
+        if (ir_cfg_preheader(cfg, &h) >= 0) b = h;
+    }
+}
+
+int ir_opt_licm(IRCfg *cfg) {
+    add_preheaders(cfg);
+
+    int nv = cfg->prog->next_vreg;
+    int n = cfg->block_count;
+    int *def_block = malloc((nv > 0 ? nv : 1) * sizeof(int));
+    char *safe_divisor = calloc(nv + 1, 1);
+    for (int v = 0; v < nv; v++) def_block[v] = -1;
+    for (int b = 0; b < n; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        for (int ph = 0; ph < blk->phi_count; ph++)
+            def_block[blk->phis[ph].dst] = b;
+        for (int i = 0; i < blk->instr_count; i++) {
+            int d = ir_instr_def(&blk->instrs[i]);
+            if (d < 0) continue;
+            def_block[d] = b;
+            if (blk->instrs[i].op == IR_CONST_INT)
+                safe_divisor[d] = blk->instrs[i].imm != 0 && blk->instrs[i].imm != -1;
+        }
+    }
+
+    char *in_loop = malloc(n > 0 ? n : 1);
+    int changed = 0;
+    for (int k = n - 1; k >= 0; k--) {
+        int h = cfg->rpo[k];
+        if (!ir_cfg_natural_loop(cfg, h, in_loop)) continue;
+        int pre = -1;
+        for (int p = 0; p < cfg->blocks[h].pred_count; p++)
+            if (!in_loop[cfg->blocks[h].preds[p]]) pre = cfg->blocks[h].preds[p];
+        if (pre < 0) continue;
+        IRBlock *pb = &cfg->blocks[pre];
+
+        /* Dominators before the blocks they dominate, so an operand
+         * hoisted earlier in the walk counts as outside already */
+        for (int r = 0; r < n; r++) {
+            int b = cfg->rpo[r];
+            if (!in_loop[b]) continue;
+            IRBlock *blk = &cfg->blocks[b];
+            int out = 0;
+            for (int i = 0; i < blk->instr_count; i++) {
+                IRInstr ir = blk->instrs[i];
+                int hoist = !instr_has_effect(&ir, safe_divisor) &&
+                            ir.op != IR_CONST_STR && ir.op != IR_LOAD_LOCAL &&
+                            ir.op != IR_LOAD_ELEM_UNCHECKED &&
+                            ir.op != IR_PARAM && ir_instr_def(&ir) >= 0;
+                int uses[IR_MAX_USES];
+                int nu = ir_instr_uses(&ir, uses);
+                for (int u = 0; u < nu && hoist; u++)
+                    if (def_block[uses[u]] < 0 || in_loop[def_block[uses[u]]]) hoist = 0;
+                if (!hoist) {
+                    blk->instrs[out++] = ir;
+                    continue;
+                }
+                int pos = pb->instr_count;
+                if (pos > 0 && ir_is_terminator(pb->instrs[pos - 1].op)) pos--;
+                ir_block_insert(pb, pos, ir);
+                def_block[ir.dst] = pre;
+                changed = 1;
+            }
+            blk->instr_count = out;
+        }
+    }
+
+    free(in_loop);
+    free(safe_divisor);
+    free(def_block);
+    return changed;
+}
+
+/* ================================================================
+ * Loop unrolling
+ *
+ * Counted loops only: the header holds nothing but phis and the exit
+ * test `br i >= bound`, where i is a basic induction variable with a
+ * constant step s > 0 and bound is defined outside the loop.  The
+ * header must be the only way out, and the loop must contain no other
+ * loop.  Such a loop
+ *
+ *     H:  i = phi(init, i + s); if !(i < bound) goto exit
+ *         body; goto H
+ *
+ * becomes a main loop testing once per `factor` iterations, followed
+ * by the original loop, which runs whatever is left:
+ *
+ *     P:  lim = bound - (factor - 1) * s; if !(lim < bound) goto H
+ *     U:  i' = phi(init, ...); if !(i' < lim) goto H
+ *         body [i = i']; body [i = i' + s]; ...; goto U
+ *     H:  i = phi(init from P, i' from U, i + s from the latch) ...
+ *
+ * i' < lim means the next `factor` iterations would all pass the
+ * original test, so the copies need none.  The lim < bound guard sends
+ * a bound too close to INT64_MIN for the subtraction straight to the
+ * remainder loop.
+ * ================================================================ */
+
+/* Upper limit on instructions added per loop */
+#define UNROLL_BUDGET 256
+
+typedef struct {
+    int nv;             /* vregs before unrolling; only those get renamed */
+    int *ren;           /* vreg defined in the body -> its copy */
+    int *phi_of;        /* header phi dst -> phi index, else -1 */
+    int *cur;           /* value of each header phi in the current copy */
+} UnrollMap;
+
+static int unroll_value(const UnrollMap *m, int v) {
+    if (v < 0 || v >= m->nv) return v;
+    if (m->phi_of[v] >= 0) return m->cur[m->phi_of[v]];
+    if (m->ren[v] >= 0) return m->ren[v];
+    return v;
+}
+
+/* Unroll the loop headed by h if it is a counted loop; returns the
+ * number of blocks inserted before h (0 if it was left alone) */
+static int unroll_loop(IRCfg *cfg, int h, int factor, const char *known, const int64_t *value) {
+    int n = cfg->block_count;
+    IRBlock *hb = &cfg->blocks[h];
+    if (hb->pred_count != 2 || hb->instr_count != 1) return 0;
+    char *in_loop = malloc(n);
+    int inserted = 0;
+    int *body = NULL;
+    UnrollMap m = { 0, NULL, NULL, NULL };
+    if (ir_cfg_natural_loop(cfg, h, in_loop) != 1) goto done;
+
+    int pi = in_loop[hb->preds[0]] ? 1 : 0;
+    int pre = hb->preds[pi], latch = hb->preds[1 - pi];
+    if (in_loop[pre] || cfg->blocks[pre].succ_count != 1 || cfg->blocks[latch].succ_count != 1)
+        goto done;
+
+    /* Exit test */
+    const IRInstr *test = &hb->instrs[0];
+    if (test->op != IR_BR_CMP || test->imm != IR_CMP_GE) goto done;
+    int iv = test->lhs, bound = test->rhs;
+    if (hb->succ_count != 2 || in_loop[hb->succs[0]] || !in_loop[hb->succs[1]] ||
+        hb->succs[1] == h)
+        goto done;
+    int iv_phi = -1;
+    for (int ph = 0; ph < hb->phi_count; ph++)
+        if (hb->phis[ph].dst == iv) iv_phi = ph;
+    if (iv_phi < 0) goto done;
+
+    /* Body: everything but the header, entry block first.  No exits,
+     * no inner loops, nothing defined in the header used besides its
+     * phis, and the bound and step defined outside. */
+    body = malloc(n * sizeof(int));
+    int nb = 0, size = 0;
+    body[nb++] = hb->succs[1];
+    for (int b = 0; b < n; b++)
+        if (in_loop[b] && b != h && b != hb->succs[1]) body[nb++] = b;
+    int next = hb->phis[iv_phi].args[1 - pi];
+    int64_t step = 0;
+    int step_ok = 0, bound_outside = 1;
+    for (int k = 0; k < nb; k++) {
+        const IRBlock *blk = &cfg->blocks[body[k]];
+        if (blk->succ_count == 0) goto done;
+        if (blk->instr_count > 0 && blk->instrs[blk->instr_count - 1].op == IR_SWITCH)
+            goto done;      /* the copies would share its case table */
+        for (int s = 0; s < blk->succ_count; s++) {
+            int t = blk->succs[s];
+            if (!in_loop[t]) goto done;
+            if (t != h && ir_cfg_dominates(cfg, t, body[k])) goto done;
+        }
+        size += blk->instr_count + blk->phi_count;
+        for (int ph = 0; ph < blk->phi_count; ph++)
+            if (blk->phis[ph].dst == bound) bound_outside = 0;
+        for (int i = 0; i < blk->instr_count; i++) {
+            const IRInstr *ir = &blk->instrs[i];
+            if (ir_instr_def(ir) == bound) bound_outside = 0;
+            if (ir_instr_def(ir) != next) continue;
+            if (ir->op == IR_ADD && ir->lhs == iv && known[ir->rhs]) {
+                step = value[ir->rhs];
+                step_ok = 1;
+            } else if (ir->op == IR_ADD && ir->rhs == iv && known[ir->lhs]) {
+                step = value[ir->lhs];
+                step_ok = 1;
+            }
+        }
+    }
+    for (int ph = 0; ph < hb->phi_count; ph++)
+        if (hb->phis[ph].dst == bound) bound_outside = 0;
+    if (!step_ok || !bound_outside || step <= 0 || step > INT32_MAX) goto done;
+    if (size * factor > UNROLL_BUDGET) factor = UNROLL_BUDGET / (size > 0 ? size : 1);
+    if (factor < 2) goto done;
+
+    /* Rename maps: body defs get a fresh vreg per copy */
+    m.nv = cfg->prog->next_vreg;
+    m.ren = malloc(m.nv * sizeof(int));
+    m.phi_of = malloc(m.nv * sizeof(int));
+    m.cur = malloc((hb->phi_count > 0 ? hb->phi_count : 1) * sizeof(int));
+    for (int v = 0; v < m.nv; v++) m.phi_of[v] = -1;
+    for (int ph = 0; ph < hb->phi_count; ph++) m.phi_of[hb->phis[ph].dst] = ph;
+    int *slot_of = malloc(n * sizeof(int));   /* body block -> position in body[] */
+    for (int b = 0; b < n; b++) slot_of[b] = -1;
+    for (int k = 0; k < nb; k++) slot_of[body[k]] = k;
+    int entry_arg = pi, latch_arg = 1 - pi;
+
+    /* Make room: U, then the copies in body[] order, before the header */
+    inserted = 1 + factor * nb;
+    ir_cfg_insert_blocks(cfg, h, inserted);
+    int u = h, H = h + inserted;
+#define SHIFT(b) ((b) >= h ? (b) + inserted : (b))
+    pre = SHIFT(pre);
+    latch = SHIFT(latch);
+    for (int k = 0; k < nb; k++) body[k] = SHIFT(body[k]);
+    int *old_slot = slot_of;
+    slot_of = malloc((n + inserted) * sizeof(int));
+    for (int b = 0; b < n + inserted; b++) slot_of[b] = -1;
+    for (int b = 0; b < n; b++) if (old_slot[b] >= 0) slot_of[SHIFT(b)] = old_slot[b];
+    free(old_slot);
+#undef SHIFT
+#define COPY(c, k) (u + 1 + (c) * nb + (k))
+    hb = &cfg->blocks[H];
+
+    if (hb->label < 0) hb->label = ir_alloc_label(cfg->prog);
+
+    /* U: phis for the header values (the second argument comes from
+     * the last copy), then i' < lim */
+    IRBlock *ub = &cfg->blocks[u];
+    ub->label = ir_alloc_label(cfg->prog);
+    ir_block_add_pred(ub, pre);
+    ir_block_add_pred(ub, COPY(factor - 1, slot_of[latch]));
+    for (int ph = 0; ph < hb->phi_count; ph++) {
+        IRPhi *phi = ir_block_add_phi(ub, ir_alloc_vreg(cfg->prog), hb->phis[ph].slot);
+        phi->args[0] = hb->phis[ph].args[entry_arg];
+        m.cur[ph] = phi->dst;
+    }
+
+    /* P: lim = bound - (factor - 1) * s; enter U only if that did not wrap */
+    IRBlock *pb = &cfg->blocks[pre];
+    if (pb->instr_count > 0 && pb->instrs[pb->instr_count - 1].op == IR_JMP)
+        pb->instr_count--;
+    int dist = ir_alloc_vreg(cfg->prog), lim = ir_alloc_vreg(cfg->prog);
+    ir_block_append(pb, make_const(dist, (factor - 1) * step));
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IR_SUB; ins.dst = lim; ins.lhs = bound; ins.rhs = dist;
+    ir_block_append(pb, ins);
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IR_BR_CMP; ins.imm = IR_CMP_GE; ins.dst = -1;
+    ins.lhs = lim; ins.rhs = bound; ins.label_id = hb->label;
+    ir_block_append(pb, ins);
+    pb->succ_count = 0;
+    ir_block_add_succ(pb, H);
+    ir_block_add_succ(pb, u);
+
+    ins.lhs = m.cur[iv_phi]; ins.rhs = lim;
+    ir_block_append(ub, ins);
+    ir_block_add_succ(ub, H);
+    ir_block_add_succ(ub, COPY(0, 0));
+
+    /* The copies */
+    for (int c = 0; c < factor; c++) {
+        for (int v = 0; v < m.nv; v++) m.ren[v] = -1;
+        for (int k = 0; k < nb; k++) {
+            const IRBlock *src = &cfg->blocks[body[k]];
+            for (int ph = 0; ph < src->phi_count; ph++)
+                m.ren[src->phis[ph].dst] = ir_alloc_vreg(cfg->prog);
+            for (int i = 0; i < src->instr_count; i++) {
+                int d = ir_instr_def(&src->instrs[i]);
+                if (d >= 0) m.ren[d] = ir_alloc_vreg(cfg->prog);
+            }
+        }
+        for (int k = 0; k < nb; k++) {
+            IRBlock *dst = &cfg->blocks[COPY(c, k)];
+            const IRBlock *src = &cfg->blocks[body[k]];
+            dst->label = ir_alloc_label(cfg->prog);
+            for (int p = 0; p < src->pred_count; p++) {
+                int from = src->preds[p];
+                if (from == H) from = c == 0 ? u : COPY(c - 1, slot_of[latch]);
+                else from = COPY(c, slot_of[from]);
+                ir_block_add_pred(dst, from);
+            }
+            for (int ph = 0; ph < src->phi_count; ph++) {
+                IRPhi *phi = ir_block_add_phi(dst, m.ren[src->phis[ph].dst], src->phis[ph].slot);
+                for (int p = 0; p < src->pred_count; p++)
+                    phi->args[p] = unroll_value(&m, src->phis[ph].args[p]);
+            }
+            for (int i = 0; i < src->instr_count; i++) {
+                IRInstr ir = src->instrs[i];
+                int *refs[IR_MAX_USES];
+                int nr = ir_instr_use_refs(&ir, refs);
+                for (int r = 0; r < nr; r++) *refs[r] = unroll_value(&m, *refs[r]);
+                if (ir_instr_def(&ir) >= 0) ir.dst = m.ren[ir.dst];
+                ir_block_append(dst, ir);
+            }
+            for (int s = 0; s < src->succ_count; s++) {
+                int t = src->succs[s];
+                if (t == H) t = c + 1 < factor ? COPY(c + 1, 0) : u;
+                else t = COPY(c, slot_of[t]);
+                ir_block_add_succ(dst, t);
+            }
+        }
+        /* Header values entering the next copy */
+        int *next_cur = malloc((hb->phi_count > 0 ? hb->phi_count : 1) * sizeof(int));
+        for (int ph = 0; ph < hb->phi_count; ph++)
+            next_cur[ph] = unroll_value(&m, hb->phis[ph].args[latch_arg]);
+        memcpy(m.cur, next_cur, hb->phi_count * sizeof(int));
+        free(next_cur);
+    }
+    for (int ph = 0; ph < hb->phi_count; ph++)
+        ub->phis[ph].args[1] = m.cur[ph];
+
+    /* Every copy has a label; point the copied jumps at their copies */
+    for (int b = u + 1; b < H; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        IRInstr *term = blk->instr_count > 0 ? &blk->instrs[blk->instr_count - 1] : NULL;
+        if (term && (term->op == IR_JMP || ir_is_cond_branch(term->op)))
+            term->label_id = cfg->blocks[blk->succs[0]].label;
+    }
+
+    /* H: one more entering edge, from U, carrying U's phis */
+    ir_block_add_pred(hb, u);
+    for (int ph = 0; ph < hb->phi_count; ph++) {
+        hb->phis[ph].args = realloc(hb->phis[ph].args, hb->pred_count * sizeof(int));
+        hb->phis[ph].args[hb->pred_count - 1] = ub->phis[ph].dst;
+    }
+#undef COPY
+    free(slot_of);
+    ir_cfg_compute_dominators(cfg);
+
+done:
+    free(m.cur);
+    free(m.phi_of);
+    free(m.ren);
+    free(body);
+    free(in_loop);
+    return inserted;
+}
+
+int ir_opt_unroll(IRCfg *cfg, int factor) {
+    if (factor < 2) return 0;
+    add_preheaders(cfg);
+
+    int changed = 0;
+    char *known = NULL;
+    int64_t *value = NULL;
+    for (int b = 0; b < cfg->block_count; b++) {
+        if (!known || changed) {
+            int nv = cfg->prog->next_vreg;
+            free(known);
+            free(value);
+            known = calloc(nv + 1, 1);
+            value = malloc((nv > 0 ? nv : 1) * sizeof(int64_t));
+            for (int k = 0; k < cfg->block_count; k++) {
+                const IRBlock *blk = &cfg->blocks[k];
+                for (int i = 0; i < blk->instr_count; i++) {
+                    if (blk->instrs[i].op != IR_CONST_INT) continue;
+                    known[blk->instrs[i].dst] = 1;
+                    value[blk->instrs[i].dst] = blk->instrs[i].imm;
+                }
+            }
+        }
+        /* Skip over U and the copies; the remainder loop is not redone */
+        int added = unroll_loop(cfg, b, factor, known, value);
+        if (added > 0) {
+            changed = 1;
+            b += added;
+        }
+    }
+    free(value);
+    free(known);
+    return changed;
+}
+
+/* ================================================================
+ * If-conversion
+ *
+ * A two-way branch whose sides only compute a few values before
+ * meeting again (a diamond, or a triangle when one side goes straight
+ * to the join) becomes straight-line code: both sides run and every
+ * phi of the join picks its value with an IR_SELECT, which the x86-64
+ * backend lowers to cmov.  A branch on data mispredicts about half the
+ * time; running the other side costs a handful of instructions.  Only
+ * instructions that cannot trap run speculatively, with the same rules
+ * for division and table loads as LICM.
+ * ================================================================ */
+
+#define IFCVT_SIDE_LIMIT 4      /* instructions run speculatively per side */
+#define IFCVT_PHI_LIMIT 4       /* selects per join */
+
+/* Instructions block b adds when it runs unconditionally, or -1 if it
+ * cannot: it must be entered only from h, go only to join and have no
+ * effect beyond its values.  The join itself costs nothing. */
+static int ifcvt_side_cost(const IRCfg *cfg, int h, int b, int join, const char *safe_divisor) {
+    if (b == join) return 0;
+    const IRBlock *blk = &cfg->blocks[b];
+    if (b == h || blk->pred_count != 1 || blk->phi_count > 0) return -1;
+    if (blk->succ_count != 1 || blk->succs[0] != join) return -1;
+    int cost = 0;
+    for (int i = 0; i < blk->instr_count; i++) {
+        if (blk->instrs[i].op == IR_JMP) continue;
+        if (instr_has_effect(&blk->instrs[i], safe_divisor) ||
+            blk->instrs[i].op == IR_LOAD_ELEM_UNCHECKED) return -1;
+        cost++;
+    }
+    return cost <= IFCVT_SIDE_LIMIT ? cost : -1;
+}
+
+/* Predecessor of join on the way through side b of h */
+static int ifcvt_pred_index(const IRBlock *jb, int h, int b, int join) {
+    int via = b == join ? h : b;
+    for (int p = 0; p < jb->pred_count; p++)
+        if (jb->preds[p] == via) return p;
+    return -1;
+}
+
+int ir_opt_if_convert(IRCfg *cfg) {
+    int nv = cfg->prog->next_vreg;
+    char *safe_divisor = calloc(nv + 1, 1);
+    for (int b = 0; b < cfg->block_count; b++) {
+        const IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count; i++)
+            if (blk->instrs[i].op == IR_CONST_INT)
+                safe_divisor[blk->instrs[i].dst] = blk->instrs[i].imm != 0 && blk->instrs[i].imm != -1;
+    }
+
+    int changed = 0;
+    for (int h = 0; h < cfg->block_count; h++) {
+        IRBlock *hb = &cfg->blocks[h];
+        IRInstr *term = block_terminator(hb);
+        if (!term || !ir_is_cond_branch(term->op) || hb->succ_count != 2) continue;
+
+        /* succs[0] is the taken side, succs[1] the fallthrough */
+        int t = hb->succs[0], f = hb->succs[1];
+        const IRBlock *tb = &cfg->blocks[t], *fb = &cfg->blocks[f];
+        if (t == f) continue;
+        int join;
+        if (tb->succ_count == 1 && tb->succs[0] == f) join = f;
+        else if (fb->succ_count == 1 && fb->succs[0] == t) join = t;
+        else if (tb->succ_count == 1) join = tb->succs[0];
+        else continue;
+        IRBlock *jb = &cfg->blocks[join];
+        if (join == h || jb->pred_count != 2 || jb->phi_count > IFCVT_PHI_LIMIT) continue;
+        if (ifcvt_side_cost(cfg, h, t, join, safe_divisor) < 0 ||
+            ifcvt_side_cost(cfg, h, f, join, safe_divisor) < 0) continue;
+        int pt = ifcvt_pred_index(jb, h, t, join), pf = ifcvt_pred_index(jb, h, f, join);
+        if (pt < 0 || pf < 0 || pt == pf) continue;
+
+        /* Both sides run in h, then each phi becomes a select on the
+         * branch condition */
+        IRInstr br = *term;
+        hb->instr_count--;
+        for (int side = 0; side < 2; side++) {
+            IRBlock *sb = &cfg->blocks[side == 0 ? t : f];
+            if (sb == jb) continue;
+            for (int i = 0; i < sb->instr_count; i++)
+                if (sb->instrs[i].op != IR_JMP) ir_block_append(hb, sb->instrs[i]);
+            sb->instr_count = 0;
+            sb->succ_count = 0;
+            sb->pred_count = 0;
+        }
+        for (int ph = 0; ph < jb->phi_count; ph++) {
+            const IRPhi *phi = &jb->phis[ph];
+            IRInstr sel;
+            memset(&sel, 0, sizeof(sel));
+            sel.op = IR_SELECT;
+            sel.dst = phi->dst;
+            sel.lhs = phi->args[pt];
+            sel.rhs = phi->args[pf];
+            if (br.op == IR_BR_CMP) {
+                /* A compare of its own right before each select, so the
+                 * backend can take the flags straight from it */
+                IRInstr c;
+                memset(&c, 0, sizeof(c));
+                c.op = (IROpcode)br.imm;
+                c.dst = ir_alloc_vreg(cfg->prog);
+                c.lhs = br.lhs;
+                c.rhs = br.rhs;
+                ir_block_append(hb, c);
+                sel.src = c.dst;
+            } else {
+                sel.src = br.src;
+                if (br.op == IR_JZ) {
+                    sel.lhs = phi->args[pf];
+                    sel.rhs = phi->args[pt];
+                }
+            }
+            ir_block_append(hb, sel);
+        }
+        while (jb->phi_count > 0)
+            block_remove_phi(jb, jb->phi_count - 1);
+
+        if (jb->label < 0) jb->label = ir_alloc_label(cfg->prog);
+        IRInstr jmp;
+        memset(&jmp, 0, sizeof(jmp));
+        jmp.op = IR_JMP;
+        jmp.dst = -1;
+        jmp.src = -1;
+        jmp.label_id = jb->label;
+        ir_block_append(hb, jmp);
+        hb->succ_count = 0;
+        ir_block_add_succ(hb, join);
+        jb->pred_count = 0;
+        ir_block_add_pred(jb, h);
+        changed = 1;
+    }
+
+    if (changed)
+        ir_cfg_compute_dominators(cfg);
+    free(safe_divisor);
+    return changed;
+}
+
+/* ================================================================
+ * Scalar replacement of objects
+ *
+ * Runs on slot form, before SSA construction.  An object from
+ * IR_STACK_ALLOC reaches its uses through vregs and the slots of the
+ * variables holding it.  Closing over both gives the set of vregs that
+ * can only be its address and the slots that only ever hold it.  When
+ * the address does nothing but get stored to those slots, read or
+ * written at a field, or counted (stack objects are never freed), each
+ * field becomes a slot of its own, which SSA construction then turns
+ * into plain vregs, and the object disappears.
+ * ================================================================ */
+
+/* Replace the object of the IR_STACK_ALLOC defining vreg obj (size
+ * bytes), if it never escapes */
+static int scalar_replace_object(IRCfg *cfg, int obj, int size) {
+    IRProgram *prog = cfg->prog;
+    int nv = prog->next_vreg, ns = prog->next_slot;
+    char *addr = calloc(nv + 1, 1);
+    char *held = calloc(ns + 1, 1);
+    addr[obj] = 1;
+
+    /* Close over the slots the address is stored to and the loads of
+     * those slots */
+    for (int grew = 1; grew; ) {
+        grew = 0;
+        for (int b = 0; b < cfg->block_count; b++) {
+            IRBlock *blk = &cfg->blocks[b];
+            for (int i = 0; i < blk->instr_count; i++) {
+                IRInstr *ir = &blk->instrs[i];
+                if (ir->op == IR_STORE_LOCAL && addr[ir->src] && !held[ir->slot])
+                    grew = held[ir->slot] = 1;
+                else if (ir->op == IR_LOAD_LOCAL && held[ir->slot] && !addr[ir->dst])
+                    grew = addr[ir->dst] = 1;
+            }
+        }
+    }
+
+    int ok = 1;
+    for (int b = 0; b < cfg->block_count && ok; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count && ok; i++) {
+            IRInstr *ir = &blk->instrs[i];
+            switch (ir->op) {
+            case IR_STORE_LOCAL:
+                ok = addr[ir->src] == held[ir->slot];
+                break;
+            case IR_OBJ_LOAD:
+                ok = !addr[ir->src] || (ir->imm % 8 == 0 && ir->imm >= 0 && ir->imm < size);
+                break;
+            case IR_OBJ_STORE:
+                ok = !addr[ir->src] &&
+                     (!addr[ir->lhs] || (ir->imm % 8 == 0 && ir->imm >= 0 && ir->imm < size));
+                break;
+            case IR_OBJ_RETAIN: case IR_OBJ_RELEASE:
+                break;
+            default: {
+                int uses[IR_MAX_USES];
+                int nu = ir_instr_uses(ir, uses);
+                for (int u = 0; u < nu; u++)
+                    if (addr[uses[u]]) ok = 0;
+                break;
+            }
+            }
+        }
+    }
+    for (int b = 0; b < cfg->block_count && ok; b++)
+        for (int ph = 0; ph < cfg->blocks[b].phi_count; ph++)
+            if (addr[cfg->blocks[b].phis[ph].dst]) ok = 0;
+
+    if (ok) {
+        int *field = malloc(((size + 7) / 8) * sizeof(int));
+        for (int k = 0; k < (size + 7) / 8; k++) field[k] = ir_alloc_slot(prog);
+        for (int b = 0; b < cfg->block_count; b++) {
+            IRBlock *blk = &cfg->blocks[b];
+            for (int i = 0; i < blk->instr_count; i++) {
+                IRInstr *ir = &blk->instrs[i];
+                if (ir->op == IR_OBJ_LOAD && addr[ir->src]) {
+                    ir->op = IR_LOAD_LOCAL;
+                    ir->slot = field[ir->imm / 8];
+                } else if (ir->op == IR_OBJ_STORE && addr[ir->lhs]) {
+                    ir->op = IR_STORE_LOCAL;
+                    ir->slot = field[ir->imm / 8];
+                    ir->lhs = 0;
+                } else if (((ir->op == IR_OBJ_RETAIN || ir->op == IR_OBJ_RELEASE) && addr[ir->src]) ||
+                           (ir->op == IR_STORE_LOCAL && held[ir->slot]) ||
+                           (ir->op == IR_LOAD_LOCAL && held[ir->slot]) ||
+                           (ir->op == IR_STACK_ALLOC && ir->dst == obj)) {
+                    ir_block_remove(blk, i--);
+                }
+            }
+        }
+        free(field);
+    }
+    free(addr);
+    free(held);
+    return ok;
+}
+
+int ir_opt_scalar_replace(IRCfg *cfg) {
+    int changed = 0;
+    for (int b = 0; b < cfg->block_count; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count; i++) {
+            IRInstr *ir = &blk->instrs[i];
+            if (ir->op != IR_STACK_ALLOC) continue;
+            int obj = ir->dst, size = (int)ir->imm;
+            if (scalar_replace_object(cfg, obj, size)) {
+                /* Instructions of this block may be gone too: rescan it */
+                changed = 1;
+                i = -1;
+            }
+        }
+    }
+    return changed;
+}
+
+/* ================================================================
+ * Driver
+ * ================================================================ */
+
+static void opt_verify(const IRCfg *cfg, const char *pass) {
+    if (ir_cfg_verify(cfg))
+        diag_error_no_loc("internal error: IR invalid after %s", pass);
+}
+
+/* Iterate: folding a branch can make phis trivial, and removing phis
+ * can expose more constants */
+static void cleanup(IRCfg *cfg) {
+    for (int round = 0; round < 4; round++) {
+        int changed = 0;
+        changed |= ir_opt_sccp(cfg);
+        opt_verify(cfg, "constant propagation");
+        changed |= ir_opt_copy_prop(cfg);
+        opt_verify(cfg, "copy propagation");
+        changed |= ir_opt_dce(cfg);
+        opt_verify(cfg, "dead-code elimination");
+        changed |= ir_opt_simplify_cfg(cfg);
+        opt_verify(cfg, "CFG simplification");
+        if (!changed) break;
+    }
+}
+
+static void optimize_function(IRCfg *cfg, int opt_level, int unroll) {
+    if (ir_opt_scalar_replace(cfg))
+        opt_verify(cfg, "scalar replacement");
+    ir_ssa_construct(cfg);
+    opt_verify(cfg, "SSA construction");
+
+    cleanup(cfg);
+    ir_opt_elide_bounds_checks(cfg);
+    opt_verify(cfg, "bounds-check elimination");
+    ir_opt_strength_reduce(cfg);
+    opt_verify(cfg, "strength reduction");
+    ir_opt_gvn(cfg);
+    opt_verify(cfg, "value numbering");
+    ir_opt_licm(cfg);
+    opt_verify(cfg, "loop-invariant code motion");
+    cleanup(cfg);
+
+    if (opt_level >= 2 && ir_opt_unroll(cfg, unroll > 0 ? unroll : IR_UNROLL_DEFAULT)) {
+        opt_verify(cfg, "loop unrolling");
+        ir_opt_gvn(cfg);
+        opt_verify(cfg, "value numbering");
+        cleanup(cfg);
+    }
+
+    if (ir_opt_if_convert(cfg)) {
+        opt_verify(cfg, "if-conversion");
+        cleanup(cfg);
+    }
+
+    ir_ssa_destruct(cfg);
+    opt_verify(cfg, "leaving SSA");
+}
+
+void ir_optimize(IRProgram *prog, int opt_level, int unroll) {
+    if (opt_level <= 0) return;
+
+    int *starts;
+    int n = ir_program_functions(prog, &starts);
+
+    /* Linearized functions are collected in a scratch program; vreg,
+     * slot and label numbering stays with prog */
+    IRProgram out;
+    ir_init(&out);
+    for (int f = 0; f < n; f++) {
+        int end = f + 1 < n ? starts[f + 1] : prog->instr_count;
+        IRCfg cfg;
+        ir_cfg_build(&cfg, prog, starts[f], end);
+        opt_verify(&cfg, "CFG construction");
+        optimize_function(&cfg, opt_level, unroll);
+        ir_cfg_linearize(&cfg, &out);
+        ir_cfg_free(&cfg);
+    }
+    free(starts);
+
+    free(prog->instrs);
+    prog->instrs = out.instrs;
+    prog->instr_count = out.instr_count;
+    prog->instr_cap = out.instr_cap;
+    free(out.strings);
+}
@@ -0,0 +1,78 @@
+#ifndef IR_OPT_H
+#define IR_OPT_H
+
+#include "codegen/ir_cfg.h"
+
+/* ================================================================
+ * IR optimization passes
+ *
+ * Every pass works on one function's CFG in SSA form (see ir_cfg.h),
+ * except scalar replacement, which runs before SSA construction, and
+ * returns nonzero if it changed anything.  ir_optimize runs the
+ * pipeline for an optimization level over a whole program.
+ * ================================================================ */
+
+/* Scalar replacement: an object from IR_STACK_ALLOC whose address only
+ * reaches field loads and stores, reference counting and the slots
+ * of variables that hold nothing else gets a slot per field instead */
+int ir_opt_scalar_replace(IRCfg *cfg);
+
+/* Sparse conditional constant propagation (Wegman-Zadeck): folds
+ * values that are constant on every executable path, resolves
+ * branches on them and drops blocks that can never run */
+int ir_opt_sccp(IRCfg *cfg);
+
+/* Copy propagation: phis whose incoming values are all the same vreg
+ * (ignoring the phi itself) are replaced by that vreg */
+int ir_opt_copy_prop(IRCfg *cfg);
+
+/* Dead-code elimination: removes instructions and phis whose results
+ * are never used and which have no side effects */
+int ir_opt_dce(IRCfg *cfg);
+
+/* CFG cleanup: bypasses empty forwarding blocks and merges a block
+ * into its only predecessor when that predecessor has no other
+ * successor */
+int ir_opt_simplify_cfg(IRCfg *cfg);
+
+/* Bounds-check elimination: table loads whose index is provably in
+ * range, from its definition and the branches that lead to it, lose
+ * their check */
+int ir_opt_elide_bounds_checks(IRCfg *cfg);
+
+/* Strength reduction: multiplies, divides and remainders by constants
+ * become shifts, adds and high multiplies, and constant multiples of
+ * loop induction variables become induction variables of their own */
+int ir_opt_strength_reduce(IRCfg *cfg);
+
+/* Global value numbering over the dominator tree: a pure instruction
+ * computing a value already computed in a dominating block is removed
+ * and its uses take the earlier result */
+int ir_opt_gvn(IRCfg *cfg);
+
+/* Loop-invariant code motion: gives every loop a preheader and moves
+ * pure, non-trapping instructions whose operands are defined outside
+ * the loop there */
+int ir_opt_licm(IRCfg *cfg);
+
+/* Loop unrolling: counted innermost loops (`i < bound` with a constant
+ * step) run factor copies of their body per test, with the original
+ * loop left behind for the remaining iterations */
+int ir_opt_unroll(IRCfg *cfg, int factor);
+
+/* If-conversion: a branch whose sides only compute a few values that
+ * meet at phis runs both sides and picks the values with IR_SELECT */
+int ir_opt_if_convert(IRCfg *cfg);
+
+/* Rewrite every use of a vreg v with map[v] >= 0 to map[v] (map covers
+ * prog->next_vreg entries) */
+void ir_opt_replace_uses(IRCfg *cfg, const int *map);
+
+/* Unroll factor used at -O2 unless one is given */
+#define IR_UNROLL_DEFAULT 4
+
+/* Optimize prog in place at the given level (0 = nothing).  unroll is
+ * the loop unroll factor for -O2 (0 for the default, 1 to disable). */
+void ir_optimize(IRProgram *prog, int opt_level, int unroll);
+
+#endif
@@ -0,0 +1,257 @@
+#include "codegen/ir_regalloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int value;          /* dense index within the function */
+    int start;          /* first live position (instruction index - start) */
+    int end;            /* last live position */
+    unsigned forbid;    /* registers clobbered somewhere in (start, end] */
+    int reg;
+} Interval;
+
+/* Keys an instruction reads and writes */
+static int instr_keys(const IRProgram *prog, const IRInstr *ir,
+                      int uses[IR_MAX_USES + 1], int *def) {
+    int n = ir_instr_uses(ir, uses);
+    for (int u = 0; u < n; u++) uses[u] += prog->next_slot;
+    *def = ir_instr_def(ir);
+    if (*def >= 0) *def += prog->next_slot;
+    if (ir->op == IR_LOAD_LOCAL) uses[n++] = ir->slot;
+    if (ir->op == IR_STORE_LOCAL) *def = ir->slot;
+    return n;
+}
+
+static int ends_block(IROpcode op) {
+    return op == IR_JMP || ir_is_cond_branch(op) || op == IR_SWITCH ||
+           op == IR_RET || op == IR_EXIT;
+}
+
+static int interval_by_start(const void *a, const void *b) {
+    const Interval *x = a, *y = b;
+    if (x->start != y->start) return x->start - y->start;
+    return x->value - y->value;
+}
+
+unsigned ir_regalloc(const IRProgram *prog, int start, int end,
+                     const IRRegTarget *target, const char *second, int *reg) {
+    int n = end - start;
+    const IRInstr *code = prog->instrs + start;
+
+    /* Dense numbering of the values the function touches.  Until the
+     * results are written back, reg[] maps keys to indices as a sparse
+     * set: reg[key] is valid only if keys[reg[key]] == key, so it needs
+     * no clearing between functions. */
+    int *keys = malloc((3 * n + 1) * sizeof(int));
+    int nvals = 0;
+#define LOCAL(key) (reg[key])
+#define KNOWN(key) (reg[key] >= 0 && reg[key] < nvals && keys[reg[key]] == (key))
+    for (int i = 0; i < n; i++) {
+        int uses[IR_MAX_USES + 1], def;
+        int nu = instr_keys(prog, &code[i], uses, &def);
+        if (def >= 0) uses[nu++] = def;
+        for (int u = 0; u < nu; u++) {
+            if (KNOWN(uses[u])) continue;
+            reg[uses[u]] = nvals;
+            keys[nvals++] = uses[u];
+        }
+    }
+#undef KNOWN
+
+    /* Where each use is read: IR_ARG operands are read by their call */
+    int *read_at = malloc((n > 0 ? n : 1) * sizeof(int));
+    for (int i = n - 1, call = n - 1; i >= 0; i--) {
+        if (code[i].op == IR_CALL) call = i;
+        read_at[i] = code[i].op == IR_ARG ? call : i;
+    }
+
+    /* Basic blocks: a new one at every label and after every terminator */
+    int *bstart = malloc((n + 1) * sizeof(int));
+    int nblocks = 0;
+    int *label_block = malloc((prog->next_label > 0 ? prog->next_label : 1) * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || code[i].op == IR_LABEL || ends_block(code[i - 1].op))
+            bstart[nblocks++] = i;
+        if (code[i].op == IR_LABEL)
+            label_block[code[i].label_id] = nblocks - 1;
+    }
+    bstart[nblocks] = n;
+
+    /* Per-block use/def, then live-in/live-out to a fixed point */
+    int words = (nvals + 63) / 64;
+    if (words == 0) words = 1;
+    uint64_t *use = calloc((size_t)nblocks * words, sizeof(uint64_t));
+    uint64_t *def = calloc((size_t)nblocks * words, sizeof(uint64_t));
+    uint64_t *in = calloc((size_t)nblocks * words, sizeof(uint64_t));
+    uint64_t *out = calloc((size_t)nblocks * words, sizeof(uint64_t));
+
+    /* Successors of block b are succ[succ_start[b] .. succ_start[b + 1]) */
+    int *succ_start = malloc((nblocks + 1) * sizeof(int));
+    int nsucc = 0, succ_cap = 2 * nblocks + 1;
+    int *succ = malloc(succ_cap * sizeof(int));
+#define ADD_SUCC(t) do { \
+        if (nsucc == succ_cap) succ = realloc(succ, (succ_cap *= 2) * sizeof(int)); \
+        succ[nsucc++] = (t); \
+    } while (0)
+
+#define BIT_SET(set, b, v)  ((set)[(size_t)(b) * words + (v) / 64] |= (uint64_t)1 << ((v) % 64))
+#define BIT_TEST(set, b, v) (((set)[(size_t)(b) * words + (v) / 64] >> ((v) % 64)) & 1)
+
+    for (int b = 0; b < nblocks; b++) {
+        for (int i = bstart[b]; i < bstart[b + 1]; i++) {
+            int uses[IR_MAX_USES + 1], d;
+            int nu = instr_keys(prog, &code[i], uses, &d);
+            for (int u = 0; u < nu; u++) {
+                int v = LOCAL(uses[u]);
+                if (!BIT_TEST(def, b, v)) BIT_SET(use, b, v);
+            }
+            if (d >= 0) BIT_SET(def, b, LOCAL(d));
+        }
+        succ_start[b] = nsucc;
+        const IRInstr *last = &code[bstart[b + 1] - 1];
+        int next = b + 1 < nblocks ? b + 1 : -1;
+        if (last->op == IR_JMP) {
+            ADD_SUCC(label_block[last->label_id]);
+        } else if (ir_is_cond_branch(last->op)) {
+            ADD_SUCC(label_block[last->label_id]);
+            if (next >= 0) ADD_SUCC(next);
+        } else if (last->op == IR_SWITCH) {
+            const IRSwitch *sw = &prog->switches[last->imm];
+            ADD_SUCC(label_block[last->label_id]);
+            for (int k = 0; k < sw->count; k++) ADD_SUCC(label_block[sw->labels[k]]);
+        } else if (last->op != IR_RET && last->op != IR_EXIT && next >= 0) {
+            ADD_SUCC(next);
+        }
+    }
+    succ_start[nblocks] = nsucc;
+#undef ADD_SUCC
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = nblocks - 1; b >= 0; b--) {
+            uint64_t *bo = &out[(size_t)b * words], *bi = &in[(size_t)b * words];
+            for (int s = succ_start[b]; s < succ_start[b + 1]; s++) {
+                const uint64_t *si = &in[(size_t)succ[s] * words];
+                for (int w = 0; w < words; w++) bo[w] |= si[w];
+            }
+            for (int w = 0; w < words; w++) {
+                uint64_t v = use[(size_t)b * words + w] | (bo[w] & ~def[(size_t)b * words + w]);
+                if (v != bi[w]) {
+                    bi[w] = v;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    /* One interval per value over every position it is live at */
+    Interval *iv = malloc((nvals > 0 ? nvals : 1) * sizeof(Interval));
+    for (int v = 0; v < nvals; v++) {
+        iv[v].value = v;
+        iv[v].start = n;
+        iv[v].end = -1;
+        iv[v].forbid = 0;
+        iv[v].reg = -1;
+    }
+#define EXTEND(v, p) do { \
+        if ((p) < iv[v].start) iv[v].start = (p); \
+        if ((p) > iv[v].end) iv[v].end = (p); \
+    } while (0)
+    for (int b = 0; b < nblocks; b++) {
+        for (int w = 0; w < words; w++) {
+            for (uint64_t m = in[(size_t)b * words + w]; m; m &= m - 1)
+                EXTEND(w * 64 + __builtin_ctzll(m), bstart[b]);
+            for (uint64_t m = out[(size_t)b * words + w]; m; m &= m - 1)
+                EXTEND(w * 64 + __builtin_ctzll(m), bstart[b + 1] - 1);
+        }
+        for (int i = bstart[b]; i < bstart[b + 1]; i++) {
+            int uses[IR_MAX_USES + 1], d;
+            int nu = instr_keys(prog, &code[i], uses, &d);
+            for (int u = 0; u < nu; u++) EXTEND(LOCAL(uses[u]), read_at[i]);
+            if (d >= 0) EXTEND(LOCAL(d), i);
+        }
+    }
+#undef EXTEND
+#undef BIT_SET
+#undef BIT_TEST
+
+    /* Registers clobbered inside each interval, from per-register
+     * prefix counts of the clobbering instructions */
+    int *clob = calloc((size_t)target->count * (n + 1), sizeof(int));
+    for (int i = 0; i < n; i++) {
+        unsigned m = target->clobbers(&code[i]);
+        for (int r = 0; r < target->count; r++)
+            clob[(size_t)r * (n + 1) + i + 1] = clob[(size_t)r * (n + 1) + i] + ((m >> r) & 1);
+    }
+    for (int v = 0; v < nvals; v++)
+        for (int r = 0; r < target->count; r++)
+            if (clob[(size_t)r * (n + 1) + iv[v].end + 1] > clob[(size_t)r * (n + 1) + iv[v].start + 1])
+                iv[v].forbid |= 1u << r;
+
+    /* Linear scan */
+    qsort(iv, nvals, sizeof(Interval), interval_by_start);
+    Interval **active = malloc((target->count + 1) * sizeof(Interval *));
+    int nactive = 0;
+    unsigned busy = 0, handed = 0;
+    for (int k = 0; k < nvals; k++) {
+        Interval *cur = &iv[k];
+
+        /* Expire intervals that ended before this one starts */
+        int kept = 0;
+        for (int a = 0; a < nactive; a++) {
+            if (active[a]->end < cur->start) busy &= ~(1u << active[a]->reg);
+            else active[kept++] = active[a];
+        }
+        nactive = kept;
+
+        /* Registers of the value's class are lo .. hi-1 */
+        int lo = 0, hi = target->split;
+        if (second && second[keys[cur->value]]) {
+            lo = target->split;
+            hi = target->count;
+        }
+        int r = lo;
+        while (r < hi && (((busy | cur->forbid) >> r) & 1)) r++;
+        if (r < hi) {
+            cur->reg = r;
+            busy |= 1u << r;
+            handed |= 1u << r;
+            active[nactive++] = cur;
+            continue;
+        }
+
+        /* Spill whichever usable interval lives longest */
+        int victim = -1;
+        for (int a = 0; a < nactive; a++) {
+            if (active[a]->reg < lo || active[a]->reg >= hi ||
+                ((cur->forbid >> active[a]->reg) & 1))
+                continue;
+            if (victim < 0 || active[a]->end > active[victim]->end) victim = a;
+        }
+        if (victim >= 0 && active[victim]->end > cur->end) {
+            cur->reg = active[victim]->reg;
+            active[victim]->reg = -1;
+            active[victim] = cur;
+        }
+    }
+
+#undef LOCAL
+    for (int k = 0; k < nvals; k++)
+        reg[keys[iv[k].value]] = iv[k].reg;
+
+    free(active);
+    free(clob);
+    free(iv);
+    free(succ);
+    free(succ_start);
+    free(out);
+    free(in);
+    free(def);
+    free(use);
+    free(label_block);
+    free(bstart);
+    free(read_at);
+    free(keys);
+    return handed;
+}
@@ -0,0 +1,47 @@
+#ifndef IR_REGALLOC_H
+#define IR_REGALLOC_H
+
+#include "codegen/ir.h"
+
+/* ================================================================
+ * Linear-scan register allocation over IR functions
+ *
+ * Slots and vregs are both just values here; a value is identified by
+ * its key: slot s is key s, vreg v is key prog->next_slot + v.  Each
+ * value gets one live interval, the span of instructions from its
+ * first to its last live point (found by block-level liveness, so an
+ * interval covers every loop it is live around).  Intervals are then
+ * handed registers in order of start (Poletto and Sarkar); when none
+ * is free, whichever live interval ends last goes to the stack.
+ *
+ * Uses by IR_ARG count as happening at the IR_CALL they feed, since
+ * that is when the backend reads them.
+ *
+ * A target may split its registers into two classes, such as general
+ * and vector registers; the caller says which values belong to the
+ * second, and each class is scanned from its own registers.
+ * ================================================================ */
+
+/* Registers of a target, numbered 0 .. count-1 in order of preference
+ * within each class: 0 .. split-1 are the first class, split .. count-1
+ * the second (empty when split == count) */
+typedef struct {
+    int count;
+    int split;
+    /* Registers (bitmask over 0 .. count-1) whose contents do not
+     * survive ir, or that ir writes before it has read all its inputs.
+     * A value live across such an instruction never gets them. */
+    unsigned (*clobbers)(const IRInstr *ir);
+} IRRegTarget;
+
+/* Allocate the function in instructions [start, end) of prog.  Values
+ * whose key is set in second (NULL for none) get registers of the
+ * second class, the others of the first.  For the key of every value
+ * the function touches, reg[key] is set to its register or -1 if it
+ * lives on the stack; other entries are left alone.  reg and second
+ * cover prog->next_slot + prog->next_vreg entries.  Returns the mask of
+ * registers handed out. */
+unsigned ir_regalloc(const IRProgram *prog, int start, int end,
+                     const IRRegTarget *target, const char *second, int *reg);
+
+#endif
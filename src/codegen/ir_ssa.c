@@ -0,0 +1,262 @@
+#include "codegen/ir_cfg.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ================================================================
+ * SSA construction
+ *
+ * Vregs are already single-assignment; the only mutable state is the
+ * local slots.  Construction follows Cytron et al.: phis for a slot go
+ * on the iterated dominance frontier of the blocks that store it, then
+ * a walk of the dominator tree replaces every load with the value that
+ * reaches it and drops the loads and stores.  A slot read before any
+ * store reaches it takes the value of a shared `const 0` placed at the
+ * top of the entry block.
+ * ================================================================ */
+
+typedef struct {
+    IRCfg *cfg;
+    int nslots;
+    int *cur;           /* reaching value per slot (-1 = none yet) */
+    int *undo_slot;     /* log of cur[] overwrites, unwound per block */
+    int *undo_val;
+    int undo_count;
+    int undo_cap;
+    int *vmap;          /* value each removed load's vreg stands for */
+    int vmap_count;
+    int undef;          /* vreg of the shared zero, -1 until needed */
+    int **children;     /* dominator tree */
+    int *child_count;
+} SSABuilder;
+
+static void ssa_set_cur(SSABuilder *sb, int slot, int value) {
+    if (sb->undo_count == sb->undo_cap) {
+        sb->undo_cap = sb->undo_cap ? sb->undo_cap * 2 : 64;
+        sb->undo_slot = realloc(sb->undo_slot, sb->undo_cap * sizeof(int));
+        sb->undo_val = realloc(sb->undo_val, sb->undo_cap * sizeof(int));
+    }
+    sb->undo_slot[sb->undo_count] = slot;
+    sb->undo_val[sb->undo_count] = sb->cur[slot];
+    sb->undo_count++;
+    sb->cur[slot] = value;
+}
+
+static int ssa_reaching(SSABuilder *sb, int slot) {
+    if (sb->cur[slot] >= 0) return sb->cur[slot];
+    if (sb->undef < 0) sb->undef = ir_alloc_vreg(sb->cfg->prog);
+    return sb->undef;
+}
+
+static void ssa_rename(SSABuilder *sb, int b) {
+    IRCfg *cfg = sb->cfg;
+    IRBlock *blk = &cfg->blocks[b];
+    int mark = sb->undo_count;
+
+    for (int ph = 0; ph < blk->phi_count; ph++)
+        ssa_set_cur(sb, blk->phis[ph].slot, blk->phis[ph].dst);
+
+    for (int i = 0; i < blk->instr_count; i++) {
+        IRInstr *ir = &blk->instrs[i];
+        int *refs[IR_MAX_USES];
+        int nr = ir_instr_use_refs(ir, refs);
+        for (int r = 0; r < nr; r++)
+            if (*refs[r] >= 0 && *refs[r] < sb->vmap_count && sb->vmap[*refs[r]] >= 0)
+                *refs[r] = sb->vmap[*refs[r]];
+
+        if (ir->op == IR_LOAD_LOCAL) {
+            sb->vmap[ir->dst] = ssa_reaching(sb, ir->slot);
+            ir_block_remove(blk, i--);
+        } else if (ir->op == IR_STORE_LOCAL) {
+            ssa_set_cur(sb, ir->slot, ir->src);
+            ir_block_remove(blk, i--);
+        }
+    }
+
+    /* Fill in this block's operand of each successor phi */
+    for (int s = 0; s < blk->succ_count; s++) {
+        IRBlock *succ = &cfg->blocks[blk->succs[s]];
+        if (s == 1 && blk->succs[1] == blk->succs[0]) break;
+        for (int p = 0; p < succ->pred_count; p++) {
+            if (succ->preds[p] != b) continue;
+            for (int ph = 0; ph < succ->phi_count; ph++)
+                succ->phis[ph].args[p] = ssa_reaching(sb, succ->phis[ph].slot);
+        }
+    }
+
+    for (int c = 0; c < sb->child_count[b]; c++)
+        ssa_rename(sb, sb->children[b][c]);
+
+    while (sb->undo_count > mark) {
+        sb->undo_count--;
+        sb->cur[sb->undo_slot[sb->undo_count]] = sb->undo_val[sb->undo_count];
+    }
+}
+
+IRPhi *ir_block_add_phi(IRBlock *b, int dst, int slot) {
+    if (b->phi_count == b->phi_cap) {
+        b->phi_cap = b->phi_cap ? b->phi_cap * 2 : 4;
+        b->phis = realloc(b->phis, b->phi_cap * sizeof(IRPhi));
+    }
+    IRPhi *phi = &b->phis[b->phi_count++];
+    phi->dst = dst;
+    phi->slot = slot;
+    phi->args = malloc((b->pred_count > 0 ? b->pred_count : 1) * sizeof(int));
+    for (int p = 0; p < b->pred_count; p++) phi->args[p] = -1;
+    return phi;
+}
+
+void ir_ssa_construct(IRCfg *cfg) {
+    int n = cfg->block_count;
+    int nslots = cfg->prog->next_slot;
+    int ns = nslots > 0 ? nslots : 1;
+
+    /* Which blocks store each slot, and which slots are read in some
+     * block before being written there (only those need phis) */
+    int **def_blocks = calloc(ns, sizeof(int *));
+    int *def_count = calloc(ns, sizeof(int));
+    int *def_cap = calloc(ns, sizeof(int));
+    char *is_global = calloc(ns, 1);
+    int *stored_in = malloc(ns * sizeof(int));
+    for (int s = 0; s < nslots; s++) stored_in[s] = -1;
+
+    for (int b = 0; b < n; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        for (int i = 0; i < blk->instr_count; i++) {
+            IRInstr *ir = &blk->instrs[i];
+            if (ir->op == IR_LOAD_LOCAL && stored_in[ir->slot] != b) {
+                is_global[ir->slot] = 1;
+            } else if (ir->op == IR_STORE_LOCAL && stored_in[ir->slot] != b) {
+                int s = ir->slot;
+                stored_in[s] = b;
+                if (def_count[s] == def_cap[s]) {
+                    def_cap[s] = def_cap[s] ? def_cap[s] * 2 : 4;
+                    def_blocks[s] = realloc(def_blocks[s], def_cap[s] * sizeof(int));
+                }
+                def_blocks[s][def_count[s]++] = b;
+            }
+        }
+    }
+
+    /* Phi placement on the iterated dominance frontier */
+    int **df, *df_count;
+    ir_cfg_frontiers(cfg, &df, &df_count);
+    int *has_phi = malloc(n * sizeof(int));
+    int *queued = malloc(n * sizeof(int));
+    int *work = malloc(n * sizeof(int));
+    for (int b = 0; b < n; b++) has_phi[b] = queued[b] = -1;
+
+    for (int s = 0; s < nslots; s++) {
+        if (!is_global[s]) continue;
+        int wn = 0;
+        for (int k = 0; k < def_count[s]; k++) {
+            work[wn++] = def_blocks[s][k];
+            queued[def_blocks[s][k]] = s;
+        }
+        while (wn > 0) {
+            int b = work[--wn];
+            for (int k = 0; k < df_count[b]; k++) {
+                int d = df[b][k];
+                if (has_phi[d] == s) continue;
+                ir_block_add_phi(&cfg->blocks[d], ir_alloc_vreg(cfg->prog), s);
+                has_phi[d] = s;
+                if (queued[d] != s) {
+                    queued[d] = s;
+                    work[wn++] = d;
+                }
+            }
+        }
+    }
+
+    /* Rename along the dominator tree */
+    SSABuilder sb;
+    memset(&sb, 0, sizeof(sb));
+    sb.cfg = cfg;
+    sb.nslots = nslots;
+    sb.cur = malloc(ns * sizeof(int));
+    for (int s = 0; s < nslots; s++) sb.cur[s] = -1;
+    sb.vmap_count = cfg->prog->next_vreg;
+    sb.vmap = malloc((sb.vmap_count > 0 ? sb.vmap_count : 1) * sizeof(int));
+    for (int v = 0; v < sb.vmap_count; v++) sb.vmap[v] = -1;
+    sb.undef = -1;
+    sb.children = calloc(n, sizeof(int *));
+    sb.child_count = calloc(n, sizeof(int));
+    for (int b = 1; b < n; b++) {
+        int p = cfg->blocks[b].idom;
+        sb.children[p] = realloc(sb.children[p], (sb.child_count[p] + 1) * sizeof(int));
+        sb.children[p][sb.child_count[p]++] = b;
+    }
+
+    ssa_rename(&sb, 0);
+
+    if (sb.undef >= 0) {
+        IRInstr zero;
+        memset(&zero, 0, sizeof(zero));
+        zero.op = IR_CONST_INT;
+        zero.dst = sb.undef;
+        ir_block_insert(&cfg->blocks[0], 0, zero);
+    }
+    cfg->is_ssa = 1;
+
+    for (int b = 0; b < n; b++) free(sb.children[b]);
+    free(sb.children);
+    free(sb.child_count);
+    free(sb.vmap);
+    free(sb.cur);
+    free(sb.undo_slot);
+    free(sb.undo_val);
+    free(work);
+    free(queued);
+    free(has_phi);
+    ir_cfg_free_frontiers(cfg, df, df_count);
+    for (int s = 0; s < nslots; s++) free(def_blocks[s]);
+    free(def_blocks);
+    free(def_count);
+    free(def_cap);
+    free(is_global);
+    free(stored_in);
+}
+
+/* ================================================================
+ * SSA destruction
+ *
+ * Each phi is given a fresh slot.  Every predecessor stores its
+ * argument just before its terminator and the phi's block loads the
+ * slot into the phi's vreg on entry.  Because all stores of an edge
+ * happen before any load, phis that read each other (the swap
+ * problem) and critical edges need no special handling.
+ * ================================================================ */
+
+void ir_ssa_destruct(IRCfg *cfg) {
+    for (int b = 0; b < cfg->block_count; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        for (int ph = 0; ph < blk->phi_count; ph++) {
+            IRPhi *phi = &blk->phis[ph];
+            int slot = ir_alloc_slot(cfg->prog);
+
+            for (int p = 0; p < blk->pred_count; p++) {
+                IRBlock *pred = &cfg->blocks[blk->preds[p]];
+                IRInstr st;
+                memset(&st, 0, sizeof(st));
+                st.op = IR_STORE_LOCAL;
+                st.dst = -1;
+                st.slot = slot;
+                st.src = phi->args[p];
+                int pos = pred->instr_count;
+                if (pos > 0 && ir_is_terminator(pred->instrs[pos - 1].op)) pos--;
+                ir_block_insert(pred, pos, st);
+            }
+
+            IRInstr ld;
+            memset(&ld, 0, sizeof(ld));
+            ld.op = IR_LOAD_LOCAL;
+            ld.dst = phi->dst;
+            ld.slot = slot;
+            ir_block_insert(blk, ph, ld);
+            free(phi->args);
+        }
+        free(blk->phis);
+        blk->phis = NULL;
+        blk->phi_count = blk->phi_cap = 0;
+    }
+    cfg->is_ssa = 0;
+}
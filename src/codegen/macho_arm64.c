@@ -315,9 +315,9 @@ int emit_net_binary(NetConfig *config, const char *output_path)
     return 1;
 }
 
-int emit_binary_ir(IRProgram *prog, const char *output_path)
+int emit_binary_ir(IRProgram *prog, const char *output_path, int line_buffered)
 {
-    (void)prog; (void)output_path;
+    (void)prog; (void)output_path; (void)line_buffered;
     diag_error_no_loc("IR-based binary not yet supported on macOS ARM64");
     return 1;
 }
@@ -1,11 +1,15 @@
+#define _POSIX_C_SOURCE 200809L
 #include "diagnostic.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static const char *g_filename;
-static const char *g_source;
+/* Per thread, so imports can be parsed concurrently (see import.c) */
+static _Thread_local const char *g_filename;
+static _Thread_local const char *g_source;
+static _Thread_local jmp_buf *g_trap;
+static _Thread_local DiagRecord *g_trap_record;
 
 void diag_init(const char *filename, const char *source) {
     g_filename = filename;
@@ -48,6 +52,21 @@ static void print_source_caret(SourceLoc loc) {
 }
 
 void diag_emit(SourceLoc loc, DiagSeverity severity, const char *fmt, ...) {
+    if (severity == DIAG_ERROR && g_trap) {
+        jmp_buf *trap = g_trap;
+        g_trap_record->loc = loc;
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(g_trap_record->message, sizeof(g_trap_record->message), fmt, ap);
+        va_end(ap);
+        g_trap = NULL;
+        g_trap_record = NULL;
+        longjmp(*trap, 1);
+    }
+
+    /* Keep a diagnostic in one piece when several threads report at once */
+    flockfile(stderr);
+
     /* filename:line:col: */
     if (g_filename && loc.line > 0)
         fprintf(stderr, "\033[1m%s:%d:%d: \033[0m", g_filename, loc.line, loc.col);
@@ -72,6 +91,12 @@ void diag_emit(SourceLoc loc, DiagSeverity severity, const char *fmt, ...) {
 
     if (severity == DIAG_ERROR)
         exit(1);
+    funlockfile(stderr);
+}
+
+void diag_trap(jmp_buf *trap, DiagRecord *record) {
+    g_trap = trap;
+    g_trap_record = record;
 }
 
 DiagContext diag_save(void) {
@@ -1,6 +1,8 @@
 #ifndef DIAGNOSTIC_H
 #define DIAGNOSTIC_H
 
+#include <setjmp.h>
+
 typedef struct {
     int line;   /* 1-based */
     int col;    /* 1-based */
@@ -24,4 +26,16 @@ typedef struct {
 DiagContext diag_save(void);
 void diag_restore(DiagContext ctx);
 
+/* An error caught by a trap instead of reported */
+typedef struct {
+    SourceLoc loc;
+    char message[512];
+} DiagRecord;
+
+/* While the calling thread has a trap set, its next error is recorded
+   in *record and control returns through longjmp(*trap, 1) instead of
+   the process exiting; the trap is then cleared.  Pass NULLs to clear
+   it.  Warnings are still printed. */
+void diag_trap(jmp_buf *trap, DiagRecord *record);
+
 #endif
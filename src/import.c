@@ -2,11 +2,15 @@
 #include "import.h"
 #include "lexer.h"
 #include "diagnostic.h"
+#include "modcache.h"
+#include "pathtable.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <unistd.h>
 
 /* ================================================================
  * Module cache — stores parsed ASTs so each file is only parsed once
@@ -14,15 +18,19 @@
 
 typedef struct {
     char *abs_path;
-    ASTNode *ast;
+    ASTNode *ast;       /* NULL if parsing failed */
     char *source;
     char *filename;
+    DiagRecord *error;  /* the parse error of a prefetched module, else NULL */
 } CachedModule;
 
 static CachedModule *module_cache;
 static int module_cache_count;
 static int module_cache_cap;
 
+/* Canonical path -> index into module_cache */
+static PathTable module_index;
+
 /* ================================================================
  * Import stack — tracks files currently being processed for
  * circular import detection
@@ -32,6 +40,24 @@ static char **import_stack;
 static int import_stack_count;
 static int import_stack_cap;
 
+/* Canonical path -> number of times it is on the import stack */
+static PathTable import_stack_set;
+
+/* ================================================================
+ * Resolved path memo — maps "importing dir" + import string to the
+ * canonical path so realpath() runs once per distinct import
+ * ================================================================ */
+
+typedef struct {
+    char *key;
+    char *abs_path;
+} ResolvedPath;
+
+static ResolvedPath *resolved_paths;
+static int resolved_path_count;
+static int resolved_path_cap;
+static PathTable resolved_index;
+
 /* Project root directory */
 static char *project_root_dir;
 
@@ -49,6 +75,14 @@ void import_init(const char *project_root) {
     import_stack_cap = 8;
     import_stack_count = 0;
     import_stack = malloc(import_stack_cap * sizeof(char *));
+
+    resolved_path_cap = 8;
+    resolved_path_count = 0;
+    resolved_paths = malloc(resolved_path_cap * sizeof(ResolvedPath));
+
+    path_table_init(&module_index);
+    path_table_init(&import_stack_set);
+    path_table_init(&resolved_index);
 }
 
 void import_cleanup(void) {
@@ -57,6 +91,7 @@ void import_cleanup(void) {
         ast_free(module_cache[i].ast);
         free(module_cache[i].source);
         free(module_cache[i].filename);
+        free(module_cache[i].error);
     }
     free(module_cache);
     module_cache = NULL;
@@ -68,6 +103,19 @@ void import_cleanup(void) {
     import_stack_count = 0;
     import_stack_cap = 0;
 
+    for (int i = 0; i < resolved_path_count; i++) {
+        free(resolved_paths[i].key);
+        free(resolved_paths[i].abs_path);
+    }
+    free(resolved_paths);
+    resolved_paths = NULL;
+    resolved_path_count = 0;
+    resolved_path_cap = 0;
+
+    path_table_free(&module_index);
+    path_table_free(&import_stack_set);
+    path_table_free(&resolved_index);
+
     free(project_root_dir);
     project_root_dir = NULL;
 }
@@ -90,28 +138,70 @@ static char *read_file(const char *path) {
     return buf;
 }
 
+/* Parse a module's source, reusing a precompiled .lmod artifact when
+   one exists for this exact text.  The diagnostic context must already
+   name the module. */
+static ASTNode *parse_module(const char *source) {
+    ASTNode *ast = modcache_load(source);
+    if (ast)
+        return ast;
+
+    Lexer lexer;
+    lexer_init(&lexer, source);
+    ast = parse(&lexer);
+    modcache_store(source, ast);
+    return ast;
+}
+
 /* ================================================================
  * Path resolution
  * ================================================================ */
 
-static char *resolve_path(const char *importing_file, const char *import_path, SourceLoc loc) {
-    char raw_path[PATH_MAX];
+/* Resolve import_path against the importing file, or the project root,
+   to a canonical path; NULL if there is no such file.  raw_path
+   receives the path tried. */
+static char *try_resolve_path(const char *importing_file, const char *import_path,
+                              char raw_path[PATH_MAX]) {
+    char key[PATH_MAX * 2];
 
     if (import_path[0] == '.' && import_path[1] == '/') {
         /* Relative to the importing file's directory */
         char *importing_copy = strdup(importing_file);
         char *dir = dirname(importing_copy);
-        snprintf(raw_path, sizeof(raw_path), "%s/%s.lingua", dir, import_path + 2);
+        snprintf(raw_path, PATH_MAX, "%s/%s.lingua", dir, import_path + 2);
+        snprintf(key, sizeof(key), "%s\n%s", dir, import_path);
         free(importing_copy);
     } else {
         /* Relative to project root */
-        snprintf(raw_path, sizeof(raw_path), "%s/%s.lingua", project_root_dir, import_path);
+        snprintf(raw_path, PATH_MAX, "%s/%s.lingua", project_root_dir, import_path);
+        snprintf(key, sizeof(key), "\n%s", import_path);
     }
 
+    PathSlot *memo = path_table_find(&resolved_index, key);
+    if (memo)
+        return strdup(resolved_paths[memo->value].abs_path);
+
     char *resolved = realpath(raw_path, NULL);
-    if (!resolved) {
-        diag_emit(loc, DIAG_ERROR, "cannot find module '%s' (tried '%s')", import_path, raw_path);
+    if (!resolved)
+        return NULL;
+
+    if (resolved_path_count == resolved_path_cap) {
+        resolved_path_cap *= 2;
+        resolved_paths = realloc(resolved_paths, resolved_path_cap * sizeof(ResolvedPath));
     }
+    ResolvedPath *rp = &resolved_paths[resolved_path_count];
+    rp->key = strdup(key);
+    rp->abs_path = strdup(resolved);
+    path_table_put(&resolved_index, rp->key, resolved_path_count);
+    resolved_path_count++;
+    return resolved;
+}
+
+static char *resolve_path(const char *importing_file, const char *import_path, SourceLoc loc) {
+    char raw_path[PATH_MAX];
+    char *resolved = try_resolve_path(importing_file, import_path, raw_path);
+    if (!resolved)
+        diag_emit(loc, DIAG_ERROR, "cannot find module '%s' (tried '%s')", import_path, raw_path);
     return resolved;
 }
 
@@ -120,23 +210,191 @@ static char *resolve_path(const char *importing_file, const char *import_path, S
  * ================================================================ */
 
 static CachedModule *cache_find(const char *abs_path) {
-    for (int i = 0; i < module_cache_count; i++) {
-        if (strcmp(module_cache[i].abs_path, abs_path) == 0)
-            return &module_cache[i];
+    PathSlot *slot = path_table_find(&module_index, abs_path);
+    return slot ? &module_cache[slot->value] : NULL;
+}
+
+/* Add a parsed module to the cache, taking ownership of abs_path,
+   source and ast */
+static CachedModule *cache_add(char *abs_path, char *source, ASTNode *ast) {
+    if (module_cache_count == module_cache_cap) {
+        module_cache_cap *= 2;
+        module_cache = realloc(module_cache, module_cache_cap * sizeof(CachedModule));
     }
+    CachedModule *mod = &module_cache[module_cache_count++];
+    mod->abs_path = abs_path;
+    mod->ast = ast;
+    mod->source = source;
+    mod->filename = strdup(abs_path);
+    mod->error = NULL;
+    path_table_put(&module_index, mod->abs_path, module_cache_count - 1);
+    return mod;
+}
+
+/* ================================================================
+ * Parallel import discovery
+ *
+ * import_prefetch walks the import graph ahead of evaluation.  Each
+ * discovered module becomes a job; a pool of worker threads reads,
+ * lexes and parses jobs concurrently and queues the modules they
+ * import in turn.  Path resolution and queueing happen under a single
+ * lock, parsing happens outside it.  Finished modules go into the
+ * module cache, so the later depth-first evaluation in codegen (which
+ * already visits dependencies before dependents) only hits the cache.
+ *
+ * Workers never report errors, which would exit while other threads
+ * run and in whatever order they happened to finish.  A missing
+ * module is skipped, and a parse error is trapped and cached with the
+ * module; import_resolve reports either when evaluation reaches that
+ * import, so errors come out in import order.  Circular imports are
+ * likewise left to import_resolve.
+ * ================================================================ */
+
+typedef struct {
+    char *abs_path;
+    char *source;       /* NULL if the file could not be read */
+    ASTNode *ast;
+    DiagRecord *error;  /* set if parsing failed */
+} PrefetchJob;
+
+static PrefetchJob **prefetch_jobs;
+static int prefetch_job_count;
+static int prefetch_job_cap;
+static int prefetch_next;       /* index of the next job to hand out */
+static int prefetch_active;     /* workers currently parsing a job */
+static PathTable prefetch_seen;
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+/* Modules resolved inside the compiler rather than from disk */
+static int is_stdlib_module(const char *import_path) {
+    static const char *stdlib_modules[] = {
+        "std/string", "std/array", "std/concurrency", "std/map", "std/http", "std/net", NULL
+    };
+    for (int i = 0; stdlib_modules[i]; i++)
+        if (strcmp(import_path, stdlib_modules[i]) == 0)
+            return 1;
+    return 0;
+}
+
+/* Queue every file import of ast that has not been seen yet.
+   Caller holds prefetch_lock (or no workers are running). */
+static void prefetch_scan(const char *importing_file, ASTNode *ast) {
+    for (ASTNode *n = ast; n; n = n->next) {
+        if (n->type != NODE_IMPORT || is_stdlib_module(n->import_path))
+            continue;
+        char raw_path[PATH_MAX];
+        char *abs_path = try_resolve_path(importing_file, n->import_path, raw_path);
+        if (!abs_path)
+            continue;
+        if (cache_find(abs_path) || path_table_find(&prefetch_seen, abs_path)) {
+            free(abs_path);
+            continue;
+        }
+        if (prefetch_job_count == prefetch_job_cap) {
+            prefetch_job_cap = prefetch_job_cap ? prefetch_job_cap * 2 : 16;
+            prefetch_jobs = realloc(prefetch_jobs, prefetch_job_cap * sizeof(PrefetchJob *));
+        }
+        PrefetchJob *job = calloc(1, sizeof(PrefetchJob));
+        job->abs_path = abs_path;
+        prefetch_jobs[prefetch_job_count] = job;
+        path_table_put(&prefetch_seen, job->abs_path, prefetch_job_count);
+        prefetch_job_count++;
+        pthread_cond_signal(&prefetch_cond);
+    }
+}
+
+static void *prefetch_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&prefetch_lock);
+    for (;;) {
+        /* Wait while the queue is empty but a busy worker may still add to it */
+        while (prefetch_next == prefetch_job_count && prefetch_active > 0)
+            pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+        if (prefetch_next == prefetch_job_count)
+            break;
+
+        PrefetchJob *job = prefetch_jobs[prefetch_next++];
+        prefetch_active++;
+        pthread_mutex_unlock(&prefetch_lock);
+
+        /* The diagnostic context and trap are per thread */
+        job->source = read_file(job->abs_path);
+        if (job->source) {
+            jmp_buf trap;
+            job->error = calloc(1, sizeof(DiagRecord));
+            diag_init(job->abs_path, job->source);
+            diag_trap(&trap, job->error);
+            if (setjmp(trap) == 0) {
+                job->ast = parse_module(job->source);
+                diag_trap(NULL, NULL);
+                free(job->error);
+                job->error = NULL;
+            }
+        }
+
+        pthread_mutex_lock(&prefetch_lock);
+        if (job->ast)
+            prefetch_scan(job->abs_path, job->ast);
+        prefetch_active--;
+        if (prefetch_active == 0 && prefetch_next == prefetch_job_count)
+            pthread_cond_broadcast(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
     return NULL;
 }
 
+void import_prefetch(const char *root_file, ASTNode *root_ast) {
+    path_table_init(&prefetch_seen);
+    prefetch_job_count = 0;
+    prefetch_next = 0;
+    prefetch_active = 0;
+
+    prefetch_scan(root_file, root_ast);
+
+    if (prefetch_job_count > 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        int nthreads = ncpu < 1 ? 1 : ncpu > 64 ? 64 : (int)ncpu;
+        pthread_t threads[64];
+        int started = 0;
+        for (int i = 0; i < nthreads; i++) {
+            if (pthread_create(&threads[started], NULL, prefetch_worker, NULL) != 0)
+                break;
+            started++;
+        }
+        if (started == 0)
+            prefetch_worker(NULL);
+        for (int i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    /* Move parsed modules, and the errors of those that failed, into the
+       cache in discovery order.  Unreadable files are left for
+       import_resolve to report. */
+    for (int i = 0; i < prefetch_job_count; i++) {
+        PrefetchJob *job = prefetch_jobs[i];
+        if (job->ast || job->error)
+            cache_add(job->abs_path, job->source, job->ast)->error = job->error;
+        else {
+            free(job->abs_path);
+            free(job->source);
+        }
+        free(job);
+    }
+    free(prefetch_jobs);
+    prefetch_jobs = NULL;
+    prefetch_job_count = 0;
+    prefetch_job_cap = 0;
+    path_table_free(&prefetch_seen);
+}
+
 /* ================================================================
  * Circular import detection
  * ================================================================ */
 
 static int is_in_import_stack(const char *abs_path) {
-    for (int i = 0; i < import_stack_count; i++) {
-        if (strcmp(import_stack[i], abs_path) == 0)
-            return 1;
-    }
-    return 0;
+    PathSlot *slot = path_table_find(&import_stack_set, abs_path);
+    return slot && slot->value > 0;
 }
 
 static void push_import_stack(const char *abs_path) {
@@ -145,11 +403,18 @@ static void push_import_stack(const char *abs_path) {
         import_stack = realloc(import_stack, import_stack_cap * sizeof(char *));
     }
     import_stack[import_stack_count++] = (char *)abs_path;
+
+    PathSlot *slot = path_table_find(&import_stack_set, abs_path);
+    path_table_put(&import_stack_set, abs_path, slot ? slot->value + 1 : 1);
 }
 
 static void pop_import_stack(void) {
-    if (import_stack_count > 0)
-        import_stack_count--;
+    if (import_stack_count > 0) {
+        const char *abs_path = import_stack[--import_stack_count];
+        PathSlot *slot = path_table_find(&import_stack_set, abs_path);
+        if (slot)
+            slot->value--;
+    }
 }
 
 void import_push_file(const char *abs_path) {
@@ -186,6 +451,10 @@ int import_resolve(const char *importing_file, const char *import_path,
 
     /* Check cache */
     CachedModule *cached = cache_find(abs_path);
+    if (cached && cached->error) {
+        diag_init(cached->filename, cached->source);
+        diag_emit(cached->error->loc, DIAG_ERROR, "%s", cached->error->message);
+    }
     if (cached) {
         *out_ast = cached->ast;
         *out_source = cached->source;
@@ -206,24 +475,13 @@ int import_resolve(const char *importing_file, const char *import_path,
     DiagContext saved = diag_save();
     diag_init(abs_path, source);
 
-    /* Lex and parse */
-    Lexer lexer;
-    lexer_init(&lexer, source);
-    ASTNode *ast = parse(&lexer);
+    ASTNode *ast = parse_module(source);
 
     /* Restore diagnostic context */
     diag_restore(saved);
 
     /* Cache the result */
-    if (module_cache_count == module_cache_cap) {
-        module_cache_cap *= 2;
-        module_cache = realloc(module_cache, module_cache_cap * sizeof(CachedModule));
-    }
-    CachedModule *mod = &module_cache[module_cache_count++];
-    mod->abs_path = abs_path;
-    mod->ast = ast;
-    mod->source = source;
-    mod->filename = strdup(abs_path);
+    CachedModule *mod = cache_add(abs_path, source, ast);
 
     *out_ast = ast;
     *out_source = source;
@@ -19,6 +19,12 @@ int import_resolve(const char *importing_file, const char *import_path,
                    SourceLoc loc, ASTNode **out_ast,
                    const char **out_source, const char **out_filename);
 
+/* Discover, read and parse every module reachable from root_ast ahead
+   of evaluation, parsing independent modules concurrently on a pool of
+   worker threads (one per CPU).  Results land in the module cache used
+   by import_resolve. */
+void import_prefetch(const char *root_file, ASTNode *root_ast);
+
 /* Push/pop a file path onto the import stack (for circular detection) */
 void import_push_file(const char *abs_path);
 void import_pop_file(void);
@@ -30,21 +30,26 @@ static void help(void) {
     printf("lingua - a minimal compiler for the Lingua language\n"
            "\n"
            "Usage:\n"
-           "  lingua <file>.lingua                Build and run a .lingua file\n"
+           "  lingua <file>.lingua [-O<n>]        Build and run a .lingua file\n"
            "  lingua build <file> -o <output>     Compile a .lingua file to a native binary\n"
+           "        [--dump-ir]                    Also print the runtime IR and its SSA form\n"
+           "        [-O<n>]                        Optimize the runtime IR (0-2, default 0)\n"
+           "        [--unroll=<n>]                 Loop unroll factor at -O2 (1-64, default 4)\n"
+           "        [--line-buffered]              Flush program output at every newline\n"
            "  lingua completions <shell>           Generate shell completions (bash, zsh, fish)\n"
            "  lingua --help, -h                    Show this help message\n");
 }
 
 static void usage(void) {
-    fprintf(stderr, "usage: lingua <file>.lingua\n");
-    fprintf(stderr, "       lingua build <file> -o <output>\n");
+    fprintf(stderr, "usage: lingua <file>.lingua [-O<n>] [--unroll=<n>] [--line-buffered]\n");
+    fprintf(stderr, "       lingua build <file> -o <output> [--dump-ir] [-O<n>] [--unroll=<n>] [--line-buffered]\n");
     fprintf(stderr, "       lingua completions <shell>\n");
     fprintf(stderr, "       lingua --help\n");
     exit(1);
 }
 
-static int build(const char *input_path, const char *output_path) {
+static int build(const char *input_path, const char *output_path,
+                 const CodegenOptions *opts) {
     char *source = read_file(input_path);
     if (!source)
         return 1;
@@ -63,7 +68,7 @@ static int build(const char *input_path, const char *output_path) {
     if (!ast)
         diag_error_no_loc("no statements found");
 
-    int result = codegen(ast, output_path, abs_path);
+    int result = codegen(ast, output_path, abs_path, opts);
 
     ast_free(ast);
     free(source);
@@ -72,6 +77,31 @@ static int build(const char *input_path, const char *output_path) {
     return result;
 }
 
+/* Options accepted after the input file; returns 0 for anything else */
+static int parse_option(const char *arg, CodegenOptions *opts) {
+    if (strcmp(arg, "--dump-ir") == 0) {
+        opts->dump_ir = 1;
+        return 1;
+    }
+    if (arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '2' && arg[3] == '\0') {
+        opts->opt_level = arg[2] - '0';
+        return 1;
+    }
+    if (strcmp(arg, "--line-buffered") == 0) {
+        opts->line_buffered = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--unroll=", 9) == 0) {
+        char *end;
+        long n = strtol(arg + 9, &end, 10);
+        if (end == arg + 9 || *end != '\0' || n < 1 || n > 64)
+            return 0;
+        opts->unroll = (int)n;
+        return 1;
+    }
+    return 0;
+}
+
 static int ends_with(const char *str, const char *suffix) {
     int str_len = strlen(str);
     int suf_len = strlen(suffix);
@@ -96,7 +126,7 @@ static void completions_bash(void) {
         "            if [[ $prev == -o ]]; then\n"
         "                _filedir\n"
         "            elif [[ $cur == -* ]]; then\n"
-        "                COMPREPLY=($(compgen -W '-o' -- \"$cur\"))\n"
+        "                COMPREPLY=($(compgen -W '-o --dump-ir -O0 -O1 -O2 --unroll= --line-buffered' -- \"$cur\"))\n"
         "            else\n"
         "                _filedir lingua\n"
         "            fi\n"
@@ -128,7 +158,7 @@ static void completions_zsh(void) {
         "        args)\n"
         "            case $words[1] in\n"
         "                build)\n"
-        "                    _arguments '1:input file:_files -g \"*.lingua\"' '-o[output file]:output file:_files'\n"
+        "                    _arguments '1:input file:_files -g \"*.lingua\"' '-o[output file]:output file:_files' '--dump-ir[print the runtime IR]' '-O0[no optimization]' '-O1[optimize the runtime IR]' '-O2[optimize the runtime IR more]' '--unroll=[loop unroll factor at -O2]:factor' '--line-buffered[flush output at every newline]'\n"
         "                    ;;\n"
         "                completions)\n"
         "                    _arguments '1:shell:(bash zsh fish)'\n"
@@ -148,6 +178,10 @@ static void completions_fish(void) {
         "complete -c lingua -n '__fish_use_subcommand' -a build -d 'Compile a .lingua file'\n"
         "complete -c lingua -n '__fish_use_subcommand' -a completions -d 'Generate shell completions'\n"
         "complete -c lingua -n '__fish_seen_subcommand_from build' -s o -r -F -d 'Output file'\n"
+        "complete -c lingua -n '__fish_seen_subcommand_from build' -l dump-ir -d 'Print the runtime IR'\n"
+        "complete -c lingua -n '__fish_seen_subcommand_from build' -a '-O0 -O1 -O2' -d 'Optimization level'\n"
+        "complete -c lingua -n '__fish_seen_subcommand_from build' -l unroll -x -d 'Loop unroll factor at -O2'\n"
+        "complete -c lingua -n '__fish_seen_subcommand_from build' -l line-buffered -d 'Flush output at every newline'\n"
         "complete -c lingua -n '__fish_seen_subcommand_from build' -F -d 'Input .lingua file'\n"
         "complete -c lingua -n '__fish_seen_subcommand_from completions' -a 'bash zsh fish' -d 'Shell type'\n"
     );
@@ -180,18 +214,27 @@ int main(int argc, char **argv) {
             usage();
         if (strcmp(argv[3], "-o") != 0)
             usage();
-        return build(argv[2], argv[4]);
+        CodegenOptions opts = {0};
+        for (int i = 5; i < argc; i++)
+            if (!parse_option(argv[i], &opts))
+                usage();
+        return build(argv[2], argv[4], &opts);
     }
 
     /* lingua <file>.lingua — build to a temp binary, run it, clean up */
     if (ends_with(argv[1], ".lingua")) {
+        CodegenOptions opts = {0};
+        for (int i = 2; i < argc; i++)
+            if (!parse_option(argv[i], &opts) || opts.dump_ir)
+                usage();
+
         char tmp[] = "/tmp/lingua_XXXXXX";
         int fd = mkstemp(tmp);
         if (fd < 0)
             diag_error_no_loc("cannot create temporary file");
         close(fd);
 
-        int rc = build(argv[1], tmp);
+        int rc = build(argv[1], tmp, &opts);
         if (rc != 0) {
             unlink(tmp);
             return rc;
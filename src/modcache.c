@@ -0,0 +1,795 @@
+#define _GNU_SOURCE
+#include "modcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Bump when the serialized layout changes */
+#define LMOD_FORMAT_VERSION 5
+
+/* Once the artifacts in the cache directory exceed this many bytes,
+   the least recently used are removed down to three quarters of it */
+#define LMOD_CACHE_MAX_BYTES (256L * 1024 * 1024)
+
+static const char lmod_magic[4] = {'L', 'M', 'O', 'D'};
+
+/* The format version and the number of values of each serialized
+   enum, checked before anything else is read */
+static const int lmod_layout[] = {
+    LMOD_FORMAT_VERSION,
+    NODE_SPAWN + 1,
+    EXPR_MAP_LIT + 1,
+    VAL_MAP + 1,
+    BINOP_SHR + 1,
+    UNOP_BIT_NOT + 1,
+};
+
+/* ================================================================
+ * Cache key and location
+ * ================================================================ */
+
+static unsigned long long fnv1a64(unsigned long long h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Identity of the running compiler: a hash of its executable, so an
+   artifact written by one build of the front end is never read by
+   another, whatever changed between them, while identical builds
+   share artifacts.  0 if the executable cannot be read, which turns
+   the cache off. */
+static unsigned long long compiler_id;
+static pthread_once_t compiler_id_once = PTHREAD_ONCE_INIT;
+
+static void compiler_id_init(void) {
+    int fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            compiler_id = fnv1a64(14695981039346656037ULL, map, st.st_size);
+            if (compiler_id == 0)
+                compiler_id = 1;
+            munmap(map, st.st_size);
+        }
+    }
+    close(fd);
+}
+
+/* The file name only narrows the search: an artifact also holds the
+   full source text it was parsed from, compared on load, so two
+   sources that share a key never share an AST */
+static unsigned long long source_key(const char *source) {
+    unsigned long long h = 14695981039346656037ULL;
+    h = fnv1a64(h, &compiler_id, sizeof(compiler_id));
+    h = fnv1a64(h, lmod_layout, sizeof(lmod_layout));
+    return fnv1a64(h, source, strlen(source));
+}
+
+/* Write the cache directory into buf, creating it if needed.
+   Returns 0 on success. */
+static int cache_dir(char *buf, size_t size) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0]) {
+        mkdir(xdg, 0755);
+        snprintf(buf, size, "%s/lingua", xdg);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home || !home[0])
+            return 1;
+        snprintf(buf, size, "%s/.cache", home);
+        mkdir(buf, 0755);
+        snprintf(buf, size, "%s/.cache/lingua", home);
+    }
+    if (mkdir(buf, 0755) != 0) {
+        struct stat st;
+        if (stat(buf, &st) != 0 || !S_ISDIR(st.st_mode))
+            return 1;
+    }
+    return 0;
+}
+
+static int cache_path(const char *source, char *buf, size_t size) {
+    pthread_once(&compiler_id_once, compiler_id_init);
+    if (compiler_id == 0)
+        return 1;
+    char dir[PATH_MAX - 32];    /* leave room for the file name */
+    if (cache_dir(dir, sizeof(dir)) != 0)
+        return 1;
+    snprintf(buf, size, "%s/%016llx.lmod", dir, source_key(source));
+    return 0;
+}
+
+/* ================================================================
+ * Eviction
+ *
+ * A hit refreshes the artifact's modification time, so mtime orders
+ * artifacts by last use.  The first store of each process checks the
+ * size of the directory and, past LMOD_CACHE_MAX_BYTES, removes the
+ * least recently used artifacts.
+ * ================================================================ */
+
+typedef struct {
+    char name[32];
+    time_t mtime;
+    off_t size;
+} CacheEntry;
+
+static int cache_entry_older(const void *a, const void *b) {
+    const CacheEntry *x = a, *y = b;
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+static void cache_prune(void) {
+    char dir[PATH_MAX - 32];
+    if (cache_dir(dir, sizeof(dir)) != 0)
+        return;
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+
+    CacheEntry *entries = NULL;
+    int count = 0, cap = 0;
+    long total = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len < 5 || len >= sizeof(entries[0].name) || strcmp(de->d_name + len - 5, ".lmod") != 0)
+            continue;
+        struct stat st;
+        if (fstatat(dirfd(d), de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 256;
+            entries = realloc(entries, cap * sizeof(CacheEntry));
+        }
+        memcpy(entries[count].name, de->d_name, len + 1);
+        entries[count].mtime = st.st_mtime;
+        entries[count].size = st.st_size;
+        total += st.st_size;
+        count++;
+    }
+
+    if (total > LMOD_CACHE_MAX_BYTES) {
+        qsort(entries, count, sizeof(CacheEntry), cache_entry_older);
+        for (int i = 0; i < count && total > LMOD_CACHE_MAX_BYTES / 4 * 3; i++) {
+            if (unlinkat(dirfd(d), entries[i].name, 0) == 0)
+                total -= entries[i].size;
+        }
+    }
+    closedir(d);
+    free(entries);
+}
+
+static pthread_once_t cache_prune_once = PTHREAD_ONCE_INIT;
+
+/* ================================================================
+ * Serialization
+ * ================================================================ */
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} Writer;
+
+static void w_bytes(Writer *w, const void *p, size_t n) {
+    if (w->len + n > w->cap) {
+        while (w->len + n > w->cap)
+            w->cap = w->cap ? w->cap * 2 : 4096;
+        w->data = realloc(w->data, w->cap);
+    }
+    memcpy(w->data + w->len, p, n);
+    w->len += n;
+}
+
+static void w_i32(Writer *w, int v) { w_bytes(w, &v, sizeof(v)); }
+static void w_i64(Writer *w, long v) { long long x = v; w_bytes(w, &x, sizeof(x)); }
+static void w_f64(Writer *w, double v) { w_bytes(w, &v, sizeof(v)); }
+static void w_loc(Writer *w, SourceLoc loc) { w_i32(w, loc.line); w_i32(w, loc.col); }
+
+/* Length-prefixed bytes; -1 encodes NULL */
+static void w_blob(Writer *w, const char *s, int len) {
+    if (!s) { w_i32(w, -1); return; }
+    w_i32(w, len);
+    w_bytes(w, s, len);
+}
+
+static void w_str(Writer *w, const char *s) {
+    w_blob(w, s, s ? (int)strlen(s) : 0);
+}
+
+static void w_expr(Writer *w, Expr *e);
+static void w_nodes(Writer *w, ASTNode *n);
+
+static void w_expr_array(Writer *w, Expr **arr, int count) {
+    w_i32(w, arr != NULL);
+    if (arr)
+        for (int i = 0; i < count; i++)
+            w_expr(w, arr[i]);
+}
+
+static void w_str_array(Writer *w, char **arr, int count) {
+    w_i32(w, arr != NULL);
+    if (arr)
+        for (int i = 0; i < count; i++)
+            w_str(w, arr[i]);
+}
+
+static void w_expr(Writer *w, Expr *e) {
+    if (!e) { w_i32(w, -1); return; }
+    w_i32(w, e->kind);
+    w_i32(w, e->value_type);
+    w_loc(w, e->loc);
+    switch (e->kind) {
+        case EXPR_INT_LIT:    w_i64(w, e->as.int_lit.value); break;
+        case EXPR_FLOAT_LIT:  w_f64(w, e->as.float_lit.value); break;
+        case EXPR_STRING_LIT: w_blob(w, e->as.string_lit.value, e->as.string_lit.len); break;
+        case EXPR_BOOL_LIT:   w_i32(w, e->as.bool_lit.value); break;
+        case EXPR_VAR_REF:    w_str(w, e->as.var_ref.name); break;
+        case EXPR_BINARY:
+            w_i32(w, e->as.binary.op);
+            w_expr(w, e->as.binary.left);
+            w_expr(w, e->as.binary.right);
+            break;
+        case EXPR_MEMBER_ACCESS:
+            w_expr(w, e->as.member_access.object);
+            w_str(w, e->as.member_access.field_name);
+            break;
+        case EXPR_UNARY:
+            w_i32(w, e->as.unary.op);
+            w_expr(w, e->as.unary.operand);
+            break;
+        case EXPR_INDEX:
+            w_expr(w, e->as.index_access.object);
+            w_expr(w, e->as.index_access.index);
+            break;
+        case EXPR_SLICE:
+            w_expr(w, e->as.slice.object);
+            w_expr(w, e->as.slice.start);
+            w_expr(w, e->as.slice.end);
+            break;
+        case EXPR_FN_CALL:
+            w_str(w, e->as.fn_call.fn_name);
+            w_str(w, e->as.fn_call.obj_name);
+            w_i32(w, e->as.fn_call.arg_count);
+            w_expr_array(w, e->as.fn_call.args, e->as.fn_call.arg_count);
+            w_str_array(w, e->as.fn_call.arg_names, e->as.fn_call.arg_count);
+            break;
+        case EXPR_ARRAY_LIT:
+            w_i32(w, e->as.array_lit.count);
+            w_expr_array(w, e->as.array_lit.elements, e->as.array_lit.count);
+            break;
+        case EXPR_CHANNEL_LIT:
+            w_i32(w, e->as.channel_lit.elem_type);
+            break;
+        case EXPR_MAP_LIT:
+            w_i32(w, e->as.map_lit.key_type);
+            w_i32(w, e->as.map_lit.value_type);
+            break;
+    }
+}
+
+static void w_node(Writer *w, ASTNode *n) {
+    w_i32(w, n->type);
+    w_loc(w, n->loc);
+    w_str(w, n->var_name);
+    w_i32(w, n->is_const);
+    w_expr(w, n->expr);
+
+    w_str(w, n->fn_name);
+    w_i32(w, n->param_count);
+    w_i32(w, n->params != NULL);
+    if (n->params) {
+        for (int i = 0; i < n->param_count; i++) {
+            FnParam *p = &n->params[i];
+            w_str(w, p->name);
+            w_i32(w, p->type);
+            w_str(w, p->class_type_name);
+            w_i32(w, p->array_elem_type);
+            w_i32(w, p->map_key_type);
+            w_i32(w, p->has_default);
+            w_blob(w, p->default_value, p->default_value_len);
+        }
+    }
+    w_i32(w, n->has_return_type);
+    w_i32(w, n->return_type);
+    w_nodes(w, n->body);
+
+    w_nodes(w, n->for_init);
+    w_expr(w, n->for_cond);
+    w_nodes(w, n->for_update);
+
+    w_expr(w, n->if_cond);
+    w_nodes(w, n->if_body);
+    w_nodes(w, n->else_body);
+
+    w_expr(w, n->match_expr);
+    w_i32(w, n->match_arm_count);
+    w_i32(w, n->match_arms != NULL);
+    if (n->match_arms) {
+        for (int i = 0; i < n->match_arm_count; i++) {
+            w_expr(w, n->match_arms[i].pattern);
+            w_i32(w, n->match_arms[i].is_wildcard);
+            w_nodes(w, n->match_arms[i].body);
+        }
+    }
+
+    w_i32(w, n->print_newline);
+
+    w_i32(w, n->is_fn_call);
+    w_i32(w, n->call_arg_count);
+    w_str_array(w, n->call_args, n->call_arg_count);
+    w_i32(w, n->call_arg_types != NULL);
+    if (n->call_arg_types)
+        for (int i = 0; i < n->call_arg_count; i++)
+            w_i32(w, n->call_arg_types[i]);
+    w_i32(w, n->call_arg_is_var_ref != NULL);
+    if (n->call_arg_is_var_ref)
+        for (int i = 0; i < n->call_arg_count; i++)
+            w_i32(w, n->call_arg_is_var_ref[i]);
+    w_str_array(w, n->call_arg_names, n->call_arg_count);
+    w_expr_array(w, n->call_arg_exprs, n->call_arg_count);
+
+    w_str(w, n->class_name);
+    w_str(w, n->parent_class_name);
+    w_i32(w, n->class_field_count);
+    w_i32(w, n->class_fields != NULL);
+    if (n->class_fields) {
+        for (int i = 0; i < n->class_field_count; i++) {
+            w_str(w, n->class_fields[i].name);
+            w_i32(w, n->class_fields[i].type);
+            w_str(w, n->class_fields[i].class_type_name);
+        }
+    }
+    w_nodes(w, n->class_methods);
+
+    w_str(w, n->obj_name);
+    w_str(w, n->field_name);
+    w_expr(w, n->index_expr);
+    w_i32(w, n->is_new_expr);
+
+    w_str(w, n->enum_name);
+    w_i32(w, n->enum_variant_count);
+    w_i32(w, n->enum_variants != NULL);
+    if (n->enum_variants) {
+        for (int i = 0; i < n->enum_variant_count; i++) {
+            w_str(w, n->enum_variants[i].name);
+            w_i64(w, n->enum_variants[i].value);
+        }
+    }
+
+    w_str(w, n->import_path);
+    w_i32(w, n->import_name_count);
+    w_str_array(w, n->import_names, n->import_name_count);
+
+    w_i32(w, n->var_array_elem_type);
+    w_i32(w, n->return_array_elem_type);
+    w_i32(w, n->var_map_key_type);
+    w_i32(w, n->return_map_key_type);
+    w_str(w, n->return_class_name);
+    w_i32(w, n->is_pub);
+    w_expr(w, n->spawn_expr);
+}
+
+/* A statement list is written as its length followed by each node */
+static void w_nodes(Writer *w, ASTNode *n) {
+    int count = 0;
+    for (ASTNode *c = n; c; c = c->next)
+        count++;
+    w_i32(w, count);
+    for (; n; n = n->next)
+        w_node(w, n);
+}
+
+/* ================================================================
+ * Deserialization
+ *
+ * Every read is bounds-checked; a truncated or corrupt artifact sets
+ * ok = 0 and the partially built AST is freed by the caller.  Arrays
+ * are zero-allocated before they are filled so ast_free can always
+ * walk them.
+ * ================================================================ */
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    int ok;
+} Reader;
+
+static void r_bytes(Reader *r, void *out, size_t n) {
+    if (!r->ok || (size_t)(r->end - r->p) < n) {
+        r->ok = 0;
+        memset(out, 0, n);
+        return;
+    }
+    memcpy(out, r->p, n);
+    r->p += n;
+}
+
+static int r_i32(Reader *r) { int v; r_bytes(r, &v, sizeof(v)); return v; }
+static long r_i64(Reader *r) { long long v; r_bytes(r, &v, sizeof(v)); return (long)v; }
+static double r_f64(Reader *r) { double v; r_bytes(r, &v, sizeof(v)); return v; }
+
+/* An enum value in [0, limit); anything else marks the input corrupt */
+static int r_enum(Reader *r, int limit) {
+    int v = r_i32(r);
+    if (v < 0 || v >= limit) {
+        r->ok = 0;
+        return 0;
+    }
+    return v;
+}
+
+static ValueType r_type(Reader *r) { return (ValueType)r_enum(r, VAL_MAP + 1); }
+
+static SourceLoc r_loc(Reader *r) {
+    SourceLoc loc;
+    loc.line = r_i32(r);
+    loc.col = r_i32(r);
+    return loc;
+}
+
+/* Element count; rejects values the remaining input cannot hold */
+static int r_count(Reader *r) {
+    int n = r_i32(r);
+    if (n < 0 || n > r->end - r->p) {
+        r->ok = 0;
+        return 0;
+    }
+    return n;
+}
+
+static char *r_blob(Reader *r, int *out_len) {
+    int len = r_i32(r);
+    if (out_len) *out_len = 0;
+    if (len < 0 || !r->ok)
+        return NULL;
+    if (len > r->end - r->p) {
+        r->ok = 0;
+        return NULL;
+    }
+    char *s = malloc(len + 1);
+    memcpy(s, r->p, len);
+    s[len] = '\0';
+    r->p += len;
+    if (out_len) *out_len = len;
+    return s;
+}
+
+static char *r_str(Reader *r) {
+    return r_blob(r, NULL);
+}
+
+static Expr *r_expr(Reader *r);
+static ASTNode *r_nodes(Reader *r);
+
+static Expr **r_expr_array(Reader *r, int count) {
+    if (!r_i32(r) || !r->ok)
+        return NULL;
+    Expr **arr = calloc(count ? count : 1, sizeof(Expr *));
+    for (int i = 0; i < count && r->ok; i++)
+        arr[i] = r_expr(r);
+    return arr;
+}
+
+static char **r_str_array(Reader *r, int count) {
+    if (!r_i32(r) || !r->ok)
+        return NULL;
+    char **arr = calloc(count ? count : 1, sizeof(char *));
+    for (int i = 0; i < count && r->ok; i++)
+        arr[i] = r_str(r);
+    return arr;
+}
+
+static Expr *r_expr(Reader *r) {
+    int kind = r_i32(r);
+    if (kind < 0 || !r->ok)
+        return NULL;
+    if (kind > EXPR_MAP_LIT) {
+        r->ok = 0;
+        return NULL;
+    }
+    Expr *e = calloc(1, sizeof(Expr));
+    e->kind = (ExprKind)kind;
+    e->value_type = r_type(r);
+    e->loc = r_loc(r);
+    switch (e->kind) {
+        case EXPR_INT_LIT:    e->as.int_lit.value = r_i64(r); break;
+        case EXPR_FLOAT_LIT:  e->as.float_lit.value = r_f64(r); break;
+        case EXPR_STRING_LIT:
+            e->as.string_lit.value = r_blob(r, &e->as.string_lit.len);
+            break;
+        case EXPR_BOOL_LIT:   e->as.bool_lit.value = r_i32(r); break;
+        case EXPR_VAR_REF:    e->as.var_ref.name = r_str(r); break;
+        case EXPR_BINARY:
+            e->as.binary.op = (BinOpKind)r_enum(r, BINOP_SHR + 1);
+            e->as.binary.left = r_expr(r);
+            e->as.binary.right = r_expr(r);
+            break;
+        case EXPR_MEMBER_ACCESS:
+            e->as.member_access.object = r_expr(r);
+            e->as.member_access.field_name = r_str(r);
+            break;
+        case EXPR_UNARY:
+            e->as.unary.op = (UnaryOpKind)r_enum(r, UNOP_BIT_NOT + 1);
+            e->as.unary.operand = r_expr(r);
+            break;
+        case EXPR_INDEX:
+            e->as.index_access.object = r_expr(r);
+            e->as.index_access.index = r_expr(r);
+            break;
+        case EXPR_SLICE:
+            e->as.slice.object = r_expr(r);
+            e->as.slice.start = r_expr(r);
+            e->as.slice.end = r_expr(r);
+            break;
+        case EXPR_FN_CALL:
+            e->as.fn_call.fn_name = r_str(r);
+            e->as.fn_call.obj_name = r_str(r);
+            e->as.fn_call.arg_count = r_count(r);
+            e->as.fn_call.args = r_expr_array(r, e->as.fn_call.arg_count);
+            if (!e->as.fn_call.args && e->as.fn_call.arg_count > 0)
+                r->ok = 0;
+            e->as.fn_call.arg_names = r_str_array(r, e->as.fn_call.arg_count);
+            break;
+        case EXPR_ARRAY_LIT:
+            e->as.array_lit.count = r_count(r);
+            e->as.array_lit.elements = r_expr_array(r, e->as.array_lit.count);
+            if (!e->as.array_lit.elements && e->as.array_lit.count > 0)
+                r->ok = 0;
+            break;
+        case EXPR_CHANNEL_LIT:
+            e->as.channel_lit.elem_type = r_type(r);
+            break;
+        case EXPR_MAP_LIT:
+            e->as.map_lit.key_type = r_type(r);
+            e->as.map_lit.value_type = r_type(r);
+            break;
+    }
+    return e;
+}
+
+static ASTNode *r_node(Reader *r) {
+    ASTNode *n = calloc(1, sizeof(ASTNode));
+    n->type = (NodeType)r_enum(r, NODE_SPAWN + 1);
+    n->loc = r_loc(r);
+    n->var_name = r_str(r);
+    n->is_const = r_i32(r);
+    n->expr = r_expr(r);
+
+    n->fn_name = r_str(r);
+    n->param_count = r_count(r);
+    if (r_i32(r) && r->ok) {
+        n->params = calloc(n->param_count ? n->param_count : 1, sizeof(FnParam));
+        for (int i = 0; i < n->param_count && r->ok; i++) {
+            FnParam *p = &n->params[i];
+            p->name = r_str(r);
+            p->type = r_type(r);
+            p->class_type_name = r_str(r);
+            p->array_elem_type = r_type(r);
+            p->map_key_type = r_type(r);
+            p->has_default = r_i32(r);
+            p->default_value = r_blob(r, &p->default_value_len);
+        }
+    } else if (n->param_count > 0) {
+        r->ok = 0;
+    }
+    n->has_return_type = r_i32(r);
+    n->return_type = r_type(r);
+    n->body = r_nodes(r);
+
+    n->for_init = r_nodes(r);
+    n->for_cond = r_expr(r);
+    n->for_update = r_nodes(r);
+
+    n->if_cond = r_expr(r);
+    n->if_body = r_nodes(r);
+    n->else_body = r_nodes(r);
+
+    n->match_expr = r_expr(r);
+    n->match_arm_count = r_count(r);
+    if (r_i32(r) && r->ok) {
+        n->match_arms = calloc(n->match_arm_count ? n->match_arm_count : 1, sizeof(MatchArm));
+        for (int i = 0; i < n->match_arm_count && r->ok; i++) {
+            n->match_arms[i].pattern = r_expr(r);
+            n->match_arms[i].is_wildcard = r_i32(r);
+            n->match_arms[i].body = r_nodes(r);
+        }
+    } else if (n->match_arm_count > 0) {
+        r->ok = 0;
+    }
+
+    n->print_newline = r_i32(r);
+
+    n->is_fn_call = r_i32(r);
+    n->call_arg_count = r_count(r);
+    n->call_args = r_str_array(r, n->call_arg_count);
+    if (r_i32(r) && r->ok) {
+        n->call_arg_types = calloc(n->call_arg_count ? n->call_arg_count : 1, sizeof(ValueType));
+        for (int i = 0; i < n->call_arg_count; i++)
+            n->call_arg_types[i] = r_type(r);
+    }
+    if (r_i32(r) && r->ok) {
+        n->call_arg_is_var_ref = calloc(n->call_arg_count ? n->call_arg_count : 1, sizeof(int));
+        for (int i = 0; i < n->call_arg_count; i++)
+            n->call_arg_is_var_ref[i] = r_i32(r);
+    }
+    n->call_arg_names = r_str_array(r, n->call_arg_count);
+    n->call_arg_exprs = r_expr_array(r, n->call_arg_count);
+
+    n->class_name = r_str(r);
+    n->parent_class_name = r_str(r);
+    n->class_field_count = r_count(r);
+    if (r_i32(r) && r->ok) {
+        n->class_fields = calloc(n->class_field_count ? n->class_field_count : 1, sizeof(ClassField));
+        for (int i = 0; i < n->class_field_count && r->ok; i++) {
+            n->class_fields[i].name = r_str(r);
+            n->class_fields[i].type = r_type(r);
+            n->class_fields[i].class_type_name = r_str(r);
+        }
+    } else if (n->class_field_count > 0) {
+        r->ok = 0;
+    }
+    n->class_methods = r_nodes(r);
+
+    n->obj_name = r_str(r);
+    n->field_name = r_str(r);
+    n->index_expr = r_expr(r);
+    n->is_new_expr = r_i32(r);
+
+    n->enum_name = r_str(r);
+    n->enum_variant_count = r_count(r);
+    if (r_i32(r) && r->ok) {
+        n->enum_variants = calloc(n->enum_variant_count ? n->enum_variant_count : 1, sizeof(EnumVariant));
+        for (int i = 0; i < n->enum_variant_count && r->ok; i++) {
+            n->enum_variants[i].name = r_str(r);
+            n->enum_variants[i].value = r_i64(r);
+        }
+    } else if (n->enum_variant_count > 0) {
+        r->ok = 0;
+    }
+
+    n->import_path = r_str(r);
+    n->import_name_count = r_count(r);
+    n->import_names = r_str_array(r, n->import_name_count);
+
+    n->var_array_elem_type = r_type(r);
+    n->return_array_elem_type = r_type(r);
+    n->var_map_key_type = r_type(r);
+    n->return_map_key_type = r_type(r);
+    n->return_class_name = r_str(r);
+    n->is_pub = r_i32(r);
+    n->spawn_expr = r_expr(r);
+    return n;
+}
+
+static ASTNode *r_nodes(Reader *r) {
+    int count = r_count(r);
+    ASTNode *head = NULL, *tail = NULL;
+    for (int i = 0; i < count && r->ok; i++) {
+        ASTNode *n = r_node(r);
+        if (tail) tail->next = n; else head = n;
+        tail = n;
+    }
+    return head;
+}
+
+/* ================================================================
+ * Artifact layout:
+ *   "LMOD" | compiler_id | lmod_layout | source text |
+ *   FNV-1a-64 of the AST | AST
+ * ================================================================ */
+
+ASTNode *modcache_load(const char *source) {
+    char path[PATH_MAX];
+    if (cache_path(source, path, sizeof(path)) != 0)
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    Reader r = {map, (const unsigned char *)map + st.st_size, 1};
+    char magic[4];
+    unsigned long long id;
+    int layout[sizeof(lmod_layout) / sizeof(lmod_layout[0])];
+    r_bytes(&r, magic, sizeof(magic));
+    r_bytes(&r, &id, sizeof(id));
+    r_bytes(&r, layout, sizeof(layout));
+    int source_len = r_i32(&r);
+    size_t len = strlen(source);
+
+    ASTNode *ast = NULL;
+    if (r.ok && memcmp(magic, lmod_magic, sizeof(magic)) == 0 && id == compiler_id &&
+        memcmp(layout, lmod_layout, sizeof(layout)) == 0 &&
+        source_len >= 0 && (size_t)source_len == len &&
+        (size_t)(r.end - r.p) >= len && memcmp(r.p, source, len) == 0) {
+        r.p += len;
+        unsigned long long sum;
+        r_bytes(&r, &sum, sizeof(sum));
+        if (r.ok && sum != fnv1a64(14695981039346656037ULL, r.p, r.end - r.p))
+            r.ok = 0;
+        ast = r_nodes(&r);
+        if (!r.ok || r.p != r.end) {
+            ast_free(ast);
+            ast = NULL;
+        }
+    }
+    if (ast)
+        futimens(fd, NULL);     /* mark as recently used */
+    close(fd);
+    munmap(map, st.st_size);
+    return ast;
+}
+
+void modcache_store(const char *source, ASTNode *ast) {
+    char path[PATH_MAX];
+    if (cache_path(source, path, sizeof(path)) != 0)
+        return;
+
+    size_t len = strlen(source);
+    if (len > INT_MAX)
+        return;
+    pthread_once(&cache_prune_once, cache_prune);
+
+    Writer w = {NULL, 0, 0};
+    w_bytes(&w, lmod_magic, sizeof(lmod_magic));
+    w_bytes(&w, &compiler_id, sizeof(compiler_id));
+    w_bytes(&w, lmod_layout, sizeof(lmod_layout));
+    w_blob(&w, source, (int)len);
+    size_t sum_at = w.len;
+    unsigned long long sum = 0;
+    w_bytes(&w, &sum, sizeof(sum));
+    w_nodes(&w, ast);
+    sum = fnv1a64(14695981039346656037ULL, w.data + sum_at + sizeof(sum),
+                  w.len - sum_at - sizeof(sum));
+    memcpy(w.data + sum_at, &sum, sizeof(sum));
+
+    /* Write to a private temp file and rename, so concurrent compilers
+       never observe a partial artifact */
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(w.data);
+        return;
+    }
+    size_t off = 0;
+    while (off < w.len) {
+        ssize_t n = write(fd, w.data + off, w.len - off);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    close(fd);
+    if (off == w.len && rename(tmp, path) == 0) {
+        free(w.data);
+        return;
+    }
+    unlink(tmp);
+    free(w.data);
+}
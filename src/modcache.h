@@ -0,0 +1,28 @@
+#ifndef MODCACHE_H
+#define MODCACHE_H
+
+#include "parser.h"
+
+/* On-disk cache of parsed modules (.lmod files).
+
+   Each artifact holds a serialized AST and the source text it was
+   parsed from, and lives in $XDG_CACHE_HOME/lingua (or
+   ~/.cache/lingua), named after a hash of that text and of the
+   compiler executable, so a rebuilt compiler never reads what another
+   build wrote.  A hit replaces a full lex + parse with one mmap.
+   Corrupt artifacts are misses, and the least recently used are
+   evicted once the directory grows past a size cap.  Both functions
+   are thread-safe and fail silently; on a miss the caller parses as
+   usual.
+
+   Only the parse is cached: the evaluated pub exports of a module are
+   not, so an import still evaluates the module's statements each
+   build. */
+
+/* Load the cached AST for this source text, or return NULL on a miss */
+ASTNode *modcache_load(const char *source);
+
+/* Store the AST parsed from this source text */
+void modcache_store(const char *source, ASTNode *ast);
+
+#endif
@@ -30,6 +30,7 @@ const char *value_type_name(ValueType vt) {
         case VAL_OBJECT: return "object";
         case VAL_ARRAY:   return "Array";
         case VAL_CHANNEL: return "Channel";
+        case VAL_MAP:     return "Map";
         default:          return "unknown";
     }
 }
@@ -97,11 +98,58 @@ static Token expect(Lexer *lexer, TokenType type, const char *what) {
     return tok;
 }
 
-/* Parse a type that may be Array<T>. Reads additional tokens from lexer if needed.
-   type_tok is the already-consumed identifier token. */
+/* Parse the key and value types of Map<K, V> or map<K, V>(), the '<'
+   already consumed.  Keys are int, string or bool. */
+static void parse_map_types(Lexer *lexer, ValueType *key_type, ValueType *value_type) {
+    Token key_tok = expect(lexer, TOKEN_IDENT, "key type");
+    expect(lexer, TOKEN_COMMA, "','");
+    Token value_tok = expect(lexer, TOKEN_IDENT, "value type");
+    expect(lexer, TOKEN_GT, "'>'");
+    *key_type = parse_type_name(&key_tok, NULL);
+    *value_type = parse_type_name(&value_tok, NULL);
+    if (*key_type != VAL_INT && *key_type != VAL_STRING && *key_type != VAL_BOOL)
+        diag_emit((SourceLoc){key_tok.line, key_tok.col}, DIAG_ERROR,
+                  "Map key type must be int, string, or bool");
+    if (*value_type == VAL_OBJECT)
+        diag_emit((SourceLoc){value_tok.line, value_tok.col}, DIAG_ERROR,
+                  "Map value type must be int, float, string, or bool");
+}
+
+/* Check whether the tokens after an identifier 'map' read '<' Type ','
+   Type '>' '(', the start of a map<K, V>() literal; otherwise 'map' is
+   an ordinary name, as in 'map < 2'.  Consumes nothing. */
+static int map_literal_follows(Lexer *lexer) {
+    static const TokenType shape[] = {
+        TOKEN_LT, TOKEN_IDENT, TOKEN_COMMA, TOKEN_IDENT, TOKEN_GT, TOKEN_LPAREN
+    };
+    Lexer probe = *lexer;
+    for (size_t i = 0; i < sizeof(shape) / sizeof(shape[0]); i++) {
+        if (lexer_next(&probe).type != shape[i])
+            return 0;
+    }
+    return 1;
+}
+
+/* Parse a type that may be Array<T>, Channel<T> or Map<K, V>. Reads additional
+   tokens from lexer if needed. type_tok is the already-consumed identifier token.
+   A map's value type goes to out_array_elem_type, its key type to
+   out_map_key_type. */
 static ValueType parse_full_type(Lexer *lexer, Token *type_tok, char **out_class_name,
-                                 ValueType *out_array_elem_type) {
+                                 ValueType *out_array_elem_type, ValueType *out_map_key_type) {
     if (out_array_elem_type) *out_array_elem_type = VAL_VOID;
+    if (out_map_key_type) *out_map_key_type = VAL_VOID;
+    if (type_tok->length == 3 && memcmp(type_tok->start, "Map", 3) == 0) {
+        Token peek = lexer_peek(lexer);
+        if (peek.type == TOKEN_LT) {
+            lexer_next(lexer); /* consume '<' */
+            ValueType key_type, value_type;
+            parse_map_types(lexer, &key_type, &value_type);
+            if (out_array_elem_type) *out_array_elem_type = value_type;
+            if (out_map_key_type) *out_map_key_type = key_type;
+            if (out_class_name) *out_class_name = NULL;
+            return VAL_MAP;
+        }
+    }
     if (type_tok->length == 7 && memcmp(type_tok->start, "Channel", 7) == 0) {
         Token peek = lexer_peek(lexer);
         if (peek.type == TOKEN_LT) {
@@ -197,6 +245,7 @@ void expr_free(Expr *expr) {
             }
             break;
         case EXPR_CHANNEL_LIT:
+        case EXPR_MAP_LIT:
             break;
         default:
             break;
@@ -392,6 +441,19 @@ static Expr *parse_primary(Lexer *lexer) {
                 return e;
             }
         }
+        /* map<K, V>() expression */
+        if (tok.length == 3 && memcmp(tok.start, "map", 3) == 0) {
+            if (map_literal_follows(lexer)) {
+                lexer_next(lexer); /* consume '<' */
+                Expr *e = expr_alloc(EXPR_MAP_LIT);
+                parse_map_types(lexer, &e->as.map_lit.key_type, &e->as.map_lit.value_type);
+                expect(lexer, TOKEN_LPAREN, "'('");
+                expect(lexer, TOKEN_RPAREN, "')'");
+                e->loc = loc;
+                e->value_type = VAL_MAP;
+                return e;
+            }
+        }
         Expr *e = expr_alloc(EXPR_VAR_REF);
         e->loc = loc;
         e->as.var_ref.name = malloc(tok.length + 1);
@@ -886,10 +948,10 @@ static int try_parse_rhs_call(Lexer *lexer, ASTNode *node);
 static int try_parse_new_only(Lexer *lexer, ASTNode *node);
 
 /* Loop depth counter for break/continue validation */
-static int parse_loop_depth = 0;
+static _Thread_local int parse_loop_depth = 0;
 
 /* Scope depth counter for pub/import top-level enforcement */
-static int parse_scope_depth = 0;
+static _Thread_local int parse_scope_depth = 0;
 
 /* Parse an import statement: import { name1, name2 } from "path"; */
 static ASTNode *parse_import_stmt(Lexer *lexer, SourceLoc import_loc) {
@@ -978,7 +1040,8 @@ static ASTNode *parse_fn_decl(Lexer *lexer, SourceLoc fn_loc) {
             p->name = malloc(pname.length + 1);
             memcpy(p->name, pname.start, pname.length);
             p->name[pname.length] = '\0';
-            p->type = parse_full_type(lexer, &ptype, &p->class_type_name, &p->array_elem_type);
+            p->type = parse_full_type(lexer, &ptype, &p->class_type_name, &p->array_elem_type,
+                                      &p->map_key_type);
             p->has_default = 0;
             p->default_value = NULL;
             p->default_value_len = 0;
@@ -1030,7 +1093,9 @@ static ASTNode *parse_fn_decl(Lexer *lexer, SourceLoc fn_loc) {
         lexer_next(lexer); /* consume '->' */
         Token ret_type = expect(lexer, TOKEN_IDENT, "return type");
         node->has_return_type = 1;
-        node->return_type = parse_full_type(lexer, &ret_type, NULL, &node->return_array_elem_type);
+        node->return_type = parse_full_type(lexer, &ret_type, &node->return_class_name,
+                                            &node->return_array_elem_type,
+                                            &node->return_map_key_type);
     } else {
         node->has_return_type = 0;
         node->return_type = VAL_VOID;
@@ -1676,12 +1741,14 @@ static ASTNode *parse_statement(Lexer *lexer, Token tok) {
         int has_annotation = 0;
         ValueType annotated_type = VAL_STRING;
         ValueType annotated_array_elem_type = VAL_VOID;
+        ValueType annotated_map_key_type = VAL_VOID;
 
         Token after_name = lexer_next(lexer);
         if (after_name.type == TOKEN_COLON) {
             Token type_tok = expect(lexer, TOKEN_IDENT, "type name");
             has_annotation = 1;
-            annotated_type = parse_full_type(lexer, &type_tok, NULL, &annotated_array_elem_type);
+            annotated_type = parse_full_type(lexer, &type_tok, NULL, &annotated_array_elem_type,
+                                             &annotated_map_key_type);
             expect(lexer, TOKEN_EQUALS, "'='");
         } else if (after_name.type != TOKEN_EQUALS) {
             diag_emit((SourceLoc){after_name.line, after_name.col}, DIAG_ERROR, "expected ':' or '='");
@@ -1693,6 +1760,7 @@ static ASTNode *parse_statement(Lexer *lexer, Token tok) {
         node->loc = stmt_loc;
         node->is_const = is_const;
         node->var_array_elem_type = annotated_array_elem_type;
+        node->var_map_key_type = annotated_map_key_type;
 
         if (!try_parse_new_only(lexer, node)) {
             node->expr = parse_expr(lexer);
@@ -1713,6 +1781,16 @@ static ASTNode *parse_statement(Lexer *lexer, Token tok) {
                               "type mismatch: variable '%s' declared as '%s', but assigned '%s'",
                               node->var_name, value_type_name(annotated_type), value_type_name(node->expr->value_type));
                 }
+                if (node->expr->kind == EXPR_MAP_LIT &&
+                    (annotated_map_key_type != node->expr->as.map_lit.key_type ||
+                     annotated_array_elem_type != node->expr->as.map_lit.value_type)) {
+                    diag_emit(node->expr->loc, DIAG_ERROR,
+                              "type mismatch: variable '%s' declared as 'Map<%s, %s>', but assigned 'Map<%s, %s>'",
+                              node->var_name, value_type_name(annotated_map_key_type),
+                              value_type_name(annotated_array_elem_type),
+                              value_type_name(node->expr->as.map_lit.key_type),
+                              value_type_name(node->expr->as.map_lit.value_type));
+                }
             }
             /* Store the annotated type for codegen to check */
             node->expr->value_type = annotated_type;
@@ -1767,6 +1845,76 @@ static ASTNode *parse_statement(Lexer *lexer, Token tok) {
     if (tok.type == TOKEN_IDENT) {
         Token peek = lexer_peek(lexer);
 
+        /* name[index] = value; and its ++, -- and compound forms, which
+         * read the element through a second parse of the index */
+        if (peek.type == TOKEN_LBRACKET) {
+            lexer_next(lexer); /* consume '[' */
+            Lexer index_start = *lexer;
+            Expr *index = parse_expr(lexer);
+            expect(lexer, TOKEN_RBRACKET, "']'");
+            Token op = lexer_next(lexer);
+
+            ASTNode *node = malloc(sizeof(ASTNode));
+            memset(node, 0, sizeof(ASTNode));
+            node->type = NODE_ASSIGN;
+            node->loc = stmt_loc;
+            node->var_name = malloc(tok.length + 1);
+            memcpy(node->var_name, tok.start, tok.length);
+            node->var_name[tok.length] = '\0';
+            node->index_expr = index;
+
+            BinOpKind compound_op;
+            switch (op.type) {
+                case TOKEN_EQUALS:
+                    node->expr = parse_expr(lexer);
+                    expect(lexer, TOKEN_SEMICOLON, "';'");
+                    return node;
+                case TOKEN_PLUS_PLUS:  compound_op = BINOP_ADD; break;
+                case TOKEN_MINUS_MINUS: compound_op = BINOP_SUB; break;
+                case TOKEN_PLUS_EQ:    compound_op = BINOP_ADD; break;
+                case TOKEN_MINUS_EQ:   compound_op = BINOP_SUB; break;
+                case TOKEN_STAR_EQ:    compound_op = BINOP_MUL; break;
+                case TOKEN_SLASH_EQ:   compound_op = BINOP_DIV; break;
+                case TOKEN_PERCENT_EQ: compound_op = BINOP_MOD; break;
+                case TOKEN_AMP_EQ:     compound_op = BINOP_BIT_AND; break;
+                case TOKEN_PIPE_EQ:    compound_op = BINOP_BIT_OR; break;
+                case TOKEN_CARET_EQ:   compound_op = BINOP_BIT_XOR; break;
+                case TOKEN_SHL_EQ:     compound_op = BINOP_SHL; break;
+                case TOKEN_SHR_EQ:     compound_op = BINOP_SHR; break;
+                default:
+                    diag_emit((SourceLoc){op.line, op.col}, DIAG_ERROR,
+                              "expected '=' after indexed name");
+                    return NULL; /* unreachable */
+            }
+
+            Expr *var = expr_alloc(EXPR_VAR_REF);
+            var->loc = stmt_loc;
+            var->as.var_ref.name = malloc(tok.length + 1);
+            memcpy(var->as.var_ref.name, tok.start, tok.length);
+            var->as.var_ref.name[tok.length] = '\0';
+            Expr *elem = expr_alloc(EXPR_INDEX);
+            elem->loc = index->loc;
+            elem->as.index_access.object = var;
+            elem->as.index_access.index = parse_expr(&index_start);
+            Expr *rhs;
+            if (op.type == TOKEN_PLUS_PLUS || op.type == TOKEN_MINUS_MINUS) {
+                rhs = expr_alloc(EXPR_INT_LIT);
+                rhs->loc = stmt_loc;
+                rhs->value_type = VAL_INT;
+                rhs->as.int_lit.value = 1;
+            } else {
+                rhs = parse_expr(lexer);
+            }
+            Expr *bin = expr_alloc(EXPR_BINARY);
+            bin->loc = stmt_loc;
+            bin->as.binary.op = compound_op;
+            bin->as.binary.left = elem;
+            bin->as.binary.right = rhs;
+            node->expr = bin;
+            expect(lexer, TOKEN_SEMICOLON, "';'");
+            return node;
+        }
+
         /* obj.method(args); or obj.field = value; */
         if (peek.type == TOKEN_DOT) {
             lexer_next(lexer); /* consume '.' */
@@ -1959,6 +2107,7 @@ void ast_free(ASTNode *node) {
         free(node->var_name);
         expr_free(node->expr);
         free(node->fn_name);
+        free(node->return_class_name);
         if (node->params) {
             for (int i = 0; i < node->param_count; i++) {
                 free(node->params[i].name);
@@ -2017,6 +2166,7 @@ void ast_free(ASTNode *node) {
             ast_free(node->class_methods);
         free(node->obj_name);
         free(node->field_name);
+        expr_free(node->index_expr);
         free(node->enum_name);
         if (node->enum_variants) {
             for (int i = 0; i < node->enum_variant_count; i++)
@@ -32,6 +32,7 @@ typedef enum {
     VAL_OBJECT,
     VAL_ARRAY,
     VAL_CHANNEL,
+    VAL_MAP,
 } ValueType;
 
 typedef enum {
@@ -48,6 +49,7 @@ typedef enum {
     EXPR_FN_CALL,
     EXPR_ARRAY_LIT,
     EXPR_CHANNEL_LIT,
+    EXPR_MAP_LIT,
 } ExprKind;
 
 typedef enum {
@@ -100,6 +102,7 @@ typedef struct Expr {
             int count;
         } array_lit;
         struct { ValueType elem_type; } channel_lit;
+        struct { ValueType key_type; ValueType value_type; } map_lit;
     } as;
 } Expr;
 
@@ -107,7 +110,9 @@ typedef struct {
     char *name;
     ValueType type;
     char *class_type_name;
-    ValueType array_elem_type; /* element type when type == VAL_ARRAY */
+    ValueType array_elem_type; /* element type when type == VAL_ARRAY, value type
+                                * when type == VAL_MAP */
+    ValueType map_key_type;    /* key type when type == VAL_MAP */
     int has_default;
     char *default_value;
     int default_value_len;
@@ -143,6 +148,7 @@ typedef struct ASTNode {
     int param_count;
     int has_return_type;
     ValueType return_type;
+    char *return_class_name; /* class of an object return type */
     struct ASTNode *body;
 
     /* For loop fields */
@@ -182,6 +188,7 @@ typedef struct ASTNode {
     /* Object/method/field support */
     char *obj_name;      /* for method calls: obj.method(...) */
     char *field_name;    /* for dotted assignment: obj.field = value */
+    Expr *index_expr;    /* for indexed assignment: name[index] = value */
     int is_new_expr;     /* for new ClassName(...) */
 
     /* Enum declaration fields */
@@ -194,9 +201,11 @@ typedef struct ASTNode {
     char **import_names;     /* array of imported symbol names */
     int import_name_count;
 
-    /* Array type annotation fields */
+    /* Array type annotation fields (the value type of a Map<K, V>) */
     ValueType var_array_elem_type;      /* element type for var decl Array<T> annotation */
     ValueType return_array_elem_type;   /* element type for fn return Array<T> annotation */
+    ValueType var_map_key_type;         /* key type for var decl Map<K, V> annotation */
+    ValueType return_map_key_type;      /* key type for fn return Map<K, V> annotation */
 
     /* Pub visibility */
     int is_pub;
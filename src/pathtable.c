@@ -0,0 +1,62 @@
+#include "pathtable.h"
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned path_hash(const char *s) {
+    unsigned h = 2166136261u;   /* FNV-1a */
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void path_table_init(PathTable *t) {
+    t->cap = 64;
+    t->count = 0;
+    t->slots = calloc(t->cap, sizeof(PathSlot));
+}
+
+void path_table_free(PathTable *t) {
+    free(t->slots);
+    t->slots = NULL;
+    t->cap = 0;
+    t->count = 0;
+}
+
+static PathSlot *path_table_slot(PathTable *t, const char *key, unsigned hash) {
+    unsigned mask = (unsigned)t->cap - 1;
+    unsigned i = hash & mask;
+    while (t->slots[i].key) {
+        if (t->slots[i].hash == hash && strcmp(t->slots[i].key, key) == 0)
+            return &t->slots[i];
+        i = (i + 1) & mask;
+    }
+    return &t->slots[i];
+}
+
+PathSlot *path_table_find(PathTable *t, const char *key) {
+    PathSlot *slot = path_table_slot(t, key, path_hash(key));
+    return slot->key ? slot : NULL;
+}
+
+void path_table_put(PathTable *t, const char *key, int value) {
+    if ((t->count + 1) * 4 > t->cap * 3) {
+        PathSlot *old = t->slots;
+        int old_cap = t->cap;
+        t->cap *= 2;
+        t->slots = calloc(t->cap, sizeof(PathSlot));
+        for (int i = 0; i < old_cap; i++)
+            if (old[i].key)
+                *path_table_slot(t, old[i].key, old[i].hash) = old[i];
+        free(old);
+    }
+    unsigned hash = path_hash(key);
+    PathSlot *slot = path_table_slot(t, key, hash);
+    if (!slot->key) {
+        slot->key = key;
+        slot->hash = hash;
+        t->count++;
+    }
+    slot->value = value;
+}
@@ -0,0 +1,28 @@
+#ifndef PATHTABLE_H
+#define PATHTABLE_H
+
+/* Path hash table — open-addressed map from a canonical path (or
+   other string key) to an int.  Keys are not owned by the table. */
+
+typedef struct {
+    const char *key;    /* NULL for an empty slot */
+    unsigned hash;
+    int value;
+} PathSlot;
+
+typedef struct {
+    PathSlot *slots;
+    int cap;            /* always a power of two */
+    int count;
+} PathTable;
+
+void path_table_init(PathTable *t);
+void path_table_free(PathTable *t);
+
+/* The slot of key, or NULL if it is not in the table */
+PathSlot *path_table_find(PathTable *t, const char *key);
+
+/* Insert or update key -> value */
+void path_table_put(PathTable *t, const char *key, int value);
+
+#endif
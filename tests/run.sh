@@ -0,0 +1,57 @@
+#!/bin/sh
+# Build each tests/*.lingua at -O0 and -O2, run it, and compare its
+# stdout and stderr with the matching .expected file.  The program must
+# exit with status 0, or with the one in a matching .status file.  A
+# .status file reading "build" means the compiler must reject the
+# program; its diagnostics, uncoloured, are compared instead.  Each
+# line of a .flags file is one more set of build flags to test with.
+#
+#   tests/run.sh [name...]
+#
+# LINGUA selects the compiler (default ./lingua relative to the repo root).
+root=$(cd "$(dirname "$0")/.." && pwd)
+LINGUA=${LINGUA:-$root/lingua}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+export XDG_CACHE_HOME="$tmp/cache"
+esc=$(printf '\033')
+
+names=${*:-$(cd "$root/tests" && ls *.lingua | sed 's/\.lingua$//')}
+pass=0
+fail=0
+for name in $names; do
+    want=0
+    [ -f "$root/tests/$name.status" ] && want=$(cat "$root/tests/$name.status")
+    configs="-O0
+-O2"
+    [ -f "$root/tests/$name.flags" ] && configs="$configs
+$(cat "$root/tests/$name.flags")"
+    IFS='
+'
+    for opt in $configs; do
+        unset IFS
+        if [ "$want" = build ]; then
+            if "$LINGUA" build "$root/tests/$name.lingua" -o "$tmp/prog" $opt >"$tmp/build.log" 2>&1; then
+                echo "compiled, expected an error" >"$tmp/out"
+            else
+                sed "s/$esc\[[0-9;]*m//g; s|$root/||g" "$tmp/build.log" >"$tmp/out"
+            fi
+            : >"$tmp/build.log"
+            cmp -s "$tmp/out" "$root/tests/$name.expected"
+        else
+            "$LINGUA" build "$root/tests/$name.lingua" -o "$tmp/prog" $opt >"$tmp/build.log" 2>&1 &&
+            { "$tmp/prog" >"$tmp/out" 2>&1; [ $? -eq "$want" ]; } &&
+            cmp -s "$tmp/out" "$root/tests/$name.expected"
+        fi
+        if [ $? -eq 0 ]; then
+            pass=$((pass + 1))
+        else
+            fail=$((fail + 1))
+            echo "FAIL $name $opt"
+            cat "$tmp/build.log"
+            diff "$root/tests/$name.expected" "$tmp/out" | head -20
+        fi
+    done
+done
+echo "$pass passed, $fail failed"
+[ "$fail" -eq 0 ]